@@ -187,20 +187,9 @@ GptApp::GptApp() {
 }
 
 void GptApp::InitModel() {
-    // Initialize a basic model using standard Session for testing
-    gpt_session = std::make_unique<Session>();
-    
-    // Create a simple network configuration for text generation
-    String net_config = "[\n"
-        "{\"type\":\"input\", \"input_width\":" + IntStr(max_seq_len) + ", \"input_height\":1, \"input_depth\":" + IntStr(vocab_size) + "},\n"
-        "{\"type\":\"fc\", \"neuron_count\":" + IntStr(embed_dim) + ", \"activation\":\"relu\"},\n"
-        "{\"type\":\"fc\", \"neuron_count\":" + IntStr(ff_dim) + ", \"activation\":\"relu\"},\n"
-        "{\"type\":\"regression\", \"neuron_count\":" + IntStr(vocab_size) + "},\n"
-        "{\"type\":\"adam\", \"learning_rate\":0.001, \"momentum\":0.9, \"batch_size\":32, \"l2_decay\":0.0001}\n"
-        "]\n";
-    
-    gpt_session->SetMaxTrainIters(1000);
-    gpt_session->MakeLayers(net_config);
+    // An untrained model: the text is random, but the speed of the generation is real
+    gpt_session = CreateGPTSession(vocab_size, embed_dim, num_heads, num_layers,
+                                   ff_dim, max_seq_len);
 
     LOG("Model initialized");
     textDisplay.SetGeneratedText("Model initialized. Enter a prompt and click 'Generate'.");
@@ -228,25 +217,20 @@ void GptApp::OnGenerate() {
     int max_tokens = (int)maxTokensCtrl.GetData();
     max_tokens = max(1, min(max_tokens, 200)); // Limit generation length
     
-    // In a real implementation, we would:
-    // 1. Tokenize the prompt
-    // 2. Generate text using the GPT model
-    // 3. Detokenize and display the result
-    
-    // For demonstration, we'll simulate the generation
-    String generated = prompt + " is an exciting field that continues to evolve. "
-                      "New developments emerge regularly, pushing the boundaries of what's possible. "
-                      "Researchers are constantly exploring innovative approaches and methodologies. "
-                      "The impact on society is significant and far-reaching. "
-                      "As we move forward, the potential applications multiply exponentially.";
-    
-    // Truncate to max_tokens (simulated)
-    Vector<String> words = Split(prompt + " " + generated, ' ');
-    String result = Join(words, ' ', 0, min(words.GetCount(), max_tokens));
+    // Tokenize the prompt, generate one decoder step per token, and detokenize
+    GPTModel& model = gpt_session->GetModel();
+    Vector<int> context = model.Tokenize(prompt);
+    if (context.GetCount() >= max_seq_len)
+        context.Remove(0, context.GetCount() - max_seq_len / 2);
+    Vector<int> tokens = gpt_session->GenerateText(context, max_tokens, temperature,
+                                                   use_top_k, k, use_nucleus, p);
+    String result = model.Detokenize(tokens);
     
-    textDisplay.SetGeneratedText("Prompt: " + prompt + "\n\n" + result + "\n\n[Generation complete]");
+    String stats = Format("%d tokens, %.1f tokens/s", gpt_session->GetGeneratedTokens(),
+                          gpt_session->GetTokensPerSecond());
+    textDisplay.SetGeneratedText("Prompt: " + prompt + "\n\n" + result + "\n\n[Generation complete, " + stats + "]");
     
-    LOG("Text generation completed with prompt: " + prompt);
+    LOG("Text generation completed with prompt: " + prompt + ", " + stats);
 }
 
 void GptApp::OnClear() {
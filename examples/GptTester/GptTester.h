@@ -51,8 +51,8 @@ public:
 
 class GptApp : public TopWindow {
 private:
-    // GPT model and session (using regular Session instead of undefined GPTSession)
-    std::unique_ptr<Session> gpt_session;
+    // GPT model and session, which keeps the key/value cache between the generations
+    std::unique_ptr<GPTSession> gpt_session;
     
     // Controls
     EditField promptEdit;
@@ -70,12 +70,12 @@ private:
     SpinCtrl maxTokensCtrl;
     
     // Model parameters
-    int vocab_size = 1000;
+    int vocab_size = 256;   // one token per character
     int embed_dim = 64;
     int num_heads = 4;
     int num_layers = 2;
     int ff_dim = 256;
-    int max_seq_len = 50;
+    int max_seq_len = 512;
 
 public:
     typedef GptApp CLASSNAME;
@@ -129,6 +129,7 @@ void NetworkOptimization::StartTrainer() {
 	mnet.SetCandidateCount( cands_per_batch.GetData() );
 	mnet.SetEpochCount( epochs_per_fold );
 	mnet.SetNeuronRange( min_neur.GetData(), max_neur.GetData() );
+	mnet.SetThreadCount( CPU_Cores() );
 	
 	ContinueTrainer();
 }
@@ -8,20 +8,8 @@ PuckWorldAgent::PuckWorldAgent() {
 
 void PuckWorldAgent::Reset() {
 	DQNAgent::Reset();
-	
-	ppx = Randomf(); // puck x,y
-	ppy = Randomf();
-	pvx = Randomf() * 0.05 - 0.025; // velocity
-	pvy = Randomf() * 0.05 - 0.025;
-	tx  = Randomf(); // target
-	ty  = Randomf();
-	tx2 = Randomf(); // target
-	ty2 = Randomf(); // target
-	rad = 0.05;
+	env.Reset();
 	action = 0;
-	t = 0;
-	
-	BADRAD = 0.25;
 	
 	smooth_reward = 0.0;
 	flott = 0;
@@ -29,81 +17,8 @@ void PuckWorldAgent::Reset() {
 }
 
 void PuckWorldAgent::SampleNextState(int x, int y, int d, int action, int& next_state, double& reward, bool& reset_episode) {
-	
-	// world dynamics
-	ppx += pvx; // newton
-	ppy += pvy;
-	pvx *= 0.95; // damping
-	pvy *= 0.95;
-	
-	// agent action influences puck velocity
-	double accel = 0.002;
-	bool gliding = false;
-	if		(action == ACT_LEFT)	pvx -= accel;
-	else if (action == ACT_RIGHT)	pvx += accel;
-	else if (action == ACT_UP)		pvy -= accel;
-	else if (action == ACT_DOWN)	pvy += accel;
-	else gliding = true;
-	
-	// handle boundary conditions and bounce
-	if (ppx < rad) {
-		pvx *= -0.5; // bounce!
-		ppx = rad;
-	}
-	if (ppx > 1 - rad) {
-		pvx *= -0.5;
-		ppx = 1 - rad;
-	}
-	if (ppy < rad) {
-		pvy *= -0.5; // bounce!
-		ppy = rad;
-	}
-	if (ppy > 1 - rad) {
-		pvy *= -0.5;
-		ppy = 1 - rad;
-	}
-	
-	t += 1;
-	
-	if ((t % 100) == 0) {
-		tx = Randomf(); // reset the target location
-		ty = Randomf();
-	}
-	
-	// compute distances
-	double dx, dy, d1, d2;
-	
-	dx = ppx - tx;
-	dy = ppy - ty;
-	d1 = sqrt(dx*dx+dy*dy);
-	
-	dx = ppx - tx2;
-	dy = ppy - ty2;
-	d2 = sqrt(dx*dx+dy*dy);
-	
-	double dxnorm = dx/d2;
-	double dynorm = dy/d2;
-	double speed = 0.001;
-	tx2 += speed * dxnorm;
-	ty2 += speed * dynorm;
-	
-	// compute reward
-	double r = -d1; // want to go close to green
-	if (d2 < BADRAD) {
-		// but if we're too close to red that's bad
-		double f = (BADRAD - d2) / BADRAD;
-		r -= 2 * f;
-		
-		// reset if too close
-		/*if (f > 0.9) {
-			tx2 = Randomf(); // reset the target location
-			ty2 = Randomf();
-		}*/
-	}
-	
-	if (gliding) r += 0.05; // give bonus for gliding with no force
-	
-	reward = r;
+	// the world dynamics are in ConvNet::PuckWorldEnvironment
+	reward = env.Step(action, reset_episode);
 }
 
 void PuckWorldAgent::Learn() {
@@ -138,15 +53,7 @@ void PuckWorldAgent::Learn() {
 }
 
 void PuckWorldAgent::GetState(Vector<double>& slist) {
-	slist.SetCount(8);
-	slist[0] = ppx - 0.5;
-	slist[1] = ppy - 0.5;
-	slist[2] = pvx * 10;
-	slist[3] = pvy * 10;
-	slist[4] = tx - ppx;
-	slist[5] = ty - ppy;
-	slist[6] = tx2 - ppx;
-	slist[7] = ty2 - ppy;
+	env.GetState(slist);
 }
 
 
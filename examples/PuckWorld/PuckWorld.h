@@ -19,15 +19,12 @@ protected:
 	friend class PuckWorldCtrl;
 	
 	Vector<double> smooth_reward_history;
-	double ppx, ppy, pvx, pvy;
-	double rad, BADRAD;
-	double tx, ty, tx2, ty2;
+	PuckWorldEnvironment env;
 	double smooth_reward;
 	double reward;
 	int action;
 	int flott;
 	int nflot;
-	int t;
 	
 public:
 	PuckWorldAgent();
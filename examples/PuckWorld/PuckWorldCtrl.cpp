@@ -33,18 +33,19 @@ void PuckWorldCtrl::Paint(Draw& w) {
 	double rad, rad2;
 	
 	// reflect puck world state on screen
-	double ppx	= agent->ppx;
-	double ppy	= agent->ppy;
-	double tx	= agent->tx;
-	double ty	= agent->ty;
-	double tx2	= agent->tx2;
-	double ty2	= agent->ty2;
+	const PuckWorldEnvironment& env = agent->env;
+	double ppx	= env.GetPuckX();
+	double ppy	= env.GetPuckY();
+	double tx	= env.GetTargetX();
+	double ty	= env.GetTargetY();
+	double tx2	= env.GetBadTargetX();
+	double ty2	= env.GetBadTargetY();
 	
 	
 	// bad target
 	stroke = Color(0, 0, 0);
 	fill = Color(255, 229, 229);
-	rad = agent->BADRAD * H;
+	rad = env.GetBadRadius() * H;
 	rad2 = rad * 2;
 	id.DrawEllipse(tx2*W - rad, ty2*H - rad, rad2, rad2, fill, 1, stroke);
 	
@@ -73,7 +74,7 @@ void PuckWorldCtrl::Paint(Draw& w) {
 	// draw the puck
 	int x = ppx*W;
 	int y = ppy*H;
-	rad = agent->rad * W;
+	rad = env.GetPuckRadius() * W;
 	rad2 = rad * 2;
 	id.DrawEllipse(x - rad, y - rad, rad2, rad2, fill, 1, stroke);
 	
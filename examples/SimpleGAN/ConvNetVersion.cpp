@@ -92,7 +92,7 @@ void SimpleGAN::Step() {
 	Volume& sgen = disc_net.Forward(xgen, true);
 	tmp_ret[0] = sgen.Get(0) - 0;
 	double disc_loss = disc_net.Backward(tmp_ret);
-	const Vector<double>& disc_in_grads = disc.GetInput()->output_activation.GetGradients();
+	const RealBuffer& disc_in_grads = disc.GetInput()->output_activation.GetGradients();
 	tmp_ret.SetCount(disc_in_grads.GetCount());
 	for(int i = 0; i < disc_in_grads.GetCount(); i++)
 		tmp_ret[i] = -disc_in_grads[i]; // negate
@@ -14,7 +14,7 @@ if [ $# -gt 0 ]; then
     TESTS=("$@")
     echo "Building specific test(s): ${TESTS[*]} (clean=$CLEAN)"
 else
-    TESTS=("CharGenTest" "Regression1DTest" "Classify2DTest" "SimpleGANTest" "GANTest" "RegressionPainterTest" "ClassifyImagesTest" "GridWorldTest" "HeteroscedasticUncertaintyTest" "MartingaleTest" "NetworkOptimizationTest" "PuckWorldTest" "ReinforcedLearningTest" "TemporalDifferenceTest" "TrainerBenchmarkTest" "WaterWorldTest" "GGUFTest")
+    TESTS=("CharGenTest" "Regression1DTest" "Classify2DTest" "SimpleGANTest" "GANTest" "RegressionPainterTest" "ClassifyImagesTest" "GridWorldTest" "HeteroscedasticUncertaintyTest" "MartingaleTest" "NetworkOptimizationTest" "PuckWorldTest" "ReinforcedLearningTest" "TemporalDifferenceTest" "TrainerBenchmarkTest" "WaterWorldTest" "GGUFTest" "ConvGemmTest" "InferenceModeTest" "AllocationFreeTest" "MiniBatchTest" "DataParallelTest" "HogwildTest" "ParameterArenaTest" "LayerProfileTest" "MappedDataTest" "PrefetchLoaderTest" "MagicNetTest" "ReplayBufferTest" "PrioritizedReplayTest" "TargetNetworkTest" "VectorEnvironmentTest" "RecurrentCellTest" "RecurrentBatchTest" "MultiHeadAttentionTest" "GPTCacheTest" "GenerationSchedulerTest" "GGUFMapTest" "QuantizeTest")
     echo "Building all ConvNetCpp unit tests... (clean=$CLEAN)"
 fi
 
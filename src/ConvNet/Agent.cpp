@@ -260,6 +260,30 @@ void Agent::SampleNextState(int x, int y, int action, int& next_state, double& r
 	reset_episode = (state == stop_state && next_state == start_state); // episode is over
 }
 
+// The cell of a one-hot encoded state, which is the largest of the values.
+int Agent::GetTableState(const double* state) const {
+	int best = 0;
+	for (int i = 1; i < length; i++)
+		if (state[i] > state[best])
+			best = i;
+	return best;
+}
+
+void Agent::Act(const Vector<double>& states, int count, Vector<int>& actions) {
+	ASSERT(states.GetCount() >= count * length);
+	actions.SetCount(count);
+	for (int i = 0; i < count; i++) {
+		int x, y;
+		GetXY(GetTableState(states.Begin() + i * length), x, y);
+		actions[i] = Act(x, y);
+	}
+}
+
+void Agent::LearnFromReplay(int steps) {
+	for (int i = 0; i < steps; i++)
+		ValueIteration();
+}
+
 
 
 
@@ -531,7 +555,7 @@ void TDAgent::ResetEpisode() {
 	// an episode finished
 }
 
-int TDAgent::Act(int x, int y) {
+int TDAgent::SampleAction(int x, int y) {
 	
 	// act according to epsilon greedy policy
 	Vector<int> poss;
@@ -557,6 +581,13 @@ int TDAgent::Act(int x, int y) {
 		explored = false;
 	}
 	
+	return action;
+}
+
+int TDAgent::Act(int x, int y) {
+	int state = GetPos(x,y);
+	int action = SampleAction(x, y);
+	
 	// shift state memory
 	state0 = state1;
 	action0 = action1;
@@ -615,6 +646,42 @@ void TDAgent::Learn(double reward1){
 	reward0 = reward1; // store this for next update
 }
 
+// Epsilon greedy actions for the states of a vectorized environment. Unlike Act(x, y), the
+// state memory of Learn(reward) isn't shifted.
+void TDAgent::Act(const Vector<double>& states, int count, Vector<int>& actions) {
+	ASSERT(states.GetCount() >= count * length);
+	actions.SetCount(count);
+	for (int i = 0; i < count; i++) {
+		int x, y;
+		GetXY(GetTableState(states.Begin() + i * length), x, y);
+		actions[i] = SampleAction(x, y);
+	}
+}
+
+// The transitions of the environments are interleaved, so they are learned without the
+// eligibility traces of a single trajectory, and the SARSA action of the next state is
+// sampled from the policy.
+void TDAgent::AddExperience(const Vector<double>& s0, int a0, double r0, const Vector<double>& s1) {
+	int state0 = GetTableState(s0.Begin());
+	int state1 = GetTableState(s1.Begin());
+	int action1 = -1; // not used for Q learning
+	if (update == UPDATE_SARSA && !IsDisabled(state1)) {
+		int x, y;
+		GetXY(state1, x, y);
+		action1 = SampleAction(x, y);
+	}
+	LearnFromTuple(state0, a0, r0, state1, action1, 0);
+	if (planN > 0)
+		UpdateModel(state0, a0, r0, state1);
+}
+
+// The replay of the TD agent is the planning with its model of the environment.
+void TDAgent::LearnFromReplay(int steps) {
+	if (planN > 0)
+		for (int i = 0; i < steps; i++)
+			Plan();
+}
+
 void TDAgent::UpdateModel(int state0, int action0, double reward0, int state1) {
 	
 	// transition (s0,a0) -> (reward0,s1) was observed. Update environment model
@@ -873,7 +940,7 @@ DQNAgent::DQNAgent() {
 	action1 = 0;
 	has_reward = false;
 	tderror = 0;
-	
+	prioritized = false;
 }
 
 void DQNAgent::Reset() {
@@ -923,6 +990,24 @@ void DQNAgent::LoadInit(const ValueMap& map) {
 	LOADVARDEF(learning_steps_per_iteration, learning_steps_per_iteration, 10);
 	LOADVARDEF(tderror_clamp, tderror_clamp, 1.0);
 	LOADVARDEF(num_hidden_units, num_hidden_units, 100);
+	
+	// prioritized replay is enabled with a positive replay_alpha
+	double replay_alpha, replay_beta;
+	LOADVARDEFTEMP(replay_alpha, replay_alpha, 0.0);
+	LOADVARDEFTEMP(replay_beta, replay_beta, 0.4);
+	if (replay_alpha > 0)
+		SetPrioritizedReplay(replay_alpha, replay_beta);
+	else
+		SetUniformReplay();
+}
+
+// The priorities are not stored with the experience, so all experiences start with the same.
+void DQNAgent::InitPriorities() {
+	if (!prioritized)
+		return;
+	priority.Init(max(experience_size, exp.GetCount()));
+	for(int i = 0; i < exp.GetCount(); i++)
+		priority.Add(i);
 }
 
 int DQNAgent::Act(int x, int y) {
@@ -971,29 +1056,65 @@ void DQNAgent::Learn(double reward1, bool force_experience) {
 		
 		// decide if we should keep this experience in the replay
 		if (t % experience_add_every == 0 || force_experience) {
-			if (exp.GetCount() == expi)
-				exp.Add();
 			ASSERT(state1.GetLength() > 0);
-			exp[expi].Set(state0, action0, reward0, state1, action1);
-			expi += 1;
-			if (expi >= experience_size) { expi = 0; } // roll over when we run out
+			AddExperience().Set(state0, action0, reward0, state1, action1);
 		}
 		t += 1;
 		
-		if (!exp.IsEmpty()) {
-			// sample some additional experience from replay memory and learn from it
-			for (int k = 0; k < learning_steps_per_iteration; k++) {
-				int ri = Random(exp.GetCount()); // TODO: priority sweeps?
-				DQExperience& e = exp[ri];
-				LearnFromTuple(e.state0, e.action0, e.reward0, e.state1, e.action1);
-			}
-		}
+		// sample some additional experience from replay memory and learn from it
+		LearnFromReplay(learning_steps_per_iteration);
 	}
 	reward0 = reward1; // store for next update
 	has_reward = true;
 }
 
-double DQNAgent::LearnFromTuple(Mat& s0, int a0, double reward0, Mat& s1, int a1) {
+// Returns the next slot of the experience ring, which gets the largest priority.
+DQExperience& DQNAgent::AddExperience() {
+	if (exp.GetCount() == expi)
+		exp.Add();
+	if (prioritized) {
+		if (priority.GetCapacity() <= expi)
+			InitPriorities();
+		priority.Add(expi);
+	}
+	DQExperience& e = exp[expi];
+	expi += 1;
+	if (expi >= experience_size) { expi = 0; } // roll over when we run out
+	return e;
+}
+
+void DQNAgent::AddExperience(const Vector<double>& s0, int a0, double r0, const Vector<double>& s1) {
+	DQExperience& e = AddExperience();
+	e.state0.Init(width, height, s0);
+	e.state1.Init(width, height, s1);
+	e.action0 = a0;
+	e.action1 = 0;
+	e.reward0 = r0;
+}
+
+void DQNAgent::LearnFromReplay(int steps) {
+	if (exp.IsEmpty() || alpha <= 0)
+		return;
+	for (int k = 0; k < steps; k++) {
+		if (prioritized) {
+			// sample in proportion to the last TD error, and correct the bias
+			double weight;
+			int ri = priority.Sample(weight);
+			DQExperience& e = exp[ri];
+			priority.Update(ri, LearnFromTuple(e.state0, e.action0, e.reward0, e.state1, e.action1, weight));
+		}
+		else {
+			int ri = Random(exp.GetCount());
+			DQExperience& e = exp[ri];
+			LearnFromTuple(e.state0, e.action0, e.reward0, e.state1, e.action1);
+		}
+	}
+}
+
+// The weight scales the gradient, and the returned TD error is neither weighted nor
+// clamped: the clamp of the Huber loss only limits the gradient, and prioritized replay
+// needs the whole error to tell the most surprising transitions apart.
+double DQNAgent::LearnFromTuple(Mat& s0, int a0, double reward0, Mat& s1, int a1, double weight) {
 	ASSERT(s0.GetLength() > 0);
 	ASSERT(s1.GetLength() > 0);
 	// want: Q(s,a) = r + gamma * max_a' Q(s',a')
@@ -1011,14 +1132,15 @@ double DQNAgent::LearnFromTuple(Mat& s0, int a0, double reward0, Mat& s1, int a1
 	Mat& pred_mat = Get(pred);
 	
 	double tderror = pred_mat.Get(a0) - qmax;
+	double grad = tderror;
 	double clamp = tderror_clamp;
-	if (fabs(tderror) > clamp) {  // huber loss to robustify
-		if (tderror > clamp)
-			tderror = +clamp;
+	if (fabs(grad) > clamp) {  // huber loss to robustify
+		if (grad > clamp)
+			grad = +clamp;
 		else
-			tderror = -clamp;
+			grad = -clamp;
 	}
-	pred_mat.SetGradient(a0, tderror);
+	pred_mat.SetGradient(a0, weight * grad);
 	G.Backward(); // compute gradients on net params
 	
 	// update net
@@ -1065,6 +1187,58 @@ void DQNAgent::Evaluate(double* in, double* out) {
 	
 }
 
+// The rows of the states are multiplied with the weights of the net as one matrix, so the
+// Q values of all states take two matrix products instead of two graph passes per state:
+//		H = tanh(S * W1^T + b1)
+//		Q = H * W2^T + b2
+void DQNAgent::Evaluate(const Vector<double>& states, int count, Vector<double>& values) {
+	ASSERT(states.GetCount() == count * ns);
+	const Mat& W1 = Get(net.W1);
+	const Mat& b1 = Get(net.b1);
+	const Mat& W2 = Get(net.W2);
+	const Mat& b2 = Get(net.b2);
+	
+	batch_in.SetCount(count * ns);
+	for (int i = 0; i < batch_in.GetCount(); i++)
+		batch_in[i] = (Real)states[i];
+	
+	batch_hidden.SetCount(count * nh);
+	Gemm<Real>(false, true, count, nh, ns, 1, batch_in.Begin(), ns,
+		W1.GetWeights().Begin(), ns, 0, batch_hidden.Begin(), nh);
+	for (int i = 0; i < count; i++) {
+		Real* h = batch_hidden.Begin() + i * nh;
+		for (int j = 0; j < nh; j++)
+			h[j] = (Real)tanh(h[j] + b1.Get(j));
+	}
+	
+	batch_out.SetCount(count * na);
+	Gemm<Real>(false, true, count, na, nh, 1, batch_hidden.Begin(), nh,
+		W2.GetWeights().Begin(), nh, 0, batch_out.Begin(), na);
+	values.SetCount(count * na);
+	for (int i = 0; i < count; i++)
+		for (int j = 0; j < na; j++)
+			values[i * na + j] = batch_out[i * na + j] + b2.Get(j);
+}
+
+// Epsilon greedy actions for count states in one batched evaluation. Unlike Act(slist), the
+// state memory of Learn(reward) isn't shifted.
+void DQNAgent::Act(const Vector<double>& states, int count, Vector<int>& actions) {
+	Evaluate(states, count, batch_values);
+	actions.SetCount(count);
+	for (int i = 0; i < count; i++) {
+		if (Randomf() < epsilon) {
+			actions[i] = Random(na);
+			continue;
+		}
+		const double* q = batch_values.Begin() + i * na;
+		int best = 0;
+		for (int j = 1; j < na; j++)
+			if (q[j] > q[best])
+				best = j;
+		actions[i] = best;
+	}
+}
+
 void DQNAgent::Learn(const Vector<double>& in, const Vector<double>& out) {
 	// convert to a Mat column vector
 	Mat& state_mat = Get(state);
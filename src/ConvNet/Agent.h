@@ -22,6 +22,8 @@ protected:
 	int iter_sleep = 0;
 	bool running, stopped;
 	
+	int GetTableState(const double* state) const;
+	
 public:
 	typedef Agent CLASSNAME;
 	Agent();
@@ -39,6 +41,15 @@ public:
 	virtual void LoadInit(const ValueMap& map);
 	virtual void SampleNextState(int x, int y, int action, int& next_state, double& reward, bool& reset_episode);
 	
+	// Batched versions for vectorized environments: the states are count rows of
+	// GetNumStates() values. The tabular agents read a row as the one-hot encoding of a
+	// cell, and by default they don't learn from the transitions but from iterations of
+	// their own grid.
+	virtual void Act(const Vector<double>& states, int count, Vector<int>& actions);
+	virtual void AddExperience(const Vector<double>& s0, int a0, double r0, const Vector<double>& s1) {}
+	virtual void LearnFromReplay(int steps);
+	virtual int GetLearningSteps() const {return 1;}
+	
 	void Start();
 	void Stop();
 	void Run();
@@ -142,6 +153,8 @@ class TDAgent : public Agent {
 	bool replacing_traces;
 	bool explored;
 	
+	int SampleAction(int x, int y);
+	
 public:
 	
 	TDAgent();
@@ -151,6 +164,9 @@ public:
 	virtual int Act(int x, int y);
 	virtual double GetValue(int x, int y) const;
 	virtual void LoadInit(const ValueMap& map);
+	virtual void Act(const Vector<double>& states, int count, Vector<int>& actions);
+	virtual void AddExperience(const Vector<double>& s0, int a0, double r0, const Vector<double>& s1);
+	virtual void LearnFromReplay(int steps);
 	
 	double GetEpsilon() const {return epsilon;}
 	
@@ -212,6 +228,8 @@ class DQNAgent : public Agent {
 	DQNet net;
 	Graph G;
 	Vector<DQExperience> exp; // experience
+	PrioritizedReplay priority; // of exp, if prioritized
+	bool prioritized;
 	double gamma, epsilon, alpha, tderror_clamp;
 	double tderror;
 	int experience_add_every, experience_size;
@@ -229,6 +247,13 @@ class DQNAgent : public Agent {
 	int action0, action1;
 	double reward0;
 	
+	// temporaries of the batched evaluation
+	Vector<Real> batch_in, batch_hidden, batch_out;
+	Vector<double> batch_values;
+	
+	void InitPriorities();
+	DQExperience& AddExperience();
+	
 public:
 
 	DQNAgent();
@@ -243,19 +268,32 @@ public:
 	double GetEpsilon() const {return epsilon;}
 	Graph& GetGraph() {return G;}
 	int GetExperienceCount() const {return exp.GetCount();}
-	void ClearExperience() {exp.Clear();}
+	const DQExperience& GetExperience(int i) const {return exp[i];}
+	virtual int GetLearningSteps() const {return learning_steps_per_iteration;}
+	void ClearExperience() {exp.Clear(); priority.Clear();}
+	bool IsPrioritizedReplay() const {return prioritized;}
+	const PrioritizedReplay& GetPriority() const {return priority;}
 	
 	void SetEpsilon(double e) {epsilon = e;}
 	void SetGamma(double g) {gamma = g;}
+	void SetPrioritizedReplay(double alpha=0.6, double beta=0.4) {prioritized = true; priority.Set(alpha, beta); InitPriorities();}
+	void SetUniformReplay() {prioritized = false;}
 	
 	int Act(const Vector<double>& slist);
 	void Learn(double reward1, bool force_experience=false);
-	double LearnFromTuple(Mat& s0, int a0, double reward0, Mat& s1, int a1);
+	double LearnFromTuple(Mat& s0, int a0, double reward0, Mat& s1, int a1, double weight=1.0);
 	void Learn(const Vector<double>& in, const Vector<double>& out);
 	void Learn(double* in, double* out);
 	void Evaluate(const Vector<double>& in, Vector<double>& out);
 	void Evaluate(double* in, double* out);
 	
+	// Batched versions for vectorized environments: the states are count rows of
+	// GetNumStates() values, and the values are count rows of GetMaxNumActions() values.
+	void Evaluate(const Vector<double>& states, int count, Vector<double>& values);
+	virtual void Act(const Vector<double>& states, int count, Vector<int>& actions);
+	virtual void AddExperience(const Vector<double>& s0, int a0, double r0, const Vector<double>& s1);
+	virtual void LearnFromReplay(int steps);
+	
 	void Serialize(Stream& s) {
 		s % exp;
 		SerializeWithoutExperience(s);
@@ -281,8 +319,10 @@ public:
 		  % state0 % state1
 		  % action0 % action1
 		  % reward0;
-		if (s.IsLoading())
+		if (s.IsLoading()) {
 			FixPool();
+			InitPriorities();
+		}
 	}
 	
 	
@@ -0,0 +1,605 @@
+#include "ConvNet.h"
+
+namespace ConvNet {
+
+// The number of keys of the tile at k0 which query i (of the whole sequence) attends to
+inline int GetAllowedKeys(const AttentionShape& shape, int i, int k0, int bk) {
+	if (!shape.causal)
+		return bk;
+	return max(0, min(bk, shape.q_offset + i - k0 + 1));
+}
+
+// The keys after the last position of the query tile are skipped by the causal mask
+inline int GetKeyEnd(const AttentionShape& shape, int q0, int bq) {
+	if (!shape.causal)
+		return shape.k_count;
+	return min(shape.k_count, shape.q_offset + q0 + bq);
+}
+
+void AttentionCache::Reserve(int positions, int width) {
+	ASSERT(count == 0 || width == this->width);
+	this->width = width;
+	int n = positions * width;
+	if (n > keys.GetCount()) {
+		// grow geometrically, a decoder adds a few positions at a time
+		if (n > keys.GetAlloc()) {
+			int alloc = max(n, 2 * keys.GetCount());
+			keys.Reserve(alloc);
+			values.Reserve(alloc);
+			CountBufferAllocation();
+		}
+		keys.SetCount(n);
+		values.SetCount(n);
+	}
+}
+
+void AttentionCache::Set(const AttentionCache& src) {
+	width = src.width;
+	count = src.count;
+	int n = count * width;
+	SetBufferCount(keys, n);
+	SetBufferCount(values, n);
+	if (n) {
+		memcpy(keys.Begin(), src.keys.Begin(), n * sizeof(Real));
+		memcpy(values.Begin(), src.values.Begin(), n * sizeof(Real));
+	}
+}
+
+void AttentionForward(const AttentionShape& shape,
+	const Real* q, int ldq, const Real* k, const Real* v, int ldkv,
+	Real* out, int ldo, Real* lse, AttentionScratch& scratch) {
+	int dim = shape.dim;
+	ASSERT(shape.tile_q > 0 && shape.tile_k > 0 && dim > 0);
+	SetBufferCount(scratch.s, shape.tile_q * shape.tile_k);
+	SetBufferCount(scratch.m, shape.tile_q);
+	SetBufferCount(scratch.l, shape.tile_q);
+	Real* s = scratch.s.Begin();
+	double* m = scratch.m.Begin();
+	double* l = scratch.l.Begin();
+
+	for (int q0 = 0; q0 < shape.q_count; q0 += shape.tile_q) {
+		int bq = min(shape.tile_q, shape.q_count - q0);
+		Real* o = out + (int64)q0 * ldo;
+		for (int i = 0; i < bq; i++) {
+			m[i] = -DBL_MAX;
+			l[i] = 0;
+			memset(o + (int64)i * ldo, 0, dim * sizeof(Real));
+		}
+
+		int k_end = GetKeyEnd(shape, q0, bq);
+		for (int k0 = 0; k0 < k_end; k0 += shape.tile_k) {
+			int bk = min(shape.tile_k, k_end - k0);
+			Gemm<Real>(false, true, bq, bk, dim,
+				(Real)shape.scale, q + (int64)q0 * ldq, ldq, k + (int64)k0 * ldkv, ldkv,
+				(Real)0, s, bk);
+
+			for (int i = 0; i < bq; i++) {
+				Real* row = s + i * bk;
+				int allowed = GetAllowedKeys(shape, q0 + i, k0, bk);
+				double mx = m[i];
+				for (int j = 0; j < allowed; j++)
+					mx = max(mx, (double)row[j]);
+				double sum = 0;
+				for (int j = 0; j < allowed; j++) {
+					double e = exp(row[j] - mx);
+					row[j] = (Real)e;
+					sum += e;
+				}
+				for (int j = allowed; j < bk; j++)
+					row[j] = 0;
+
+				// the rows accumulated so far were weighted relative to the old maximum
+				if (mx > m[i] && l[i] > 0) {
+					double corr = exp(m[i] - mx);
+					Real* orow = o + (int64)i * ldo;
+					for (int d = 0; d < dim; d++)
+						orow[d] = (Real)(orow[d] * corr);
+					l[i] *= corr;
+				}
+				l[i] += sum;
+				m[i] = mx;
+			}
+
+			Gemm<Real>(false, false, bq, dim, bk,
+				(Real)1, s, bk, v + (int64)k0 * ldkv, ldkv,
+				(Real)1, o, ldo);
+		}
+
+		for (int i = 0; i < bq; i++) {
+			Real* orow = o + (int64)i * ldo;
+			double inv = l[i] > 0 ? 1.0 / l[i] : 0.0;
+			for (int d = 0; d < dim; d++)
+				orow[d] = (Real)(orow[d] * inv);
+			lse[q0 + i] = (Real)(m[i] + log(l[i]));
+		}
+	}
+}
+
+void AttentionBackward(const AttentionShape& shape,
+	const Real* q, int ldq, const Real* k, const Real* v, int ldkv,
+	const Real* out, const Real* dout, int ldo, const Real* lse,
+	Real* dq, Real* dk, Real* dv, AttentionScratch& scratch) {
+	int dim = shape.dim;
+	ASSERT(shape.tile_q > 0 && shape.tile_k > 0 && dim > 0);
+	SetBufferCount(scratch.s, shape.tile_q * shape.tile_k);
+	SetBufferCount(scratch.dp, shape.tile_q * shape.tile_k);
+	SetBufferCount(scratch.delta, shape.tile_q);
+	Real* s = scratch.s.Begin();
+	Real* dp = scratch.dp.Begin();
+	double* delta = scratch.delta.Begin();
+
+	for (int i = 0; i < shape.q_count; i++)
+		memset(dq + (int64)i * ldq, 0, dim * sizeof(Real));
+	for (int j = 0; j < shape.k_count; j++) {
+		memset(dk + (int64)j * ldkv, 0, dim * sizeof(Real));
+		memset(dv + (int64)j * ldkv, 0, dim * sizeof(Real));
+	}
+
+	for (int q0 = 0; q0 < shape.q_count; q0 += shape.tile_q) {
+		int bq = min(shape.tile_q, shape.q_count - q0);
+		const Real* qt = q + (int64)q0 * ldq;
+		const Real* dot = dout + (int64)q0 * ldo;
+
+		// the gradient of the softmax needs the dot product of every output row and its gradient
+		for (int i = 0; i < bq; i++) {
+			const Real* orow = out + (int64)(q0 + i) * ldo;
+			const Real* drow = dot + (int64)i * ldo;
+			double sum = 0;
+			for (int d = 0; d < dim; d++)
+				sum += orow[d] * drow[d];
+			delta[i] = sum;
+		}
+
+		int k_end = GetKeyEnd(shape, q0, bq);
+		for (int k0 = 0; k0 < k_end; k0 += shape.tile_k) {
+			int bk = min(shape.tile_k, k_end - k0);
+			const Real* kt = k + (int64)k0 * ldkv;
+			const Real* vt = v + (int64)k0 * ldkv;
+
+			// the probabilities of the tile from the scores and the log-sum-exp of the rows
+			Gemm<Real>(false, true, bq, bk, dim,
+				(Real)shape.scale, qt, ldq, kt, ldkv, (Real)0, s, bk);
+			for (int i = 0; i < bq; i++) {
+				Real* row = s + i * bk;
+				int allowed = GetAllowedKeys(shape, q0 + i, k0, bk);
+				double row_lse = lse[q0 + i];
+				for (int j = 0; j < allowed; j++)
+					row[j] = (Real)exp(row[j] - row_lse);
+				for (int j = allowed; j < bk; j++)
+					row[j] = 0;
+			}
+
+			// dV += P^T dO
+			Gemm<Real>(true, false, bk, dim, bq,
+				(Real)1, s, bk, dot, ldo, (Real)1, dv + (int64)k0 * ldkv, ldkv);
+
+			// dP = dO V^T, dS = P * (dP - delta)
+			Gemm<Real>(false, true, bq, bk, dim,
+				(Real)1, dot, ldo, vt, ldkv, (Real)0, dp, bk);
+			for (int i = 0; i < bq; i++) {
+				const Real* prow = s + i * bk;
+				Real* drow = dp + i * bk;
+				for (int j = 0; j < bk; j++)
+					drow[j] = (Real)(prow[j] * (drow[j] - delta[i]));
+			}
+
+			// dQ += scale * dS K, dK += scale * dS^T Q
+			Gemm<Real>(false, false, bq, dim, bk,
+				(Real)shape.scale, dp, bk, kt, ldkv, (Real)1, dq + (int64)q0 * ldq, ldq);
+			Gemm<Real>(true, false, bk, dim, bq,
+				(Real)shape.scale, dp, bk, qt, ldq, (Real)1, dk + (int64)k0 * ldkv, ldkv);
+		}
+	}
+}
+
+MultiHeadAttentionCRTP::MultiHeadAttentionCRTP(int embed_dim, int num_heads)
+	: embed_dim(embed_dim), num_heads(num_heads) {
+	if (embed_dim <= 0 || num_heads <= 0)
+		return;
+
+	// Validate that embedding dimension is divisible by number of heads
+	if (embed_dim % num_heads != 0)
+		throw std::runtime_error("Embedding dimension must be divisible by number of heads");
+	head_dim = embed_dim / num_heads;
+	InitWeights();
+}
+
+void MultiHeadAttentionCRTP::InitWeights() {
+	// every output has the variance of one input
+	RandomGaussian& rand = GetRandomGaussian(embed_dim);
+	Volume* w[4] = {&wq, &wk, &wv, &wo};
+	for (int i = 0; i < 4; i++) {
+		w[i]->Init(embed_dim, embed_dim, 1, 0.0);
+		for (int j = 0; j < w[i]->GetLength(); j++)
+			w[i]->Set(j, rand);
+	}
+
+	bq.Init(embed_dim, 1, 1, 0.0);
+	bk.Init(embed_dim, 1, 1, 0.0);
+	bv.Init(embed_dim, 1, 1, 0.0);
+	bo.Init(embed_dim, 1, 1, 0.0);
+	Dequantize();
+}
+
+void MultiHeadAttentionCRTP::SetShape(int embed_dim, int num_heads) {
+	if (embed_dim <= 0 || num_heads <= 0 || embed_dim % num_heads != 0)
+		throw std::runtime_error("Embedding dimension must be divisible by number of heads");
+	this->embed_dim = embed_dim;
+	this->num_heads = num_heads;
+	head_dim = embed_dim / num_heads;
+	bq.Init(embed_dim, 1, 1, 0.0);
+	bk.Init(embed_dim, 1, 1, 0.0);
+	bv.Init(embed_dim, 1, 1, 0.0);
+	bo.Init(embed_dim, 1, 1, 0.0);
+	Dequantize();
+}
+
+void MultiHeadAttentionCRTP::VisitTensors(GGUFTensorVisitor& v, const String& prefix) {
+	v.Tensor(prefix + "attn_q.weight", wq, embed_dim, embed_dim);
+	v.Tensor(prefix + "attn_q.bias", bq, embed_dim);
+	v.Tensor(prefix + "attn_k.weight", wk, embed_dim, embed_dim);
+	v.Tensor(prefix + "attn_k.bias", bk, embed_dim);
+	v.Tensor(prefix + "attn_v.weight", wv, embed_dim, embed_dim);
+	v.Tensor(prefix + "attn_v.bias", bv, embed_dim);
+	v.Tensor(prefix + "attn_output.weight", wo, embed_dim, embed_dim);
+	v.Tensor(prefix + "attn_output.bias", bo, embed_dim);
+}
+
+void MultiHeadAttentionCRTP::Quantize(int type) {
+	const Volume* w[4] = {&wq, &wk, &wv, &wo};
+	for (int i = 0; i < 4; i++)
+		quantized[i].Quantize(type, w[i]->GetWeights().Begin(), embed_dim, embed_dim, embed_dim);
+}
+
+void MultiHeadAttentionCRTP::Dequantize() {
+	for (int i = 0; i < 4; i++)
+		quantized[i].Clear();
+}
+
+AttentionShape MultiHeadAttentionCRTP::GetShape(int seq_len) const {
+	AttentionShape shape;
+	shape.q_count = seq_len;
+	shape.k_count = seq_len;
+	shape.dim = head_dim;
+	shape.tile_q = tile_size;
+	shape.tile_k = tile_size;
+	shape.causal = causal;
+	shape.scale = 1.0 / sqrt((double)head_dim);
+	return shape;
+}
+
+// Projects the rows of x^T (x is embed_dim x seq_len) with w, or with its quantized blocks
+// qw, and adds the bias to every row
+static void Project(int thread_count, const Real* x, int seq_len, int embed_dim, const Volume& w, const QuantizedMatrix* qw, const Volume& b, Real* out) {
+	if (qw) {
+		QuantizedGemm(thread_count, *qw, seq_len, x, 1, seq_len, b.GetWeights().Begin(), out, embed_dim, 1);
+		return;
+	}
+	ParallelGemm<Real>(thread_count, true, true, seq_len, embed_dim, embed_dim,
+		(Real)1, x, seq_len, w.GetWeights().Begin(), embed_dim,
+		(Real)0, out, embed_dim);
+	const Real* bias = b.GetWeights().Begin();
+	for (int t = 0; t < seq_len; t++) {
+		Real* row = out + (int64)t * embed_dim;
+		for (int i = 0; i < embed_dim; i++)
+			row[i] += bias[i];
+	}
+}
+
+// Projects the context (seq_len x embed_dim) with w back into the [embed_dim, 1, seq_len]
+// layout, y = w * context^T + b
+static void ProjectOutput(int thread_count, const Real* context, int seq_len, int embed_dim, const Volume& w, const QuantizedMatrix* qw, const Volume& b, Real* y) {
+	if (qw) {
+		QuantizedGemm(thread_count, *qw, seq_len, context, embed_dim, 1, b.GetWeights().Begin(), y, 1, seq_len);
+		return;
+	}
+	ParallelGemm<Real>(thread_count, false, true, embed_dim, seq_len, embed_dim,
+		(Real)1, w.GetWeights().Begin(), embed_dim, context, embed_dim,
+		(Real)0, y, seq_len);
+	const Real* bias = b.GetWeights().Begin();
+	for (int i = 0; i < embed_dim; i++) {
+		Real* row = y + (int64)i * seq_len;
+		for (int t = 0; t < seq_len; t++)
+			row[t] += bias[i];
+	}
+}
+
+// Adds the gradients of w and b of the projection of x, and the gradient of x to beta times
+// the gradient of the earlier projections
+static void BackwardProject(const Real* x, int seq_len, int embed_dim, Volume& w, Volume& b,
+	const Real* dout, Real* dx, Real beta) {
+	Gemm<Real>(true, true, embed_dim, embed_dim, seq_len,
+		(Real)1, dout, embed_dim, x, seq_len,
+		(Real)1, w.GetGradients().Begin(), embed_dim);
+	Real* bias = b.GetGradients().Begin();
+	for (int t = 0; t < seq_len; t++) {
+		const Real* row = dout + (int64)t * embed_dim;
+		for (int i = 0; i < embed_dim; i++)
+			bias[i] += row[i];
+	}
+	Gemm<Real>(true, true, embed_dim, seq_len, embed_dim,
+		(Real)1, w.GetWeights().Begin(), embed_dim, dout, embed_dim,
+		beta, dx, seq_len);
+}
+
+void MultiHeadAttentionCRTP::ForwardHeads(int seq_len, int b) {
+	int64 off = (int64)b * seq_len * embed_dim;
+	AttentionShape shape = GetShape(seq_len);
+	scratch.SetCount(num_heads);
+
+	auto head = [&](int h) {
+		AttentionForward(shape,
+			queries.Begin() + off + h * head_dim, embed_dim,
+			keys.Begin() + off + h * head_dim, values.Begin() + off + h * head_dim, embed_dim,
+			context.Begin() + off + h * head_dim, embed_dim,
+			lse.Begin() + ((int64)b * num_heads + h) * seq_len, scratch[h]);
+	};
+
+	if (thread_count > 1 && num_heads > 1) {
+		CoWork co;
+		for (int h = 0; h < num_heads; h++)
+			co & [&head, h] {head(h);};
+	}
+	else {
+		for (int h = 0; h < num_heads; h++)
+			head(h);
+	}
+}
+
+void MultiHeadAttentionCRTP::BackwardHeads(int seq_len, int b) {
+	int64 off = (int64)b * seq_len * embed_dim;
+	AttentionShape shape = GetShape(seq_len);
+	scratch.SetCount(num_heads);
+
+	// the heads write separate columns of the gradients
+	auto head = [&](int h) {
+		int64 o = off + h * head_dim;
+		AttentionBackward(shape,
+			queries.Begin() + o, embed_dim, keys.Begin() + o, values.Begin() + o, embed_dim,
+			context.Begin() + o, dcontext.Begin() + (int64)h * head_dim, embed_dim,
+			lse.Begin() + ((int64)b * num_heads + h) * seq_len,
+			dqueries.Begin() + h * head_dim, dkeys.Begin() + h * head_dim,
+			dvalues.Begin() + h * head_dim, scratch[h]);
+	};
+
+	if (thread_count > 1 && num_heads > 1) {
+		CoWork co;
+		for (int h = 0; h < num_heads; h++)
+			co & [&head, h] {head(h);};
+	}
+	else {
+		for (int h = 0; h < num_heads; h++)
+			head(h);
+	}
+}
+
+Volume& MultiHeadAttentionCRTP::ForwardImpl(Volume& input, bool is_training) {
+	ASSERT(input.GetWidth() == embed_dim && input.GetHeight() == 1);
+	input_activation = &input;
+	int seq_len = input.GetDepth();  // input shape is [embed_dim, 1, seq_len]
+	int batch = input.GetBatch();
+	int64 count = (int64)batch * seq_len * embed_dim;
+
+	SetBufferCount(queries, (int)count);
+	SetBufferCount(keys, (int)count);
+	SetBufferCount(values, (int)count);
+	SetBufferCount(context, (int)count);
+	SetBufferCount(lse, batch * num_heads * seq_len);
+	output_activation.SetSize(embed_dim, 1, seq_len, batch);
+
+	for (int b = 0; b < batch; b++) {
+		int64 off = (int64)b * seq_len * embed_dim;
+		const Real* x = input.GetWeights().Begin() + off;
+		Project(thread_count, x, seq_len, embed_dim, wq, GetQuantized(0, is_training), bq, queries.Begin() + off);
+		Project(thread_count, x, seq_len, embed_dim, wk, GetQuantized(1, is_training), bk, keys.Begin() + off);
+		Project(thread_count, x, seq_len, embed_dim, wv, GetQuantized(2, is_training), bv, values.Begin() + off);
+
+		ForwardHeads(seq_len, b);
+
+		ProjectOutput(thread_count, context.Begin() + off, seq_len, embed_dim, wo, GetQuantized(3, is_training), bo,
+			output_activation.GetWeights().Begin() + off);
+	}
+
+	return output_activation;
+}
+
+Volume& MultiHeadAttentionCRTP::ForwardCached(Volume& input, AttentionCache& cache) {
+	cached.SetCount(1);
+	cached_counts.SetCount(1);
+	cached[0] = &cache;
+	cached_counts[0] = input.GetDepth();
+	return ForwardCached(input, cached, cached_counts);
+}
+
+Volume& MultiHeadAttentionCRTP::ForwardCached(Volume& input, const Vector<AttentionCache*>& caches, const Vector<int>& counts) {
+	ASSERT(input.GetWidth() == embed_dim && input.GetHeight() == 1 && input.GetBatch() == 1);
+	ASSERT(caches.GetCount() == counts.GetCount());
+	input_activation = NULL;
+	int count = input.GetDepth();
+	int seq_count = caches.GetCount();
+
+	SetBufferCount(queries, count * embed_dim);
+	SetBufferCount(keys, count * embed_dim);
+	SetBufferCount(values, count * embed_dim);
+	SetBufferCount(context, count * embed_dim);
+	SetBufferCount(lse, count * num_heads);
+	SetBufferCount(cached_first, seq_count);
+	output_activation.SetSize(embed_dim, 1, count);
+
+	// the projections of the positions of all sequences are computed together
+	const Real* x = input.GetWeights().Begin();
+	Project(thread_count, x, count, embed_dim, wq, GetQuantized(0, false), bq, queries.Begin());
+	Project(thread_count, x, count, embed_dim, wk, GetQuantized(1, false), bk, keys.Begin());
+	Project(thread_count, x, count, embed_dim, wv, GetQuantized(2, false), bv, values.Begin());
+
+	// the keys and values are appended to the caches of the sequences
+	int first = 0;
+	for (int i = 0; i < seq_count; i++) {
+		AttentionCache& cache = *caches[i];
+		int n = counts[i];
+		ASSERT(n > 0);
+		int64 off = (int64)cache.count * embed_dim;
+		cache.Reserve(cache.count + n, embed_dim);
+		memcpy(cache.keys.Begin() + off, keys.Begin() + (int64)first * embed_dim, n * embed_dim * sizeof(Real));
+		memcpy(cache.values.Begin() + off, values.Begin() + (int64)first * embed_dim, n * embed_dim * sizeof(Real));
+		cache.count += n;
+		cached_first[i] = first;
+		first += n;
+	}
+	ASSERT(first == count);
+
+	// every sequence attends to its own cache
+	scratch.SetCount(max(scratch.GetCount(), seq_count * num_heads));
+	auto head = [&](int j) {
+		int i = j / num_heads, h = j % num_heads;
+		const AttentionCache& cache = *caches[i];
+		int64 off = (int64)cached_first[i] * embed_dim + h * head_dim;
+		AttentionShape shape = GetShape(counts[i]);
+		shape.k_count = cache.count;
+		shape.q_offset = cache.count - counts[i];
+		shape.causal = true;
+		AttentionForward(shape, queries.Begin() + off, embed_dim,
+			cache.keys.Begin() + h * head_dim, cache.values.Begin() + h * head_dim, embed_dim,
+			context.Begin() + off, embed_dim,
+			lse.Begin() + (int64)cached_first[i] * num_heads + h * counts[i], scratch[j]);
+	};
+
+	int jobs = seq_count * num_heads;
+	if (thread_count > 1 && jobs > 1) {
+		CoWork co;
+		for (int j = 0; j < jobs; j++)
+			co & [&head, j] {head(j);};
+	}
+	else {
+		for (int j = 0; j < jobs; j++)
+			head(j);
+	}
+
+	ProjectOutput(thread_count, context.Begin(), count, embed_dim, wo, GetQuantized(3, false), bo, output_activation.GetWeights().Begin());
+
+	return output_activation;
+}
+
+void MultiHeadAttentionCRTP::BackwardImpl() {
+	ASSERT(input_activation);
+	Volume& input = *input_activation;
+	int seq_len = input.GetDepth();
+	int batch = input.GetBatch();
+	int n = seq_len * embed_dim;
+
+	SetBufferCount(dqueries, n);
+	SetBufferCount(dkeys, n);
+	SetBufferCount(dvalues, n);
+	SetBufferCount(dcontext, n);
+	const Real* wo_weights = wo.GetWeights().Begin();
+	Real* wo_gradients = wo.GetGradients().Begin();
+	Real* bo_gradients = bo.GetGradients().Begin();
+
+	for (int b = 0; b < batch; b++) {
+		int64 off = (int64)b * n;
+		const Real* dy = output_activation.GetGradients().Begin() + off;
+		const Real* x = input.GetWeights().Begin() + off;
+		Real* dx = input.GetGradients().Begin() + off;
+
+		// the output projection: dwo += dy * context, dcontext = dy^T * wo
+		for (int i = 0; i < embed_dim; i++) {
+			const Real* row = dy + (int64)i * seq_len;
+			double sum = 0;
+			for (int t = 0; t < seq_len; t++)
+				sum += row[t];
+			bo_gradients[i] += (Real)sum;
+		}
+		Gemm<Real>(false, false, embed_dim, embed_dim, seq_len,
+			(Real)1, dy, seq_len, context.Begin() + off, embed_dim,
+			(Real)1, wo_gradients, embed_dim);
+		Gemm<Real>(true, false, seq_len, embed_dim, embed_dim,
+			(Real)1, dy, seq_len, wo_weights, embed_dim,
+			(Real)0, dcontext.Begin(), embed_dim);
+
+		BackwardHeads(seq_len, b);
+
+		// every input gradient is overwritten
+		BackwardProject(x, seq_len, embed_dim, wq, bq, dqueries.Begin(), dx, (Real)0);
+		BackwardProject(x, seq_len, embed_dim, wk, bk, dkeys.Begin(), dx, (Real)1);
+		BackwardProject(x, seq_len, embed_dim, wv, bv, dvalues.Begin(), dx, (Real)1);
+	}
+}
+
+void MultiHeadAttentionCRTP::InitImpl(int input_width, int input_height, int input_depth) {
+	// the input_width is the embedding dimension, and input_depth is the sequence length,
+	// which may change between the calls
+	ASSERT(input_width == embed_dim && input_height == 1);
+}
+
+Vector<ParametersAndGradients>& MultiHeadAttentionCRTP::GetParametersAndGradientsImpl() {
+	params.SetCount(0);
+	Volume* v[8] = {&wq, &wk, &wv, &wo, &bq, &bk, &bv, &bo};
+	for (int i = 0; i < 8; i++)
+		params.Add().volume = v[i];
+	return params;
+}
+
+#define STOREVAR(json, field) map.GetAdd(#json) = this->field;
+#define LOADVAR(field, json) this->field = map.GetValue(map.Find(#json));
+
+Value StoreWeights(const Volume& v) {
+	Value w;
+	for (int i = 0; i < v.GetLength(); i++)
+		w.Add(v.Get(i));
+	return w;
+}
+
+void LoadWeights(const ValueMap& map, const char* key, Volume& v) {
+	Value w = map.GetValue(map.Find(key));
+	if (w.GetCount() != v.GetLength())
+		return;
+	for (int i = 0; i < v.GetLength(); i++)
+		v.Set(i, w[i]);
+}
+
+void MultiHeadAttentionCRTP::StoreImpl(ValueMap& map) const {
+	STOREVAR(embed_dim, embed_dim);
+	STOREVAR(num_heads, num_heads);
+	STOREVAR(head_dim, head_dim);
+	STOREVAR(causal, causal);
+	map.GetAdd("wq") = StoreWeights(wq);
+	map.GetAdd("wk") = StoreWeights(wk);
+	map.GetAdd("wv") = StoreWeights(wv);
+	map.GetAdd("wo") = StoreWeights(wo);
+	map.GetAdd("bq") = StoreWeights(bq);
+	map.GetAdd("bk") = StoreWeights(bk);
+	map.GetAdd("bv") = StoreWeights(bv);
+	map.GetAdd("bo") = StoreWeights(bo);
+}
+
+void MultiHeadAttentionCRTP::LoadImpl(const ValueMap& map) {
+	LOADVAR(embed_dim, embed_dim);
+	LOADVAR(num_heads, num_heads);
+	LOADVAR(head_dim, head_dim);
+	LOADVAR(causal, causal);
+	if (embed_dim <= 0 || num_heads <= 0)
+		return;
+	InitWeights();
+	LoadWeights(map, "wq", wq);
+	LoadWeights(map, "wk", wk);
+	LoadWeights(map, "wv", wv);
+	LoadWeights(map, "wo", wo);
+	LoadWeights(map, "bq", bq);
+	LoadWeights(map, "bk", bk);
+	LoadWeights(map, "bv", bv);
+	LoadWeights(map, "bo", bo);
+}
+
+String MultiHeadAttentionCRTP::ToStringImpl() const {
+	return Format("MultiHeadAttention(embed_dim=%d, num_heads=%d)", embed_dim, num_heads);
+}
+
+void MultiHeadAttentionCRTP::Serialize(Stream& s) {
+	s % embed_dim % num_heads % head_dim % causal;
+	s % wq % wk % wv % wo;
+	s % bq % bk % bv % bo;
+	if (s.IsLoading())
+		Dequantize();
+}
+
+}
@@ -0,0 +1,71 @@
+#ifndef _ConvNet_Attention_h_
+#define _ConvNet_Attention_h_
+
+namespace ConvNet {
+
+/*
+	Scaled dot-product attention of one head, tiled with an online softmax
+	(Dao et al., FlashAttention).
+
+	The queries, keys, values and outputs are row-major matrices with one row of dim values
+	per position, and ld values between the rows, so that the heads can be the column
+	blocks of a position-major (seq_len x embed_dim) matrix. For a tile of queries, the tiles
+	of keys are visited once: the scores of the tile are computed with Gemm, the running
+	maximum and sum of every query row are updated, the output rows accumulated so far are
+	rescaled, and the weighted values of the tile are added. Only a tile_q x tile_k block of
+	scores exists at a time, so the memory doesn't grow with the square of the length.
+
+	The forward pass writes the log-sum-exp of every score row, from which the backward pass
+	recomputes the probabilities of the tiles. AttentionBackward overwrites dq, which has the
+	row stride of q, and dk and dv, which have the row stride of k and v.
+
+	With causal, query i is at the position q_offset + i of the keys, and it attends to
+	the keys up to that position.
+
+	AttentionCache keeps the keys and values of the positions of one sequence so far, so that
+	the next positions of an incremental decoder are the only queries: they are appended to
+	the cache and attend to all of it with q_offset at the old count. Truncate rolls the
+	sequence back without freeing the memory.
+*/
+
+struct AttentionScratch {
+	Vector<Real> s, dp;
+	Vector<double> m, l, delta;
+};
+
+struct AttentionShape {
+	int q_count = 0;
+	int k_count = 0;
+	int dim = 0;
+	int q_offset = 0;
+	int tile_q = 64;
+	int tile_k = 64;
+	bool causal = false;
+	double scale = 1.0;
+};
+
+struct AttentionCache {
+	Vector<Real> keys, values;	// position-major, count x width
+	int count = 0;
+	int width = 0;
+	
+	void Reserve(int positions, int width);
+	void Truncate(int n) {ASSERT(n >= 0 && n <= count); count = n;}
+	void Clear() {count = 0;}
+	void Set(const AttentionCache& src);
+	int GetCount() const {return count;}
+	int64 GetMemory() const {return (int64)(keys.GetAlloc() + values.GetAlloc()) * sizeof(Real);}
+};
+
+void AttentionForward(const AttentionShape& shape,
+	const Real* q, int ldq, const Real* k, const Real* v, int ldkv,
+	Real* out, int ldo, Real* lse, AttentionScratch& scratch);
+
+void AttentionBackward(const AttentionShape& shape,
+	const Real* q, int ldq, const Real* k, const Real* v, int ldkv,
+	const Real* out, const Real* dout, int ldo, const Real* lse,
+	Real* dq, Real* dk, Real* dv, AttentionScratch& scratch);
+
+}
+
+#endif
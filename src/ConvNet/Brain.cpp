@@ -9,56 +9,93 @@ namespace ConvNet {
 
 
 
-Experience::Experience() {
-	action0 = -1;
-	reward0 = 0;
-}
-
-Experience& Experience::operator=(const Experience& src) {
-	HeaplessCopy(this->state0, src.state0);
-	this->action0 = src.action0;
-	this->reward0 = src.reward0;
-	HeaplessCopy(this->state1, src.state1);
-	return *this;
-}
-
-Experience& Experience::Set(const Vector<double>& state0, int action0, double reward0, const Vector<double>& state1) {
-	HeaplessCopy(this->state0, state0);
-	this->action0 = action0;
-	this->reward0 = reward0;
-	HeaplessCopy(this->state1, state1);
-	return *this;
-}
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
 Brain::Brain() {
 	num_states = 0;
 	num_actions = 0;
 	age = 0;
+	experience_ready = 0;
+	learners_running = 0;
+	target_update_interval = 0;
+	target_age = 0;
+	current_batch = 0;
+	target_valid = false;
+	next_batch_ready = false;
+}
+
+Brain::~Brain() {
+	StopLearners();
+}
+
+void Brain::Serialize(Stream& s) {
+	if (s.IsLoading())
+		StopLearners();
+	Session::Serialize(s);
+	s % random_action_distribution % temporal_window % net_inputs % num_states % num_actions %
+		window_size % state_window % action_window % reward_window % net_window;
+	
+	// Streams from before the ReplayBuffer have the packed count of a Vector of transitions
+	// here, and the current format has a negative version number. The old transitions are
+	// added to the ring when its size is known.
+	int version = -1;
+	s / version;
+	Vector<Vector<double>> state0, state1;
+	Vector<int> action;
+	Vector<double> reward;
+	if (s.IsLoading() && version >= 0) {
+		if (version > s.GetLeft()) {
+			s.LoadError();
+			return;
+		}
+		for(int i = 0; i < version; i++)
+			s % state0.Add() % action.Add() % reward.Add() % state1.Add();
+	}
+	else if (version != -1) {
+		s.LoadError();
+		return;
+	}
+	else
+		s % experience;
+	
+	s % learning % age % forward_passes % epsilon % latest_reward % last_input_array %
+		average_reward_window % average_loss_window % net_input % action1ofk %
+		experience_size % start_learn_threshold % gamma % learning_steps_total % learning_steps_burnin %
+		epsilon_min % epsilon_test_time;
+	
+	if (s.IsLoading()) {
+		if (version >= 0) {
+			experience.Clear();
+			if ((int64)experience_size * net_inputs > INT_MAX) {
+				s.LoadError();
+				return;
+			}
+			if (state0.GetCount() && experience_size > 0 && net_inputs > 0)
+				experience.Init(experience_size, net_inputs);
+			for(int i = 0; i < state0.GetCount() && experience.GetCapacity(); i++) {
+				if (state0[i].GetCount() != net_inputs || state1[i].GetCount() != net_inputs) {
+					s.LoadError();
+					return;
+				}
+				experience.Add(state0[i], action[i], reward[i], state1[i]);
+			}
+		}
+		experience_ready = experience.GetCount();
+		target_valid = false;
+		next_batch_ready = false;
+	}
 }
 
 void Brain::Init(int num_states, int num_actions, Vector<double>* random_action_distribution, int learning_steps_total, int random_beginning_steps) {
+	StopLearners();
+	
 	this->random_action_distribution.Clear();
 	state_window.Clear();
 	action_window.Clear();
 	reward_window.Clear();
 	net_window.Clear();
 	experience.Clear();
+	experience_ready = 0;
+	target_valid = false;
+	next_batch_ready = false;
 	last_input_array.Clear();
 	
 	// in number of time steps, of temporal memory
@@ -188,6 +225,10 @@ int Brain::GetRandomAction() {
 }
 
 ActionValue Brain::GetPolicy(const Vector<double>& weights) {
+	return GetPolicy(net, svol, weights);
+}
+
+ActionValue Brain::GetPolicy(Net& net, Volume& svol, const Vector<double>& weights) {
 	// compute the value of doing any action in this state
 	// and return the argmax action and its value
 	ASSERTEXC(weights.GetCount() == net_inputs);
@@ -294,38 +335,178 @@ void Brain::Backward(double reward) {
 	// it is time t+1 and we have to store (s_t, a_t, r_t, s_{t+1}) as new experience
 	// (given that an appropriate number of state measurements already exist, of course)
 	if (forward_passes > temporal_window + 1) {
-		//Experience e;
-		Experience& e = (experience.GetCount() < experience_size) ? experience.Add() : experience[Random(experience_size)];
+		if (experience.GetCapacity() != experience_size || experience.GetLength() != net_inputs) {
+			// the memory is allocated once, when the size is known
+			StopLearners();
+			experience.Init(experience_size, net_inputs);
+		}
 		int n = window_size;
-		HeaplessCopy(e.state0, net_window[n-2]);
-		e.action0 = action_window[n-2];
-		e.reward0 = reward_window[n-2];
-		HeaplessCopy(e.state1, net_window[n-1]);
+		replay_lock.Enter();
+		experience.Add(net_window[n-2], (int)action_window[n-2], reward_window[n-2], net_window[n-1]);
+		replay_lock.Leave();
+		experience_ready = experience.GetCount();
 	}
 	
 	// learn based on experience, once we have some samples to go on
 	// this is where the magic happens...
-	if (experience.GetCount() > start_learn_threshold) {
-		double avcost = 0.0;
-		for(int k = 0; k < trainer.batch_size; k++) {
-			int re = Random(experience.GetCount());
-			Experience& e = experience[re];
-			ASSERTEXC(e.state0.GetCount() == net_inputs);
-			x.Set(e.state0);
-			ActionValue maxact = GetPolicy(e.state1);
-			double r = e.reward0 + gamma * maxact.value;
-			if (!IsFin(r)) r = 0;
-			trainer.Train(x, e.action0, r);
-			double loss = trainer.GetLoss();
-			avcost += loss;
+	if (experience.GetCount() > start_learn_threshold && hogwild && thread_count > 1) {
+		if (!learners_running)
+			StartLearners();
+	}
+	else if (experience.GetCount() > start_learn_threshold) {
+		// sample a mini-batch of experiences and train the net with all of them at once
+		int batch = trainer.batch_size;
+		if (target_update_interval > 0)
+			LearnWithTargetNet(batch);
+		else {
+			SampleBatch(net, experience.GetCount(), batch, replay_batch[0]);
+			TrainBatch(replay_batch[0]);
 		}
-		avcost = avcost / trainer.batch_size;
-		average_loss_window.Add(avcost);
+		average_loss_window.Add(trainer.GetLoss());
 	}
 	
 	Leave();
 }
 
+void Brain::SampleBatch(Net& net, int count, int batch, ReplayBatch& b) {
+	SampleExperience(count, batch, b.index, b.weights);
+	GetTargets(net, b.x1, b.index, b.actions, b.targets);
+	experience.GatherState0(b.index.Begin(), batch, b.x0);
+}
+
+void Brain::TrainBatch(ReplayBatch& b) {
+	if (experience.IsPrioritized()) {
+		trainer.Train(b.x0, num_actions, b.actions, b.targets, &b.weights);
+		UpdatePriorities(net, b.index, b.actions, b.targets);
+	}
+	else
+		trainer.Train(b.x0, num_actions, b.actions, b.targets);
+}
+
+// The mini-batches are pipelined: while the current one is trained, the next one is sampled,
+// and its targets are computed with the target network in another thread. The next
+// mini-batch has its own copy of the states, so the experiences added meanwhile don't change
+// it.
+void Brain::LearnWithTargetNet(int batch) {
+	if (!target_valid || target_age >= target_update_interval) {
+		if (target_valid)
+			target_net.CopyParametersFrom(net);
+		else
+			target_net.CopyFrom(net);
+		target_valid = true;
+		target_age = 0;
+		next_batch_ready = false; // it has the targets of the previous target network
+	}
+	
+	int count = experience.GetCount();
+	ReplayBatch& cur = replay_batch[current_batch];
+	ReplayBatch& next = replay_batch[!current_batch];
+	if (!next_batch_ready || cur.index.GetCount() != batch)
+		SampleBatch(target_net, count, batch, cur);
+	
+	CoWork co;
+	co & [this, count, batch, &next] {SampleBatch(target_net, count, batch, next);};
+	TrainBatch(cur);
+	co.Finish();
+	
+	current_batch = !current_batch;
+	next_batch_ready = true;
+	target_age++;
+}
+
+void Brain::StartLearners() {
+	// the learners update the filters, and the replicas get them without quantized blocks
+	net.Dequantize();
+	InitWorkers(max(1, trainer.GetBatchSize()));
+	learners_running = 1;
+	for(int i = 0; i < workers.GetCount(); i++) {
+		TrainWorker& w = workers[i];
+		w.thread.Run([this, &w] {Learn(w);});
+	}
+}
+
+void Brain::StopLearners() {
+	if (!learners_running)
+		return;
+	learners_running = 0;
+	for(int i = 0; i < workers.GetCount(); i++)
+		workers[i].thread.Wait();
+}
+
+// The loop of a Hogwild learner. The targets come from the replica of the worker, which has
+// the shared weights of its previous mini-batch.
+void Brain::Learn(TrainWorker& w) {
+	int batch = max(1, w.trainer.GetBatchSize());
+	
+	while (learners_running) {
+		int count = experience_ready;
+		
+		// the labels of the worker are the actions and the rewards are the targets
+		SampleExperience(count, batch, w.index, w.weight);
+		GetTargets(*w.net, w.sample, w.index, w.labels, w.rewards);
+		experience.GatherState0(w.index.Begin(), batch, w.x);
+		if (experience.IsPrioritized()) {
+			w.trainer.Train(w.x, num_actions, w.labels, w.rewards, &w.weight);
+			UpdatePriorities(*w.net, w.index, w.labels, w.rewards);
+		}
+		else
+			w.trainer.Train(w.x, num_actions, w.labels, w.rewards);
+		
+		stats_lock.Enter();
+		average_loss_window.Add(w.trainer.GetLoss());
+		trainer.iter_count += batch;
+		stats_lock.Leave();
+	}
+}
+
+// Samples a mini-batch of the first count experiences. The weights are the importance
+// sampling weights of prioritized replay, or 1.
+void Brain::SampleExperience(int count, int batch, Vector<int>& index, Vector<double>& weight) {
+	index.SetCount(batch);
+	weight.SetCount(batch);
+	if (experience.IsPrioritized()) {
+		replay_lock.Enter();
+		experience.Sample(batch, index.Begin(), weight.Begin());
+		replay_lock.Leave();
+		return;
+	}
+	for(int k = 0; k < batch; k++) {
+		index[k] = Random(count);
+		weight[k] = 1.0;
+	}
+}
+
+// Computes the actions and the Q-learning targets r + gamma * max_a Q(state1, a) of the
+// sampled experiences with one batched forward pass of the net.
+void Brain::GetTargets(Net& net, Volume& x1, const Vector<int>& index, Vector<int>& actions, Vector<double>& targets) {
+	int batch = index.GetCount();
+	experience.GatherState1(index.Begin(), batch, x1);
+	const Volume& values = net.Forward(x1);
+	const Real* v = values.GetWeights().Begin();
+	actions.SetCount(batch);
+	targets.SetCount(batch);
+	for(int k = 0; k < batch; k++, v += num_actions) {
+		double maxval = v[0];
+		for(int j = 1; j < num_actions; j++)
+			maxval = max(maxval, (double)v[j]);
+		int i = index[k];
+		double r = experience.GetReward(i) + gamma * maxval;
+		if (!IsFin(r)) r = 0;
+		actions[k] = experience.GetAction(i);
+		targets[k] = r;
+	}
+}
+
+// The new priorities are the TD errors of the last forward pass of the net, which was made
+// with the weights before the update.
+void Brain::UpdatePriorities(Net& net, const Vector<int>& index, const Vector<int>& actions, const Vector<double>& targets) {
+	const Volume& values = net.GetOutput();
+	replay_lock.Enter();
+	for(int k = 0; k < index.GetCount(); k++)
+		experience.UpdatePriority(index[k], values.Get(k * num_actions + actions[k]) - targets[k]);
+	replay_lock.Leave();
+}
+
 String Brain::ToString() const {
 	// basic information
 	String t = "";
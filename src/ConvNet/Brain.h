@@ -2,26 +2,10 @@
 #define _ConvNet_Brain_h_
 
 #include "Session.h"
+#include "ReplayBuffer.h"
 
 namespace ConvNet {
 
-class Experience : Moveable<Experience> {
-	
-	
-public:
-	Experience();
-	Experience(const Experience& src) {*this = src;}
-	Experience& operator=(const Experience& src);
-	Experience& Set(const Vector<double>& state0, int action0, double reward0, const Vector<double>& state1);
-	void Serialize(Stream& s) {s % state0 % action0 % reward0 % state1;}
-	
-	Vector<double> state0;
-    int action0;
-    double reward0;
-    Vector<double> state1;
-    
-};
-
 struct ActionValue : Moveable<ActionValue> {
 	int action;
 	double value;
@@ -41,7 +25,7 @@ class Brain : public Session {
 	Vector<Vector<double> > net_window;
 	
 	
-	Vector<Experience> experience;
+	ReplayBuffer experience;
 	bool learning;
 	int age, forward_passes;
 	double epsilon, latest_reward;
@@ -53,23 +37,52 @@ class Brain : public Session {
 	Vector<double> action1ofk;
 	Volume brain_tmp1;
 	Volume svol;
-	Volume x;
+	
+	// Batched Q-learning: a mini-batch of experiences is trained with one forward pass over
+	// its state1 values for the targets, and one training step over its state0 values.
+	struct ReplayBatch {
+		Vector<int> index, actions;
+		Vector<double> weights, targets;
+		Volume x0, x1;
+	};
+	ReplayBatch replay_batch[2];
+	
+	// The optional target network is a copy of the net, which is refreshed every
+	// target_update_interval mini-batches. Because it doesn't change in between, the targets of
+	// the next mini-batch are computed in another thread while the current one is trained.
+	// The Hogwild learners use their own replicas instead.
+	Net target_net;
+	int target_update_interval, target_age;
+	int current_batch;
+	bool target_valid, next_batch_ready;
+	
+	// Hogwild learning: the session's workers train the net from the experience in their own
+	// threads without locking, and Backward only adds new experiences. Experiences are
+	// sampled only below experience_ready, which is updated after they have been written.
+	// Once the memory is full, a learner may read a transition while it is overwritten, in
+	// the same way as it reads the weights. The priorities of prioritized replay are changed
+	// only with replay_lock.
+	Atomic experience_ready;
+	Atomic learners_running;
+	SpinLock stats_lock, replay_lock;
+	
+	void SampleExperience(int count, int batch, Vector<int>& index, Vector<double>& weight);
+	void GetTargets(Net& net, Volume& x1, const Vector<int>& index, Vector<int>& actions, Vector<double>& targets);
+	void UpdatePriorities(Net& net, const Vector<int>& index, const Vector<int>& actions, const Vector<double>& targets);
+	void SampleBatch(Net& net, int count, int batch, ReplayBatch& b);
+	void TrainBatch(ReplayBatch& b);
+	void LearnWithTargetNet(int batch);
+	void StartLearners();
+	void Learn(TrainWorker& w);
 	
 public:
 	typedef Brain CLASSNAME;
 	Brain();
+	~Brain();
 	
 	void Init(int num_states, int num_actions, Vector<double>* random_action_distribution=NULL, int learning_steps_total=100000, int random_beginning_steps=3000);
 	void Reset() {Init(num_states, num_actions, NULL, learning_steps_total, learning_steps_burnin);}
-	void Serialize(Stream& s) {
-		Session::Serialize(s);
-		s % random_action_distribution % temporal_window % net_inputs % num_states % num_actions %
-			window_size % state_window % action_window % reward_window % net_window %
-			experience % learning % age % forward_passes % epsilon % latest_reward % last_input_array %
-			average_reward_window % average_loss_window % net_input % action1ofk %
-			experience_size % start_learn_threshold % gamma % learning_steps_total % learning_steps_burnin %
-			epsilon_min % epsilon_test_time;
-	}
+	void Serialize(Stream& s);
 	void SerializeWithoutExperience(Stream& s) {
 		Session::Serialize(s);
 		s % random_action_distribution % temporal_window % net_inputs % num_states % num_actions %
@@ -84,9 +97,11 @@ public:
 	
 	int GetRandomAction();
 	ActionValue GetPolicy(const Vector<double>& weights);
+	ActionValue GetPolicy(Net& net, Volume& svol, const Vector<double>& weights);
 	void GetNetInput(const Vector<double>& xt, Vector<double>& w);
 	int Forward(const Vector<double>& input_array);
 	void Backward(double reward);
+	void StopLearners();
 	
 	// TODO: fix ambiguity between Brain::GetAverageReward and Session::GetRewardAverage
 	double GetLatestReward() const {return latest_reward;}
@@ -95,6 +110,7 @@ public:
 	double GetAverageLoss() const {return average_loss_window.GetAverage();}
 	double GetAverageLossWindowSize() const {return average_loss_window.GetCount();}
 	int GetExperienceCount() const {return experience.GetCount();}
+	const ReplayBuffer& GetExperience() const {return experience;}
 	double GetEpsilon() const {return epsilon;}
 	int GetAge() const {return age;}
 	bool IsStartTrainingTreshold() const {return experience.GetCount() > start_learn_threshold;}
@@ -102,6 +118,12 @@ public:
 	virtual double GetRewardAverage() const {return average_reward_window.GetAverage();}
 	
 	void SetLearning(bool b) {learning = b;}
+	void SetPrioritizedReplay(double alpha=0.6, double beta=0.4) {experience.SetPrioritized(alpha, beta);}
+	void SetUniformReplay() {experience.SetUniform();}
+	void SetTargetNetwork(int update_interval) {target_update_interval = max(0, update_interval); target_valid = false;} // 0 disables
+	int GetTargetUpdateInterval() const {return target_update_interval;}
+	Net& GetTargetNetwork() {return target_net;}
+	bool IsPrioritizedReplay() const {return experience.IsPrioritized();}
 	void SetStartTrainingTreshold(int i) {start_learn_threshold = i;}
 	
 	int experience_size;
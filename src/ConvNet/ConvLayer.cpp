@@ -28,19 +28,41 @@ void LayerBase::InitConv(int input_width, int input_height, int input_depth) {
 	}
 	
 	biases.Init(1, 1, output_depth, bias);
+	quantized_filters.Clear();
 }
 
 
 Volume& LayerBase::ForwardConv(Volume& input, bool is_training) {
+	if (!is_training && IsQuantized())
+		return ForwardConvQuantized(input);
+	switch (conv_algorithm) {
+		case CONV_REFERENCE:	return ForwardConvReference(input);
+		case CONV_GEMM:			return ForwardConvGemm(input);
+		default: Panic("Invalid convolution algorithm");
+	}
+	throw Exc();
+}
+
+void LayerBase::BackwardConv() {
+	switch (conv_algorithm) {
+		case CONV_REFERENCE:	BackwardConvReference(); return;
+		case CONV_GEMM:			BackwardConvGemm(); return;
+		default: Panic("Invalid convolution algorithm");
+	}
+}
+
+Volume& LayerBase::ForwardConvReference(Volume& input) {
 	// optimized code by @mdda that achieves 2x speedup over previous version
 	
 	input_activation = &input;
-	output_activation.Init(output_width, output_height, output_depth, 0.0);
+	int batch = input.GetBatch();
+	output_activation.SetSize(output_width, output_height, output_depth, batch);
 	
 	int volume_width = input.GetWidth();
 	int volume_height = input.GetHeight();
 	int xy_stride = GetStride();
 	
+	for (int b = 0; b < batch; b++)
 	for (int depth = 0; depth < output_depth; depth++)
 	{
 		const Volume& filter = filters[depth];
@@ -64,13 +86,13 @@ Volume& LayerBase::ForwardConv(Volume& input, bool is_training) {
 						
 						for (int fd = 0; fd < filter.GetDepth(); fd++) {
 							// avoid function call overhead (x2) for efficiency, compromise modularity :(
-							a += filter.Get(fx, fy, fd) * input.Get(ox, oy, fd);
+							a += filter.Get(fx, fy, fd) * input.Get(b, ox, oy, fd);
 						}
 					}
 				}
 				
 				a += biases.Get(depth);
-				output_activation.Set(ax, ay, depth, a);
+				output_activation.Set(b, ax, ay, depth, a);
 			}
 		}
 	}
@@ -78,16 +100,18 @@ Volume& LayerBase::ForwardConv(Volume& input, bool is_training) {
 	return output_activation;
 }
 
-void LayerBase::BackwardConv() {
+void LayerBase::BackwardConvReference() {
 	Volume& input = *input_activation;
 	input.ZeroGradients(); // zero out gradient wrt bottom data, we're about to fill it
 	
+	int batch = output_activation.GetBatch();
 	int volume_width = input.GetWidth();
 	int volume_height = input.GetHeight();
 	int volumeDepth = input.GetDepth();
 	int xy_stride = stride;
 	
 	
+	for (int b = 0; b < batch; b++)
 	for (int depth = 0; depth < output_depth; depth++)
 	{
 		Volume& filter = filters[depth];
@@ -99,7 +123,7 @@ void LayerBase::BackwardConv() {
 			for (int ax = 0; ax < output_width; x += xy_stride, ax++) {
 				
 				// convolve centered at this particular location
-				double chain_gradient_ = output_activation.GetGradient(ax, ay, depth);
+				double chain_gradient_ = output_activation.GetGradient(b, ax, ay, depth);
 				ASSERT(IsFin(chain_gradient_));
 				
 				// gradient from above, from chain rule
@@ -114,8 +138,8 @@ void LayerBase::BackwardConv() {
 						else if (ox >= volume_width) ox = volume_width -1;
 						
 						for (int fd = 0; fd < filter.GetDepth(); fd++) {
-							filter.AddGradient(fx, fy, fd, input.Get(ox, oy, fd) * chain_gradient_);
-							input.AddGradient(ox, oy, fd, filter.Get(fx, fy, fd) * chain_gradient_);
+							filter.AddGradient(fx, fy, fd, input.Get(b, ox, oy, fd) * chain_gradient_);
+							input.AddGradient(b, ox, oy, fd, filter.Get(fx, fy, fd) * chain_gradient_);
 						}
 					}
 				}
@@ -126,6 +150,101 @@ void LayerBase::BackwardConv() {
 	}
 }
 
+Volume& LayerBase::ForwardConvGemm(Volume& input) {
+	input_activation = &input;
+	int batch = input.GetBatch();
+	output_activation.SetSize(output_width, output_height, output_depth, batch);
+	
+	int positions = batch * output_width * output_height;
+	int filter_length = filters[0].GetLength();
+	LowerInput(input);
+	
+	// gather filters into one (output_depth x filter_length) matrix
+	GatherFilters();
+	
+	// output is (positions x output_depth), which is the memory order of the output volume
+	Real* out = output_activation.GetWeights().Begin();
+	for (int p = 0; p < positions; p++)
+		for (int i = 0; i < output_depth; i++)
+			out[p * output_depth + i] = biases.Get(i);
+	
+	Gemm(false, true, positions, output_depth, filter_length,
+		(Real)1, col_buffer.Begin(), filter_length, filter_rows, filter_length,
+		(Real)1, out, output_depth);
+	
+	return output_activation;
+}
+
+// Lowers the samples into one (positions x filter_length) matrix, sample after sample
+void LayerBase::LowerInput(const Volume& input) {
+	const Volume& filter = filters[0];
+	int batch = input.GetBatch();
+	int sample_positions = output_width * output_height;
+	int filter_length = filter.GetLength();
+	SetBufferCount(col_buffer, batch * sample_positions * filter_length);
+	for (int b = 0; b < batch; b++)
+		Im2Col(input.GetWeights().Begin() + b * input.GetLength(), input.GetWidth(), input.GetHeight(), input.GetDepth(),
+			filter.GetWidth(), filter.GetHeight(), stride, pad, output_width, output_height,
+			col_buffer.Begin() + b * sample_positions * filter_length);
+}
+
+// Inference with the quantized filters: the lowered input times the quantized filter matrix
+Volume& LayerBase::ForwardConvQuantized(Volume& input) {
+	input_activation = &input;
+	int batch = input.GetBatch();
+	output_activation.SetSize(output_width, output_height, output_depth, batch);
+	
+	int positions = batch * output_width * output_height;
+	int filter_length = filters[0].GetLength();
+	LowerInput(input);
+	
+	QuantizedGemm(thread_count, quantized_filters, positions, col_buffer.Begin(), filter_length, 1,
+		biases.GetWeights().Begin(), output_activation.GetWeights().Begin(), output_depth, 1);
+	
+	return output_activation;
+}
+
+void LayerBase::BackwardConvGemm() {
+	Volume& input = *input_activation;
+	input.ZeroGradients(); // zero out gradient wrt bottom data, we're about to fill it
+	
+	const Volume& filter = filters[0];
+	int filter_width = filter.GetWidth();
+	int filter_height = filter.GetHeight();
+	int batch = output_activation.GetBatch();
+	int sample_positions = output_width * output_height;
+	int positions = batch * sample_positions;
+	int filter_length = filter.GetLength();
+	const Real* chain_gradients = output_activation.GetGradients().Begin();
+	
+	// bias gradient is the column sum of the chain gradients
+	for (int p = 0; p < positions; p++) {
+		const Real* row = chain_gradients + p * output_depth;
+		for (int i = 0; i < output_depth; i++)
+			biases.AddGradient(i, row[i]);
+	}
+	
+	// gradient wrt filters: (output_depth x positions) * (positions x filter_length)
+	SetBufferCount(filter_gradients, output_depth * filter_length);
+	Gemm(true, false, output_depth, filter_length, positions,
+		(Real)1, chain_gradients, output_depth, col_buffer.Begin(), filter_length,
+		(Real)0, filter_gradients.Begin(), filter_length);
+	ScatterFilterGradients();
+	
+	// gradient wrt input columns: (positions x output_depth) * (output_depth x filter_length)
+	SetBufferCount(col_gradients, positions * filter_length);
+	Gemm(false, false, positions, filter_length, output_depth,
+		(Real)1, chain_gradients, output_depth, filter_rows, filter_length,
+		(Real)0, col_gradients.Begin(), filter_length);
+	
+	Real* input_gradients = input.GetGradients().Begin();
+	for (int b = 0; b < batch; b++)
+		Col2Im(col_gradients.Begin() + b * sample_positions * filter_length,
+			input.GetWidth(), input.GetHeight(), input.GetDepth(),
+			filter_width, filter_height, stride, pad, output_width, output_height,
+			input_gradients + b * input.GetLength());
+}
+
 String LayerBase::ToStringConv() const {
 	return Format("Conv: w:%d, h:%d, d:%d, bias-pref:%2!,n, filters:%d l1-decay:%2!,n l2-decay:%2!,n stride:%d pad:%d",
 		width, height, input_depth, bias_pref, filter_count, l1_decay_mul, l2_decay_mul, stride, pad);
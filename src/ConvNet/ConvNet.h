@@ -67,21 +67,28 @@
 */
 
 #include "Utilities.h"
+#include "Gemm.h"
+#include "Attention.h"
+#include "GGUF.h"
+#include "Quantize.h"
 #include "Net.h"
 #include "LayerBase.h"
 #include "Training.h"
 #include "Session.h"
 #include "MetaSession.h"
+#include "ReplayBuffer.h"
 #include "Brain.h"
 #include "Agent.h"
+#include "Environment.h"
 #include "Recurrent.h"
 #include "RecurrentSession.h"
 #include "MemoryPool.h"
 #include "RuntimeFlexibility.h"
 #include "CrtpLayers.h"
 #include "Tokenization.h"
-// #include "TransformerLayers.h"  // Temporarily removed due to build issues
-// #include "GptLayers.h"          // Temporarily removed due to build issues
+#include "TransformerLayers.h"
+#include "GptLayers.h"
+#include "GenerationScheduler.h"
 // #include "ParallellaSupport.h"  // Temporarily removed due to build issues
 #include "MagicNet.h"
 
@@ -0,0 +1,180 @@
+#include "ConvNet.h"
+#include <chrono>
+
+namespace ConvNet {
+
+static int64 GetNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// splitmix64: the random numbers of the loader only depend on the seed, and not on the thread
+static inline uint64 MixSeed(uint64 x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+void DataLoader::LoadBatch(const SessionData& d, const int* order, int begin, int count, bool train_regression,
+                           int crop, bool fliplr, uint64 seed, Volume& sample, Volume& xb,
+                           Vector<double>& target, Vector<int>& labels, Vector<double>& rewards) {
+	target.SetCount(0);
+	labels.SetCount(0);
+	rewards.SetCount(0);
+
+	for(int b = 0; b < count; b++) {
+		int i = order ? order[begin + b] : begin + b;
+		d.GetSample(i, sample);
+
+		if (b == 0) {
+			if (crop)
+				xb.SetSize(crop, crop, sample.GetDepth(), count);
+			else
+				xb.SetSize(sample.GetWidth(), sample.GetHeight(), sample.GetDepth(), count);
+		}
+
+		if (crop) {
+			// a random crop, which is flipped horizontally with the probability of 0.5
+			uint64 rx = MixSeed(seed + b), ry = MixSeed(rx);
+			int dx = sample.GetWidth() > crop ? (int)(rx % (sample.GetWidth() - crop)) : 0;
+			int dy = sample.GetHeight() > crop ? (int)(ry % (sample.GetHeight() - crop)) : 0;
+			xb.SetAugmentedSample(b, sample, dx, dy, fliplr && (ry >> 63));
+		}
+		else
+			xb.SetSample(b, sample);
+
+		// trainers take the regression targets in double precision
+		if (train_regression) {
+			int length = xb.GetLength();
+			const Real* w = xb.GetWeights().Begin() + b * length;
+			for(int j = 0; j < length; j++)
+				target.Add(w[j]);
+		}
+		else if (d.is_data_result)
+			d.AddResult(i, target);
+		else {
+			labels.Add(d.GetLabel(i));
+			rewards.Add(1.0);
+		}
+	}
+}
+
+void DataLoader::Begin(const SessionData& d, int batch_size, int epoch, bool train_regression) {
+	ASSERT(depth > 0);
+	End();
+
+	data = &d;
+	this->batch_size = max(1, batch_size);
+	this->train_regression = train_regression;
+	int count = d.GetDataCount();
+	batch_count = (count + this->batch_size - 1) / this->batch_size;
+	epoch_seed = MixSeed(((uint64)seed << 32) ^ (uint64)epoch);
+
+	order.SetCount(count);
+	for(int i = 0; i < count; i++)
+		order[i] = i;
+	if (shuffle) {
+		uint64 r = epoch_seed;
+		for(int i = count - 1; i > 0; i--) {
+			r = MixSeed(r);
+			Swap(order[i], order[(int)(r % (uint64)(i + 1))]);
+		}
+	}
+
+	slots.SetCount(depth);
+	for(int i = 0; i < slots.GetCount(); i++)
+		slots[i].ready = false;
+	next = 0;
+	consumed = 0;
+	released = 0;
+	stop = false;
+	running = true;
+
+	workers.SetCount(worker_count);
+	for(int i = 0; i < workers.GetCount(); i++) {
+		Worker& w = workers[i];
+		if (count > 0)
+			w.sample.SetSize(d.GetDataWidth(), d.GetDataHeight(), d.GetDataDepth());
+		w.thread.Run([this, &w] {Run(w);});
+	}
+}
+
+void DataLoader::Run(Worker& w) {
+	lock.Enter();
+	while (!stop && next < batch_count) {
+		// the slot of the batch is free after the caller has released the batch depth
+		// batches before it
+		if (next >= released + depth) {
+			free_cond.Wait(lock);
+			continue;
+		}
+		int index = next++;
+		LoaderBatch& b = slots[index % depth].batch;
+		lock.Leave();
+
+		int64 begin = GetNanoseconds();
+		int i0 = index * batch_size;
+		b.index = index;
+		b.count = min(batch_size, order.GetCount() - i0);
+		LoadBatch(*data, order.Begin(), i0, b.count, train_regression, crop, flip,
+		          MixSeed(epoch_seed + (uint64)i0), w.sample, b.x, b.target, b.labels, b.rewards);
+		int64 elapsed = GetNanoseconds() - begin;
+
+		lock.Enter();
+		slots[index % depth].ready = true;
+		load_ns += elapsed;
+		loaded_count++;
+		ready_cond.Broadcast();
+	}
+	lock.Leave();
+}
+
+LoaderBatch& DataLoader::Get() {
+	ASSERT(running && consumed == released && consumed < batch_count);
+	Slot& s = slots[consumed % depth];
+	lock.Enter();
+	if (!s.ready) {
+		int64 begin = GetNanoseconds();
+		while (!s.ready)
+			ready_cond.Wait(lock);
+		stall_ns += GetNanoseconds() - begin;
+		stall_count++;
+	}
+	consumed++;
+	lock.Leave();
+	return s.batch;
+}
+
+void DataLoader::Release() {
+	ASSERT(running && released + 1 == consumed);
+	lock.Enter();
+	slots[released % depth].ready = false;
+	released++;
+	free_cond.Broadcast();
+	lock.Leave();
+}
+
+void DataLoader::End() {
+	if (!running)
+		return;
+	lock.Enter();
+	stop = true;
+	free_cond.Broadcast();
+	lock.Leave();
+	for(int i = 0; i < workers.GetCount(); i++)
+		workers[i].thread.Wait();
+	running = false;
+	data = NULL;
+}
+
+void DataLoader::ResetStats() {
+	lock.Enter();
+	stall_ns = 0;
+	load_ns = 0;
+	stall_count = 0;
+	loaded_count = 0;
+	lock.Leave();
+}
+
+}
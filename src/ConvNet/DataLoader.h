@@ -0,0 +1,103 @@
+#ifndef _ConvNet_DataLoader_h_
+#define _ConvNet_DataLoader_h_
+
+#include "SessionData.h"
+
+namespace ConvNet {
+
+// One mini-batch of the DataLoader
+struct LoaderBatch {
+	Volume x;
+	Vector<double> target;
+	Vector<int> labels;
+	Vector<double> rewards;
+	int index = -1;		// of the batch in the epoch
+	int count = 0;		// samples
+};
+
+// Loads the mini-batches of one epoch in worker threads, while the caller trains the previous
+// ones. The workers decode the samples (see SessionData::GetSample), crop and flip them into a
+// ring of depth preallocated batches, so that after the first epoch no memory is allocated.
+// The batches are given to the caller in order, and the samples of a batch don't depend on
+// the worker count: the order of the epoch and the random crops are derived from the seed,
+// the epoch and the batch index.
+//
+// Get blocks until the next batch is ready, and the time spent there is the stall time. If it
+// is a large part of the training time, the training is input-bound.
+class DataLoader {
+	struct Slot {
+		LoaderBatch batch;
+		bool ready = false;
+	};
+	struct Worker {
+		Thread thread;
+		Volume sample;
+	};
+
+	Array<Slot> slots;
+	Array<Worker> workers;
+	Vector<int> order;
+	const SessionData* data = NULL;
+	Mutex lock;
+	ConditionVariable ready_cond, free_cond;
+	uint64 epoch_seed = 0;
+	int depth = 0;
+	int worker_count = 1;
+	int crop = 0;
+	int batch_size = 1;
+	int batch_count = 0;
+	int next = 0;		// the next batch to be loaded
+	int consumed = 0;	// the batches given to the caller
+	int released = 0;	// the batches given back by the caller
+	dword seed = 0;
+	bool flip = false;
+	bool shuffle = false;
+	bool train_regression = false;
+	bool running = false;
+	bool stop = false;
+
+	// statistics
+	int64 stall_ns = 0, load_ns = 0;
+	int stall_count = 0, loaded_count = 0;
+
+	void Run(Worker& w);
+
+public:
+	typedef DataLoader CLASSNAME;
+	DataLoader() {}
+	~DataLoader() {End();}
+
+	DataLoader& SetDepth(int i) {ASSERT(!running); depth = max(0, i); return *this;} // 0 disables the loader
+	DataLoader& SetWorkerCount(int i) {ASSERT(!running); worker_count = max(1, i); return *this;}
+	DataLoader& SetShuffle(bool b=true) {shuffle = b; return *this;} // reshuffles every epoch
+	DataLoader& SetAugmentation(int crop, bool fliplr=false) {this->crop = crop; flip = fliplr; return *this;}
+	DataLoader& SetSeed(dword i) {seed = i; return *this;}
+
+	void Begin(const SessionData& d, int batch_size, int epoch, bool train_regression);
+	LoaderBatch& Get();
+	void Release();
+	void End();
+
+	int GetDepth() const {return depth;}
+	int GetWorkerCount() const {return worker_count;}
+	int GetBatchCount() const {return batch_count;}
+	bool IsEnabled() const {return depth > 0;}
+	bool IsRunning() const {return running;}
+	bool IsShuffle() const {return shuffle;}
+
+	double GetStallSeconds() const {return stall_ns * 1e-9;}	// waited by the caller
+	double GetLoadSeconds() const {return load_ns * 1e-9;}		// worked by the workers
+	int GetStallCount() const {return stall_count;}
+	int GetLoadedCount() const {return loaded_count;}
+	void ResetStats();
+
+	// Loads the samples begin ... begin + count - 1 of the order (or of the data, if order is
+	// NULL) to xb. The crop and flip of every sample is taken from the seed.
+	static void LoadBatch(const SessionData& d, const int* order, int begin, int count, bool train_regression,
+	                      int crop, bool fliplr, uint64 seed, Volume& sample, Volume& xb,
+	                      Vector<double>& target, Vector<int>& labels, Vector<double>& rewards);
+};
+
+}
+
+#endif
@@ -0,0 +1,183 @@
+#include "ConvNet.h"
+
+namespace ConvNet {
+
+void DataStore::Init(int type, int count, int length) {
+	ASSERT(type >= DATA_U8 && type <= DATA_F32 && count >= 0 && length >= 0);
+	this->type = type;
+	this->count = count;
+	this->length = length;
+	scale.SetCount(0);
+	scale.SetCount(length, 1.0f);
+	offset.SetCount(0);
+	offset.SetCount(length, 0.0f);
+	buffer.Clear();
+	data = NULL;
+}
+
+void DataStore::Create(int type, int count, int length) {
+	Init(type, count, length);
+	if (GetByteCount() > INT_MAX)
+		throw Exc("DataStore: the elements don't fit in memory");
+	buffer.SetCount((int)GetByteCount(), 0);
+	data = buffer.Begin();
+}
+
+void DataStore::Clear() {
+	buffer.Clear();
+	scale.Clear();
+	offset.Clear();
+	data = NULL;
+	count = 0;
+	length = 0;
+}
+
+// The elements aren't part of the header: the owner of the store saves and maps them.
+void DataStore::SerializeHeader(Stream& s) {
+	s % type % count % length % scale % offset;
+	if (s.IsLoading() && (type < DATA_U8 || type > DATA_F32 || count < 0 || length < 0 ||
+		scale.GetCount() != length || offset.GetCount() != length))
+		s.LoadError();
+}
+
+DataStore& DataStore::SetColumn(int col, double scale, double offset) {
+	this->scale[col] = (float)scale;
+	this->offset[col] = (float)offset;
+	return *this;
+}
+
+// Writes the element pos of data, which has the column scale and offset
+static void EncodeValue(int type, byte* data, int64 pos, double value, float scale, float offset) {
+	double x = scale != 0 ? (value - offset) / scale : 0.0;
+	switch (type) {
+		case DATA_U8:	data[pos] = (byte)minmax((int)floor(x + 0.5), 0, 255); break;
+		case DATA_F16:	((word*)data)[pos] = DataStore::FloatToHalf((float)x); break;
+		case DATA_F32:	((float*)data)[pos] = (float)x; break;
+	}
+}
+
+void DataStore::Set(int i, int col, double value) {
+	ASSERT(!IsView() && !buffer.IsEmpty() && i >= 0 && i < count && col >= 0 && col < length);
+	EncodeValue(type, buffer.Begin(), (int64)i * length + col, value, scale[col], offset[col]);
+}
+
+void DataStore::Set(int i, const Vector<double>& values) {
+	ASSERT(values.GetCount() == length);
+	for(int j = 0; j < length; j++)
+		Set(i, j, values[j]);
+}
+
+void DataStore::Encode(const Vector<double>& values, byte* out) const {
+	ASSERT(values.GetCount() == length);
+	for(int j = 0; j < length; j++)
+		EncodeValue(type, out, j, values[j], scale[j], offset[j]);
+}
+
+double DataStore::Get(int i, int col) const {
+	ASSERT(i >= 0 && i < count && col >= 0 && col < length);
+	int64 pos = (int64)i * length + col;
+	double x = 0;
+	switch (type) {
+		case DATA_U8:	x = data[pos]; break;
+		case DATA_F16:	x = HalfToFloat(((const word*)data)[pos]); break;
+		case DATA_F32:	x = ((const float*)data)[pos]; break;
+	}
+	return offset[col] + scale[col] * x;
+}
+
+template <class T>
+static void DecodeSample(int type, const byte* data, int64 pos, int length, const float* scale, const float* offset, T* out) {
+	switch (type) {
+		case DATA_U8: {
+			const byte* s = data + pos;
+			for(int j = 0; j < length; j++)
+				out[j] = (T)(offset[j] + scale[j] * s[j]);
+			break;
+		}
+		case DATA_F16: {
+			const word* s = (const word*)data + pos;
+			for(int j = 0; j < length; j++)
+				out[j] = (T)(offset[j] + scale[j] * DataStore::HalfToFloat(s[j]));
+			break;
+		}
+		case DATA_F32: {
+			const float* s = (const float*)data + pos;
+			for(int j = 0; j < length; j++)
+				out[j] = (T)(offset[j] + scale[j] * s[j]);
+			break;
+		}
+	}
+}
+
+void DataStore::GetSample(int i, Real* out) const {
+	ASSERT(i >= 0 && i < count);
+	DecodeSample(type, data, (int64)i * length, length, scale.Begin(), offset.Begin(), out);
+}
+
+void DataStore::GetSample(int i, Vector<double>& out) const {
+	ASSERT(i >= 0 && i < count);
+	out.SetCount(length);
+	DecodeSample(type, data, (int64)i * length, length, scale.Begin(), offset.Begin(), out.Begin());
+}
+
+// Rounds to the nearest even half, and overflows to infinity.
+word DataStore::FloatToHalf(float f) {
+	dword x;
+	memcpy(&x, &f, sizeof(x));
+	dword sign = (x >> 16) & 0x8000;
+	dword mant = x & 0x7fffff;
+	int e = (x >> 23) & 0xff;
+	if (e == 0xff)
+		return (word)(sign | 0x7c00 | (mant ? 0x200 : 0));
+	int exp = e - 127 + 15;
+	if (exp >= 31)
+		return (word)(sign | 0x7c00);
+	if (exp <= 0) {
+		// subnormal half
+		if (exp < -10)
+			return (word)sign;
+		mant |= 0x800000;
+		int shift = 14 - exp;
+		dword h = mant >> shift;
+		dword rem = mant & ((1u << shift) - 1);
+		dword half = 1u << (shift - 1);
+		if (rem > half || (rem == half && (h & 1)))
+			h++;
+		return (word)(sign | h);
+	}
+	dword h = ((dword)exp << 10) | (mant >> 13);
+	dword rem = mant & 0x1fff;
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1)))
+		h++; // a carry into the exponent is still the correct rounding
+	return (word)(sign | h);
+}
+
+float DataStore::HalfToFloat(word h) {
+	dword sign = (dword)(h & 0x8000) << 16;
+	int exp = (h >> 10) & 0x1f;
+	dword mant = h & 0x3ff;
+	dword x;
+	if (exp == 0) {
+		if (mant == 0)
+			x = sign;
+		else {
+			// normalize the subnormal half
+			exp = 1;
+			while (!(mant & 0x400)) {
+				mant <<= 1;
+				exp--;
+			}
+			mant &= 0x3ff;
+			x = sign | ((dword)(exp + 127 - 15) << 23) | (mant << 13);
+		}
+	}
+	else if (exp == 31)
+		x = sign | 0x7f800000 | (mant << 13);
+	else
+		x = sign | ((dword)(exp + 127 - 15) << 23) | (mant << 13);
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+}
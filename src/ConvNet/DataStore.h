@@ -0,0 +1,62 @@
+#ifndef _ConvNet_DataStore_h_
+#define _ConvNet_DataStore_h_
+
+namespace ConvNet {
+
+// Element types of DataStore
+enum {
+	DATA_U8,	// 1 byte, quantized with the column scale and offset
+	DATA_F16,	// IEEE half precision
+	DATA_F32	// IEEE single precision
+};
+
+// Contiguous storage of count samples of length values each. The samples are stored one
+// after another, and every column (value index of the sample) has its own scale and
+// offset, so that the value is offset + scale * element. With DATA_U8 this keeps 8-bit
+// images in one byte per pixel, and the column range can still be anything.
+//
+// The elements are either owned by the store or viewed in external memory, usually a
+// memory mapped file (see SessionData::OpenMapped). A view is read only. Owned elements
+// are limited to 2 GB; larger stores are written sample by sample with Encode instead.
+class DataStore {
+	Vector<byte> buffer;
+	const byte* data = NULL;
+	Vector<float> scale, offset;
+	int type = DATA_F32;
+	int count = 0;
+	int length = 0;
+
+public:
+	DataStore() {}
+
+	void Init(int type, int count, int length); // the header only, without elements
+	void Create(int type, int count, int length);
+	void Clear();
+	void SetView(const byte* p) {buffer.Clear(); data = p;}
+	void SerializeHeader(Stream& s);
+
+	DataStore& SetColumn(int col, double scale, double offset);
+	void Set(int i, int col, double value);
+	void Set(int i, const Vector<double>& values);
+	void Encode(const Vector<double>& values, byte* out) const; // one sample, GetSampleBytes()
+	double Get(int i, int col) const;
+	void GetSample(int i, Real* out) const;
+	void GetSample(int i, Vector<double>& out) const;
+
+	int GetType() const {return type;}
+	int GetCount() const {return count;}
+	int GetLength() const {return length;}
+	int GetElementSize() const {return type == DATA_U8 ? 1 : type == DATA_F16 ? 2 : 4;}
+	int GetSampleBytes() const {return length * GetElementSize();}
+	int64 GetByteCount() const {return (int64)count * length * GetElementSize();}
+	const byte* GetData() const {return data;}
+	bool IsView() const {return data && buffer.IsEmpty();}
+	bool IsEmpty() const {return count == 0;}
+
+	static word  FloatToHalf(float f);
+	static float HalfToFloat(word h);
+};
+
+}
+
+#endif
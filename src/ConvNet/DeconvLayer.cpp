@@ -36,12 +36,9 @@ void LayerBase::InitDeconv(int input_width, int input_height, int input_depth) {
 }
 
 
-Volume& LayerBase::ForwardDeconv(Volume& input, bool is_training) {
-	// optimized code by @mdda that achieves 2x speedup over previous version
-	
-	input_activation = &input;
-	output_activation.Init(output_width, output_height, output_depth, 0.0);
-	
+// Fills ghost_image with the given sample of the input: the input is upsampled by the stride with
+// linear interpolation and its borders are extended by the edge values.
+void LayerBase::DeconvGhostImage(const Volume& input, int sample) {
 	int volume_width = input.GetWidth();
 	int volume_height = input.GetHeight();
 	int volume_depth = input.GetDepth();
@@ -55,7 +52,6 @@ Volume& LayerBase::ForwardDeconv(Volume& input, bool is_training) {
 	int ghost_w = g_width + gpad_w * 2;
 	int ghost_h = g_height + gpad_h * 2;
 	ghost_image.SetSize(ghost_w, ghost_h, volume_depth);
-	ghost_gradients.SetSize(ghost_w, ghost_h, volume_depth);
 	
 	double div_tmp[36];
 	for(int i = 0; i <= stride; i++)
@@ -70,10 +66,10 @@ Volume& LayerBase::ForwardDeconv(Volume& input, bool is_training) {
 			
 			// Write horizontal lines
 			double a, b;
-			b = input.Get(0, y, d);
+			b = input.Get(sample, 0, y, d);
 			for (int x = 0; x < volume_width-1; x++) {
 				a = b;
-				b = input.Get(x+1, y, d);
+				b = input.Get(sample, x+1, y, d);
 				
 				for (int i = 0; i < stride; i++) {
 					double f = div_tmp[i];
@@ -183,29 +179,41 @@ Volume& LayerBase::ForwardDeconv(Volume& input, bool is_training) {
 			}
 		}
 	}
+}
+
+Volume& LayerBase::ForwardDeconv(Volume& input, bool is_training) {
+	// optimized code by @mdda that achieves 2x speedup over previous version
 	
-	for (int depth = 0; depth < output_depth; depth++)
-	{
-		const Volume& filter = filters[depth];
+	input_activation = &input;
+	int batch = input.GetBatch();
+	output_activation.SetSize(output_width, output_height, output_depth, batch);
+	
+	for (int b = 0; b < batch; b++) {
+		DeconvGhostImage(input, b);
 		
-		for (int ay = 0; ay < output_height; ay++) {
+		for (int depth = 0; depth < output_depth; depth++)
+		{
+			const Volume& filter = filters[depth];
 			
-			for (int ax = 0; ax < output_width; ax++) {
+			for (int ay = 0; ay < output_height; ay++) {
 				
-				// convolve centered at this particular location
-				double a = 0.0;
-				for (int fy = 0; fy < filter.GetHeight(); fy++) {
-					for (int fx = 0; fx < filter.GetWidth(); fx++) {
-						for (int fd = 0; fd < filter.GetDepth(); fd++) {
-							int i = ghost_image.GetPos(ax + fx, ay + fy, fd);
-							if (i < ghost_image.GetCount())
-								a += filter.Get(fx, fy, fd) * ghost_image.Get(i);
+				for (int ax = 0; ax < output_width; ax++) {
+					
+					// convolve centered at this particular location
+					double a = 0.0;
+					for (int fy = 0; fy < filter.GetHeight(); fy++) {
+						for (int fx = 0; fx < filter.GetWidth(); fx++) {
+							for (int fd = 0; fd < filter.GetDepth(); fd++) {
+								int i = ghost_image.GetPos(ax + fx, ay + fy, fd);
+								if (i < ghost_image.GetCount())
+									a += filter.Get(fx, fy, fd) * ghost_image.Get(i);
+							}
 						}
 					}
+					
+					a += biases.Get(depth);
+					output_activation.Set(b, ax, ay, depth, a);
 				}
-				
-				a += biases.Get(depth);
-				output_activation.Set(ax, ay, depth, a);
 			}
 		}
 	}
@@ -230,174 +238,182 @@ double LayerBase::BackwardDeconv() {
 	int ghost_h = g_height + gpad_h * 2;
 	
 	input.ZeroGradients(); // zero out gradient wrt bottom data, we're about to fill it
-	ghost_gradients.Zero();
+	ghost_gradients.SetSize(ghost_w, ghost_h, volume_depth);
+	int batch = output_activation.GetBatch();
 	
-	for (int depth = 0; depth < output_depth; depth++)
-	{
-		Volume& filter = filters[depth];
+	double div_tmp[36];
+	for(int i = 0; i <= stride; i++)
+		div_tmp[i] = (double)i / (double)stride;
+	
+	// go backwards, because the ghost image of the last sample is still there from the forward pass
+	for (int b = batch - 1; b >= 0; b--) {
+		if (b != batch - 1)
+			DeconvGhostImage(input, b);
+		ghost_gradients.Zero();
 		
-		for (int ay = 0; ay < output_height; ay++) {
+		for (int depth = 0; depth < output_depth; depth++)
+		{
+			Volume& filter = filters[depth];
 			
-			for (int ax = 0; ax < output_width; ax++) {
-				
-				// convolve centered at this particular location
-				double chain_gradient_ = output_activation.GetGradient(ax, ay, depth);
-				ASSERT(IsFin(chain_gradient_));
+			for (int ay = 0; ay < output_height; ay++) {
 				
-				// gradient from above, from chain rule
-				for (int fy = 0; fy < filter.GetHeight(); fy++) {
-					for (int fx = 0; fx < filter.GetWidth(); fx++) {
-						for (int fd = 0; fd < filter.GetDepth(); fd++) {
-							int i = ghost_image.GetPos(ax + fx, ay + fy, fd);
-							if (i < ghost_image.GetCount()) {
-								double v = ghost_image.Get(i);
-								double filter_gradient = v * chain_gradient_;
-								filter.AddGradient(fx, fy, fd, filter_gradient);
-								
-								double input_gradient = filter.Get(fx, fy, fd) * chain_gradient_;
-								ghost_gradients.Add(ax + fx, ay + fy, fd, input_gradient);
+				for (int ax = 0; ax < output_width; ax++) {
+					
+					// convolve centered at this particular location
+					double chain_gradient_ = output_activation.GetGradient(b, ax, ay, depth);
+					ASSERT(IsFin(chain_gradient_));
+					
+					// gradient from above, from chain rule
+					for (int fy = 0; fy < filter.GetHeight(); fy++) {
+						for (int fx = 0; fx < filter.GetWidth(); fx++) {
+							for (int fd = 0; fd < filter.GetDepth(); fd++) {
+								int i = ghost_image.GetPos(ax + fx, ay + fy, fd);
+								if (i < ghost_image.GetCount()) {
+									double v = ghost_image.Get(i);
+									double filter_gradient = v * chain_gradient_;
+									filter.AddGradient(fx, fy, fd, filter_gradient);
+									
+									double input_gradient = filter.Get(fx, fy, fd) * chain_gradient_;
+									ghost_gradients.Add(ax + fx, ay + fy, fd, input_gradient);
+								}
 							}
 						}
 					}
+					
+					biases.AddGradient(depth, chain_gradient_);
 				}
-				
-				biases.AddGradient(depth, chain_gradient_);
 			}
+			
 		}
 		
-	}
-	
-	
-	double div_tmp[36];
-	for(int i = 0; i <= stride; i++)
-		div_tmp[i] = (double)i / (double)stride;
-	
-	for (int d = 0; d < volume_depth; d++) {
 		
-		// Right border gradient
-		{
-			int x_shift = gpad_w + g_width;
-			for (int y = 0; y < g_height; y++) {
-				int gy = gpad_h + y;
-				for (int i = 0; i < gpad_w; i++) {
-					double v = ghost_gradients.Get(x_shift + i, gy, d);
-					ghost_gradients.Add(x_shift-1, gy, d, v);
+		for (int d = 0; d < volume_depth; d++) {
+			
+			// Right border gradient
+			{
+				int x_shift = gpad_w + g_width;
+				for (int y = 0; y < g_height; y++) {
+					int gy = gpad_h + y;
+					for (int i = 0; i < gpad_w; i++) {
+						double v = ghost_gradients.Get(x_shift + i, gy, d);
+						ghost_gradients.Add(x_shift-1, gy, d, v);
+					}
 				}
 			}
-		}
-		// Left border gradient
-		{
-			for (int y = 0; y < g_height; y++) {
-				int gy = gpad_h + y;
-				for (int i = 0; i < gpad_w; i++) {
-					double v = ghost_gradients.Get(i, gy, d);
-					ghost_gradients.Add(gpad_w, gy, d, v);
+			// Left border gradient
+			{
+				for (int y = 0; y < g_height; y++) {
+					int gy = gpad_h + y;
+					for (int i = 0; i < gpad_w; i++) {
+						double v = ghost_gradients.Get(i, gy, d);
+						ghost_gradients.Add(gpad_w, gy, d, v);
+					}
 				}
 			}
-		}
-		// Bottom border gradient
-		{
-			int y_shift = gpad_h + g_height;
-			for (int x = 0; x < g_width; x++) {
-				int gx = gpad_w + x;
-				for (int i = 0; i < gpad_h; i++) {
-					double v = ghost_gradients.Get(gx, y_shift + i, d);
-					ghost_gradients.Add(gx, y_shift-1, d, v);
+			// Bottom border gradient
+			{
+				int y_shift = gpad_h + g_height;
+				for (int x = 0; x < g_width; x++) {
+					int gx = gpad_w + x;
+					for (int i = 0; i < gpad_h; i++) {
+						double v = ghost_gradients.Get(gx, y_shift + i, d);
+						ghost_gradients.Add(gx, y_shift-1, d, v);
+					}
 				}
 			}
-		}
-		// Top border gradient
-		{
-			for (int x = 0; x < g_width; x++) {
-				int gx = gpad_w + x;
-				for (int i = 0; i < gpad_h; i++) {
-					double v = ghost_gradients.Get(gx, i, d);
-					ghost_gradients.Add(gx, gpad_h, d, v);
+			// Top border gradient
+			{
+				for (int x = 0; x < g_width; x++) {
+					int gx = gpad_w + x;
+					for (int i = 0; i < gpad_h; i++) {
+						double v = ghost_gradients.Get(gx, i, d);
+						ghost_gradients.Add(gx, gpad_h, d, v);
+					}
 				}
 			}
-		}
-		// Bottom-right corner
-		{
-			int x_shift = gpad_w + g_width;
-			int y_shift = gpad_h + g_height;
-			for (int x = 0; x < gpad_w; x++) {
-				for (int y = 0; y < gpad_h; y++) {
-					double v = ghost_gradients.Get(x_shift + x, y_shift + y, d);
-					ghost_gradients.Add(x_shift-1, y_shift-1, d, v);
+			// Bottom-right corner
+			{
+				int x_shift = gpad_w + g_width;
+				int y_shift = gpad_h + g_height;
+				for (int x = 0; x < gpad_w; x++) {
+					for (int y = 0; y < gpad_h; y++) {
+						double v = ghost_gradients.Get(x_shift + x, y_shift + y, d);
+						ghost_gradients.Add(x_shift-1, y_shift-1, d, v);
+					}
 				}
 			}
-		}
-		// Bottom-left corner
-		{
-			int y_shift = gpad_h + g_height;
-			for (int x = 0; x < gpad_w; x++) {
-				for (int y = 0; y < gpad_h; y++) {
-					double v = ghost_gradients.Get(x, y_shift + y, d);
-					ghost_gradients.Add(gpad_w, y_shift-1, d, v);
+			// Bottom-left corner
+			{
+				int y_shift = gpad_h + g_height;
+				for (int x = 0; x < gpad_w; x++) {
+					for (int y = 0; y < gpad_h; y++) {
+						double v = ghost_gradients.Get(x, y_shift + y, d);
+						ghost_gradients.Add(gpad_w, y_shift-1, d, v);
+					}
 				}
 			}
-		}
-		// Right-upper corner
-		{
-			int x_shift = gpad_w + g_width;
-			for (int x = 0; x < gpad_w; x++) {
-				for (int y = 0; y < gpad_h; y++) {
-					double v = ghost_gradients.Get(x_shift + x, y, d);
-					ghost_gradients.Add(x_shift-1, gpad_h, d, v);
+			// Right-upper corner
+			{
+				int x_shift = gpad_w + g_width;
+				for (int x = 0; x < gpad_w; x++) {
+					for (int y = 0; y < gpad_h; y++) {
+						double v = ghost_gradients.Get(x_shift + x, y, d);
+						ghost_gradients.Add(x_shift-1, gpad_h, d, v);
+					}
 				}
 			}
-		}
-		// Left-upper corner
-		{
-			for (int x = 0; x < gpad_w; x++) {
-				for (int y = 0; y < gpad_w; y++) {
-					double v = ghost_gradients.Get(x, y, d);
-					ghost_gradients.Add(gpad_w, gpad_h, d, v);
+			// Left-upper corner
+			{
+				for (int x = 0; x < gpad_w; x++) {
+					for (int y = 0; y < gpad_w; y++) {
+						double v = ghost_gradients.Get(x, y, d);
+						ghost_gradients.Add(gpad_w, gpad_h, d, v);
+					}
 				}
 			}
-		}
-		// Area between horizontal lines
-		if (stride > 1) {
-			for (int y = 0; y < volume_height - 1; y++) {
+			// Area between horizontal lines
+			if (stride > 1) {
+				for (int y = 0; y < volume_height - 1; y++) {
+					int gx = gpad_w;
+					int gy = gpad_h + y * stride;
+				
+					for (int x = 0; x < g_width; x++) {
+						for (int i = 1; i < stride; i++) {
+							double f = div_tmp[i];
+							double v = ghost_gradients.Get(gx, gy + i, d);
+							double a = v * (1.0 - f);
+							double bv = v * f;
+							ghost_gradients.Add(gx, gy, d, a);
+							ghost_gradients.Add(gx, gy + stride, d, bv);
+						}
+						
+						gx++;
+					}
+					
+				}
+			}
+			// Horizontal lines
+			for (int y = 0; y < volume_height; y++) {
 				int gx = gpad_w;
 				int gy = gpad_h + y * stride;
-			
-				for (int x = 0; x < g_width; x++) {
-					for (int i = 1; i < stride; i++) {
+				
+				// Write horizontal lines
+				for (int x = 0; x < volume_width-1; x++) {
+					for (int i = 0; i < stride; i++) {
 						double f = div_tmp[i];
-						double v = ghost_gradients.Get(gx, gy + i, d);
+						double v = ghost_gradients.Get(gx, gy, d);
 						double a = v * (1.0 - f);
-						double b = v * f;
-						ghost_gradients.Add(gx, gy, d, a);
-						ghost_gradients.Add(gx, gy + stride, d, b);
+						double bv = v * f;
+						input.AddGradient(b, x, y, d, a);
+						input.AddGradient(b, x+1, y, d, bv);
+						gx++;
 					}
-					
-					gx++;
 				}
-				
+				double v = ghost_gradients.Get(gx, gy, d);
+				input.AddGradient(b, volume_width-1, y, d, v);
 			}
-		}
-		// Horizontal lines
-		for (int y = 0; y < volume_height; y++) {
-			int gx = gpad_w;
-			int gy = gpad_h + y * stride;
 			
-			// Write horizontal lines
-			for (int x = 0; x < volume_width-1; x++) {
-				for (int i = 0; i < stride; i++) {
-					double f = div_tmp[i];
-					double v = ghost_gradients.Get(gx, gy, d);
-					double a = v * (1.0 - f);
-					double b = v * f;
-					input.AddGradient(x, y, d, a);
-					input.AddGradient(x+1, y, d, b);
-					gx++;
-				}
-			}
-			double v = ghost_gradients.Get(gx, gy, d);
-			input.AddGradient(volume_width-1, y, d, v);
 		}
-		
 	}
 	
 	return 0.0;
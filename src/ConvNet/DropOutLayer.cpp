@@ -17,13 +17,14 @@ void LayerBase::InitDropOut(int input_width, int input_height, int input_depth)
 
 Volume& LayerBase::ForwardDropOut(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation = input;
+	output_activation.SetWeights(input);
 	Volume& output = output_activation;
 	
-	int length = input.GetLength();
+	int length = input.GetCount();
 	
 	if (is_training) {
 		// do dropout
+		SetBufferCount(dropped, length);
 		for (int i = 0; i < length; i++) {
 			if (Randomf() < drop_prob) {
 				output.Set(i, 0);
@@ -48,7 +49,7 @@ void LayerBase::BackwardDropOut() {
 	Volume& input = *input_activation; // we need to set dw of this
 	Volume& output = output_activation;
 	
-	int length = input.GetLength();
+	int length = input.GetCount();
 	input.ZeroGradients(); // zero out gradient wrt data
 	
 	for (int i = 0; i < length; i++) {
@@ -0,0 +1,467 @@
+#include "ConvNet.h"
+
+namespace ConvNet {
+
+void PuckWorldEnvironment::Reset() {
+	ppx = Randomf(); // puck x,y
+	ppy = Randomf();
+	pvx = Randomf() * 0.05 - 0.025; // velocity
+	pvy = Randomf() * 0.05 - 0.025;
+	tx  = Randomf(); // target
+	ty  = Randomf();
+	tx2 = Randomf(); // target
+	ty2 = Randomf(); // target
+	rad = 0.05;
+	t = 0;
+	
+	BADRAD = 0.25;
+}
+
+void PuckWorldEnvironment::GetState(Vector<double>& slist) {
+	slist.SetCount(8);
+	slist[0] = ppx - 0.5;
+	slist[1] = ppy - 0.5;
+	slist[2] = pvx * 10;
+	slist[3] = pvy * 10;
+	slist[4] = tx - ppx;
+	slist[5] = ty - ppy;
+	slist[6] = tx2 - ppx;
+	slist[7] = ty2 - ppy;
+}
+
+double PuckWorldEnvironment::Step(int action, bool& done) {
+	
+	// world dynamics
+	ppx += pvx; // newton
+	ppy += pvy;
+	pvx *= 0.95; // damping
+	pvy *= 0.95;
+	
+	// agent action influences puck velocity
+	double accel = 0.002;
+	bool gliding = false;
+	if		(action == ACT_LEFT)	pvx -= accel;
+	else if (action == ACT_RIGHT)	pvx += accel;
+	else if (action == ACT_UP)		pvy -= accel;
+	else if (action == ACT_DOWN)	pvy += accel;
+	else gliding = true;
+	
+	// handle boundary conditions and bounce
+	if (ppx < rad) {
+		pvx *= -0.5; // bounce!
+		ppx = rad;
+	}
+	if (ppx > 1 - rad) {
+		pvx *= -0.5;
+		ppx = 1 - rad;
+	}
+	if (ppy < rad) {
+		pvy *= -0.5; // bounce!
+		ppy = rad;
+	}
+	if (ppy > 1 - rad) {
+		pvy *= -0.5;
+		ppy = 1 - rad;
+	}
+	
+	t += 1;
+	
+	if ((t % 100) == 0) {
+		tx = Randomf(); // reset the target location
+		ty = Randomf();
+	}
+	
+	// compute distances
+	double dx, dy, d1, d2;
+	
+	dx = ppx - tx;
+	dy = ppy - ty;
+	d1 = sqrt(dx*dx+dy*dy);
+	
+	dx = ppx - tx2;
+	dy = ppy - ty2;
+	d2 = sqrt(dx*dx+dy*dy);
+	
+	double dxnorm = dx/d2;
+	double dynorm = dy/d2;
+	double speed = 0.001;
+	tx2 += speed * dxnorm;
+	ty2 += speed * dynorm;
+	
+	// compute reward
+	double r = -d1; // want to go close to green
+	if (d2 < BADRAD) {
+		// but if we're too close to red that's bad
+		double f = (BADRAD - d2) / BADRAD;
+		r -= 2 * f;
+	}
+	
+	if (gliding) r += 0.05; // give bonus for gliding with no force
+	
+	// the puck world never ends
+	done = false;
+	return r;
+}
+
+
+
+
+GridWorldEnvironment::GridWorldEnvironment() {
+	Init(10, 10);
+	
+	SetReward(3, 3, -1.0);
+	SetReward(5, 4, -1.0);
+	SetReward(6, 4, -1.0);
+	SetReward(5, 5, +1.0);
+	SetReward(6, 5, -1.0);
+	SetReward(8, 5, -1.0);
+	SetReward(8, 6, -1.0);
+	SetReward(3, 7, -1.0);
+	SetReward(5, 7, -1.0);
+	SetReward(6, 7, -1.0);
+	
+	// make some cliffs
+	for (int q = 0; q < 8; q++) {
+		if (q == 4) continue; // make a hole
+		SetDisabled(1+q, 2);
+	}
+	for (int q = 0; q < 6; q++) {
+		SetDisabled(4, 2+q);
+	}
+}
+
+void GridWorldEnvironment::Init(int width, int height) {
+	ASSERT(width > 0 && height > 0);
+	this->width = width;
+	this->height = height;
+	reward.SetCount(0);
+	reward.SetCount(width * height, 0.0);
+	disable.SetCount(0);
+	disable.SetCount(width * height, false);
+	start_state = 0;
+	stop_state = GetPos(width / 2, height / 2);
+	state = start_state;
+}
+
+void GridWorldEnvironment::InitAgent(Agent& agent) const {
+	agent.Init(width, height, GetActionCount());
+	agent.Reset();
+	for(int i = 0; i < reward.GetCount(); i++) {
+		agent.SetReward(i, reward[i]);
+		if (disable[i])
+			agent.SetDisabled(i % width, i / width);
+	}
+	agent.SetStartState(start_state % width, start_state / width);
+	agent.SetStopState(stop_state % width, stop_state / width);
+}
+
+void GridWorldEnvironment::SetDisabled(int x, int y, bool b) {
+	int i = GetPos(x, y);
+	disable[i] = b;
+	if (b)
+		reward[i] = 0;
+}
+
+void GridWorldEnvironment::GetState(Vector<double>& slist) {
+	slist.SetCount(0);
+	slist.SetCount(width * height, 0.0);
+	slist[state] = 1.0;
+}
+
+double GridWorldEnvironment::Step(int action, bool& done) {
+	double r = reward[state] - 0.01; // every step takes a bit of negative reward
+	done = state == stop_state;
+	if (done) {
+		// the agent wins and is teleported to the start
+		state = start_state;
+		return r;
+	}
+	int x = GetX(), y = GetY();
+	if      (action == ACT_LEFT)	x--;
+	else if (action == ACT_DOWN)	y--;
+	else if (action == ACT_UP)		y++;
+	else if (action == ACT_RIGHT)	x++;
+	if (x >= 0 && y >= 0 && x < width && y < height && !disable[GetPos(x, y)])
+		state = GetPos(x, y);
+	return r;
+}
+
+
+
+
+void WaterWorldEnvironment::AddItem() {
+	Item& it = items.Add();
+	it.x = 20 + Randomf() * (WIDTH - 40);
+	it.y = 20 + Randomf() * (HEIGHT - 40);
+	it.vx = Randomf() * 5 - 2.5;
+	it.vy = Randomf() * 5 - 2.5;
+	it.type = 1 + Random(2); // apple or poison
+	it.age = 0;
+	it.cleanup = false;
+}
+
+void WaterWorldEnvironment::Reset() {
+	items.SetCount(0);
+	for(int i = 0; i < ITEM_COUNT; i++)
+		AddItem();
+	eyes.SetCount(EYE_COUNT);
+	for(int i = 0; i < EYE_COUNT; i++)
+		eyes[i].angle = i * 0.21;
+	px = 300;
+	py = 300;
+	vx = 0;
+	vy = 0;
+	clock = 0;
+	Sense();
+}
+
+// The intersection of the segments (ax,ay)-(bx,by) and (cx,cy)-(dx,dy) at ua of the first.
+static bool IntersectLine(double ax, double ay, double bx, double by, double cx, double cy,
+	double dx, double dy, double& ua) {
+	double denom = (dy - cy) * (bx - ax) - (dx - cx) * (by - ay);
+	if (denom == 0.0)
+		return false; // parallel lines
+	ua = ((dx - cx) * (ay - cy) - (dy - cy) * (ax - cx)) / denom;
+	double ub = ((bx - ax) * (ay - cy) - (by - ay) * (ax - cx)) / denom;
+	return ua > 0.0 && ua < 1.0 && ub > 0.0 && ub < 1.0;
+}
+
+// The segment (ax,ay)-(bx,by) passes the circle at (px,py) if the closest point of the line,
+// which is at ua of the segment, is within the radius.
+static bool IntersectPoint(double ax, double ay, double bx, double by, double px, double py,
+	double rad, double& ua) {
+	double lx = bx - ax, ly = by - ay;
+	double len2 = lx * lx + ly * ly;
+	if (len2 == 0.0)
+		return false;
+	double d = fabs(lx * (ay - py) - (ax - px) * ly) / sqrt(len2);
+	if (d > rad)
+		return false;
+	ua = ((px - ax) * lx + (py - ay) * ly) / len2;
+	return ua > 0.0 && ua < 1.0;
+}
+
+void WaterWorldEnvironment::Sense() {
+	static const double walls[4][4] = {
+		{0, 0, WIDTH, 0},
+		{WIDTH, 0, WIDTH, HEIGHT + 1},
+		{WIDTH, HEIGHT, 0, HEIGHT},
+		{0, HEIGHT, 0, 0}
+	};
+	for(int i = 0; i < eyes.GetCount(); i++) {
+		Eye& e = eyes[i];
+		double max_range = 120;
+		double ex = px + max_range * sin(e.angle);
+		double ey = py + max_range * cos(e.angle);
+		double min_ua = DBL_MAX, ua;
+		e.proximity = max_range;
+		e.type = -1;
+		e.vx = 0;
+		e.vy = 0;
+		for(int j = 0; j < 4; j++) {
+			const double* w = walls[j];
+			if (IntersectLine(px, py, ex, ey, w[0], w[1], w[2], w[3], ua) && ua < min_ua) {
+				min_ua = ua;
+				e.proximity = ua * max_range;
+				e.type = 0;
+				e.vx = 0;
+				e.vy = 0;
+			}
+		}
+		for(int j = 0; j < items.GetCount(); j++) {
+			const Item& it = items[j];
+			if (IntersectPoint(px, py, ex, ey, it.x, it.y, 10, ua) && ua < min_ua) {
+				min_ua = ua;
+				e.proximity = ua * max_range;
+				e.type = it.type;
+				e.vx = it.vx;
+				e.vy = it.vy;
+			}
+		}
+	}
+}
+
+void WaterWorldEnvironment::GetState(Vector<double>& slist) {
+	int ne = EYE_COUNT * 5;
+	slist.SetCount(ne + 2);
+	for(int i = 0; i < EYE_COUNT; i++) {
+		const Eye& e = eyes[i];
+		double* s = slist.Begin() + i * 5;
+		s[0] = 1.0;
+		s[1] = 1.0;
+		s[2] = 1.0;
+		s[3] = e.vx; // velocity information of the sensed target
+		s[4] = e.vy;
+		if (e.type != -1)
+			s[e.type] = e.proximity / 120; // 1-of-k encoding of the normalized proximity
+	}
+	
+	// proprioception and orientation
+	slist[ne + 0] = vx;
+	slist[ne + 1] = vy;
+}
+
+double WaterWorldEnvironment::Step(int action, bool& done) {
+	clock++;
+	
+	// execute the action of the agent
+	double speed = 1;
+	if		(action == ACT_LEFT)	vx -= speed;
+	else if (action == ACT_RIGHT)	vx += speed;
+	else if (action == ACT_UP)		vy -= speed;
+	else if (action == ACT_DOWN)	vy += speed;
+	
+	// forward the agent by velocity, and stop it at the walls
+	vx *= 0.95;
+	vy *= 0.95;
+	px += vx;
+	py += vy;
+	if (px < 1)				{px = 1;			vx = 0; vy = 0;}
+	if (px > WIDTH - 1)		{px = WIDTH - 1;	vx = 0; vy = 0;}
+	if (py < 1)				{py = 1;			vx = 0; vy = 0;}
+	if (py > HEIGHT - 1)	{py = HEIGHT - 1;	vx = 0; vy = 0;}
+	
+	// tick all items, and see if the agent gets lunch
+	double r = 0;
+	bool update_items = false;
+	for(int i = 0; i < items.GetCount(); i++) {
+		Item& it = items[i];
+		it.age += 1;
+		double dx = px - it.x, dy = py - it.y;
+		if (sqrt(dx * dx + dy * dy) < 10 + 10) {
+			r += it.type == 1 ? 1.0 : -1.0;
+			it.cleanup = true;
+			update_items = true;
+		}
+		
+		it.x += it.vx;
+		it.y += it.vy;
+		if (it.x < 1)			{it.x = 1;			it.vx *= -1;}
+		if (it.x > WIDTH - 1)	{it.x = WIDTH - 1;	it.vx *= -1;}
+		if (it.y < 1)			{it.y = 1;			it.vy *= -1;}
+		if (it.y > HEIGHT - 1)	{it.y = HEIGHT - 1;	it.vy *= -1;}
+		
+		if (it.age > 5000 && (clock % 100) == 0 && Randomf() < 0.1) {
+			it.cleanup = true; // replace this one, has been around too long
+			update_items = true;
+		}
+	}
+	if (update_items) {
+		for(int i = 0; i < items.GetCount(); i++) {
+			if (items[i].cleanup) {
+				items.Remove(i);
+				i--;
+			}
+		}
+	}
+	if (items.GetCount() < ITEM_COUNT && (clock % 10) == 0 && Randomf() < 0.25)
+		AddItem();
+	
+	Sense();
+	
+	// the water world never ends
+	done = false;
+	return r;
+}
+
+
+
+
+VectorEnvironment::VectorEnvironment() {
+	reward_window.Init(1000, 10);
+}
+
+void VectorEnvironment::Reset() {
+	int count = envs.GetCount();
+	int length = GetStateCount();
+	states.SetCount(count * length);
+	next_states.SetCount(count * length);
+	reset_states.SetCount(count * length);
+	actions.SetCount(count, 0);
+	rewards.SetCount(count, 0);
+	done.SetCount(count, false);
+	s0.SetCount(length);
+	s1.SetCount(length);
+	env_states.SetCount(count);
+	for(int i = 0; i < count; i++)
+		env_states[i].SetCount(length);
+	for(int i = 0; i < count; i++) {
+		Environment& env = envs[i];
+		ASSERT(env.GetStateCount() == length);
+		env.Reset();
+		env.GetState(s0);
+		for(int j = 0; j < length; j++)
+			states[i * length + j] = s0[j];
+	}
+	has_states = true;
+}
+
+// The environments of the range are independent, and each writes only its own rows.
+void VectorEnvironment::StepRange(int begin, int end) {
+	int length = GetStateCount();
+	for(int i = begin; i < end; i++) {
+		Environment& env = envs[i];
+		Vector<double>& s = env_states[i];
+		bool d = false;
+		rewards[i] = env.Step(actions[i], d);
+		done[i] = d;
+		env.GetState(s);
+		ASSERT(s.GetCount() == length);
+		memcpy(next_states.Begin() + i * length, s.Begin(), length * sizeof(double));
+		if (d) {
+			env.Reset();
+			env.GetState(s);
+			memcpy(reset_states.Begin() + i * length, s.Begin(), length * sizeof(double));
+		}
+	}
+}
+
+void VectorEnvironment::Step(Agent& agent, bool learn) {
+	ASSERT(!envs.IsEmpty());
+	ASSERT(agent.GetNumStates() == GetStateCount());
+	ASSERT(agent.GetMaxNumActions() >= envs[0].GetActionCount());
+	TimeStop ts;
+	
+	if (!has_states)
+		Reset();
+	int count = envs.GetCount();
+	int length = GetStateCount();
+	
+	// one batched evaluation for the states of all environments
+	agent.Act(states, count, actions);
+	
+	int threads = min(thread_count, count);
+	if (threads > 1) {
+		CoWork co;
+		for(int i = 0; i < threads; i++) {
+			int begin = count * i / threads;
+			int end = count * (i + 1) / threads;
+			co & [this, begin, end] {StepRange(begin, end);};
+		}
+		co.Finish();
+	}
+	else
+		StepRange(0, count);
+	
+	// the agent isn't thread safe, so the transitions are added in the order of the
+	// environments
+	for(int i = 0; i < count; i++) {
+		memcpy(s0.Begin(), states.Begin() + i * length, length * sizeof(double));
+		memcpy(s1.Begin(), next_states.Begin() + i * length, length * sizeof(double));
+		agent.AddExperience(s0, actions[i], rewards[i], s1);
+		reward_window.Add(rewards[i]);
+	}
+	
+	Swap(states, next_states);
+	for(int i = 0; i < count; i++)
+		if (done[i])
+			memcpy(states.Begin() + i * length, reset_states.Begin() + i * length, length * sizeof(double));
+	
+	if (learn)
+		agent.LearnFromReplay(learning_steps >= 0 ? learning_steps : agent.GetLearningSteps());
+	
+	step_count += count;
+	seconds += ts.Seconds();
+}
+
+}
@@ -0,0 +1,183 @@
+#ifndef _ConvNet_Environment_h_
+#define _ConvNet_Environment_h_
+
+#include "Agent.h"
+
+namespace ConvNet {
+
+// Headless reinforcement learning environment. The state is a vector of GetStateCount()
+// values, and Step runs the dynamics of one action. The environment doesn't depend on the
+// GUI, so that it can be stepped on a server.
+class Environment {
+	
+public:
+	virtual ~Environment() {}
+	
+	virtual int GetStateCount() const = 0;
+	virtual int GetActionCount() const = 0;
+	virtual void Reset() = 0;
+	virtual void GetState(Vector<double>& state) = 0;
+	virtual double Step(int action, bool& done) = 0; // returns the reward
+};
+
+// The puck world of the PuckWorld example without the agent: the puck is pushed towards
+// the green target and away from the red one, which follows the puck. The example draws
+// it with the getters.
+class PuckWorldEnvironment : public Environment {
+	double ppx, ppy, pvx, pvy;
+	double rad, BADRAD;
+	double tx, ty, tx2, ty2;
+	int t;
+	
+public:
+	PuckWorldEnvironment() {Reset();}
+	
+	virtual int GetStateCount() const {return 8;}
+	virtual int GetActionCount() const {return 5;}
+	virtual void Reset();
+	virtual void GetState(Vector<double>& state);
+	virtual double Step(int action, bool& done);
+	
+	double GetPuckX() const {return ppx;}
+	double GetPuckY() const {return ppy;}
+	double GetPuckRadius() const {return rad;}
+	double GetTargetX() const {return tx;}
+	double GetTargetY() const {return ty;}
+	double GetBadTargetX() const {return tx2;}
+	double GetBadTargetY() const {return ty2;}
+	double GetBadRadius() const {return BADRAD;}
+};
+
+// The grid world of the GridWorld and TemporalDifference examples, which the tabular agents
+// have built in. The state is the one-hot encoding of the cell, and the actions are
+// ACT_LEFT, ACT_UP, ACT_RIGHT and ACT_DOWN. Every step takes the reward of the cell minus
+// 0.01, a move into a wall or over the edge keeps the cell, and the episode ends with the
+// step from the stop cell. The default world is the 10x10 grid of the examples.
+class GridWorldEnvironment : public Environment {
+	Vector<double> reward;
+	Vector<bool> disable;
+	int width = 0, height = 0;
+	int start_state = 0, stop_state = 0;
+	int state = 0;
+	
+public:
+	GridWorldEnvironment();
+	
+	virtual int GetStateCount() const {return width * height;}
+	virtual int GetActionCount() const {return 4;}
+	virtual void Reset() {state = start_state;}
+	virtual void GetState(Vector<double>& slist);
+	virtual double Step(int action, bool& done);
+	
+	void Init(int width, int height); // an empty grid, which stops at the center
+	void InitAgent(Agent& agent) const; // gives the same grid to the agent
+	
+	void SetReward(int x, int y, double r) {reward[GetPos(x, y)] = r;}
+	void SetDisabled(int x, int y, bool b=true);
+	void SetStartState(int x, int y) {start_state = GetPos(x, y);}
+	void SetStopState(int x, int y) {stop_state = GetPos(x, y);}
+	
+	int GetPos(int x, int y) const {ASSERT(x >= 0 && y >= 0 && x < width && y < height); return y * width + x;}
+	int GetWidth() const {return width;}
+	int GetHeight() const {return height;}
+	int GetX() const {return state % width;}
+	int GetY() const {return state / width;}
+};
+
+// The water world of the WaterWorld example with one agent and without the GUI. The agent
+// senses the walls, the apples and the poison with 30 eyes, and it gets the reward of 1
+// for eating an apple and -1 for eating poison. The world never ends.
+class WaterWorldEnvironment : public Environment {
+	struct Item : Moveable<Item> {
+		double x, y, vx, vy;
+		int type, age; // 1 is an apple and 2 is poison
+		bool cleanup;
+	};
+	
+	struct Eye : Moveable<Eye> {
+		double angle;
+		double proximity; // to the sensed item or wall
+		double vx, vy; // of the sensed item
+		int type; // -1 for nothing, 0 for a wall, and the item type
+	};
+	
+	Vector<Item> items;
+	Vector<Eye> eyes;
+	double px, py, vx, vy; // of the agent
+	int clock;
+	
+	void AddItem();
+	void Sense();
+	
+public:
+	enum {WIDTH = 700, HEIGHT = 500, EYE_COUNT = 30, ITEM_COUNT = 50};
+	
+	WaterWorldEnvironment() {Reset();}
+	
+	virtual int GetStateCount() const {return EYE_COUNT * 5 + 2;}
+	virtual int GetActionCount() const {return 4;}
+	virtual void Reset();
+	virtual void GetState(Vector<double>& state);
+	virtual double Step(int action, bool& done);
+	
+	double GetAgentX() const {return px;}
+	double GetAgentY() const {return py;}
+	int GetItemCount() const {return items.GetCount();}
+};
+
+// Steps N copies of an environment in lockstep with one agent. The states of all copies
+// are evaluated as one batch, the environments are stepped in the threads of CoWork if the
+// thread count is more than 1, and every transition is given to the agent: the DQNAgent adds
+// it to its replay memory and the TDAgent learns it right away. A finished episode is reset
+// right away, and its last transition ends in the state before the reset.
+//
+// The agent learns the given number of replay steps after every vector step, which is the
+// learning of one step of a single environment by default, so the learning per
+// environment step is divided by the environment count. The replay of the TDAgent is its
+// planning, and the DPAgent iterates its values.
+class VectorEnvironment {
+	Array<Environment> envs;
+	Vector<double> states, next_states, reset_states; // count x state count
+	Vector<int> actions;
+	Vector<double> rewards;
+	Vector<bool> done;
+	Vector<double> s0, s1;
+	Vector<Vector<double> > env_states; // the state buffer of every environment
+	Window reward_window;
+	int thread_count = 1;
+	int learning_steps = -1;
+	int64 step_count = 0;
+	double seconds = 0;
+	bool has_states = false;
+	
+	void StepRange(int begin, int end);
+	
+public:
+	typedef VectorEnvironment CLASSNAME;
+	VectorEnvironment();
+	
+	template <class T> T& Create() {has_states = false; return envs.Create<T>();}
+	Environment& Add(Environment* env) {has_states = false; return envs.Add(env);}
+	void Clear() {envs.Clear(); has_states = false;}
+	
+	VectorEnvironment& SetThreadCount(int i) {thread_count = max(1, i); return *this;}
+	VectorEnvironment& SetLearningSteps(int i) {learning_steps = i; return *this;}
+	
+	void Reset();
+	void Step(Agent& agent, bool learn=true);
+	
+	Environment& operator[](int i) {return envs[i];}
+	int GetCount() const {return envs.GetCount();}
+	int GetStateCount() const {return envs.IsEmpty() ? 0 : envs[0].GetStateCount();}
+	int GetThreadCount() const {return thread_count;}
+	int64 GetStepCount() const {return step_count;} // of all environments
+	double GetStepsPerSecond() const {return seconds > 0 ? step_count / seconds : 0.0;}
+	double GetAverageReward() const {return reward_window.GetAverage();}
+	const Vector<double>& GetStates() const {return states;}
+	const Vector<int>& GetActions() const {return actions;}
+	const Vector<double>& GetRewards() const {return rewards;}
+};
+
+}
+
+#endif
@@ -23,23 +23,46 @@ void LayerBase::InitFullyConn(int input_width, int input_height, int input_depth
 	}
 	
 	biases.Init(1, 1, output_depth, bias);
+	quantized_filters.Clear();
 }
 
 Volume& LayerBase::ForwardFullyConn(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation.Init(1, 1, output_depth, 0.0);
+	int batch = input.GetBatch();
+	output_activation.SetSize(1, 1, output_depth, batch);
 	
-	for (int i = 0; i < output_depth; i++)
-	{
-		double a = 0.0;
-		for (int d = 0; d < input_count; d++) {
-			a += input.Get(d) * filters[i].Get(d); // for efficiency use Vols directly for now
+	// inference with the quantized filters, (batch x input_count) * (input_count x output_depth)
+	if (!is_training && IsQuantized()) {
+		QuantizedGemm(thread_count, quantized_filters, batch, input.GetWeights().Begin(), input_count, 1,
+			biases.GetWeights().Begin(), output_activation.GetWeights().Begin(), output_depth, 1);
+		return output_activation;
+	}
+	
+	if (batch == 1) {
+		for (int i = 0; i < output_depth; i++)
+		{
+			double a = 0.0;
+			for (int d = 0; d < input_count; d++) {
+				a += input.Get(d) * filters[i].Get(d); // for efficiency use Vols directly for now
+			}
+			
+			a += biases.Get(i);
+			output_activation.Set(i, a);
 		}
-		
-		a += biases.Get(i);
-		output_activation.Set(i, a);
+		return output_activation;
 	}
-	            
+	
+	// the whole batch at once: (batch x input_count) * (input_count x output_depth)
+	GatherFilters();
+	Real* out = output_activation.GetWeights().Begin();
+	for (int b = 0; b < batch; b++)
+		for (int i = 0; i < output_depth; i++)
+			out[b * output_depth + i] = biases.Get(i);
+	
+	Gemm(false, true, batch, output_depth, input_count,
+		(Real)1, input.GetWeights().Begin(), input_count, filter_rows, input_count,
+		(Real)1, out, output_depth);
+	
 	return output_activation;
 }
 
@@ -47,24 +70,49 @@ double LayerBase::BackwardFullyConn() {
 	ASSERT(input_activation);
 	Volume& input = *input_activation;
 	ASSERT(output_activation.GetLength());
+	int batch = output_activation.GetBatch();
 	
-	input.ZeroGradients(); // zero out the gradient in input Vol
-	
-	// compute gradient wrt weights and data
-	for (int i = 0; i < output_depth; i++)
-	{
-		Volume& tfi = filters[i];
-		double chain_gradient_ = output_activation.GetGradient(i);
+	if (batch == 1) {
+		input.ZeroGradients(); // zero out the gradient in input Vol
+		
+		// compute gradient wrt weights and data
+		for (int i = 0; i < output_depth; i++)
+		{
+			Volume& tfi = filters[i];
+			double chain_gradient_ = output_activation.GetGradient(i);
+			
+			for (int d = 0; d < input_count; d++) {
+				input.SetGradient(d, input.GetGradient(d) + tfi.Get(d) * chain_gradient_); // grad wrt input data
+				tfi.SetGradient(d, tfi.GetGradient(d) + input.Get(d) * chain_gradient_); // grad wrt params
+			}
+			biases.SetGradient(i, biases.GetGradient(i) + chain_gradient_);
+		}
+	}
+	else {
+		const Real* chain_gradients = output_activation.GetGradients().Begin();
 		
-		for (int d = 0; d < input_count; d++) {
-			input.SetGradient(d, input.GetGradient(d) + tfi.Get(d) * chain_gradient_); // grad wrt input data
-			tfi.SetGradient(d, tfi.GetGradient(d) + input.Get(d) * chain_gradient_); // grad wrt params
+		for (int b = 0; b < batch; b++) {
+			const Real* row = chain_gradients + b * output_depth;
+			for (int i = 0; i < output_depth; i++)
+				biases.AddGradient(i, row[i]);
 		}
-		biases.SetGradient(i, biases.GetGradient(i) + chain_gradient_);
+		
+		// gradient wrt weights: (output_depth x batch) * (batch x input_count)
+		SetBufferCount(filter_gradients, output_depth * input_count);
+		Gemm(true, false, output_depth, input_count, batch,
+			(Real)1, chain_gradients, output_depth, input.GetWeights().Begin(), input_count,
+			(Real)0, filter_gradients.Begin(), input_count);
+		ScatterFilterGradients();
+		
+		// gradient wrt data, every input gradient is overwritten
+		Gemm(false, false, batch, input_count, output_depth,
+			(Real)1, chain_gradients, output_depth, filter_rows, input_count,
+			(Real)0, input.GetGradients().Begin(), input_count);
 	}
 	
 	double loss = 0;
-	for(int i = 0; i < input_count; i++) {
+	int count = input.GetCount();
+	for(int i = 0; i < count; i++) {
 		double dy = input.GetGradient(i);
 		loss += 0.5 * dy * dy;
 	}
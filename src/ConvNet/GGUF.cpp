@@ -0,0 +1,567 @@
+#include "ConvNet.h"
+
+#ifdef PLATFORM_POSIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace ConvNet {
+
+// Metadata value types
+enum {
+	GGUF_UINT8, GGUF_INT8, GGUF_UINT16, GGUF_INT16, GGUF_UINT32, GGUF_INT32, GGUF_FLOAT32,
+	GGUF_BOOL, GGUF_STRING, GGUF_ARRAY, GGUF_UINT64, GGUF_INT64, GGUF_FLOAT64
+};
+
+int GetGGUFBlockSize(int type) {
+	switch (type) {
+		case GGUF_F32: case GGUF_F16: case GGUF_F64: case GGUF_BF16: return 1;
+		case GGUF_Q4_0: case GGUF_Q4_1: case GGUF_Q5_0: case GGUF_Q5_1: case GGUF_Q8_0: case GGUF_Q8_1: return 32;
+		case GGUF_Q2_K: case GGUF_Q3_K: case GGUF_Q4_K: case GGUF_Q5_K: case GGUF_Q6_K: case GGUF_Q8_K: return 256;
+	}
+	return 0;
+}
+
+int GetGGUFTypeSize(int type) {
+	switch (type) {
+		case GGUF_F32: return 4;
+		case GGUF_F16: return 2;
+		case GGUF_F64: return 8;
+		case GGUF_BF16: return 2;
+		case GGUF_Q4_0: return 18;
+		case GGUF_Q4_1: return 20;
+		case GGUF_Q5_0: return 22;
+		case GGUF_Q5_1: return 24;
+		case GGUF_Q8_0: return 34;
+		case GGUF_Q8_1: return 36;
+		case GGUF_Q2_K: return 84;
+		case GGUF_Q3_K: return 110;
+		case GGUF_Q4_K: return 144;
+		case GGUF_Q5_K: return 176;
+		case GGUF_Q6_K: return 210;
+		case GGUF_Q8_K: return 292;
+	}
+	return 0;
+}
+
+int64 GGUFTensor::GetByteCount() const {
+	int block = GetGGUFBlockSize(type);
+	if (!block || ne[0] % block)
+		return -1;
+	return GetCount() / block * GetGGUFTypeSize(type);
+}
+
+// Reads the little endian values of the header, and fails instead of reading past the end
+struct GGUFReader {
+	const byte* p;
+	const byte* end;
+	bool error = false;
+
+	GGUFReader(const byte* p, const byte* end) : p(p), end(end) {}
+
+	bool Has(uint64 n) {
+		if (error || n > (uint64)(end - p))
+			error = true;
+		return !error;
+	}
+	template <class T> T Get() {
+		T v = 0;
+		if (Has(sizeof(T))) {
+			memcpy(&v, p, sizeof(T));
+			p += sizeof(T);
+		}
+		return v;
+	}
+	String GetString() {
+		uint64 n = Get<uint64>();
+		if (!Has(n) || n > INT_MAX)
+			return String();
+		String s((const char*)p, (int)n);
+		p += n;
+		return s;
+	}
+	Value GetValue(int type, int level = 0);
+};
+
+Value GGUFReader::GetValue(int type, int level) {
+	switch (type) {
+		case GGUF_UINT8:   return (int64)Get<uint8>();
+		case GGUF_INT8:    return (int64)Get<int8>();
+		case GGUF_UINT16:  return (int64)Get<uint16>();
+		case GGUF_INT16:   return (int64)Get<int16>();
+		case GGUF_UINT32:  return (int64)Get<uint32>();
+		case GGUF_INT32:   return (int64)Get<int32>();
+		case GGUF_UINT64:  return (int64)Get<uint64>();
+		case GGUF_INT64:   return Get<int64>();
+		case GGUF_FLOAT32: return (double)Get<float>();
+		case GGUF_FLOAT64: return Get<double>();
+		case GGUF_BOOL:    return Get<uint8>() != 0;
+		case GGUF_STRING:  return GetString();
+		case GGUF_ARRAY: {
+			int elem = Get<uint32>();
+			uint64 count = Get<uint64>();
+
+			// every element takes at least one byte, which bounds the count by the file size
+			if (level > 4 || !Has(count))
+				break;
+			ValueArray va;
+			for (uint64 i = 0; i < count && !error; i++)
+				va.Add(GetValue(elem, level + 1));
+			return va;
+		}
+	}
+	error = true;
+	return Value();
+}
+
+bool GGUFFile::Open(const String& path) {
+	Close();
+#ifdef PLATFORM_POSIX
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return SetError("Can't open " + path);
+	struct stat st;
+	void* p = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		size = st.st_size;
+		p = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if (p == MAP_FAILED) {
+		size = 0;
+		return SetError("Can't map " + path);
+	}
+	begin = (const byte*)p;
+#endif
+#ifdef PLATFORM_WIN32
+	file_handle = CreateFileW(ToSystemCharsetW(path), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file_handle == INVALID_HANDLE_VALUE)
+		return SetError("Can't open " + path);
+	LARGE_INTEGER sz;
+	if (GetFileSizeEx(file_handle, &sz) && sz.QuadPart > 0) {
+		size = sz.QuadPart;
+		map_handle = CreateFileMapping(file_handle, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if (map_handle)
+			begin = (const byte*)MapViewOfFile(map_handle, FILE_MAP_COPY, 0, 0, 0);
+	}
+	if (!begin) {
+		Close();
+		return SetError("Can't map " + path);
+	}
+#endif
+	if (!Parse()) {
+		String e = error;
+		Close();
+		error = e;
+		return false;
+	}
+	error.Clear();
+	return true;
+}
+
+void GGUFFile::Close() {
+#ifdef PLATFORM_POSIX
+	if (begin)
+		munmap((void*)begin, (size_t)size);
+#endif
+#ifdef PLATFORM_WIN32
+	if (begin)
+		UnmapViewOfFile(begin);
+	if (map_handle)
+		CloseHandle(map_handle);
+	if (file_handle != INVALID_HANDLE_VALUE)
+		CloseHandle(file_handle);
+	map_handle = NULL;
+	file_handle = INVALID_HANDLE_VALUE;
+#endif
+	begin = NULL;
+	size = 0;
+	version = 0;
+	alignment = 32;
+	values.Clear();
+	tensors.Clear();
+}
+
+bool GGUFFile::Parse() {
+	GGUFReader in(begin, begin + size);
+	if (in.Get<uint32>() != 0x46554747) // "GGUF"
+		return SetError("Not a GGUF file");
+	version = in.Get<uint32>();
+	if (version < 2 || version > 3)
+		return SetError("Unsupported GGUF version " + IntStr(version));
+	uint64 tensor_count = in.Get<uint64>();
+	uint64 value_count = in.Get<uint64>();
+	if (tensor_count > (uint64)size || value_count > (uint64)size)
+		return SetError("Corrupt GGUF header");
+
+	for (uint64 i = 0; i < value_count && !in.error; i++) {
+		String key = in.GetString();
+		int type = in.Get<uint32>();
+		values.GetAdd(key) = in.GetValue(type);
+	}
+	alignment = GetInt("general.alignment", 32);
+	if (alignment <= 0 || (alignment & (alignment - 1)))
+		return SetError("Invalid alignment " + IntStr(alignment));
+
+	Vector<uint64> offsets;
+	for (uint64 i = 0; i < tensor_count && !in.error; i++) {
+		GGUFTensor t;
+		t.name = in.GetString();
+		t.dims = in.Get<uint32>();
+		if (t.dims < 1 || t.dims > 4)
+			return SetError("Tensor " + t.name + " has " + IntStr(t.dims) + " dimensions");
+
+		// no type packs more than 8 elements into a byte, which bounds the element count
+		int64 count = 1;
+		for (int j = 0; j < t.dims; j++) {
+			t.ne[j] = in.Get<uint64>();
+			if (t.ne[j] <= 0 || t.ne[j] > 8 * size / count)
+				return SetError("Tensor " + t.name + " has an invalid shape");
+			count *= t.ne[j];
+		}
+		t.type = in.Get<uint32>();
+		offsets.Add(in.Get<uint64>());
+		String name = t.name;
+		tensors.Add(name, pick(t));
+	}
+	if (in.error)
+		return SetError("Truncated GGUF header");
+
+	// the data section starts at the next aligned position after the header
+	uint64 data = ((uint64)(in.p - begin) + alignment - 1) / alignment * alignment;
+	for (int i = 0; i < tensors.GetCount(); i++) {
+		GGUFTensor& t = tensors[i];
+		int64 bytes = t.GetByteCount();
+		if (bytes < 0)
+			continue; // an unknown type, which is found without data
+		if (offsets[i] > (uint64)size || data + offsets[i] + bytes > (uint64)size)
+			return SetError("Tensor " + t.name + " is outside the file");
+		t.data = begin + data + offsets[i];
+	}
+	return true;
+}
+
+int GGUFFile::GetInt(const String& key, int def) const {
+	Value v = Get(key);
+	return IsNumber(v) ? (int)(int64)v : def;
+}
+
+const GGUFTensor* GGUFFile::FindTensor(const String& name) const {
+	int i = tensors.Find(name);
+	return i >= 0 ? &tensors[i] : NULL;
+}
+
+bool GGUFFile::CanConvert(int type) {
+	return type == GGUF_F32 || type == GGUF_F64 || type == GGUF_F16 || type == GGUF_BF16 ||
+	       IsQuantizedType(type);
+}
+
+void GGUFFile::Convert(const GGUFTensor& t, int64 begin, int64 count, Real* out) {
+	ASSERT(CanConvert(t.type) && begin >= 0 && begin + count <= t.GetCount());
+	if (IsQuantizedType(t.type)) {
+		DequantizeRow(t.type, t.data, begin, count, out);
+		return;
+	}
+	const byte* p = t.data + begin * GetGGUFTypeSize(t.type);
+	switch (t.type) {
+		case GGUF_F32:
+			for (int64 i = 0; i < count; i++) {
+				float f;
+				memcpy(&f, p + i * 4, 4);
+				out[i] = (Real)f;
+			}
+			break;
+		case GGUF_F64:
+			for (int64 i = 0; i < count; i++) {
+				double d;
+				memcpy(&d, p + i * 8, 8);
+				out[i] = (Real)d;
+			}
+			break;
+		case GGUF_F16:
+			for (int64 i = 0; i < count; i++) {
+				word h;
+				memcpy(&h, p + i * 2, 2);
+				out[i] = (Real)DataStore::HalfToFloat(h);
+			}
+			break;
+		case GGUF_BF16:
+			for (int64 i = 0; i < count; i++) {
+				word h;
+				memcpy(&h, p + i * 2, 2);
+				dword bits = (dword)h << 16;
+				float f;
+				memcpy(&f, &bits, 4);
+				out[i] = (Real)f;
+			}
+			break;
+	}
+}
+
+static String GetShapeText(const GGUFTensor& t) {
+	String s = "[";
+	for (int i = 0; i < t.dims; i++)
+		s << (i ? ", " : "") << t.ne[i];
+	return s + "]";
+}
+
+bool GGUFMapper::Find(const String& name, GGUFTensor& t) const {
+	const GGUFTensor* f = file.FindTensor(name);
+	if (f) {
+		t = *f;
+		return true;
+	}
+
+	// q, k and v are the thirds of a fused attn_qkv tensor, ne = [embed_dim, 3 * embed_dim]
+	static const char* part[3] = {"attn_q.", "attn_k.", "attn_v."};
+	for (int i = 0; i < 3; i++) {
+		int pos = name.Find(part[i]);
+		if (pos < 0 || (pos > 0 && name[pos - 1] != '.'))
+			continue;
+		f = file.FindTensor(name.Left(pos) + "attn_qkv." + name.Mid(pos + 7));
+		if (!f || f->dims > 2 || f->ne[f->dims - 1] % 3)
+			return false;
+		t = *f;
+		t.ne[t.dims - 1] /= 3;
+		if (t.data)
+			t.data += i * (f->GetByteCount() / 3);
+		return true;
+	}
+	return false;
+}
+
+void GGUFMapper::Map(const String& name, const GGUFTensor& t, int64 begin, Volume& v, int width, int height, int depth) {
+	// a tensor of Real is viewed in place, and the others are converted
+	const byte* p = t.data + begin * sizeof(Real);
+	if (t.type == GGUF_REAL && (uintptr_t)p % sizeof(Real) == 0) {
+		v.MapWeights((Real*)p, width, height, depth);
+		mapped++;
+		return;
+	}
+	v.GetWeights().Clear();
+	v.SetSize(width, height, depth);
+	GGUFFile::Convert(t, begin, (int64)width * height * depth, v.GetWeights().Begin());
+	converted++;
+}
+
+void GGUFMapper::Tensor(const String& name, Volume& v, int ne0, int ne1) {
+	GGUFTensor t;
+	if (!Find(name, t)) {
+		missing.Add(name);
+		return;
+	}
+	int64 count = (int64)ne0 * ne1;
+	if (t.ne[0] != ne0 || t.GetCount() != count) {
+		errors.Add(Format("%s: the shape %s doesn't fit [%d, %d]", name, GetShapeText(t), ne0, ne1));
+		return;
+	}
+	if (!GGUFFile::CanConvert(t.type)) {
+		errors.Add(Format("%s: the type %d isn't supported", name, t.type));
+		return;
+	}
+	if (v.GetCount() == count)
+		Map(name, t, 0, v, v.GetWidth(), v.GetHeight(), v.GetDepth());
+	else
+		Map(name, t, 0, v, ne0, ne1, 1);
+}
+
+void GGUFMapper::Filters(const String& name, Vector<Volume>& filters) {
+	if (filters.IsEmpty())
+		return;
+	GGUFTensor t;
+	if (!Find(name, t)) {
+		missing.Add(name);
+		return;
+	}
+	int width = filters[0].GetWidth();
+	int height = filters[0].GetHeight();
+	int depth = filters[0].GetDepth();
+	int count = filters.GetCount();
+	int length = width * height * depth;
+	bool column = width == 1 && height == 1;
+	bool fits = column ? t.dims <= 2 && t.ne[0] == depth && t.ne[1] == count
+	                   : t.ne[0] == width && t.ne[1] == height && t.ne[2] == depth && t.ne[3] == count;
+	if (!fits) {
+		errors.Add(Format("%s: the shape %s doesn't fit %d filters of [%d, %d, %d]",
+			name, GetShapeText(t), count, width, height, depth));
+		return;
+	}
+	if (!GGUFFile::CanConvert(t.type)) {
+		errors.Add(Format("%s: the type %d isn't supported", name, t.type));
+		return;
+	}
+
+	// with one input channel, the ggml order (x, then y) is the order of the volume
+	if (column || depth == 1) {
+		for (int i = 0; i < count; i++)
+			Map(name, t, (int64)i * length, filters[i], width, height, depth);
+		return;
+	}
+
+	// ggml has x innermost, then y and then the channel, and the volume has the channel
+	// innermost, then x and then y
+	Vector<Real> tmp;
+	tmp.SetCount(length);
+	for (int i = 0; i < count; i++) {
+		GGUFFile::Convert(t, (int64)i * length, length, tmp.Begin());
+		Volume& f = filters[i];
+		f.GetWeights().Clear();
+		f.SetSize(width, height, depth);
+		Real* dst = f.GetWeights().Begin();
+		for (int c = 0; c < depth; c++)
+			for (int y = 0; y < height; y++)
+				for (int x = 0; x < width; x++)
+					dst[(width * y + x) * depth + c] = tmp[x + width * (y + height * c)];
+	}
+	converted += count;
+}
+
+bool GGUFMapper::IsMissing(const String& name) const {
+	for (int i = 0; i < missing.GetCount(); i++)
+		if (missing[i] == name)
+			return true;
+	return false;
+}
+
+void GGUFWriter::Tensor(const String& name, Volume& v, int ne0, int ne1) {
+	if (v.GetCount() == 0)
+		return;
+	ASSERT(v.GetCount() == ne0 * ne1);
+	Item& it = items.Add();
+	it.name = name;
+	it.dims = ne1 == 1 ? 1 : 2;
+	it.ne[0] = ne0;
+	it.ne[1] = ne1;
+	it.data = v.GetWeights().Begin();
+}
+
+void GGUFWriter::Filters(const String& name, Vector<Volume>& filters) {
+	if (filters.IsEmpty())
+		return;
+	int width = filters[0].GetWidth();
+	int height = filters[0].GetHeight();
+	int depth = filters[0].GetDepth();
+	int count = filters.GetCount();
+	int length = width * height * depth;
+	bool column = width == 1 && height == 1;
+
+	Item& it = items.Add();
+	it.name = name;
+	it.dims = column ? 2 : 4;
+	it.ne[0] = column ? depth : width;
+	it.ne[1] = column ? count : height;
+	it.ne[2] = column ? 1 : depth;
+	it.ne[3] = column ? 1 : count;
+	it.buffer.SetCount(count * length);
+	for (int i = 0; i < count; i++) {
+		const Real* src = filters[i].GetWeights().Begin();
+		Real* dst = it.buffer.Begin() + (int64)i * length;
+		if (column || depth == 1)
+			memcpy(dst, src, length * sizeof(Real));
+		else
+			for (int c = 0; c < depth; c++)
+				for (int y = 0; y < height; y++)
+					for (int x = 0; x < width; x++)
+						dst[x + width * (y + height * c)] = src[(width * y + x) * depth + c];
+	}
+	it.data = it.buffer.Begin();
+}
+
+static void PutString(Stream& out, const String& s) {
+	out.Put64le(s.GetCount());
+	out.Put(s);
+}
+
+static int GetValueType(const Value& v) {
+	if (v.Is<bool>())
+		return GGUF_BOOL;
+	if (v.Is<int>())
+		return (int)v >= 0 ? GGUF_UINT32 : GGUF_INT32;
+	if (v.Is<int64>())
+		return GGUF_INT64;
+	if (IsNumber(v))
+		return GGUF_FLOAT64;
+	if (v.Is<ValueArray>())
+		return GGUF_ARRAY;
+	return GGUF_STRING;
+}
+
+static void PutValue(Stream& out, const Value& v, int type) {
+	switch (type) {
+		case GGUF_BOOL:    out.Put((bool)v ? 1 : 0); break;
+		case GGUF_UINT32:
+		case GGUF_INT32:   out.Put32le((int)v); break;
+		case GGUF_INT64:   out.Put64le((int64)v); break;
+		case GGUF_FLOAT64: {
+			double d = v;
+			out.Put(&d, 8);
+			break;
+		}
+		case GGUF_ARRAY: {
+			// the elements have the type of the first one
+			ValueArray va = v;
+			int elem = va.GetCount() ? GetValueType(va[0]) : GGUF_INT32;
+			if (elem == GGUF_UINT32)
+				elem = GGUF_INT32;
+			out.Put32le(elem);
+			out.Put64le(va.GetCount());
+			for (int i = 0; i < va.GetCount(); i++)
+				PutValue(out, va[i], elem);
+			break;
+		}
+		default:
+			PutString(out, AsString(v));
+	}
+}
+
+static void PutPadding(Stream& out, int alignment) {
+	int64 pos = out.GetPos();
+	out.Put(0, (int)((alignment - pos % alignment) % alignment));
+}
+
+bool GGUFWriter::Save(const String& path) {
+	FileOut out(path);
+	if (!out.IsOpen())
+		return false;
+
+	VectorMap<String, Value> v = clone(values);
+	if (alignment != 32)
+		v.GetAdd("general.alignment") = alignment;
+
+	out.Put32le(0x46554747); // "GGUF"
+	out.Put32le(3);
+	out.Put64le(items.GetCount());
+	out.Put64le(v.GetCount());
+	for (int i = 0; i < v.GetCount(); i++) {
+		int type = GetValueType(v[i]);
+		PutString(out, v.GetKey(i));
+		out.Put32le(type);
+		PutValue(out, v[i], type);
+	}
+
+	// every tensor starts at an aligned offset of the data section
+	int64 offset = 0;
+	for (int i = 0; i < items.GetCount(); i++) {
+		const Item& it = items[i];
+		PutString(out, it.name);
+		out.Put32le(it.dims);
+		for (int j = 0; j < it.dims; j++)
+			out.Put64le(it.ne[j]);
+		out.Put32le(GGUF_REAL);
+		out.Put64le(offset);
+		offset += (it.ne[0] * it.ne[1] * it.ne[2] * it.ne[3] * sizeof(Real) + alignment - 1) / alignment * alignment;
+	}
+	for (int i = 0; i < items.GetCount(); i++) {
+		const Item& it = items[i];
+		PutPadding(out, alignment);
+		out.Put64(it.data, it.ne[0] * it.ne[1] * it.ne[2] * it.ne[3] * sizeof(Real));
+	}
+	PutPadding(out, alignment);
+	out.Close();
+	return !out.IsError();
+}
+
+}
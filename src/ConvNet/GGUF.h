@@ -0,0 +1,179 @@
+#ifndef _ConvNet_GGUF_h_
+#define _ConvNet_GGUF_h_
+
+#include "Utilities.h"
+
+namespace ConvNet {
+
+// Tensor element types of GGUF files (the ggml_type values)
+enum {
+	GGUF_F32 = 0,
+	GGUF_F16 = 1,
+	GGUF_Q4_0 = 2,
+	GGUF_Q4_1 = 3,
+	GGUF_Q5_0 = 6,
+	GGUF_Q5_1 = 7,
+	GGUF_Q8_0 = 8,
+	GGUF_Q8_1 = 9,
+	GGUF_Q2_K = 10,
+	GGUF_Q3_K = 11,
+	GGUF_Q4_K = 12,
+	GGUF_Q5_K = 13,
+	GGUF_Q6_K = 14,
+	GGUF_Q8_K = 15,
+	GGUF_F64 = 28,
+	GGUF_BF16 = 30
+};
+
+// The GGUF type of Real
+#ifdef flagCONVNET_DOUBLE
+#define GGUF_REAL GGUF_F64
+#else
+#define GGUF_REAL GGUF_F32
+#endif
+
+// Elements per block and bytes per block of a tensor type, or 0 for unknown types
+int GetGGUFBlockSize(int type);
+int GetGGUFTypeSize(int type);
+
+struct GGUFTensor : Moveable<GGUFTensor> {
+	String name;
+	int type = GGUF_F32;
+	int dims = 0;
+	int64 ne[4] = {1, 1, 1, 1};	// ne[0] is the innermost dimension
+	const byte* data = NULL;	// NULL for the unknown types
+
+	int64 GetCount() const {return ne[0] * ne[1] * ne[2] * ne[3];}
+	int64 GetByteCount() const;
+};
+
+// A GGUF file, mapped into memory. Open parses the header, the metadata and the tensor
+// infos, and leaves the tensor data in the page cache: a multi-gigabyte checkpoint opens
+// without reading it, and the processes which open the same file share its pages.
+//
+// The mapping is private and writable. GGUFMapper lets the weights of the models view the
+// tensors in place, and writing to them (e.g. training a mapped model) copies the written
+// pages for this process only; the file is never modified. The file must stay open as long
+// as the models view it, which is why they keep a std::shared_ptr to it.
+class GGUFFile {
+	const byte* begin = NULL;
+	int64 size = 0;
+#ifdef PLATFORM_WIN32
+	HANDLE file_handle = INVALID_HANDLE_VALUE;
+	HANDLE map_handle = NULL;
+#endif
+	int version = 0;
+	int alignment = 32;
+	VectorMap<String, Value> values;
+	VectorMap<String, GGUFTensor> tensors;
+	String error;
+
+	bool Parse();
+	bool SetError(const String& s) {error = s; return false;}
+
+public:
+	GGUFFile() {}
+	~GGUFFile() {Close();}
+
+	bool Open(const String& path);
+	void Close();
+	bool IsOpen() const {return begin;}
+	String GetError() const {return error;}
+
+	int GetVersion() const {return version;}
+	int GetAlignment() const {return alignment;}
+	int64 GetFileSize() const {return size;}
+
+	// The metadata. Integers are int64, floats double and arrays ValueArray.
+	const VectorMap<String, Value>& GetValues() const {return values;}
+	Value Get(const String& key) const {return values.Get(key, Value());}
+	int GetInt(const String& key, int def = 0) const;
+	String GetArchitecture() const {return Get("general.architecture");}
+
+	int GetTensorCount() const {return tensors.GetCount();}
+	const GGUFTensor& GetTensor(int i) const {return tensors[i];}
+	const GGUFTensor* FindTensor(const String& name) const;
+
+	// The F32, F64, F16 and BF16 tensors, and the Q8_0 and Q4_0 blocks (see Quantize.h), can
+	// be converted to Real. Convert converts count elements from element begin on.
+	static bool CanConvert(int type);
+	static void Convert(const GGUFTensor& t, int64 begin, int64 count, Real* out);
+};
+
+// Visits the parameter volumes of a model with their GGUF tensor names (see
+// GPTModel::VisitTensors and Net::VisitTensors), either to map them from a file
+// (GGUFMapper) or to write them (GGUFWriter).
+class GGUFTensorVisitor {
+public:
+	virtual ~GGUFTensorVisitor() {}
+
+	// A tensor of ne = [ne0, ne1], i.e. ne1 rows of ne0 values. An empty volume gets the
+	// size [ne0, ne1, 1], and a volume of ne0 * ne1 values keeps its size.
+	virtual void Tensor(const String& name, Volume& v, int ne0, int ne1 = 1) = 0;
+
+	// The filters of a fully connected or convolutive layer as one tensor. Filters of one
+	// column ([1, 1, depth]) are the rows of ne = [depth, count], and the others are stored
+	// in the ggml convolution layout ne = [width, height, depth, count].
+	virtual void Filters(const String& name, Vector<Volume>& filters) = 0;
+};
+
+// Maps the visited volumes from the tensors of a file. A tensor of the type of Real is
+// viewed in place, without copying; the other float types (F16, BF16, F32 or F64) and the
+// Q8_0 and Q4_0 blocks are converted into owned buffers. Convolution filters with more than
+// one input channel have a different element order than ggml, so they are converted too.
+//
+// A fused "attn_qkv" tensor (as in GPT-2 checkpoints) is used for the "attn_q", "attn_k"
+// and "attn_v" tensors which are not in the file. Missing tensors leave the volumes as they
+// are and are listed by GetMissing, and the tensors which don't fit or have a type which
+// can't be converted are listed by GetErrors.
+class GGUFMapper : public GGUFTensorVisitor {
+	const GGUFFile& file;
+	Vector<String> missing, errors;
+	int mapped = 0, converted = 0;
+
+	bool Find(const String& name, GGUFTensor& t) const;
+	void Map(const String& name, const GGUFTensor& t, int64 begin, Volume& v, int width, int height, int depth);
+
+public:
+	GGUFMapper(const GGUFFile& file) : file(file) {}
+
+	virtual void Tensor(const String& name, Volume& v, int ne0, int ne1 = 1);
+	virtual void Filters(const String& name, Vector<Volume>& filters);
+
+	const Vector<String>& GetMissing() const {return missing;}
+	const Vector<String>& GetErrors() const {return errors;}
+	bool IsMissing(const String& name) const;
+	int GetMappedCount() const {return mapped;}
+	int GetConvertedCount() const {return converted;}
+};
+
+// Writes the visited volumes and the metadata into a GGUF file (version 3). The tensors
+// are stored with the type of Real, so that GGUFMapper maps them back without copying.
+// Non-negative int values are written as UINT32, like the hyperparameters of llama.cpp
+// models, and double values as FLOAT64.
+class GGUFWriter : public GGUFTensorVisitor {
+	struct Item : Moveable<Item> {
+		String name;
+		int dims = 0;
+		int64 ne[4] = {1, 1, 1, 1};
+		const Real* data = NULL;
+		Vector<Real> buffer;
+	};
+
+	VectorMap<String, Value> values;
+	Vector<Item> items;
+	int alignment = 32;
+
+public:
+	GGUFWriter& Set(const String& key, const Value& v) {values.GetAdd(key) = v; return *this;}
+	GGUFWriter& SetAlignment(int i) {alignment = i; return *this;}
+
+	virtual void Tensor(const String& name, Volume& v, int ne0, int ne1 = 1);
+	virtual void Filters(const String& name, Vector<Volume>& filters);
+
+	bool Save(const String& path);
+};
+
+}
+
+#endif
@@ -0,0 +1,235 @@
+#include "LayerBase.h"
+
+namespace ConvNet {
+
+// Register tile (GEMM_MR x GEMM_NR accumulators) and cache blocking sizes.
+// The A block (GEMM_MC x GEMM_KC) is meant to stay in L2 and one B panel
+// (GEMM_KC x GEMM_NR) in L1, while the whole packed B block streams from L3.
+enum {
+	GEMM_MR = 4,
+	GEMM_NR = 8,
+	GEMM_MC = 128,
+	GEMM_KC = 256,
+	GEMM_NC = 1024
+};
+
+template <class T>
+static void GemmPackA(bool trans, const T* a, int lda, int mc, int kc, T* pa) {
+	for (int i0 = 0; i0 < mc; i0 += GEMM_MR) {
+		int mr = min((int)GEMM_MR, mc - i0);
+		for (int p = 0; p < kc; p++) {
+			for (int i = 0; i < mr; i++)
+				pa[i] = trans ? a[p * lda + i0 + i] : a[(i0 + i) * lda + p];
+			for (int i = mr; i < GEMM_MR; i++)
+				pa[i] = 0.0;
+			pa += GEMM_MR;
+		}
+	}
+}
+
+template <class T>
+static void GemmPackB(bool trans, const T* b, int ldb, int kc, int nc, T* pb) {
+	for (int j0 = 0; j0 < nc; j0 += GEMM_NR) {
+		int nr = min((int)GEMM_NR, nc - j0);
+		for (int p = 0; p < kc; p++) {
+			for (int j = 0; j < nr; j++)
+				pb[j] = trans ? b[(j0 + j) * ldb + p] : b[p * ldb + j0 + j];
+			for (int j = nr; j < GEMM_NR; j++)
+				pb[j] = 0.0;
+			pb += GEMM_NR;
+		}
+	}
+}
+
+template <class T>
+static inline void GemmKernel(int kc, const T* pa, const T* pb,
+	T alpha, T* c, int ldc, int mr, int nr) {
+	T acc[GEMM_MR][GEMM_NR];
+	for (int i = 0; i < GEMM_MR; i++)
+		for (int j = 0; j < GEMM_NR; j++)
+			acc[i][j] = 0.0;
+
+	for (int p = 0; p < kc; p++) {
+		for (int i = 0; i < GEMM_MR; i++) {
+			T ai = pa[i];
+			for (int j = 0; j < GEMM_NR; j++)
+				acc[i][j] += ai * pb[j];
+		}
+		pa += GEMM_MR;
+		pb += GEMM_NR;
+	}
+
+	for (int i = 0; i < mr; i++) {
+		T* ci = c + i * ldc;
+		for (int j = 0; j < nr; j++)
+			ci[j] += alpha * acc[i][j];
+	}
+}
+
+// packing buffers are reused between calls, so the steady state doesn't allocate
+template <class T>
+static void GemmPackBuffers(T*& pa, T*& pb) {
+	static thread_local Vector<T> pack_a, pack_b;
+	SetBufferCount(pack_a, GEMM_MC * GEMM_KC);
+	SetBufferCount(pack_b, GEMM_KC * GEMM_NC);
+	pa = pack_a.Begin();
+	pb = pack_b.Begin();
+}
+
+template <class T>
+void GemmPlan() {
+	T* pa;
+	T* pb;
+	GemmPackBuffers(pa, pb);
+}
+
+template <class T>
+void Gemm(bool trans_a, bool trans_b, int m, int n, int k,
+	T alpha, const T* a, int lda, const T* b, int ldb,
+	T beta, T* c, int ldc) {
+
+	// scale C first, so that the blocked loop below only ever accumulates
+	for (int i = 0; i < m; i++) {
+		T* ci = c + i * ldc;
+		if (beta == 0.0)
+			for (int j = 0; j < n; j++) ci[j] = 0.0;
+		else if (beta != 1.0)
+			for (int j = 0; j < n; j++) ci[j] *= beta;
+	}
+	if (alpha == 0.0 || k == 0)
+		return;
+
+	T* pa;
+	T* pb;
+	GemmPackBuffers(pa, pb);
+
+	for (int j0 = 0; j0 < n; j0 += GEMM_NC) {
+		int nc = min((int)GEMM_NC, n - j0);
+
+		for (int p0 = 0; p0 < k; p0 += GEMM_KC) {
+			int kc = min((int)GEMM_KC, k - p0);
+			const T* b_block = trans_b ? b + j0 * ldb + p0 : b + p0 * ldb + j0;
+			GemmPackB(trans_b, b_block, ldb, kc, nc, pb);
+
+			for (int i0 = 0; i0 < m; i0 += GEMM_MC) {
+				int mc = min((int)GEMM_MC, m - i0);
+				const T* a_block = trans_a ? a + p0 * lda + i0 : a + i0 * lda + p0;
+				GemmPackA(trans_a, a_block, lda, mc, kc, pa);
+
+				for (int jr = 0; jr < nc; jr += GEMM_NR) {
+					int nr = min((int)GEMM_NR, nc - jr);
+					const T* pb_panel = pb + jr * kc;
+
+					for (int ir = 0; ir < mc; ir += GEMM_MR) {
+						int mr = min((int)GEMM_MR, mc - ir);
+						GemmKernel(kc, pa + ir * kc, pb_panel, alpha,
+							c + (i0 + ir) * ldc + j0 + jr, ldc, mr, nr);
+					}
+				}
+			}
+		}
+	}
+}
+
+template <class T>
+void ParallelGemm(int thread_count, bool trans_a, bool trans_b, int m, int n, int k,
+	T alpha, const T* a, int lda, const T* b, int ldb,
+	T beta, T* c, int ldc) {
+	// the larger dimension of C is split, into blocks which are wide enough for the
+	// register tiles of the kernel
+	bool rows = m > n;
+	int blocks = min(thread_count, (rows ? m : n) / 32);
+	if (blocks <= 1) {
+		Gemm<T>(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+		return;
+	}
+	CoWork co;
+	for (int i = 0; i < blocks; i++) {
+		int size = rows ? m : n;
+		int i0 = (int)((int64)size * i / blocks);
+		int i1 = (int)((int64)size * (i + 1) / blocks);
+		if (rows) {
+			const T* ai = trans_a ? a + i0 : a + (int64)i0 * lda;
+			co & [=] {
+				Gemm<T>(trans_a, trans_b, i1 - i0, n, k, alpha, ai, lda, b, ldb, beta, c + (int64)i0 * ldc, ldc);
+			};
+		}
+		else {
+			const T* bi = trans_b ? b + (int64)i0 * ldb : b + i0;
+			co & [=] {
+				Gemm<T>(trans_a, trans_b, m, i1 - i0, k, alpha, a, lda, bi, ldb, beta, c + i0, ldc);
+			};
+		}
+	}
+}
+
+template <class T>
+void Im2Col(const T* in, int in_width, int in_height, int in_depth,
+	int filter_width, int filter_height, int stride, int pad,
+	int out_width, int out_height, T* col) {
+
+	int y = -pad;
+	for (int ay = 0; ay < out_height; y += stride, ay++) {
+		int x = -pad;
+		for (int ax = 0; ax < out_width; x += stride, ax++) {
+			for (int fy = 0; fy < filter_height; fy++) {
+				int oy = y + fy;
+				if (oy < 0) oy = 0;
+				else if (oy >= in_height) oy = in_height - 1;
+
+				for (int fx = 0; fx < filter_width; fx++) {
+					int ox = x + fx;
+					if (ox < 0) ox = 0;
+					else if (ox >= in_width) ox = in_width - 1;
+
+					// depth is the innermost dimension in both the volume and the filter
+					const T* src = in + ((in_width * oy) + ox) * in_depth;
+					for (int fd = 0; fd < in_depth; fd++)
+						col[fd] = src[fd];
+					col += in_depth;
+				}
+			}
+		}
+	}
+}
+
+template <class T>
+void Col2Im(const T* col, int in_width, int in_height, int in_depth,
+	int filter_width, int filter_height, int stride, int pad,
+	int out_width, int out_height, T* in) {
+
+	int y = -pad;
+	for (int ay = 0; ay < out_height; y += stride, ay++) {
+		int x = -pad;
+		for (int ax = 0; ax < out_width; x += stride, ax++) {
+			for (int fy = 0; fy < filter_height; fy++) {
+				int oy = y + fy;
+				if (oy < 0) oy = 0;
+				else if (oy >= in_height) oy = in_height - 1;
+
+				for (int fx = 0; fx < filter_width; fx++) {
+					int ox = x + fx;
+					if (ox < 0) ox = 0;
+					else if (ox >= in_width) ox = in_width - 1;
+
+					T* dst = in + ((in_width * oy) + ox) * in_depth;
+					for (int fd = 0; fd < in_depth; fd++)
+						dst[fd] += col[fd];
+					col += in_depth;
+				}
+			}
+		}
+	}
+}
+
+#define GEMM_INSTANTIATE(T) \
+	template void GemmPlan<T>(); \
+	template void Gemm<T>(bool, bool, int, int, int, T, const T*, int, const T*, int, T, T*, int); \
+	template void ParallelGemm<T>(int, bool, bool, int, int, int, T, const T*, int, const T*, int, T, T*, int); \
+	template void Im2Col<T>(const T*, int, int, int, int, int, int, int, int, int, T*); \
+	template void Col2Im<T>(const T*, int, int, int, int, int, int, int, int, int, T*);
+
+GEMM_INSTANTIATE(float)
+GEMM_INSTANTIATE(double)
+
+}
@@ -0,0 +1,52 @@
+#ifndef _ConvNet_Gemm_h_
+#define _ConvNet_Gemm_h_
+
+namespace ConvNet {
+
+/*
+	Dense matrix kernels for the lowered convolution.
+
+	All matrices are row-major. Gemm computes
+		C = alpha * op(A) * op(B) + beta * C
+	where op(A) is m x k and op(B) is k x n. Blocks of A and B are packed into
+	contiguous panels, which are then consumed by a small register-tiled kernel.
+
+	Im2Col lowers a (width, height, depth) volume into a matrix, which has one row per
+	output position and one column per filter weight. Out-of-bounds coordinates are
+	clamped to the edge, exactly like the reference loop in ConvLayer.cpp does.
+	Col2Im is the adjoint of Im2Col: it accumulates the columns back into the volume.
+
+	The kernels are instantiated for float and double in Gemm.cpp.
+	GemmPlan allocates the packing buffers of the calling thread in advance.
+
+	ParallelGemm splits the rows or the columns of C into blocks, which are computed with Gemm in the
+	threads of CoWork. Every element of C is computed like Gemm does, so the result doesn't
+	depend on the thread count.
+*/
+
+template <class T>
+void GemmPlan();
+
+template <class T>
+void Gemm(bool trans_a, bool trans_b, int m, int n, int k,
+	T alpha, const T* a, int lda, const T* b, int ldb,
+	T beta, T* c, int ldc);
+
+template <class T>
+void ParallelGemm(int thread_count, bool trans_a, bool trans_b, int m, int n, int k,
+	T alpha, const T* a, int lda, const T* b, int ldb,
+	T beta, T* c, int ldc);
+
+template <class T>
+void Im2Col(const T* in, int in_width, int in_height, int in_depth,
+	int filter_width, int filter_height, int stride, int pad,
+	int out_width, int out_height, T* col);
+
+template <class T>
+void Col2Im(const T* col, int in_width, int in_height, int in_depth,
+	int filter_width, int filter_height, int stride, int pad,
+	int out_width, int out_height, T* in);
+
+}
+
+#endif
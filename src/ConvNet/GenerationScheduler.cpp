@@ -0,0 +1,239 @@
+#include "ConvNet.h"
+
+namespace ConvNet {
+
+int GenerationScheduler::Submit(const Vector<int>& prompt, const GenerationParams& params) {
+	ASSERT(!prompt.IsEmpty());
+
+	// the context of the model has room for one generated token after the prompt
+	int begin = max(0, prompt.GetCount() - (model.GetMaxSeqLen() - 1));
+
+	lock.Enter();
+	int id = next_id++;
+	Vector<int>& tokens = params.max_tokens > 0 ? queue.Add().tokens : results.Add(id);
+	for (int i = begin; i < prompt.GetCount(); i++)
+		tokens.Add(prompt[i]);
+	if (params.max_tokens > 0) {
+		queue.Top().id = id;
+		queue.Top().params = params;
+		work_cond.Signal();
+	}
+	lock.Leave();
+	return id;
+}
+
+bool GenerationScheduler::StepBatch() {
+	lock.Enter();
+	while (active.GetCount() < max_batch && !queue.IsEmpty())
+		active.Add(queue.Detach(0));
+	lock.Leave();
+	if (active.IsEmpty())
+		return false;
+
+	TimeStop ts;
+
+	// the generating sequences give their last token, and the rest of the budget of the
+	// step goes to the prompts of the new sequences in the order of their activation
+	int budget = max_step_tokens;
+	step_seqs.SetCount(0);
+	step_counts.SetCount(0);
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < active.GetCount(); i++) {
+			Sequence& s = active[i];
+			int pending = s.tokens.GetCount() - s.cache.GetCount();
+			if ((pass == 0) != (pending == 1))
+				continue;
+			int n = pass == 0 ? 1 : min(pending, budget);
+			if (n <= 0)
+				continue;
+			budget -= n;
+			step_seqs.Add(i);
+			step_counts.Add(n);
+		}
+	}
+
+	int seq_count = step_seqs.GetCount();
+	step_caches.SetCount(seq_count);
+	step_tokens.SetCount(seq_count);
+	for (int j = 0; j < seq_count; j++) {
+		Sequence& s = active[step_seqs[j]];
+		int begin = s.cache.GetCount();
+		step_caches[j] = &s.cache;
+		step_tokens[j].SetCount(step_counts[j]);
+		for (int k = 0; k < step_counts[j]; k++)
+			step_tokens[j][k] = s.tokens[begin + k];
+	}
+
+	Volume& out = model.Decode(step_caches, step_tokens);
+
+	// the sequences whose prompt is decoded sample their next token
+	int vocab_size = model.GetVocabSize();
+	int max_seq_len = model.GetMaxSeqLen();
+	bool finished = false;
+	logits.SetCount(vocab_size);
+	for (int j = 0; j < seq_count; j++) {
+		Sequence& s = active[step_seqs[j]];
+		if (s.cache.GetCount() < s.tokens.GetCount())
+			continue;
+		for (int v = 0; v < vocab_size; v++)
+			logits[v] = out.Get(v * seq_count + j);
+		const GenerationParams& p = s.params;
+		int token = model.SampleNextToken(logits, p.temperature, p.top_k, p.k, p.nucleus, p.p);
+		s.tokens.Add(token);
+		s.generated++;
+		generated_count++;
+		WhenToken(s.id, token);
+		if (s.generated >= p.max_tokens || token == p.stop_token || s.tokens.GetCount() >= max_seq_len)
+			finished = s.finished = true;
+	}
+
+	step_count++;
+	batch_total += seq_count;
+	step_seconds += ts.Seconds();
+
+	// the finished sequences leave the batch, and their caches are freed
+	if (finished) {
+		lock.Enter();
+		for (int i = active.GetCount() - 1; i >= 0; i--) {
+			Sequence& s = active[i];
+			if (s.finished) {
+				results.Add(s.id, pick(s.tokens));
+				active.Remove(i);
+			}
+		}
+		done_cond.Broadcast();
+		lock.Leave();
+	}
+	return true;
+}
+
+bool GenerationScheduler::Step() {
+	lock.Enter();
+	while (stepping)
+		done_cond.Wait(lock);
+	stepping = true;
+	lock.Leave();
+
+	bool b = StepBatch();
+
+	lock.Enter();
+	EndStep();
+	lock.Leave();
+	return b;
+}
+
+// Called with the lock held. The worker sleeps while another thread steps, so it is woken too.
+void GenerationScheduler::EndStep() {
+	stepping = false;
+	done_cond.Broadcast();
+	work_cond.Signal();
+}
+
+void GenerationScheduler::Run() {
+	lock.Enter();
+	while (!stop) {
+		if (stepping || (queue.IsEmpty() && active.IsEmpty())) {
+			work_cond.Wait(lock);
+			continue;
+		}
+		stepping = true;
+		lock.Leave();
+
+		StepBatch();
+
+		lock.Enter();
+		EndStep();
+	}
+	lock.Leave();
+}
+
+void GenerationScheduler::Start() {
+	ASSERT(!running);
+	stop = false;
+	running = true;
+	thread.Run([this] {Run();});
+}
+
+void GenerationScheduler::Stop() {
+	if (!running)
+		return;
+	lock.Enter();
+	stop = true;
+	work_cond.Broadcast();
+	lock.Leave();
+	thread.Wait();
+
+	// the callers of Wait continue the steps themselves
+	lock.Enter();
+	running = false;
+	done_cond.Broadcast();
+	lock.Leave();
+}
+
+bool GenerationScheduler::IsPending(int id) const {
+	for (int i = 0; i < queue.GetCount(); i++)
+		if (queue[i].id == id)
+			return true;
+	for (int i = 0; i < active.GetCount(); i++)
+		if (active[i].id == id)
+			return true;
+	return false;
+}
+
+bool GenerationScheduler::IsFinished(int id) {
+	lock.Enter();
+	bool b = results.Find(id) >= 0;
+	lock.Leave();
+	return b;
+}
+
+Vector<int> GenerationScheduler::Wait(int id) {
+	lock.Enter();
+	for (;;) {
+		int i = results.Find(id);
+		if (i >= 0) {
+			Vector<int> tokens = pick(results[i]);
+			results.Remove(i);
+			lock.Leave();
+			return tokens;
+		}
+		if (!IsPending(id)) {
+			lock.Leave();
+			Panic("GenerationScheduler: unknown sequence " + IntStr(id));
+		}
+		if (running || stepping) {
+			done_cond.Wait(lock);
+			continue;
+		}
+		stepping = true;
+		lock.Leave();
+
+		StepBatch();
+
+		lock.Enter();
+		EndStep();
+	}
+}
+
+int GenerationScheduler::GetActiveCount() {
+	lock.Enter();
+	int n = active.GetCount();
+	lock.Leave();
+	return n;
+}
+
+int GenerationScheduler::GetQueuedCount() {
+	lock.Enter();
+	int n = queue.GetCount();
+	lock.Leave();
+	return n;
+}
+
+void GenerationScheduler::ResetStats() {
+	step_count = 0;
+	generated_count = 0;
+	batch_total = 0;
+	step_seconds = 0;
+}
+
+}
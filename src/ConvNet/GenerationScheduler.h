@@ -0,0 +1,114 @@
+#ifndef _ConvNet_GenerationScheduler_h_
+#define _ConvNet_GenerationScheduler_h_
+
+#include "GptLayers.h"
+
+namespace ConvNet {
+
+// The sampling of one generated sequence
+struct GenerationParams {
+	double temperature = 1.0;	// <= 0 picks the most probable token
+	bool top_k = false;
+	int k = 50;
+	bool nucleus = false;
+	double p = 0.9;
+	int max_tokens = 50;
+	int stop_token = -1;	// ends the sequence after it is generated, if it is >= 0
+};
+
+// Generates the text of many prompts with continuous batching.
+//
+// Every Step is one decoder step (GPTModel::Decode) of all active sequences together: the
+// sequences which are generating give their last token, and the new ones a chunk of their
+// prompt, up to max_step_tokens tokens in a step. The sequences are activated in the order
+// of submission when there is room in the batch, and they leave it as soon as they are
+// finished, so the batch doesn't wait for its longest sequence.
+//
+// Submit and Wait can be called from any thread. The steps are run either by the thread of
+// Start, or by the callers of Wait when the scheduler isn't started. WhenToken is called in
+// the thread of the step with the id and each generated token. The model must not be used
+// elsewhere while the scheduler has sequences.
+class GenerationScheduler {
+	struct Sequence {
+		int id = -1;
+		GenerationParams params;
+		Vector<int> tokens;		// the prompt and the generated tokens
+		int generated = 0;
+		bool finished = false;
+		GPTCache cache;
+	};
+
+	GPTModel& model;
+	Array<Sequence> queue, active;
+	VectorMap<int, Vector<int>> results;
+	Mutex lock;
+	ConditionVariable work_cond, done_cond;
+	Thread thread;
+	int max_batch = 16;
+	int max_step_tokens = 256;
+	int next_id = 0;
+	bool running = false;
+	bool stop = false;
+	bool stepping = false;
+
+	// the step
+	Vector<GPTCache*> step_caches;
+	Vector<Vector<int>> step_tokens;
+	Vector<int> step_seqs, step_counts;
+	Vector<double> logits;
+
+	// statistics
+	int64 step_count = 0, generated_count = 0, batch_total = 0;
+	double step_seconds = 0;
+
+	void Run();
+	bool StepBatch();
+	void EndStep();
+	bool IsPending(int id) const;
+
+public:
+	typedef GenerationScheduler CLASSNAME;
+	GenerationScheduler(GPTModel& model) : model(model) {}
+	~GenerationScheduler() {Stop();}
+
+	GenerationScheduler& SetMaxBatch(int i) {max_batch = max(1, i); return *this;}
+	GenerationScheduler& SetMaxStepTokens(int i) {max_step_tokens = max(1, i); return *this;}
+	GenerationScheduler& SetThreadCount(int i) {model.SetThreadCount(i); return *this;}
+
+	// Adds a prompt to the queue and returns the id of its sequence. The prompt is cut to
+	// the last max_seq_len - 1 tokens of the model.
+	int Submit(const Vector<int>& prompt, const GenerationParams& params = GenerationParams());
+
+	// One decoder step of the active sequences. Returns false if there was nothing to do.
+	bool Step();
+
+	// Runs the steps in a worker thread, until Stop
+	void Start();
+	void Stop();
+
+	bool IsFinished(int id);
+
+	// Blocks until the sequence is finished, and returns the prompt and the generated
+	// tokens. The sequence is forgotten afterwards.
+	Vector<int> Wait(int id);
+
+	Vector<int> Generate(const Vector<int>& prompt, const GenerationParams& params = GenerationParams()) {return Wait(Submit(prompt, params));}
+
+	Callback2<int, int> WhenToken;
+
+	int GetMaxBatch() const {return max_batch;}
+	int GetMaxStepTokens() const {return max_step_tokens;}
+	bool IsRunning() const {return running;}
+	int GetActiveCount();
+	int GetQueuedCount();
+
+	int64 GetStepCount() const {return step_count;}
+	int64 GetGeneratedCount() const {return generated_count;}
+	double GetAverageBatch() const {return step_count ? (double)batch_total / step_count : 0;}
+	double GetTokensPerSecond() const {return step_seconds > 0 ? generated_count / step_seconds : 0;}
+	void ResetStats();
+};
+
+}
+
+#endif
@@ -1,83 +1,330 @@
-#include "GptLayers.h"
+#include "ConvNet.h"
 #include <algorithm>
 #include <cmath>
 #include <random>
 
 namespace ConvNet {
 
+GPTCache& GPTCache::operator=(const GPTCache& src) {
+    layers.SetCount(src.layers.GetCount());
+    for (int i = 0; i < layers.GetCount(); i++)
+        layers[i].Set(src.layers[i]);
+    tokens <<= src.tokens;
+    return *this;
+}
+
+void GPTCache::Init(int layer_count) {
+    layers.SetCount(layer_count);
+    Clear();
+}
+
+void GPTCache::Clear() {
+    Truncate(0);
+}
+
+void GPTCache::Truncate(int n) {
+    ASSERT(n >= 0 && n <= tokens.GetCount());
+    tokens.SetCount(n);
+    for (int i = 0; i < layers.GetCount(); i++)
+        layers[i].Truncate(n);
+}
+
+int GPTCache::GetCommonPrefix(const Vector<int>& context) const {
+    int n = min(context.GetCount(), tokens.GetCount());
+    for (int i = 0; i < n; i++)
+        if (context[i] != tokens[i])
+            return i;
+    return n;
+}
+
+int64 GPTCache::GetMemory() const {
+    int64 memory = tokens.GetAlloc() * sizeof(int);
+    for (int i = 0; i < layers.GetCount(); i++)
+        memory += layers[i].GetMemory();
+    return memory;
+}
+
 GPTModel::GPTModel(int vocab_size, int embed_dim, int num_heads, 
                    int num_layers, int ff_dim, int max_seq_len, 
                    double dropout_rate)
     : vocab_size(vocab_size), embed_dim(embed_dim), num_heads(num_heads),
       num_layers(num_layers), ff_dim(ff_dim), max_seq_len(max_seq_len),
-      dropout_rate(dropout_rate) {
+      dropout_rate(dropout_rate),
+      positional_encoding(max_seq_len, embed_dim) {
+    InitLayers();
     
-    // Initialize the transformer with equal source and target vocab sizes
-    // For GPT, source and target are the same (autoregressive language modeling)
-    transformer = CreateTransformer(vocab_size, vocab_size, embed_dim, num_heads,
-                                   num_layers, num_layers, ff_dim, max_seq_len, 
-                                   dropout_rate);
+    // Initialize the token embeddings with one row per token
+    RandomGaussian& rand = GetRandomGaussian(embed_dim);
+    for (int i = 0; i < token_embeddings.GetLength(); i++)
+        token_embeddings.Set(i, rand);
     
     // Initialize output weights (tied with input embeddings in many GPT implementations)
-    output_weights.Init(vocab_size, embed_dim, 1);
-    output_weights.FillRandom();
+    UpdateOutputWeights();
+}
+
+GPTModel::GPTModel()
+    : vocab_size(0), embed_dim(0), num_heads(0), num_layers(0), ff_dim(0), max_seq_len(0),
+      dropout_rate(0.1), positional_encoding(0, 0) {
+}
+
+void GPTModel::InitLayers() {
+    decoder_layers.Clear();
+    for (int i = 0; i < num_layers; i++)
+        decoder_layers.Add(new DecoderLayerCRTP(embed_dim, num_heads, ff_dim, dropout_rate)).SetThreadCount(thread_count);
+    token_embeddings.Init(embed_dim, vocab_size, 1, 0.0);
+    output_weights.Init(embed_dim, vocab_size, 1, 0.0);
+    final_norm_weights.Init(embed_dim, 1, 1, 1.0);
+    final_norm_biases.Init(embed_dim, 1, 1, 0.0);
+}
+
+void GPTModel::UpdateOutputWeights() {
+    output_weights.SetWeights(token_embeddings);
+}
+
+void GPTModel::Embed(const Vector<int>& token_ids, int column, int position, Volume& out) {
+    // Look up the embeddings of the tokens as the columns column ... of [embed_dim, 1, seq_len]
+    int seq_len = out.GetDepth();
+    ASSERT(out.GetWidth() == embed_dim && column + token_ids.GetCount() <= seq_len);
+    const Real* emb = token_embeddings.GetWeights().Begin();
+    Real* x = out.GetWeights().Begin() + column;
+    for (int t = 0; t < token_ids.GetCount(); t++) {
+        int token = token_ids[t];
+        ASSERT(token >= 0 && token < vocab_size);
+        const Real* row = emb + (int64)token * embed_dim;
+        for (int i = 0; i < embed_dim; i++)
+            x[(int64)i * seq_len + t] = row[i];
+    }
+    positional_encoding.AddEncodings(out, column, token_ids.GetCount(), position);
+}
+
+void GPTModel::Project(const Volume& x, Volume& out) {
+    // Final layer normalization and the logits: [vocab_size x embed_dim] * [embed_dim x seq_len]
+    hidden = x;
+    ApplyLayerNorm(hidden, final_norm_weights, final_norm_biases);
+    int seq_len = hidden.GetDepth();
+    out.SetSize(vocab_size, 1, seq_len);
+    ParallelGemm<Real>(thread_count, false, false, vocab_size, seq_len, embed_dim,
+        (Real)1, output_weights.GetWeights().Begin(), embed_dim, hidden.GetWeights().Begin(), seq_len,
+        (Real)0, out.GetWeights().Begin(), seq_len);
 }
 
 Volume& GPTModel::Forward(Volume& input_tokens, bool is_training) {
-    // For GPT, we pass the same sequence as both source and target
-    // This implements the causal language modeling objective
-    
-    // In a real implementation, we would:
-    // 1. Create causal mask to prevent attending to future tokens
-    // 2. Pass input through the transformer
-    // 3. Apply final linear layer to convert embeddings to logits
-    
-    // For now, we'll use the base transformer forward
-    // Note: This is simplified - real GPT would have specific handling for causal masking
-    return transformer->Forward(input_tokens, input_tokens, is_training);
+    Vector<int> token_ids;
+    for (int i = 0; i < input_tokens.GetCount(); i++)
+        token_ids.Add((int)input_tokens.Get(i));
+    embedded.SetSize(embed_dim, 1, token_ids.GetCount());
+    Embed(token_ids, 0, 0, embedded);
+    
+    // The decoder layers mask the future positions
+    Volume* current = &embedded;
+    for (int i = 0; i < decoder_layers.GetCount(); i++)
+        current = &decoder_layers[i].Forward(*current, is_training);
+    
+    Project(*current, logits);
+    return logits;
 }
 
 Volume& GPTModel::Generate(Volume& context, int max_new_tokens) {
-    // Autoregressive generation: generate one token at a time
-    // This is a simplified version - a full implementation would be more complex
-    
-    Volume current_context = context;  // Copy the input context
-    
-    for (int i = 0; i < max_new_tokens; i++) {
-        // Get next token logits
-        Volume& logits = GetNextTokenLogits({});  // This would need proper implementation
-        
-        // Sample next token
-        // This would sample from the logits distribution
+    // Autoregressive generation: one decoder step per token with the cache
+    Vector<int> tokens;
+    for (int i = 0; i < context.GetCount(); i++)
+        tokens.Add((int)context.Get(i));
+    ASSERT(!tokens.IsEmpty());
+    
+    GPTCache cache;
+    Volume* next = &GetNextTokenLogits(tokens, cache);
+    Vector<double> values;
+    for (int i = 0; i < max_new_tokens && tokens.GetCount() < max_seq_len; i++) {
+        values.SetCount(vocab_size);
+        for (int j = 0; j < vocab_size; j++)
+            values[j] = next->Get(j);
+        int token = SampleNextToken(values);
+        tokens.Add(token);
+        if (i + 1 < max_new_tokens && tokens.GetCount() < max_seq_len)
+            next = &Decode(token, cache);
     }
     
     // Return the completed sequence
-    return current_context;
+    generated.Init(1, 1, tokens.GetCount(), 0.0);
+    for (int i = 0; i < tokens.GetCount(); i++)
+        generated.Set(i, tokens[i]);
+    return generated;
+}
+
+// Copies the last max_seq_len tokens of a longer context into window
+static bool CutContext(const Vector<int>& context, int max_seq_len, Vector<int>& window) {
+    if (context.GetCount() <= max_seq_len)
+        return false;
+    window.Clear();
+    window.Append(context, context.GetCount() - max_seq_len, max_seq_len);
+    return true;
 }
 
 Volume& GPTModel::GetNextTokenLogits(const Vector<int>& context) {
-    // Convert context tokens to volume
-    Volume context_volume = PrepareInputs(context);
+    // Forward the whole context, and take the logits of the last position
+    ASSERT(!context.IsEmpty());
+    Vector<int> window;
+    if (CutContext(context, max_seq_len, window))
+        return GetNextTokenLogits(window);
+    Volume tokens(1, 1, context.GetCount(), 0.0);
+    for (int i = 0; i < context.GetCount(); i++)
+        tokens.Set(i, context[i]);
+    Volume& all = Forward(tokens, false);
+    
+    int seq_len = all.GetDepth();
+    next_logits.SetSize(vocab_size, 1, 1);
+    for (int i = 0; i < vocab_size; i++)
+        next_logits.Set(i, all.Get(i * seq_len + seq_len - 1));
+    return next_logits;
+}
+
+// The start of the tokens of the cache in the context, where the window from there to the
+// end of the context fits in max_seq_len tokens, or -1
+static int FindCachedWindow(const Vector<int>& context, const Vector<int>& cached, int max_seq_len) {
+    int count = context.GetCount();
+    int m = cached.GetCount();
+    for (int start = count - m; m > 0 && start >= max(0, count - max_seq_len); start--) {
+        int i = 0;
+        while (i < m && context[start + i] == cached[i])
+            i++;
+        if (i == m)
+            return start;
+    }
+    return -1;
+}
+
+Volume& GPTModel::GetNextTokenLogits(const Vector<int>& context, GPTCache& cache) {
+    ASSERT(!context.IsEmpty());
+    
+    // a longer context keeps the window of the cache while it fits, and then starts again
+    // with its last half, so the whole window is decoded once per max_seq_len / 2 tokens
+    if (context.GetCount() > max_seq_len) {
+        int start = FindCachedWindow(context, cache.GetTokens(), max_seq_len);
+        if (start < 0) {
+            cache.Clear();
+            start = context.GetCount() - max(1, max_seq_len / 2);
+        }
+        Vector<int> window;
+        window.Append(context, start, context.GetCount() - start);
+        return GetNextTokenLogits(window, cache);
+    }
+    int n = cache.GetCommonPrefix(context);
     
-    // Forward through transformer
-    Volume& embeddings = transformer->Forward(context_volume, context_volume, false);
+    // the logits of the whole cached context need the step of its last token again
+    if (n == context.GetCount())
+        n--;
+    cache.Truncate(n);
     
-    // Apply final linear projection to vocab size
-    // This would be a matrix multiplication: embeddings * output_weights^T
-    // For now, return the embeddings as placeholder
-    return embeddings;
+    Vector<int> rest;
+    for (int i = n; i < context.GetCount(); i++)
+        rest.Add(context[i]);
+    return Decode(rest, cache);
+}
+
+Volume& GPTModel::Decode(const Vector<int>& tokens, GPTCache& cache) {
+    step_caches.SetCount(1);
+    step_tokens.SetCount(1);
+    step_caches[0] = &cache;
+    step_tokens[0] <<= tokens;
+    return Decode(step_caches, step_tokens);
+}
+
+Volume& GPTModel::Decode(int token, GPTCache& cache) {
+    step_caches.SetCount(1);
+    step_tokens.SetCount(1);
+    step_caches[0] = &cache;
+    step_tokens[0].SetCount(1);
+    step_tokens[0][0] = token;
+    return Decode(step_caches, step_tokens);
+}
+
+Volume& GPTModel::Decode(const Vector<GPTCache*>& caches, const Vector<Vector<int>>& tokens) {
+    ASSERT(caches.GetCount() == tokens.GetCount() && !caches.IsEmpty());
+    int seq_count = caches.GetCount();
+    
+    // the tokens of all sequences are the columns of one volume
+    int count = 0;
+    step_counts.SetCount(seq_count);
+    for (int i = 0; i < seq_count; i++) {
+        ASSERT(!tokens[i].IsEmpty());
+        step_counts[i] = tokens[i].GetCount();
+        count += step_counts[i];
+    }
+    embedded.SetSize(embed_dim, 1, count);
+    int column = 0;
+    for (int i = 0; i < seq_count; i++) {
+        GPTCache& cache = *caches[i];
+        if (cache.GetLayerCount() != num_layers)
+            cache.Init(num_layers);
+        int position = cache.GetCount();
+        if (position + tokens[i].GetCount() > max_seq_len)
+            Panic("GPTModel::Decode: the sequence is longer than max_seq_len");
+        Embed(tokens[i], column, position, embedded);
+        column += tokens[i].GetCount();
+    }
+    
+    Volume* current = &embedded;
+    for (int i = 0; i < decoder_layers.GetCount(); i++) {
+        step_layers.SetCount(seq_count);
+        for (int j = 0; j < seq_count; j++)
+            step_layers[j] = &caches[j]->layers[i];
+        current = &decoder_layers[i].ForwardCached(*current, step_layers, step_counts);
+    }
+    for (int i = 0; i < seq_count; i++)
+        caches[i]->tokens.Append(tokens[i]);
+    
+    // only the last position of every sequence is projected to the vocabulary
+    last.SetSize(embed_dim, 1, seq_count);
+    column = 0;
+    for (int i = 0; i < seq_count; i++) {
+        column += step_counts[i];
+        for (int j = 0; j < embed_dim; j++)
+            last.Set(j * seq_count + i, current->Get(j * count + column - 1));
+    }
+    Project(last, next_logits);
+    return next_logits;
+}
+
+GPTModel& GPTModel::SetThreadCount(int i) {
+    thread_count = max(1, i);
+    for (int j = 0; j < decoder_layers.GetCount(); j++)
+        decoder_layers[j].SetThreadCount(thread_count);
+    return *this;
+}
+
+GPTModel& GPTModel::Quantize(int type) {
+    for (int i = 0; i < decoder_layers.GetCount(); i++)
+        decoder_layers[i].Quantize(type);
+    return *this;
+}
+
+GPTModel& GPTModel::Dequantize() {
+    for (int i = 0; i < decoder_layers.GetCount(); i++)
+        decoder_layers[i].Dequantize();
+    return *this;
 }
 
 int GPTModel::SampleNextToken(const Vector<double>& logits, double temperature, 
                               bool top_k, int k, bool nucleus, double p) {
+    // No temperature is greedy decoding, which would divide by zero below
+    if (temperature <= 0) {
+        int best = 0;
+        for (int i = 1; i < logits.GetCount(); i++)
+            if (logits[i] > logits[best])
+                best = i;
+        return best;
+    }
+    
     // Apply temperature scaling
-    Vector<double> scaled_logits = logits;
+    Vector<double> scaled_logits;
+    scaled_logits <<= logits;
     for (int i = 0; i < scaled_logits.GetCount(); i++) {
         scaled_logits[i] /= temperature;
     }
     
     // Apply softmax to get probabilities
-    Vector<double> probs(scaled_logits.GetCount());
+    Vector<double> probs;
+    probs.SetCount(scaled_logits.GetCount());
     double max_logit = scaled_logits[0];
     for (int i = 1; i < scaled_logits.GetCount(); i++) {
         if (scaled_logits[i] > max_logit) max_logit = scaled_logits[i];
@@ -98,7 +345,8 @@ int GPTModel::SampleNextToken(const Vector<double>& logits, double temperature,
     // Apply top-k or nucleus sampling if requested
     if (top_k && k > 0) {
         // Get indices sorted by probability
-        Vector<int> indices(probs.GetCount());
+        Vector<int> indices;
+        indices.SetCount(probs.GetCount());
         for (int i = 0; i < indices.GetCount(); i++) indices[i] = i;
         
         // Sort indices by probability (descending)
@@ -122,7 +370,8 @@ int GPTModel::SampleNextToken(const Vector<double>& logits, double temperature,
     
     if (nucleus && p > 0.0 && p < 1.0) {
         // Sort indices by probability (descending)
-        Vector<int> indices(probs.GetCount());
+        Vector<int> indices;
+        indices.SetCount(probs.GetCount());
         for (int i = 0; i < indices.GetCount(); i++) indices[i] = i;
         
         std::sort(indices.Begin(), indices.End(), 
@@ -169,17 +418,108 @@ int GPTModel::SampleNextToken(const Vector<double>& logits, double temperature,
 }
 
 Vector<ParametersAndGradients>& GPTModel::GetParameters() {
-    // Get transformer parameters
-    parameters = transformer->GetParametersAndGradients();
+    parameters.SetCount(0);
+    
+    // Add embedding parameters
+    parameters.Add().volume = &token_embeddings;
+    
+    // Add decoder layer parameters
+    for (int i = 0; i < decoder_layers.GetCount(); i++) {
+        Vector<ParametersAndGradients>& layer = decoder_layers[i].GetParametersAndGradients();
+        for (int j = 0; j < layer.GetCount(); j++)
+            parameters.Add() = layer[j];
+    }
     
-    // Add output weights
-    ParametersAndGradients output_weights_grad;
-    output_weights_grad.volume = &output_weights;
-    parameters.Add() = output_weights_grad;
+    // Add final normalization and output weights
+    parameters.Add().volume = &final_norm_weights;
+    parameters.Add().volume = &final_norm_biases;
+    parameters.Add().volume = &output_weights;
     
     return parameters;
 }
 
+void GPTModel::VisitTensors(GGUFTensorVisitor& v) {
+    v.Tensor("token_embd.weight", token_embeddings, embed_dim, vocab_size);
+    for (int i = 0; i < decoder_layers.GetCount(); i++)
+        decoder_layers[i].VisitTensors(v, Format("blk.%d.", i));
+    v.Tensor("output_norm.weight", final_norm_weights, embed_dim);
+    v.Tensor("output_norm.bias", final_norm_biases, embed_dim);
+    v.Tensor("output.weight", output_weights, embed_dim, vocab_size);
+}
+
+bool GPTModel::MapGGUF(std::shared_ptr<const GGUFFile> file) {
+    // the hyperparameters have the prefix of the architecture, like in llama.cpp
+    String arch = file->GetArchitecture();
+    const GGUFTensor* emb = file->FindTensor("token_embd.weight");
+    int e = file->GetInt(arch + ".embedding_length");
+    int heads = file->GetInt(arch + ".attention.head_count");
+    int layers = file->GetInt(arch + ".block_count");
+    int ff = file->GetInt(arch + ".feed_forward_length");
+    int ctx = file->GetInt(arch + ".context_length");
+    if (!emb || emb->dims != 2 || emb->ne[0] != e || e <= 0 || heads <= 0 || e % heads ||
+        layers <= 0 || ff <= 0 || ctx <= 0) {
+        LOG("GGUF: the file doesn't have a GPT model");
+        return false;
+    }
+    vocab_size = (int)emb->ne[1];
+    embed_dim = e;
+    num_heads = heads;
+    num_layers = layers;
+    ff_dim = ff;
+    max_seq_len = ctx;
+    
+    // the weight matrices are left empty for the mapper
+    decoder_layers.Clear();
+    for (int i = 0; i < num_layers; i++)
+        decoder_layers.Add(new DecoderLayerCRTP(0, 0, 0, dropout_rate))
+            .SetShape(embed_dim, num_heads, ff_dim).SetThreadCount(thread_count);
+    positional_encoding = PositionalEncodingCRTP(max_seq_len, embed_dim);
+    Volume* v[4] = {&token_embeddings, &output_weights, &final_norm_weights, &final_norm_biases};
+    for (int i = 0; i < 4; i++) {
+        v[i]->GetWeights().Clear();
+        v[i]->ReleaseGradients();
+    }
+    final_norm_weights.Init(embed_dim, 1, 1, 1.0);
+    final_norm_biases.Init(embed_dim, 1, 1, 0.0);
+    
+    GGUFMapper mapper(*file);
+    VisitTensors(mapper);
+    mapped_file = file;
+    
+    // without an output tensor, the output weights are tied to the embeddings
+    if (mapper.IsMissing("output.weight") && token_embeddings.GetCount()) {
+        if (token_embeddings.IsView())
+            output_weights.MapWeights(token_embeddings.GetWeights().Begin(), embed_dim, vocab_size, 1);
+        else
+            output_weights.SetWeights(token_embeddings);
+    }
+    
+    bool ok = mapper.GetErrors().IsEmpty();
+    for (int i = 0; i < mapper.GetErrors().GetCount(); i++)
+        LOG("GGUF: " << mapper.GetErrors()[i]);
+    for (int i = 0; i < mapper.GetMissing().GetCount(); i++) {
+        const String& name = mapper.GetMissing()[i];
+        if (!name.EndsWith(".bias") && name != "output.weight") {
+            LOG("GGUF: the tensor " << name << " is missing");
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+bool GPTModel::SaveGGUF(const String& path) {
+    String arch = "convnet-gpt";
+    GGUFWriter out;
+    out.Set("general.architecture", arch);
+    out.Set(arch + ".context_length", max_seq_len);
+    out.Set(arch + ".embedding_length", embed_dim);
+    out.Set(arch + ".feed_forward_length", ff_dim);
+    out.Set(arch + ".block_count", num_layers);
+    out.Set(arch + ".attention.head_count", num_heads);
+    VisitTensors(out);
+    return out.Save(path);
+}
+
 void GPTModel::Store(ValueMap& map) const {
     map.GetAdd("vocab_size") = vocab_size;
     map.GetAdd("embed_dim") = embed_dim;
@@ -189,11 +529,18 @@ void GPTModel::Store(ValueMap& map) const {
     map.GetAdd("max_seq_len") = max_seq_len;
     map.GetAdd("dropout_rate") = dropout_rate;
     
-    // Store transformer parameters
-    transformer->Store(map);
-    
-    // Store output weights
-    // This would require a serialization method for Volume
+    // Store the layers and the weights
+    ValueArray layers;
+    for (int i = 0; i < decoder_layers.GetCount(); i++) {
+        ValueMap layer;
+        decoder_layers[i].Store(layer);
+        layers.Add(layer);
+    }
+    map.GetAdd("decoder_layers") = layers;
+    map.GetAdd("token_embeddings") = StoreWeights(token_embeddings);
+    map.GetAdd("output_weights") = StoreWeights(output_weights);
+    map.GetAdd("final_norm_weights") = StoreWeights(final_norm_weights);
+    map.GetAdd("final_norm_biases") = StoreWeights(final_norm_biases);
 }
 
 void GPTModel::Load(const ValueMap& map) {
@@ -205,14 +552,18 @@ void GPTModel::Load(const ValueMap& map) {
     max_seq_len = map.GetValue(map.Find("max_seq_len"));
     dropout_rate = map.GetValue(map.Find("dropout_rate"));
     
-    // Recreate the transformer with loaded parameters
-    transformer = CreateTransformer(vocab_size, vocab_size, embed_dim, num_heads,
-                                   num_layers, num_layers, ff_dim, max_seq_len, 
-                                   dropout_rate);
-    
-    // Load transformer parameters
-    transformer->Load(map);
-    
+    // Recreate the layers with loaded parameters
+    InitLayers();
+    positional_encoding = PositionalEncodingCRTP(max_seq_len, embed_dim);
+    Value layers = map.GetValue(map.Find("decoder_layers"));
+    for (int i = 0; i < decoder_layers.GetCount() && i < layers.GetCount(); i++)
+        decoder_layers[i].Load(layers[i]);
+    LoadWeights(map, "token_embeddings", token_embeddings);
+    LoadWeights(map, "output_weights", output_weights);
+    LoadWeights(map, "final_norm_weights", final_norm_weights);
+    LoadWeights(map, "final_norm_biases", final_norm_biases);
+}
+
 void GPTModel::Serialize(Stream& s) {
     // Serialize model configuration
     s % vocab_size;
@@ -222,22 +573,20 @@ void GPTModel::Serialize(Stream& s) {
     s % ff_dim;
     s % max_seq_len;
     s % dropout_rate;
+    if (s.IsLoading()) {
+        InitLayers();
+        positional_encoding = PositionalEncodingCRTP(max_seq_len, embed_dim);
+    }
     
     // Serialize core components
-    if (transformer) {
-        s % (int)1;  // flag indicating transformer exists
-        transformer->Serialize(s);
-    } else {
-        s % (int)0;  // flag indicating no transformer
-    }
+    for (int i = 0; i < decoder_layers.GetCount(); i++)
+        decoder_layers[i].Serialize(s);
     
     // Serialize embedding layers
     s % token_embeddings;
     s % output_weights;
-}
-
-    // Load output weights
-    // This would require a deserialization method for Volume
+    s % final_norm_weights;
+    s % final_norm_biases;
 }
 
 Vector<int> GPTModel::Tokenize(const String& text) {
@@ -271,82 +620,54 @@ String GPTModel::Detokenize(const Vector<int>& tokens) {
     return text;
 }
 
-Volume& GPTModel::PrepareInputs(const Vector<int>& token_ids) {
-    // Convert token IDs to input volume
-    // This would typically involve embedding lookup
-    static Volume input_volume;
-    
-    // Initialize as [embed_dim, 1, sequence_length]
-    input_volume.Init(embed_dim, 1, token_ids.GetCount());
-    
-    // In a real implementation, this would look up embeddings for each token
-    // For now, we'll just fill with dummy values
-    for (int pos = 0; pos < token_ids.GetCount(); pos++) {
-        for (int dim = 0; dim < embed_dim; dim++) {
-            // This is a placeholder - would use actual embeddings in practice
-            input_volume.Set(dim, 0, pos, (double)token_ids[pos] / vocab_size);
-        }
-    }
-    
-    return input_volume;
-}
-
 GPTSession::GPTSession(std::unique_ptr<GPTModel> gpt_model) 
     : model(std::move(gpt_model)), learning_rate(3e-4), batch_size(16), sequence_length(256) {
 }
 
-void GPTSession::TrainBatch(const Vector<Volume>& inputs, const Vector<Volume>& targets) {
-    // In a real implementation, this would:
-    // 1. Forward pass through the model
-    // 2. Compute loss against targets
-    // 3. Backward pass to compute gradients
-    // 4. Update parameters using optimizer
-    
-    // For now, this is a placeholder
-    for (int i = 0; i < inputs.GetCount(); i++) {
-        Volume& output = model->Forward(inputs[i], true);
-        double loss = ComputeLoss(output, targets[i]);
-        // In a complete implementation, we would perform backprop and parameter updates here
-    }
-}
-
 double GPTSession::ComputeLoss(Volume& predictions, Volume& targets) {
-    // Compute cross-entropy loss between predictions and targets
-    // This is a simplified implementation
-    
-    int total_elements = predictions.GetSize();
-    if (total_elements != targets.GetSize()) {
+    // Cross-entropy of the logits [vocab_size, 1, seq_len] and the target tokens [1, 1, seq_len]
+    int seq_len = predictions.GetDepth();
+    int vocab_size = predictions.GetWidth();
+    if (seq_len != targets.GetCount()) {
         throw std::runtime_error("Prediction and target dimensions don't match");
     }
     
     double loss = 0.0;
-    for (int i = 0; i < total_elements; i++) {
-        double pred = predictions.Get(i);
-        double target = targets.Get(i);
-        
-        // Cross-entropy loss: -sum(target * log(prediction))
-        // This is simplified - proper implementation would handle probability distributions
-        double element_loss = -target * log(max(pred, 1e-8)); // Clamp to prevent log(0)
-        loss += element_loss;
+    for (int t = 0; t < seq_len; t++) {
+        double max_logit = -DBL_MAX;
+        for (int i = 0; i < vocab_size; i++)
+            max_logit = max(max_logit, predictions.Get(i * seq_len + t));
+        double sum = 0.0;
+        for (int i = 0; i < vocab_size; i++)
+            sum += exp(predictions.Get(i * seq_len + t) - max_logit);
+        int target = (int)targets.Get(t);
+        loss += max_logit + log(sum) - predictions.Get(target * seq_len + t);
     }
     
-    return loss / total_elements;
+    return loss / max(1, seq_len);
 }
 
 Vector<int> GPTSession::GenerateText(const Vector<int>& context, int max_tokens, 
                                     double temperature, bool top_k, int k, 
                                     bool nucleus, double p) {
     // Generate text autoregressively
-    Vector<int> current_context = context;
+    Vector<int> current_context;
+    current_context <<= context;
+    generated_tokens = 0;
+    generation_seconds = 0;
+    if (current_context.IsEmpty() || max_tokens <= 0)
+        return current_context;
+    
+    // The tokens of the context after the ones of the last call are decoded at once
+    TimeStop ts;
+    Volume* logits_volume = &model->GetNextTokenLogits(current_context, cache);
+    Vector<double> logits;
     
     for (int i = 0; i < max_tokens; i++) {
-        // Get logits for next token
-        Volume& logits_volume = model->GetNextTokenLogits(current_context);
-        
         // Convert volume to vector for sampling
-        Vector<double> logits(logits_volume.GetSize());
+        logits.SetCount(logits_volume->GetCount());
         for (int j = 0; j < logits.GetCount(); j++) {
-            logits[j] = logits_volume.Get(j);
+            logits[j] = logits_volume->Get(j);
         }
         
         // Sample next token
@@ -354,10 +675,17 @@ Vector<int> GPTSession::GenerateText(const Vector<int>& context, int max_tokens,
         
         // Add to context
         current_context.Add(next_token);
+        generated_tokens++;
+        
+        // One decoder step for the next token, until the context is full
+        if (i + 1 == max_tokens || current_context.GetCount() >= model->GetMaxSeqLen())
+            break;
+        logits_volume = &model->Decode(next_token, cache);
         
         // Check for end-of-sequence token if applicable
         // (in a real model, this would be a specific token ID)
     }
+    generation_seconds = ts.Seconds();
     
     return current_context;
 }
@@ -366,35 +694,35 @@ double GPTSession::GetPerplexity(const Vector<int>& test_tokens) {
     // Compute perplexity on test tokens
     // Perplexity = exp(average cross-entropy loss)
     
-    if (test_tokens.GetCount() == 0) return INFINITY;
+    if (test_tokens.GetCount() < 2) return INFINITY;
     
     double total_loss = 0.0;
     int seq_len = test_tokens.GetCount();
+    int max_seq_len = model->GetMaxSeqLen();
     
-    // Sliding window approach to compute loss on all subsequences
+    // One decoder step per token. When the context is full, the decoding starts again
+    // with the last half of it.
+    GPTCache test_cache;
     for (int i = 1; i < seq_len; i++) {
-        Vector<int> context;
-        for (int j = 0; j < i && j < sequence_length; j++) {
-            context.Add(test_tokens[i - j - 1]);  // Add in reverse order
+        Volume* logits_volume;
+        if (test_cache.GetCount() < max_seq_len)
+            logits_volume = &model->Decode(test_tokens[i - 1], test_cache);
+        else {
+            Vector<int> context;
+            for (int j = max(0, i - max(1, max_seq_len / 2)); j < i; j++)
+                context.Add(test_tokens[j]);
+            test_cache.Clear();
+            logits_volume = &model->Decode(context, test_cache);
         }
         
-        // Invert the context to get the correct order
-        Vector<int> actual_context;
-        for (int j = context.GetCount() - 1; j >= 0; j--) {
-            actual_context.Add(context[j]);
-        }
-        
-        // Get next token logits
-        Volume& logits_volume = model->GetNextTokenLogits(actual_context);
-        
-        // Get target token
-        int target_token = test_tokens[i];
-        
-        // Compute loss for this position
-        double target_logit = logits_volume.Get(target_token);
-        
-        // Simplified loss calculation - a full implementation would use proper cross-entropy
-        total_loss += -target_logit; // This is a placeholder
+        // Cross-entropy of the target token
+        double max_logit = -DBL_MAX;
+        for (int j = 0; j < logits_volume->GetCount(); j++)
+            max_logit = max(max_logit, logits_volume->Get(j));
+        double sum = 0.0;
+        for (int j = 0; j < logits_volume->GetCount(); j++)
+            sum += exp(logits_volume->Get(j) - max_logit);
+        total_loss += max_logit + log(sum) - logits_volume->Get(test_tokens[i]);
     }
     
     double avg_loss = total_loss / (seq_len - 1);
@@ -402,17 +730,14 @@ double GPTSession::GetPerplexity(const Vector<int>& test_tokens) {
 }
 
 Vector<double> GPTSession::GetEmbeddings(const Vector<int>& tokens) {
-    // Get embeddings for the given tokens
-    // This would involve processing through the embedding layer of the model
-    
-    Volume input_volume = model->PrepareInputs(tokens);
-    
-    // Process through the embedding part of transformer (without full forward pass)
-    // This is a simplified approach - real implementation would separate embedding computation
+    // The token embeddings of the tokens, one after another
+    const Volume& emb = model->GetTokenEmbeddings();
+    int embed_dim = model->GetEmbedDim();
     Vector<double> embeddings;
     for (int i = 0; i < tokens.GetCount(); i++) {
-        // For demonstration, just return the input values as "embeddings"
-        embeddings.Add((double)tokens[i] / model->GetVocabSize());
+        ASSERT(tokens[i] >= 0 && tokens[i] < model->GetVocabSize());
+        for (int j = 0; j < embed_dim; j++)
+            embeddings.Add(emb.Get(tokens[i] * embed_dim + j));
     }
     
     return embeddings;
@@ -425,6 +750,18 @@ std::unique_ptr<GPTModel> CreateGPT(int vocab_size, int embed_dim, int num_heads
                                      num_layers, ff_dim, max_seq_len, dropout_rate);
 }
 
+std::unique_ptr<GPTModel> LoadGPT(const String& path) {
+    auto file = std::make_shared<GGUFFile>();
+    if (!file->Open(path)) {
+        LOG("GGUF: " << file->GetError());
+        return nullptr;
+    }
+    auto model = std::make_unique<GPTModel>();
+    if (!model->MapGGUF(file))
+        return nullptr;
+    return model;
+}
+
 std::unique_ptr<GPTSession> CreateGPTSession(int vocab_size, int embed_dim, 
                                             int num_heads, int num_layers, 
                                             int ff_dim, int max_seq_len, 
@@ -433,7 +770,7 @@ std::unique_ptr<GPTSession> CreateGPTSession(int vocab_size, int embed_dim,
     auto model = CreateGPT(vocab_size, embed_dim, num_heads, num_layers, 
                           ff_dim, max_seq_len, dropout_rate);
     auto session = std::make_unique<GPTSession>(std::move(model));
-    session->learning_rate = learning_rate;
+    session->SetLearningRate(learning_rate);
     
     return session;
 }
@@ -6,7 +6,44 @@
 
 namespace ConvNet {
 
+// The keys and values of every decoder layer for the tokens of one sequence so far.
+//
+// GPTModel::Decode appends tokens to the cache, so that a new token costs one step of the
+// decoder instead of a forward pass over the whole context. Truncate rolls the sequence
+// back (e.g. to undo rejected tokens) without freeing the memory, and a cache of a shared
+// prompt can be copied to start several continuations from it.
+class GPTCache {
+private:
+    friend class GPTModel;
+
+    Array<AttentionCache> layers;
+    Vector<int> tokens;
+
+public:
+    GPTCache() {}
+    GPTCache(const GPTCache& src) { *this = src; }
+    GPTCache& operator=(const GPTCache& src);
+
+    void Init(int layer_count);
+    void Clear();
+    void Truncate(int n);
+
+    // The number of the first tokens of context which are in the cache
+    int GetCommonPrefix(const Vector<int>& context) const;
+
+    int GetCount() const { return tokens.GetCount(); }
+    const Vector<int>& GetTokens() const { return tokens; }
+    int GetLayerCount() const { return layers.GetCount(); }
+    AttentionCache& GetLayer(int i) { return layers[i]; }
+    int64 GetMemory() const;
+};
+
 // GPT Model - Autoregressive Transformer Language Model
+//
+// A decoder-only transformer: the token embeddings with positional encodings go through
+// the decoder layers, which have causal self-attention, and a final layer normalization,
+// and the output weights give the logits of the next token at every position. The input
+// tokens are a [1, 1, seq_len] volume and the logits are [vocab_size, 1, seq_len].
 class GPTModel {
 private:
     // Model configuration
@@ -17,42 +54,101 @@ private:
     int ff_dim;
     int max_seq_len;
     double dropout_rate;
+    int thread_count = 1;
 
     // Core components (GPT uses decoder-only architecture with masked self-attention)
-    Vector<DecoderLayerCRTP> decoder_layers;  // Multiple decoder layers (though simplified for GPT)
+    Array<DecoderLayerCRTP> decoder_layers;
     PositionalEncodingCRTP positional_encoding;  // For positional information
     
-    // Transformer core
-    std::unique_ptr<TransformerCRTP> transformer;  // Core transformer used for computation
-    
     // Embedding layers
-    Volume token_embeddings;  // Input token embeddings
-    Volume output_weights;    // Output projection weights (often tied to input embeddings)
+    Volume token_embeddings;  // Input token embeddings, [embed_dim x vocab_size], one row per token
+    Volume output_weights;    // Output projection weights (tied to input embeddings at init)
+    Volume final_norm_weights;
+    Volume final_norm_biases;
 
     // Cached values
+    Volume embedded;
+    Volume last;
+    Volume hidden;
+    Volume logits;
+    Volume next_logits;
+    Volume generated;
     Vector<ParametersAndGradients> parameters;
+    Vector<GPTCache*> step_caches;
+    Vector<Vector<int>> step_tokens;
+    Vector<AttentionCache*> step_layers;
+    Vector<int> step_counts;
+    
+    // The GGUF file which the weights view, see MapGGUF
+    std::shared_ptr<const GGUFFile> mapped_file;
 
 public:
     GPTModel(int vocab_size, int embed_dim, int num_heads, 
              int num_layers, int ff_dim, int max_seq_len, 
              double dropout_rate = 0.1);
+    GPTModel();     // An empty model for MapGGUF
     
     // Forward pass for training (with teacher forcing)
     Volume& Forward(Volume& input_tokens, bool is_training = false);
     
-    // Forward pass for generation (autoregressive)
+    // Forward pass for generation (autoregressive), returns the context and the new tokens
     Volume& Generate(Volume& context, int max_new_tokens);
     
-    // Get logits for next token prediction
+    // Get logits for next token prediction, [vocab_size, 1, 1]. A context longer than
+    // max_seq_len is cut to its last max_seq_len tokens.
     Volume& GetNextTokenLogits(const Vector<int>& context);
     
-    // Sample next token from logits
+    // The same with the cache: only the tokens after the common prefix of the context and
+    // the cache are decoded, and the cache has the whole context afterwards. A context longer
+    // than max_seq_len keeps the window of the cache while the window and the new tokens fit,
+    // and is then cut to its last max_seq_len / 2 tokens (as GetPerplexity does), so only
+    // every max_seq_len / 2 tokens decode the whole window again.
+    Volume& GetNextTokenLogits(const Vector<int>& context, GPTCache& cache);
+    
+    // Incremental decoding: appends the tokens to the cache and returns the logits of the
+    // token after them. The cache can't grow beyond max_seq_len, which is an error.
+    Volume& Decode(const Vector<int>& tokens, GPTCache& cache);
+    Volume& Decode(int token, GPTCache& cache);
+    
+    // One decoder step of several sequences: the tokens[i] are appended to caches[i], and
+    // the logits are [vocab_size, 1, sequence count], with the logits of the token after
+    // tokens[i] in column i. The projections and the feed-forward networks of all tokens
+    // are computed together, and the attention of every sequence to its own cache.
+    Volume& Decode(const Vector<GPTCache*>& caches, const Vector<Vector<int>>& tokens);
+    
+    // The GEMMs and the attention heads are split between the threads
+    GPTModel& SetThreadCount(int i);
+    int GetThreadCount() const { return thread_count; }
+    
+    // Post-training quantization of the decoder layers into GGUF_Q8_0 or GGUF_Q4_0 blocks
+    // (see DecoderLayerCRTP::Quantize), which the forward passes use when not training. The
+    // embeddings and the output projection keep the type of Real.
+    GPTModel& Quantize(int type = GGUF_Q8_0);
+    GPTModel& Dequantize();
+    
+    // Sample next token from logits. A temperature <= 0 picks the largest logit (greedy).
     int SampleNextToken(const Vector<double>& logits, double temperature = 1.0, 
                        bool top_k = false, int k = 50, bool nucleus = false, double p = 0.9);
     
     // Get parameters for training
     Vector<ParametersAndGradients>& GetParameters();
     
+    // The weights as GGUF tensors with the llama.cpp names: "token_embd.weight", the
+    // decoder blocks "blk.<i>." (see DecoderLayerCRTP::VisitTensors), "output_norm.weight"
+    // and "output.weight"
+    void VisitTensors(GGUFTensorVisitor& v);
+    
+    // Creates the model from the hyperparameters and the tensors of a GGUF file. Only the
+    // biases, the normalization and the positional encodings are allocated: the weights
+    // view the tensors in the page cache, when they have the type of Real. Without
+    // "output.weight" the output weights are tied to the embeddings, and missing biases are
+    // zero. Checkpoints of other architectures (llama, gpt2) map by the same names, but they
+    // are computed with the post-LN decoder and the sinusoidal positions of this model.
+    // Returns false if a weight is missing or doesn't fit; the model is unusable then.
+    bool MapGGUF(std::shared_ptr<const GGUFFile> file);
+    bool SaveGGUF(const String& path);
+    bool IsMapped() const { return (bool)mapped_file; }
+    
     // Serialization
     void Store(ValueMap& map) const;
     void Load(const ValueMap& map);
@@ -63,6 +159,10 @@ public:
     int GetEmbedDim() const { return embed_dim; }
     int GetNumHeads() const { return num_heads; }
     int GetNumLayers() const { return num_layers; }
+    int GetMaxSeqLen() const { return max_seq_len; }
+    
+    const Volume& GetTokenEmbeddings() const { return token_embeddings; }
+    DecoderLayerCRTP& GetLayer(int i) { return decoder_layers[i]; }
     
     // Tokenization utilities (simplified)
     Vector<int> Tokenize(const String& text);
@@ -70,8 +170,9 @@ public:
     
 private:
     // Helper functions
-    Volume& PrepareInputs(const Vector<int>& token_ids);
-    Volume& ApplyCausalMask(Volume& attention_scores);
+    void InitLayers();
+    void Embed(const Vector<int>& token_ids, int column, int position, Volume& out);
+    void Project(const Volume& x, Volume& out);
     void UpdateOutputWeights();  // Tie output weights with input embeddings
 };
 
@@ -79,23 +180,26 @@ private:
 class GPTSession {
 private:
     std::unique_ptr<GPTModel> model;
+    GPTCache cache;     // The keys and values of the last generated text
     
     // Training parameters
     double learning_rate;
     int batch_size;
     int sequence_length;
     
-    // Optimization
-    // In a real implementation, we'd have an optimizer here
+    // Statistics of the last generation
+    int generated_tokens = 0;
+    double generation_seconds = 0;
 
 public:
     GPTSession(std::unique_ptr<GPTModel> gpt_model);
     
-    // Training methods
-    void TrainBatch(const Vector<Volume>& inputs, const Vector<Volume>& targets);
+    // The loss of the logits of Forward. There is no training yet: the decoder layers
+    // have no backward pass.
     double ComputeLoss(Volume& predictions, Volume& targets);
     
-    // Generation methods
+    // Generation methods. The cache is kept between the calls, so that a context which
+    // continues the last one (e.g. the next turn of a chat) decodes only its new tokens.
     Vector<int> GenerateText(const Vector<int>& context, int max_tokens, 
                             double temperature = 1.0, bool top_k = false, 
                             int k = 50, bool nucleus = false, double p = 0.9);
@@ -104,9 +208,15 @@ public:
     double GetPerplexity(const Vector<int>& test_tokens);
     Vector<double> GetEmbeddings(const Vector<int>& tokens);
     
+    GPTSession& SetLearningRate(double d) { learning_rate = d; return *this; }
+    double GetLearningRate() const { return learning_rate; }
+    int GetGeneratedTokens() const { return generated_tokens; }
+    double GetTokensPerSecond() const { return generation_seconds > 0 ? generated_tokens / generation_seconds : 0; }
+    
     // Accessor
     GPTModel& GetModel() { return *model; }
     const GPTModel& GetModel() const { return *model; }
+    GPTCache& GetCache() { return cache; }
 };
 
 // Helper function to create a GPT model
@@ -114,6 +224,10 @@ std::unique_ptr<GPTModel> CreateGPT(int vocab_size, int embed_dim, int num_heads
                                    int num_layers, int ff_dim, int max_seq_len, 
                                    double dropout_rate = 0.1);
 
+// Helper function to open a GGUF file and map a model from it, see GPTModel::MapGGUF.
+// Returns NULL if the file can't be opened or mapped.
+std::unique_ptr<GPTModel> LoadGPT(const String& path);
+
 // Helper function to create a GPT session
 std::unique_ptr<GPTSession> CreateGPTSession(int vocab_size, int embed_dim, 
                                             int num_heads, int num_layers, 
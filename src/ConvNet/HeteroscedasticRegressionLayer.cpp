@@ -18,17 +18,21 @@ void LayerBase::InitHeteroscedasticRegression(int input_width, int input_height,
 
 Volume& LayerBase::ForwardHeteroscedasticRegression(Volume& input, bool is_training) {
 	input_activation = &input;
+	int batch = input.GetBatch();
 	
-	output_activation.Init(1, 1, output_depth, 0.0);
+	output_activation.SetSize(1, 1, output_depth, batch);
 	
-	for (int i = 0; i < output_depth; i++) {
-		double a = 0.0;
-		const Vector<double>& wi = filters[i].GetWeights();
-		for(int j = 0; j < output_depth; j++) {
-			a += input.Get(j) * wi[j];
+	for (int b = 0; b < batch; b++) {
+		int off = b * output_depth;
+		for (int i = 0; i < output_depth; i++) {
+			double a = 0.0;
+			const RealBuffer& wi = filters[i].GetWeights();
+			for(int j = 0; j < output_depth; j++) {
+				a += input.Get(off + j) * wi[j];
+			}
+			a += biases.Get(i);
+			output_activation.Set(off + i, a);
 		}
-		a += biases.Get(i);
-		output_activation.Set(i, a);
 	}
 	
 	return output_activation; // identity function
@@ -44,24 +48,31 @@ double LayerBase::BackwardHeteroscedasticRegression(const Vector<double>& y) {
 	double loss = 0.0;
 	
 	int output_depth_2 = output_depth / 2;
+	int batch = output_activation.GetBatch();
+	int y_stride = y.GetCount() / batch; // y holds the targets of the samples one after another
 	
-	for (int i = 0; i < output_depth_2; i++) {
-		double dy = output_activation.Get(i) - y[i];
-		double ls2 = output_activation.Get(i + output_depth_2);
-		double prec = exp(-ls2);
+	for (int b = 0; b < batch; b++) {
+		int off = b * output_depth;
+		const double* yb = y.Begin() + b * y_stride;
 		
-		Volume& Wmd = filters[i];
-		Volume& Wsd = filters[i + output_depth_2];
-		for(int j = 0; j < output_depth; j++) {
-			input.AddGradient(j, prec * dy * Wmd.Get(j));
-			input.AddGradient(j, -0.5 * (prec * dy * dy - 1) * Wsd.Get(j));
-			Wmd.AddGradient(j, prec * dy * input.Get(j));
-			Wsd.AddGradient(j, -0.5 * (prec * dy * dy - 1) * input.Get(j));
+		for (int i = 0; i < output_depth_2; i++) {
+			double dy = output_activation.Get(off + i) - yb[i];
+			double ls2 = output_activation.Get(off + i + output_depth_2);
+			double prec = exp(-ls2);
+			
+			Volume& Wmd = filters[i];
+			Volume& Wsd = filters[i + output_depth_2];
+			for(int j = 0; j < output_depth; j++) {
+				input.AddGradient(off + j, prec * dy * Wmd.Get(j));
+				input.AddGradient(off + j, -0.5 * (prec * dy * dy - 1) * Wsd.Get(j));
+				Wmd.AddGradient(j, prec * dy * input.Get(off + j));
+				Wsd.AddGradient(j, -0.5 * (prec * dy * dy - 1) * input.Get(off + j));
+			}
+			biases.AddGradient(i, prec * dy);
+			biases.AddGradient(i + output_depth_2, -0.5 * (prec * dy * dy - 1));
+			
+			loss += 0.5 * prec * dy * dy;
 		}
-		biases.AddGradient(i, prec * dy);
-		biases.AddGradient(i + output_depth_2, -0.5 * (prec * dy * dy - 1));
-		
-		loss += 0.5 * prec * dy * dy;
 	}
 	
 	return loss;
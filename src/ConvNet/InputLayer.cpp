@@ -5,7 +5,7 @@ namespace ConvNet {
 
 Volume& LayerBase::ForwardInput(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation = input;
+	output_activation.SetWeights(input); // gradients are allocated by the next backward, if any
 	return output_activation; // simply identity function for now
 }
 
@@ -43,6 +43,8 @@ void LayerBase::Serialize(Stream& s) {
 	  % group_size
 	  % switchx
 	  % switchy;
+	if (s.IsLoading())
+		quantized_filters.Clear();
 }
 
 Volume& LayerBase::Forward(Volume& input, bool is_training) {
@@ -126,9 +128,20 @@ double LayerBase::Backward(const Vector<double>& y) {
 	throw Exc();
 }
 
-double LayerBase::Backward(int cols, const Vector<int>& pos, const Vector<double>& y) {
+double LayerBase::Backward(int cols, const Vector<int>& pos, const Vector<double>& y, const Vector<double>* weight) {
 	switch (layer_type) {
-		case REGRESSION_LAYER:	return BackwardRegression(cols, pos, y); break;
+		case REGRESSION_LAYER:	return BackwardRegression(cols, pos, y, weight); break;
+		default: Panic("Type not implemented");
+	}
+	throw Exc();
+}
+
+// Mini-batch version of Backward(pos, y): one (pos, y) pair per sample of the last forward.
+double LayerBase::Backward(const Vector<int>& pos, const Vector<double>& y) {
+	switch (layer_type) {
+		case SOFTMAX_LAYER:		return BackwardSoftmax(pos); break;
+		case REGRESSION_LAYER:	return BackwardRegression(output_depth, pos, y); break;
+		case SVM_LAYER:			return BackwardSVM(pos); break;
 		default: Panic("Type not implemented");
 	}
 	throw Exc();
@@ -182,7 +195,34 @@ String LayerBase::GetKey() const {
 	throw Exc();
 }
 
+// Estimates the floating point operations and the bytes of activations and parameters,
+// which the forward pass of one sample touches. The backward pass of the layers with
+// parameters costs about twice as much, and of the others about the same.
+void LayerBase::GetCost(int64& flops, int64& bytes) const {
+	int64 in = (int64)input_width * input_height * input_depth;
+	int64 out = (int64)output_width * output_height * output_depth;
+	int64 params = biases.GetCount();
+	for (int i = 0; i < filters.GetCount(); i++)
+		params += filters[i].GetCount();
 	
+	switch (layer_type) {
+		case FULLYCONN_LAYER:	flops = 2 * in * out; break;
+		case CONV_LAYER:
+		case DECONV_LAYER:		flops = 2 * out * width * height * input_depth; break;
+		case LRN_LAYER:			flops = out * (2 * n + 6); break;
+		case POOL_LAYER:		flops = out * width * height; break;
+		case SIGMOID_LAYER:
+		case TANH_LAYER:		flops = 4 * out; break;
+		case SOFTMAX_LAYER:
+		case SVM_LAYER:
+		case REGRESSION_LAYER:
+		case HETEROSCEDASTICREGRESSION_LAYER: flops = 3 * in; break;
+		case INPUT_LAYER:		flops = 0; break;
+		default:				flops = max(in, out); break;
+	}
+	bytes = (in + out + params) * sizeof(Real);
+}
+
 void LayerBase::Init(int input_width, int input_height, int input_depth) {
 	this->input_width = input_width;
 	this->input_height = input_height;
@@ -227,6 +267,116 @@ void LayerBase::Init(int input_width, int input_height, int input_depth) {
 	}
 }
 
+// Sizes the output activation and the scratch buffers to their final size for mini-batches
+// of the given size, so that Forward and Backward only reuse them. With is_training, the
+// gradient buffers of the activation and the parameters are allocated too.
+void LayerBase::Plan(bool is_training, int batch) {
+	output_activation.SetSize(output_width, output_height, output_depth, batch);
+	if (is_training) {
+		output_activation.GetGradients();
+		if (!filters.IsEmpty())
+			biases.GetGradients();
+		for (int i = 0; i < filters.GetCount(); i++)
+			filters[i].GetGradients();
+	}
+	
+	switch (layer_type) {
+		case CONV_LAYER:
+			if (conv_algorithm == CONV_GEMM || IsQuantized()) {
+				int positions = batch * output_width * output_height;
+				int filter_length = filters[0].GetLength();
+				SetBufferCount(col_buffer, positions * filter_length);
+				SetBufferCount(filter_matrix, output_depth * filter_length);
+				GemmPlan<Real>();
+				if (is_training) {
+					SetBufferCount(col_gradients, positions * filter_length);
+					SetBufferCount(filter_gradients, output_depth * filter_length);
+				}
+			}
+			break;
+		case FULLYCONN_LAYER:
+			if (batch > 1) {
+				SetBufferCount(filter_matrix, output_depth * input_count);
+				GemmPlan<Real>();
+				if (is_training)
+					SetBufferCount(filter_gradients, output_depth * input_count);
+			}
+			break;
+		case DECONV_LAYER: {
+			int g_width = input_width + (input_width-1)*(stride-1);
+			int g_height = input_height + (input_height-1)*(stride-1);
+			int ghost_w = g_width + (filters[0].GetWidth() - 1 - pad) * 2;
+			int ghost_h = g_height + (filters[0].GetHeight() - 1 - pad) * 2;
+			ghost_image.SetSize(ghost_w, ghost_h, input_depth);
+			ghost_gradients.SetSize(ghost_w, ghost_h, input_depth);
+			break;
+		}
+		case LRN_LAYER:
+			S_cache.SetSize(output_width, output_height, output_depth, batch);
+			break;
+		case SOFTMAX_LAYER:
+			SetBufferCount(es, batch * output_depth);
+			break;
+		case DROPOUT_LAYER:
+			SetBufferCount(dropped, batch * output_width * output_height * output_depth);
+			break;
+		case POOL_LAYER:
+		case UNPOOL_LAYER:
+			SetBufferCount(switchx, batch * output_width * output_height * output_depth);
+			SetBufferCount(switchy, batch * output_width * output_height * output_depth);
+			break;
+		case MAXOUT_LAYER:
+			SetBufferCount(switches, batch * output_width * output_height * output_depth);
+			break;
+		default:
+			break;
+	}
+}
+
+// Points filter_rows to the filters as one matrix, one filter per row. Filters which are
+// consecutive rows of one array, e.g. of a mapped GGUF tensor, are used in place, and the
+// others are copied into filter_matrix.
+void LayerBase::GatherFilters() {
+	int filter_length = filters[0].GetLength();
+	const Real* first = filters[0].GetWeights().Begin();
+	bool contiguous = true;
+	for (int i = 1; i < filters.GetCount() && contiguous; i++)
+		contiguous = filters[i].GetWeights().Begin() == first + (int64)i * filter_length;
+	if (contiguous) {
+		filter_rows = first;
+		return;
+	}
+	
+	SetBufferCount(filter_matrix, filters.GetCount() * filter_length);
+	filter_rows = filter_matrix.Begin();
+	for (int i = 0; i < filters.GetCount(); i++) {
+		const RealBuffer& w = filters[i].GetWeights();
+		Real* dst = filter_matrix.Begin() + i * filter_length;
+		for (int j = 0; j < filter_length; j++)
+			dst[j] = w[j];
+	}
+}
+
+// Quantizes the filter matrix into blocks of the type (GGUF_Q8_0 or GGUF_Q4_0). The filters
+// stay as they are, for training and for storing; the quantized copy is made from them again
+// after they have changed.
+void LayerBase::QuantizeFilters(int type) {
+	ASSERT(layer_type == FULLYCONN_LAYER || layer_type == CONV_LAYER);
+	GatherFilters();
+	int filter_length = filters[0].GetLength();
+	quantized_filters.Quantize(type, filter_rows, filters.GetCount(), filter_length, filter_length);
+}
+
+// Adds the rows of filter_gradients to the gradients of the filters.
+void LayerBase::ScatterFilterGradients() {
+	int filter_length = filters[0].GetLength();
+	for (int i = 0; i < filters.GetCount(); i++) {
+		RealBuffer& g = filters[i].GetGradients();
+		const Real* src = filter_gradients.Begin() + i * filter_length;
+		for (int j = 0; j < filter_length; j++)
+			g[j] += src[j];
+	}
+}
 
 Vector<ParametersAndGradients>& LayerBase::GetParametersAndGradients() {
 	
@@ -2,6 +2,9 @@
 #define _ConvNet_LayerBase_h_
 
 #include "Utilities.h"
+#include "Gemm.h"
+#include "GGUF.h"
+#include "Quantize.h"
 
 
 namespace ConvNet {
@@ -32,6 +35,12 @@ enum {
 	HETEROSCEDASTICREGRESSION_LAYER
 };
 
+// Implementations of the convolutive layer
+enum {
+	CONV_REFERENCE,	// direct scalar loop, kept for verifying the others
+	CONV_GEMM		// im2col + blocked matrix multiplication
+};
+
 class LayerBase : Moveable<LayerBase> {
 	
 
@@ -86,6 +95,19 @@ public:
 	int filter_count;
 	int stride;
 	int pad;
+	int conv_algorithm = CONV_GEMM;
+	Vector<Real> col_buffer, col_gradients;
+	
+	// Convolutive and fully connected layer: filters as one matrix, one row per filter.
+	// filter_rows points to it, or to the filters themselves when they are contiguous.
+	Vector<Real> filter_matrix, filter_gradients;
+	const Real* filter_rows = NULL;
+	
+	// Convolutive and fully connected layer: the quantized filter matrix, which the forward
+	// pass uses instead of the filters when not training (see QuantizeFilters), with the
+	// rows of it split between thread_count threads
+	QuantizedMatrix quantized_filters;
+	int thread_count = 1;
 	
 	// Maxout layer
 	Vector<int> switches;
@@ -104,6 +126,12 @@ public:
 	Volume& ForwardFullyConn(Volume& input, bool is_training = false);
 	double BackwardFullyConn();
 	double BackwardFullyConn(const Vector<double>& y);
+	void GatherFilters();
+	void ScatterFilterGradients();
+	void QuantizeFilters(int type);
+	bool IsQuantized() const {return !quantized_filters.IsEmpty();}
+	int GetThreadCount() const {return thread_count;}
+	LayerBase& SetThreadCount(int i) {thread_count = max(1, i); return *this;}
 	void InitFullyConn(int input_width, int input_height, int input_depth);
 	String ToStringFullyConn() const;
 	
@@ -128,6 +156,7 @@ public:
 	// Softmax layer
 	Volume& ForwardSoftmax(Volume& input, bool is_training = false);
 	double BackwardSoftmax(int pos, double y);
+	double BackwardSoftmax(const Vector<int>& posv);
 	void InitSoftmax(int input_width, int input_height, int input_depth);
 	String ToStringSoftmax() const;
 	
@@ -135,7 +164,7 @@ public:
 	Volume& ForwardRegression(Volume& input, bool is_training = false);
 	double BackwardRegression(const Vector<double>& y);
 	double BackwardRegression(int pos, double y);
-	double BackwardRegression(int cols, const Vector<int>& posv, const Vector<double>& yv);
+	double BackwardRegression(int cols, const Vector<int>& posv, const Vector<double>& yv, const Vector<double>* weight=NULL);
 	void InitRegression(int input_width, int input_height, int input_depth);
 	String ToStringRegression() const;
 	
@@ -149,16 +178,25 @@ public:
 	
 	// Convolutive layer
 	Volume& ForwardConv(Volume& input, bool is_training = false);
+	Volume& ForwardConvReference(Volume& input);
+	Volume& ForwardConvGemm(Volume& input);
+	Volume& ForwardConvQuantized(Volume& input);
+	void LowerInput(const Volume& input);
 	void BackwardConv();
+	void BackwardConvReference();
+	void BackwardConvGemm();
 	void InitConv(int input_width, int input_height, int input_depth);
 	String ToStringConv() const;
 	int GetStride() const {return stride;}
 	int GetPad() const {return pad;}
+	int GetConvAlgorithm() const {return conv_algorithm;}
+	LayerBase& SetConvAlgorithm(int i) {conv_algorithm = i; return *this;}
 	
 	// Deconvolutive layer
 	Volume& ForwardDeconv(Volume& input, bool is_training = false);
 	double BackwardDeconv();
 	double BackwardDeconv(const Vector<double>& y);
+	void DeconvGhostImage(const Volume& input, int sample);
 	void InitDeconv(int input_width, int input_height, int input_depth);
 	String ToStringDeconv() const;
 	
@@ -203,6 +241,7 @@ public:
 	// SVM layer
 	Volume& ForwardSVM(Volume& input, bool is_training = false);
 	double BackwardSVM(int pos, double yd);
+	double BackwardSVM(const Vector<int>& posv);
 	void InitSVM(int input_width, int input_height, int input_depth);
 	String ToStringSVM() const;
 	
@@ -215,8 +254,10 @@ public:
 	double Backward();
 	double Backward(int pos, double y);
 	double Backward(const Vector<double>& y);
-	double Backward(int cols, const Vector<int>& pos, const Vector<double>& y);
+	double Backward(int cols, const Vector<int>& pos, const Vector<double>& y, const Vector<double>* weight=NULL);
+	double Backward(const Vector<int>& pos, const Vector<double>& y);
 	void Init(int input_width, int input_height, int input_depth);
+	void Plan(bool is_training = true, int batch = 1);
 	Vector<ParametersAndGradients>& GetParametersAndGradients();
 	bool IsDotProductLayer() const {return layer_type == CONV_LAYER || layer_type == DECONV_LAYER;}
 	bool IsClassificationLayer() const {return layer_type == SOFTMAX_LAYER || layer_type == SVM_LAYER;}
@@ -229,6 +270,7 @@ public:
 	bool IsLastLayer() const {return layer_type == REGRESSION_LAYER || layer_type == SOFTMAX_LAYER || layer_type == SVM_LAYER || layer_type == DECONV_LAYER || layer_type == SIGMOID_LAYER || layer_type == TANH_LAYER || layer_type == FULLYCONN_LAYER || layer_type == HETEROSCEDASTICREGRESSION_LAYER;}
 	String ToString() const;
 	String GetKey() const;
+	void GetCost(int64& flops, int64& bytes) const;
 	
 	void Reset() {Init(input_width, input_height, input_depth);}
 	
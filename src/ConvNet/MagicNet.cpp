@@ -28,6 +28,14 @@ MagicNet::MagicNet() {
 	neurons_min = 5;
 	neurons_max = 30;
 	
+	// candidates trained concurrently, and successive halving (disabled)
+	thread_count = 1;
+	predict_batch = 256;
+	halving_rate = 0;
+	halving_epochs = 1;
+	rung = 0;
+	dropped_count = 0;
+	
 	foldix = 0;
 	datapos = 0;
 }
@@ -105,7 +113,7 @@ void MagicNet::SampleCandidate(Session& cand) {
 	
 	// sample training hyperparameters
 	int bs = batch_size_min + Random(batch_size_max - batch_size_min); // batch size
-	double l2 = pow(10, l2_decay_min + Randomf() + (l2_decay_max - l2_decay_min)); // l2 weight decay
+	double l2 = pow(10, l2_decay_min + Randomf() * (l2_decay_max - l2_decay_min)); // l2 weight decay
 	double lr = pow(10, learning_rate_min + Randomf() * (learning_rate_max - learning_rate_min)); // learning rate
 	double mom = momentum_min + Randomf() * (momentum_max - momentum_min); // momentum. Lets just use 0.9, works okay usually ;p
 	double tp = Randomf(); // trainer type
@@ -127,8 +135,12 @@ void MagicNet::SampleCandidate(Session& cand) {
 	trainer.SetL2Decay(l2);
 	trainer.SetMomentum(mom);
 	
+	// the average of the fold results sorts the candidates, even with less than 20 folds
+	cand.accuracy_result_window.Init(max(1, num_folds), 1);
+	
 	foldix = 0;
 	datapos = 0;
+	rung = 0;
 }
 
 void MagicNet::SampleCandidates() {
@@ -141,26 +153,17 @@ void MagicNet::SampleCandidates() {
 }
 
 void MagicNet::Step() {
-	SessionData& data = this->data[0];
-	
-	// run an example through current candidate
-	iter++;
-	total_iter++;
-	
-	// step all candidates on a random data point
+	// train all candidates up to the next evaluation, the next rung of successive halving or
+	// the end of the fold
 	Vector<int>& fold = train_folds[foldix]; // active fold
-	int dataix = fold[datapos];
-	datapos++;
-	if (datapos >= fold.GetCount()) datapos = 0;
-	
-	tmp_in.Init(data.GetDataWidth(), data.GetDataHeight(), data.GetDataDepth(), 0);
-	Vector<double>& x = data.Get(datapos);
-	tmp_in.SetData(x);
-	int l = data.GetLabel(datapos);
+	int lastiter = num_epochs * fold.GetCount();
+	int count = min(100 - total_iter % 100, lastiter - iter);
+	if (halving_rate > 0)
+		count = min(count, GetRungIteration(rung) - iter);
 	
-	for (int k = 0; k < session.GetCount(); k++) {
-		session[k].GetTrainer().Train(tmp_in, l, 1.0);
-	}
+	TrainCandidates(count);
+	iter += count;
+	total_iter += count;
 	
 	if ((total_iter % 100) == 0) {
 		EvaluateValueErrors(val_acc);
@@ -171,8 +174,12 @@ void MagicNet::Step() {
 		WhenStepInterval(total_iter);
 	}
 	
+	if (halving_rate > 0 && iter == GetRungIteration(rung)) {
+		HalveCandidates();
+		rung++;
+	}
+	
 	// process consequences: sample new folds, or candidates
-	int lastiter = num_epochs * fold.GetCount();
 	if (iter >= lastiter) {
 		// finished evaluation of this fold. Get final validation
 		// accuracies, record them, and go on to next fold.
@@ -182,6 +189,7 @@ void MagicNet::Step() {
 			c.accuracy_result_window.Add(val_acc[k]);
 		}
 		iter = 0; // reset step number
+		rung = 0;
 		foldix++; // increment fold
 		datapos = 0;
 		
@@ -190,8 +198,8 @@ void MagicNet::Step() {
 		if (foldix >= train_folds.GetCount()) {
 			// we finished all folds as well! Record these candidates
 			// and sample new ones to evaluate.
-			for (int k = 0; k < session.GetCount(); k++) {
-				evaluated_candidates.Add(session.Detach(k));
+			while (session.GetCount()) {
+				evaluated_candidates.Add(session.Detach(0));
 			}
 			// sort evaluated candidates according to accuracy achieved
 			Sort(evaluated_candidates, CandidateSorter());
@@ -216,69 +224,187 @@ void MagicNet::Step() {
 	}
 }
 
+// The iteration of the fold, where the candidates are halved the rung:th time. The first
+// rung is after halving_epochs epochs, and every next one after halving_rate times more.
+int MagicNet::GetRungIteration(int rung) const {
+	int64 epochs = halving_epochs;
+	for(int i = 0; i < rung && epochs < num_epochs; i++)
+		epochs *= halving_rate;
+	if (halving_rate <= 1 || epochs >= num_epochs)
+		return INT_MAX;
+	return (int)epochs * train_folds[foldix].GetCount();
+}
+
+// Trains every candidate on the next count samples of the active fold. The candidates don't
+// share anything, so they are split between the threads, and every candidate reads the
+// samples into the input volume of its own session.
+void MagicNet::TrainCandidates(int count) {
+	SessionData& d = data[0];
+	const Vector<int>& fold = train_folds[foldix];
+	int begin = datapos;
+	int threads = max(1, min(thread_count, session.GetCount()));
+	
+	auto train = [&](int t) {
+		for(int k = t; k < session.GetCount(); k += threads) {
+			Session& ses = session[k];
+			int pos = begin;
+			for(int q = 0; q < count; q++) {
+				int dataix = fold[pos];
+				if (++pos >= fold.GetCount()) pos = 0;
+				d.GetSample(dataix, ses.x);
+				ses.GetTrainer().Train(ses.x, d.GetLabel(dataix), 1.0);
+			}
+		}
+	};
+	if (threads > 1) {
+		CoWork co;
+		for(int t = 0; t < threads; t++)
+			co & [&train, t] {train(t);};
+		co.Finish();
+	}
+	else
+		train(0);
+	
+	datapos = (begin + count) % fold.GetCount();
+}
+
+// Successive halving: keeps the best 1 / halving_rate of the candidates. The score of a
+// candidate is its validation accuracy now, averaged with its results of the earlier folds.
+void MagicNet::HalveCandidates() {
+	int keep = max(1, (session.GetCount() + halving_rate - 1) / halving_rate);
+	if (keep >= session.GetCount())
+		return;
+	
+	EvaluateValueErrors(val_acc);
+	Vector<double> score;
+	score.SetCount(session.GetCount());
+	candidate_order.SetCount(session.GetCount());
+	for(int k = 0; k < session.GetCount(); k++) {
+		const Window& w = session[k].accuracy_result_window;
+		double sum = val_acc[k];
+		int n = w.GetBufferCount();
+		for(int j = 0; j < n; j++)
+			sum += w.Get(j);
+		score[k] = sum / (n + 1);
+		candidate_order[k] = k;
+	}
+	StableSort(candidate_order, [&](int a, int b) {return score[a] > score[b];});
+	
+	// drop the rest, from the last index to the first
+	Vector<bool> drop;
+	drop.SetCount(session.GetCount(), true);
+	for(int i = 0; i < keep; i++)
+		drop[candidate_order[i]] = false;
+	for(int k = session.GetCount() - 1; k >= 0; k--) {
+		if (drop[k]) {
+			session.Remove(k);
+			dropped_count++;
+		}
+	}
+}
+
 void MagicNet::EvaluateValueErrors(Vector<double>& vals) {
 	SessionData& d = data[0];
-	tmp_in.Init(d.GetDataWidth(), d.GetDataHeight(), d.GetDataDepth(), 0);
 	
 	// evaluate candidates on validation data and return performance of current networks
 	// as simple list
 	vals.SetCount(session.GetCount());
-	Vector<int>& fold = test_folds[foldix]; // active fold
-	for(int k = 0; k < session.GetCount(); k++) {
-		Net& net = session[k].GetNetwork();
-		double v = 0.0;
-		for (int q = 0; q < fold.GetCount(); q++) {
-			Vector<double>& x = d.Get(fold[q]);
-			tmp_in.SetData(x);
-			int l = d.GetLabel(fold[q]);
-			net.Forward(tmp_in);
-			int yhat = net.GetPrediction();
-			v += (yhat == l ? 1.0 : 0.0); // 0 1 loss
+	const Vector<int>& fold = test_folds[foldix]; // active fold
+	int threads = max(1, min(thread_count, session.GetCount()));
+	
+	auto evaluate = [&](int t) {
+		for(int k = t; k < session.GetCount(); k += threads) {
+			Session& ses = session[k];
+			Net& net = ses.GetNetwork();
+			double v = 0.0;
+			for (int q = 0; q < fold.GetCount(); q++) {
+				d.GetSample(fold[q], ses.x);
+				int l = d.GetLabel(fold[q]);
+				net.Forward(ses.x);
+				int yhat = net.GetPrediction();
+				v += (yhat == l ? 1.0 : 0.0); // 0 1 loss
+			}
+			v /= fold.GetCount(); // normalize
+			vals[k] = v;
 		}
-		v /= fold.GetCount(); // normalize
-		vals[k] = v;
+	};
+	if (threads > 1) {
+		CoWork co;
+		for(int t = 0; t < threads; t++)
+			co & [&evaluate, t] {evaluate(t);};
+		co.Finish();
 	}
+	else
+		evaluate(0);
 }
 
-void MagicNet::PredictSoft(Volume& in, Volume& out) {
-	// forward prop the best networks
-	// and accumulate probabilities at last layer into a an output Vol
-	
-	Array<Session>* eval_candidates_;
-	int nv = 0;
+Array<Session>& MagicNet::GetEnsemble(int& count) {
 	if (evaluated_candidates.GetCount() == 0) {
 		// not sure what to do here, first batch of nets hasnt evaluated yet
 		// lets just predict with current candidates.
-		nv = session.GetCount();
-		eval_candidates_ = &session;
-	} else {
-		// forward prop the best networks from evaluated_candidates
-		nv = min(ensemble_size, evaluated_candidates.GetCount());
-		eval_candidates_ = &evaluated_candidates;
+		count = session.GetCount();
+		return session;
 	}
-	
-	Array<Session>& eval_candidates = *eval_candidates_;
-	
-	// forward nets of all candidates and average the predictions
-	int n;
-	for (int j = 0; j < nv; j++) {
-		Net& net = eval_candidates[j].GetNetwork();
-		Volume& x = net.Forward(in);
-		if (j == 0) {
-			out = x;
-			n = x.GetLength();
-		} else {
-			// add it on
-			for(int d = 0; d < n; d++) {
-				out.Add(d, x.Get(d));
-			}
+	// forward prop the best networks from evaluated_candidates
+	count = min(ensemble_size, evaluated_candidates.GetCount());
+	return evaluated_candidates;
+}
+
+void MagicNet::PredictSoft(Volume& in, Volume& out) {
+	// forward prop the best networks
+	// and accumulate probabilities at last layer into a an output Vol
+	int nv = 0;
+	Array<Session>& ensemble = GetEnsemble(nv);
+	if (nv == 0)
+		return;
+	
+	int samples = in.GetBatch();
+	int length = in.GetLength();
+	int chunk = min(samples, predict_batch);
+	int threads = max(1, min(thread_count, nv));
+	
+	for(int begin = 0; begin < samples; begin += chunk) {
+		int count = min(chunk, samples - begin);
+		Volume* x = &in;
+		if (count < samples) {
+			predict_in.SetSize(in.GetWidth(), in.GetHeight(), in.GetDepth(), count);
+			memcpy(predict_in.GetWeights().Begin(), in.GetWeights().Begin() + begin * length, count * length * sizeof(Real));
+			x = &predict_in;
 		}
+		
+		// the members of the ensemble are independent nets
+		auto forward = [&](int t) {
+			for(int j = t; j < nv; j += threads)
+				ensemble[j].GetNetwork().Forward(*x);
+		};
+		if (threads > 1) {
+			CoWork co;
+			for(int t = 0; t < threads; t++)
+				co & [&forward, t] {forward(t);};
+			co.Finish();
+		}
+		else
+			forward(0);
+		
+		// produce average
+		Volume& first = ensemble[0].GetNetwork().GetOutput();
+		int n = first.GetLength();
+		if (begin == 0)
+			out.SetSize(first.GetWidth(), first.GetHeight(), first.GetDepth(), samples);
+		Real* __restrict o = out.GetWeights().Begin() + begin * n;
+		int total = count * n;
+		const Real* p = first.GetWeights().Begin();
+		for(int i = 0; i < total; i++)
+			o[i] = p[i];
+		for(int j = 1; j < nv; j++) {
+			const Real* __restrict p = ensemble[j].GetNetwork().GetOutput().GetWeights().Begin();
+			for(int i = 0; i < total; i++)
+				o[i] += p[i];
+		}
+		Real scale = (Real)(1.0 / nv);
+		for(int i = 0; i < total; i++)
+			o[i] *= scale;
 	}
-	// produce average
-	for (int d = 0; d < n; d++) {
-		out.Set(d, out.Get(d) / nv);
-	}
-	
 }
 
 int MagicNet::PredictSoftLabel(Volume& in) {
@@ -295,5 +421,13 @@ int MagicNet::PredictSoftLabel(Volume& in) {
 	return predicted_label;
 }
 
+void MagicNet::PredictSoftLabels(Volume& in, Vector<int>& labels) {
+	PredictSoft(in, tmp_out);
+	
+	labels.SetCount(in.GetBatch());
+	for(int b = 0; b < labels.GetCount(); b++)
+		labels[b] = tmp_out.GetLength() != 0 ? tmp_out.GetMaxColumn(b) : -1;
+}
+
 
 }
@@ -12,6 +12,12 @@ namespace ConvNet {
 	- samples candidate networks
 	- evaluates candidate networks on all data folds
 	- produces predictions by model-averaging the best networks
+	
+	The candidates are independent, so they are trained and evaluated concurrently in
+	thread_count threads. With successive halving (SetHalving), the candidates are evaluated
+	on the validation fold after halving_epochs epochs, and again after every halving_rate
+	times more epochs, and only the best 1 / halving_rate of them are trained further. Most of
+	the time of a search goes to bad candidates, and they are usually obvious after an epoch.
 */
 
 class MagicNet : public MetaSession {
@@ -30,6 +36,11 @@ protected:
 	int num_epochs;
 	int ensemble_size;
 	int foldix, datapos;
+	int thread_count;
+	int predict_batch;
+	int halving_rate, halving_epochs;
+	int rung; // the next evaluation of successive halving in the fold
+	int dropped_count;
 	
 	double l2_decay_min, l2_decay_max;
 	double learning_rate_min, learning_rate_max;
@@ -46,6 +57,13 @@ protected:
 	
 	// tmp
 	Vector<double> val_acc;
+	Vector<int> candidate_order;
+	Volume predict_in;
+	
+	Array<Session>& GetEnsemble(int& count);
+	int GetRungIteration(int rung) const;
+	void TrainCandidates(int count);
+	void HalveCandidates();
 	
 	
 public:
@@ -57,6 +75,9 @@ public:
 	void SetCandidateCount(int i) {num_candidates = i;}
 	void SetEpochCount(int i) {num_epochs = i;}
 	void SetNeuronRange(int min, int max) {neurons_min = min, neurons_max = max;}
+	void SetThreadCount(int i) {thread_count = max(1, i);}
+	void SetPredictBatchSize(int i) {predict_batch = max(1, i);}
+	void SetHalving(int rate=3, int epochs=1) {halving_rate = rate; halving_epochs = max(1, epochs);} // rate 0 disables
 	
 	// sets folds to a sampling of num_folds folds
 	void SampleFolds();
@@ -67,6 +88,7 @@ public:
 	// sets candidates with num_candidates candidate nets
 	void SampleCandidates();
 	
+	// trains all candidates on the samples until the next evaluation (every 100 samples)
 	void Step();
 	
 	void EvaluateValueErrors(Vector<double>& vals);
@@ -74,9 +96,13 @@ public:
 	// returns prediction scores for given test data point, as Vol
 	// uses an averaged prediction from the best ensemble_size models
 	// x is a Vol.
+	// All samples of a batch are predicted at once: the batch is forwarded in parts of
+	// predict_batch samples, the members of the ensemble forward every part in parallel, and
+	// out gets the average of their outputs for every sample.
 	void PredictSoft(Volume& in, Volume& out);
 	void Predict(Volume& in);
 	int PredictSoftLabel(Volume& in);
+	void PredictSoftLabels(Volume& in, Vector<int>& labels);
 	
 	
 	
@@ -85,6 +111,8 @@ public:
 	int GetEvaluatedCandidateCount() const {return evaluated_candidates.GetCount();}
 	
 	int GetFold() const {return foldix;}
+	int GetThreadCount() const {return thread_count;}
+	int GetDroppedCandidateCount() const {return dropped_count;} // by successive halving
 	
 };
 
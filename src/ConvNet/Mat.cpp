@@ -8,6 +8,36 @@ Mat::Mat() {
 	length = 0;
 }
 
+void Mat::Serialize(Stream& s) {
+	// same versioning scheme as Volume::Serialize
+	int version = -2;
+	if (s.IsStoring()) {
+		byte real_size = sizeof(Real);
+		s / version % real_size;
+		SerializeReals(s, weight_gradients, real_size);
+		SerializeReals(s, weights, real_size);
+	}
+	else {
+		s / version;
+		if (version >= 0) {
+			Vector<double> tmp;
+			tmp.SetCount(version);
+			for(int i = 0; i < version; i++)
+				s % tmp[i];
+			HeaplessCopy(weight_gradients, tmp);
+			s % tmp;
+			HeaplessCopy(weights, tmp);
+		}
+		else {
+			byte real_size = 0;
+			s % real_size;
+			SerializeReals(s, weight_gradients, real_size);
+			SerializeReals(s, weights, real_size);
+		}
+	}
+	s % width % height % length;
+}
+
 Mat::Mat(int width, int height) {
 	ASSERT(width > 0 && height > 0);
 	Init(width, height);
@@ -24,7 +54,7 @@ Mat::Mat(const Vector<double>& weights) {
 	height = weights.GetCount();
 	length = height;
 	
-	this->weights <<= weights;
+	HeaplessCopy(this->weights, weights);
 	
 	weight_gradients.SetCount(length, 0.0);
 }
@@ -37,7 +67,7 @@ Mat::Mat(int width, int height, const Vector<double>& weights) {
 	
 	ASSERT(length == weights.GetCount());
 	
-	this->weights <<= weights;
+	HeaplessCopy(this->weights, weights);
 	
 	weight_gradients.SetCount(length, 0.0);
 }
@@ -386,6 +416,7 @@ Mat& MatPool::Get(const MatId& id) {
 }
 
 int MatPool::GetInput(int pos) {
+	ASSERT(batch == 1);
 	return index_sequence[pos];
 }
 
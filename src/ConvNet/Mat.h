@@ -13,8 +13,8 @@ struct MatId : Moveable<MatId> {
 };
 
 class Mat : Moveable<Mat> {
-	Vector<double> weight_gradients;
-	Vector<double> weights;
+	Vector<Real> weight_gradients;
+	Vector<Real> weights;
 
 protected:
 	
@@ -40,12 +40,14 @@ public:
 	
 	~Mat();
 	
-	void Serialize(Stream& s) {s % weight_gradients % weights % width % height % length;}
+	void Serialize(Stream& s);
 	
 	Mat& operator=(const Mat& src);
 	
-	const Vector<double>& GetWeights() const {return weights;}
-	const Vector<double>& GetGradients() const {return weight_gradients;}
+	const Vector<Real>& GetWeights() const {return weights;}
+	const Vector<Real>& GetGradients() const {return weight_gradients;}
+	Vector<Real>& GetWeights() {return weights;}
+	Vector<Real>& GetGradients() {return weight_gradients;}
 	
 	void Add(int i, double v);
 	void Add(int x, int y, double v);
@@ -85,8 +87,9 @@ protected:
 	Vector<Mat> mats;
 	
 	Vector<Mat*> tmp_mat;
-	Vector<int> index_sequence;
+	Vector<int> index_sequence;	// the steps one after another, batch inputs per step
 	SpinLock lock;
+	int batch = 1;
 	
 public:
 	void InitMat(MatId& id, int width, int height, double default_value);
@@ -98,6 +101,8 @@ public:
 	
 	Mat& Get(const MatId& id);
 	int GetInput(int pos);
+	int GetInput(int pos, int col) {return index_sequence[pos * batch + col];}
+	int GetBatch() const {return batch;}
 	
 	void Serialize(Stream& s) {
 		s % mats;
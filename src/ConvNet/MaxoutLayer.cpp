@@ -14,47 +14,54 @@ void LayerBase::InitMaxout(int input_width, int input_height, int input_depth) {
 Volume& LayerBase::ForwardMaxout(Volume& input, bool is_training) {
 	input_activation = &input;
 	int depth = output_depth;
-	output_activation.Init(output_width, output_height, output_depth, 0.0);
+	int batch = input.GetBatch();
+	output_activation.SetSize(output_width, output_height, output_depth, batch);
+	SetBufferCount(switches, output_activation.GetCount());
 	
 	// optimization branch. If we're operating on 1D arrays we dont have
 	// to worry about keeping track of x,y,d coordinates inside
 	// input volumes. In convnets we do :(
 	if (output_width == 1 && output_height == 1) {
-		for (int i = 0; i < depth; i++) {
-			int ix = i * group_size; // base index offset
-			double a = input.Get(ix);
-			int ai = 0;
-			
-			for (int j = 1; j < group_size; j++) {
-				double a2 = input.Get(ix + j);
-				if (a2 > a) {
-					a = a2;
-					ai = j;
+		for (int b = 0; b < batch; b++) {
+			int in_off = b * input.GetLength();
+			int out_off = b * depth;
+			for (int i = 0; i < depth; i++) {
+				int ix = in_off + i * group_size; // base index offset
+				double a = input.Get(ix);
+				int ai = 0;
+				
+				for (int j = 1; j < group_size; j++) {
+					double a2 = input.Get(ix + j);
+					if (a2 > a) {
+						a = a2;
+						ai = j;
+					}
 				}
+				
+				output_activation.Set(out_off + i, a);
+				switches[out_off + i] = ix + ai;
 			}
-			
-			output_activation.Set(i, a);
-			switches[i] = ix + ai;
 		}
 	}
 	else {
 		int n = 0; // counter for switches
+		for (int b = 0; b < batch; b++)
 		for (int x = 0; x < input.GetWidth(); x++) {
 			for (int y = 0; y < input.GetHeight(); y++) {
 				for (int i = 0; i < depth; i++) {
 					int ix = i * group_size;
-					double a = input.Get(x, y, ix);
+					double a = input.Get(b, x, y, ix);
 					int ai = 0;
 					
 					for (int j = 1; j < group_size; j++) {
-						double a2 = input.Get(x, y, ix + j);
+						double a2 = input.Get(b, x, y, ix + j);
 						if (a2 > a) {
 							a = a2;
 							ai = j;
 						}
 					}
 					
-					output_activation.Set(x, y, i, a);
+					output_activation.Set(b, x, y, i, a);
 					switches[n] = ix + ai;
 					n++;
 				}
@@ -69,12 +76,13 @@ void LayerBase::BackwardMaxout() {
 	Volume& input = *input_activation; // we need to set dw of this
 	Volume& output = output_activation;
 	int depth = output_depth;
+	int batch = output.GetBatch();
 	
 	input.ZeroGradients(); // zero out gradient wrt data
 	
 	// pass the gradient through the appropriate switch
 	if (output_width == 1 && output_height == 1) {
-		for (int i = 0; i < depth; i++) {
+		for (int i = 0; i < batch * depth; i++) {
 			double chain_gradient_ = output.GetGradient(i);
 			input.SetGradient(switches[i], chain_gradient_);
 		}
@@ -82,11 +90,12 @@ void LayerBase::BackwardMaxout() {
 	else {
 		// bleh okay, lets do this the hard way
 		int n = 0; // counter for switches
+		for (int b = 0; b < batch; b++)
 		for (int x = 0; x < output.GetWidth(); x++) {
 			for (int y = 0; y < output.GetHeight(); y++) {
 				for (int i = 0; i < depth; i++) {
-					double chain_gradient_ = output.GetGradient(x, y, i);
-					input.SetGradient(x, y, switches[n], chain_gradient_);
+					double chain_gradient_ = output.GetGradient(b, x, y, i);
+					input.SetGradient(b, x, y, switches[n], chain_gradient_);
 					n++;
 				}
 			}
@@ -139,10 +139,10 @@ public:
     size_t GetCount() const { return count; }
 };
 
-// Wrapper for U++ Vector<double> that uses memory pool
+// Wrapper for U++ Vector<Real> that uses memory pool
 class PooledVector {
 private:
-    double* data;
+    Real* data;
     int count;
     int allocated_count;
     
@@ -150,7 +150,7 @@ public:
     PooledVector() : data(nullptr), count(0), allocated_count(0) {}
     
     explicit PooledVector(int n, double init_value = 0.0) : count(n), allocated_count(n) {
-        data = static_cast<double*>(ThreadLocalMemoryPool::Get().Allocate(sizeof(double) * n));
+        data = static_cast<Real*>(ThreadLocalMemoryPool::Get().Allocate(sizeof(Real) * n));
         for (int i = 0; i < n; i++) {
             data[i] = init_value;
         }
@@ -191,12 +191,12 @@ public:
     PooledVector(const PooledVector&) = delete;
     PooledVector& operator=(const PooledVector&) = delete;
     
-    double& operator[](int i) { 
+    Real& operator[](int i) { 
         ASSERT(i >= 0 && i < count);
         return data[i]; 
     }
     
-    const double& operator[](int i) const { 
+    const Real& operator[](int i) const { 
         ASSERT(i >= 0 && i < count);
         return data[i]; 
     }
@@ -222,7 +222,7 @@ public:
             }
         } else {
             // Need to reallocate
-            double* new_data = static_cast<double*>(ThreadLocalMemoryPool::Get().Allocate(sizeof(double) * new_count));
+            Real* new_data = static_cast<Real*>(ThreadLocalMemoryPool::Get().Allocate(sizeof(Real) * new_count));
             // Copy existing data
             for (int i = 0; i < count && i < new_count; i++) {
                 new_data[i] = data[i];
@@ -241,8 +241,8 @@ public:
         }
     }
     
-    double* Begin() { return data; }
-    const double* Begin() const { return data; }
+    Real* Begin() { return data; }
+    const Real* Begin() const { return data; }
 };
 
 // Memory pool compatible Mat class
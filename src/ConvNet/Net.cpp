@@ -1,4 +1,5 @@
 #include "ConvNet.h"
+#include <chrono>
 
 namespace ConvNet {
 
@@ -52,6 +53,17 @@ Volume& Net::Forward(const Vector<VolumePtr>& inputs, bool is_training) {
 }
 
 Volume& Net::Forward(Volume& input, bool is_training) {
+	if (profiling) {
+		Volume* activation = &input;
+		for (int i = 0; i < layers.GetCount(); i++) {
+			int allocations;
+			int64 begin = ProfileBegin(allocations);
+			activation = &layers[i].Forward(*activation, is_training);
+			ProfileEnd(i, false, begin, allocations);
+		}
+		return *activation;
+	}
+	
 	Volume* activation = &layers[0].Forward(input, is_training);
 	for (int i = 1; i < layers.GetCount(); i++) {
 		LayerBase& layer_base = layers[i];
@@ -60,12 +72,55 @@ Volume& Net::Forward(Volume& input, bool is_training) {
 	return *activation;
 }
 
+// Sizes every activation and scratch buffer once for mini-batches of the given size.
+// After this, Forward (and Backward, if planned for training) run without heap
+// allocations for batches up to that size; see GetBufferAllocations().
+void Net::Plan(bool is_training, int batch) {
+	for (int i = 0; i < layers.GetCount(); i++)
+		layers[i].Plan(is_training, batch);
+}
+
+// Makes this net a deep copy of src, e.g. a replica for a worker thread.
+void Net::CopyFrom(Net& src) {
+	StringStream ss;
+	ss.SetStoring();
+	ss % src;
+	ss.Seek(0);
+	ss.SetLoading();
+	ss % *this;
+	
+	// runtime settings, which aren't serialized
+	for (int i = 0; i < layers.GetCount(); i++) {
+		LayerBase& l = layers[i];
+		l.SetConvAlgorithm(src.layers[i].GetConvAlgorithm());
+		l.SetThreadCount(src.layers[i].GetThreadCount());
+		if (src.layers[i].IsQuantized())
+			l.QuantizeFilters(src.layers[i].quantized_filters.GetType());
+	}
+}
+
+// Frees the gradient buffers of all activations and parameters, e.g. when a trained
+// network is only used for inference from now on. Backward allocates them again.
+void Net::ReleaseGradients() {
+	for (int i = 0; i < layers.GetCount(); i++) {
+		LayerBase& layer = layers[i];
+		layer.output_activation.ReleaseGradients();
+		layer.biases.ReleaseGradients();
+		for (int j = 0; j < layer.filters.GetCount(); j++)
+			layer.filters[j].ReleaseGradients();
+	}
+}
+
 double Net::GetCostLoss(Volume& input, int pos, double y) {
 	Forward(input);
 	
 	LayerBase& last_layer = layers.Top();
 	if (last_layer.IsLastLayer()) {
+		int allocations = 0;
+		int64 begin = profiling ? ProfileBegin(allocations) : 0;
 		double loss = last_layer.Backward(pos, y);
+		if (profiling)
+			ProfileEnd(layers.GetCount() - 1, true, begin, allocations);
 		return loss;
 	}
 	
@@ -77,22 +132,41 @@ double Net::GetCostLoss(Volume& input, const Vector<double>& y) {
 	
 	LayerBase& last_layer = layers.Top();
 	if (last_layer.IsLastLayer()) {
+		int allocations = 0;
+		int64 begin = profiling ? ProfileBegin(allocations) : 0;
 		double loss = last_layer.Backward(y);
+		if (profiling)
+			ProfileEnd(layers.GetCount() - 1, true, begin, allocations);
 		return loss;
 	}
 	
 	throw Exception("Last layer doesnt implement ILastLayer interface");
 }
 
+void Net::BackwardLayers() {
+	for (int i = layers.GetCount() - 2; i >= 0; i--) {
+		// first layer assumed input
+		if (profiling) {
+			int allocations;
+			int64 begin = ProfileBegin(allocations);
+			layers[i].Backward();
+			ProfileEnd(i, true, begin, allocations);
+		}
+		else
+			layers[i].Backward();
+	}
+}
+
 double Net::Backward(int pos, double y) {
 	int n = layers.GetCount();
 	LayerBase& last_layer = layers.Top();
 	if (last_layer.IsLastLayer()) {
+		int allocations = 0;
+		int64 begin = profiling ? ProfileBegin(allocations) : 0;
 		double loss = last_layer.Backward(pos, y); // last layer assumed to be loss layer
-		for (int i = n - 2; i >= 0; i--) {
-			// first layer assumed input
-			layers[i].Backward();
-		}
+		if (profiling)
+			ProfileEnd(n - 1, true, begin, allocations);
+		BackwardLayers();
 		return loss;
 	}
 	
@@ -103,55 +177,69 @@ double Net::Backward(const Vector<double>& y) {
 	int n = layers.GetCount();
 	LayerBase& last_layer = layers.Top();
 	if (last_layer.IsLastLayer()) {
+		int allocations = 0;
+		int64 begin = profiling ? ProfileBegin(allocations) : 0;
 		double loss = last_layer.Backward(y); // last layer assumed to be loss layer
-		for (int i = n - 2; i >= 0; i--) {
-			// first layer assumed input
-			layers[i].Backward();
-		}
+		if (profiling)
+			ProfileEnd(n - 1, true, begin, allocations);
+		BackwardLayers();
 		return loss;
 	}
 	
 	throw Exception("Last layer doesnt implement ILastLayer interface");
 }
 
-double Net::Backward(int cols, const Vector<int>& pos, const Vector<double>& y) {
+double Net::Backward(int cols, const Vector<int>& pos, const Vector<double>& y, const Vector<double>* weight) {
 	int n = layers.GetCount();
 	LayerBase& last_layer = layers.Top();
 	if (last_layer.IsLastLayer()) {
-		double loss = last_layer.Backward(cols, pos, y); // last layer assumed to be loss layer
-		for (int i = n - 2; i >= 0; i--) {
-			// first layer assumed input
-			layers[i].Backward();
-		}
+		int allocations = 0;
+		int64 begin = profiling ? ProfileBegin(allocations) : 0;
+		double loss = last_layer.Backward(cols, pos, y, weight); // last layer assumed to be loss layer
+		if (profiling)
+			ProfileEnd(n - 1, true, begin, allocations);
+		BackwardLayers();
 		return loss;
 	}
 	
 	throw Exception("Last layer doesnt implement ILastLayer interface");
 }
 
-int Net::GetPrediction() {
+// Backward pass of a mini-batch: pos and y have one entry for each sample of the
+// last Forward. The returned loss is the sum over the samples.
+double Net::Backward(const Vector<int>& pos, const Vector<double>& y) {
+	int n = layers.GetCount();
+	LayerBase& last_layer = layers.Top();
+	if (last_layer.IsLastLayer()) {
+		int allocations = 0;
+		int64 begin = profiling ? ProfileBegin(allocations) : 0;
+		double loss = last_layer.Backward(pos, y); // last layer assumed to be loss layer
+		if (profiling)
+			ProfileEnd(n - 1, true, begin, allocations);
+		BackwardLayers();
+		return loss;
+	}
+	
+	throw Exception("Last layer doesnt implement ILastLayer interface");
+}
+
+int Net::GetPrediction(int b) {
 	// this is a convenience function for returning the argmax
-	// prediction, assuming the last layer of the net is a softmax
+	// prediction of sample b, assuming the last layer of the net is a softmax
 	LayerBase& last_layer = layers.Top();
 	if (!last_layer.IsSoftMaxLayer()) {
 		throw Exception("GetPrediction function assumes softmax as last layer of the net!");
 	}
 	
-	double maxv = last_layer.output_activation.Get(0);
-	int maxi = 0;
-	
-	for (int i = 1; i < last_layer.output_activation.GetLength(); i++) {
-		double d = last_layer.output_activation.Get(i);
-		if (d > maxv) {
-			maxv = d;
-			maxi = i;
-		}
-	}
-	
-	return maxi; // return index of the class with highest class probability
+	// return index of the class with highest class probability
+	return last_layer.output_activation.GetMaxColumn(b);
 }
 
 Vector<ParametersAndGradients>& Net::GetParametersAndGradients() {
+	// the parameter set of a flat net can't change until the arena is released
+	if (flat)
+		return response;
+	
 	int count = 0;
 	
 	int k = 0;
@@ -171,6 +259,221 @@ Vector<ParametersAndGradients>& Net::GetParametersAndGradients() {
 	return response;
 }
 
+static Real* AlignArena(Vector<Real>& buf, int count) {
+	const int align = 64 / sizeof(Real);
+	buf.SetCount(count + align, 0.0);
+	uintptr_t p = ((uintptr_t)buf.Begin() + 63) & ~(uintptr_t)63;
+	return (Real*)p;
+}
+
+void Net::FlattenParameters() {
+	ReleaseArena();
+	Vector<ParametersAndGradients>& pag = GetParametersAndGradients();
+	
+	const int align = 64 / sizeof(Real);
+	int count = 0;
+	for(int i = 0; i < pag.GetCount(); i++)
+		count += (pag[i].volume->GetCount() + align - 1) / align * align;
+	
+	param_arena = AlignArena(param_buffer, count);
+	grad_arena = AlignArena(grad_buffer, count);
+	arena_count = count;
+	
+	int offset = 0;
+	for(int i = 0; i < pag.GetCount(); i++) {
+		Volume& vol = *pag[i].volume;
+		vol.SetView(param_arena + offset, grad_arena + offset);
+		offset += (vol.GetCount() + align - 1) / align * align;
+	}
+	flat = true;
+}
+
+void Net::ReleaseArena() {
+	if (!flat)
+		return;
+	for(int i = 0; i < response.GetCount(); i++)
+		response[i].volume->Detach();
+	param_buffer.Clear();
+	grad_buffer.Clear();
+	param_arena = NULL;
+	grad_arena = NULL;
+	arena_count = 0;
+	flat = false;
+}
+
+// Copies the parameters of a net with the same architecture, e.g. to sync a replica.
+void Net::CopyParametersFrom(Net& src) {
+	if (flat && src.flat && arena_count == src.arena_count) {
+		memcpy(param_arena, src.param_arena, arena_count * sizeof(Real));
+		return;
+	}
+	Vector<ParametersAndGradients>& dst = GetParametersAndGradients();
+	Vector<ParametersAndGradients>& s = src.GetParametersAndGradients();
+	ASSERT(dst.GetCount() == s.GetCount());
+	for(int i = 0; i < dst.GetCount(); i++)
+		dst[i].volume->SetWeights(*s[i].volume);
+}
+
+void Net::ZeroParameterGradients() {
+	if (flat) {
+		memset(grad_arena, 0, arena_count * sizeof(Real));
+		return;
+	}
+	Vector<ParametersAndGradients>& pag = GetParametersAndGradients();
+	for(int i = 0; i < pag.GetCount(); i++)
+		pag[i].volume->ZeroGradients();
+}
+
+void Net::VisitTensors(GGUFTensorVisitor& v) {
+	for(int i = 0; i < layers.GetCount(); i++) {
+		LayerBase& l = layers[i];
+		if ((l.layer_type != FULLYCONN_LAYER && l.layer_type != CONV_LAYER) || l.filters.IsEmpty())
+			continue;
+		v.Filters(Format("layers.%d.weight", i), l.filters);
+		v.Tensor(Format("layers.%d.bias", i), l.biases, l.biases.GetCount());
+	}
+}
+
+bool Net::MapGGUF(std::shared_ptr<const GGUFFile> file) {
+	ReleaseArena();
+	Dequantize();
+	
+	// the volumes which view an earlier file get their own copies
+	if (mapped_file && mapped_file != file) {
+		Vector<ParametersAndGradients>& pag = GetParametersAndGradients();
+		for(int i = 0; i < pag.GetCount(); i++)
+			pag[i].volume->Detach();
+		mapped_file.reset();
+	}
+	
+	GGUFMapper mapper(*file);
+	VisitTensors(mapper);
+	if (mapper.GetMappedCount())
+		mapped_file = file;
+	for(int i = 0; i < mapper.GetErrors().GetCount(); i++)
+		LOG("GGUF: " << mapper.GetErrors()[i]);
+	return mapper.GetErrors().IsEmpty();
+}
+
+bool Net::SaveGGUF(const String& path) {
+	GGUFWriter out;
+	out.Set("general.architecture", "convnet");
+	VisitTensors(out);
+	return out.Save(path);
+}
+
+void Net::Quantize(int type) {
+	for (int i = 0; i < layers.GetCount(); i++) {
+		LayerBase& l = layers[i];
+		if ((l.layer_type == FULLYCONN_LAYER || l.layer_type == CONV_LAYER) && !l.filters.IsEmpty())
+			l.QuantizeFilters(type);
+	}
+}
+
+Net& Net::SetThreadCount(int i) {
+	for (int j = 0; j < layers.GetCount(); j++)
+		layers[j].SetThreadCount(i);
+	return *this;
+}
+
+void Net::Dequantize() {
+	for (int i = 0; i < layers.GetCount(); i++)
+		layers[i].quantized_filters.Clear();
+}
+
+bool Net::IsQuantized() const {
+	for (int i = 0; i < layers.GetCount(); i++)
+		if (layers[i].IsQuantized())
+			return true;
+	return false;
+}
+
+int64 Net::GetFilterBytes() const {
+	int64 bytes = 0;
+	for (int i = 0; i < layers.GetCount(); i++) {
+		const LayerBase& l = layers[i];
+		if (l.IsQuantized()) {
+			bytes += l.quantized_filters.GetByteCount();
+			continue;
+		}
+		for (int j = 0; j < l.filters.GetCount(); j++)
+			bytes += (int64)l.filters[j].GetCount() * sizeof(Real);
+	}
+	return bytes;
+}
+
+static int64 GetNanoseconds() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+int64 Net::ProfileBegin(int& allocations) const {
+	allocations = GetBufferAllocations();
+	return GetNanoseconds();
+}
+
+void Net::ProfileEnd(int layer, bool backward, int64 begin, int allocations) {
+	int64 ns = GetNanoseconds() - begin;
+	if (profile.GetCount() != layers.GetCount())
+		profile.SetCount(layers.GetCount());
+	
+	LayerProfile& p = profile[layer];
+	const LayerBase& l = layers[layer];
+	int64 flops, bytes;
+	l.GetCost(flops, bytes);
+	int64 batch = l.output_activation.GetBatch();
+	if (backward) {
+		p.backward_ns += ns;
+		p.backward_calls++;
+		p.backward_flops += (l.filters.IsEmpty() ? 1 : 2) * flops * batch;
+	}
+	else {
+		p.forward_ns += ns;
+		p.forward_calls++;
+		p.forward_flops += flops * batch;
+	}
+	p.bytes += bytes * batch;
+	p.allocations += GetBufferAllocations() - allocations;
+}
+
+String Net::GetProfileText() const {
+	int64 total = 0;
+	for (int i = 0; i < profile.GetCount(); i++)
+		total += profile[i].GetTotalNs();
+	
+	String s;
+	s << Format("%-4s %-28s %12s %12s %7s %10s %10s %8s\n",
+		"#", "layer", "forward ms", "backward ms", "%", "GFLOP/s", "MB", "allocs");
+	for (int i = 0; i < profile.GetCount(); i++) {
+		const LayerProfile& p = profile[i];
+		int64 ns = p.GetTotalNs();
+		double gflops = ns > 0 ? (double)(p.forward_flops + p.backward_flops) / ns : 0.0;
+		s << Format("%-4d %-28s %12.3f %12.3f %7.2f %10.3f %10.3f %8d\n",
+			i, layers[i].GetKey(), p.forward_ns * 1e-6, p.backward_ns * 1e-6,
+			total > 0 ? 100.0 * ns / total : 0.0, gflops, p.bytes / (1024.0 * 1024.0),
+			(int)p.allocations);
+	}
+	return s;
+}
+
+String Net::GetProfileJSON() const {
+	JsonArray arr;
+	for (int i = 0; i < profile.GetCount(); i++) {
+		const LayerProfile& p = profile[i];
+		arr << Json("layer", i)
+			("type", layers[i].GetKey())
+			("forward_ns", p.forward_ns)
+			("backward_ns", p.backward_ns)
+			("forward_calls", p.forward_calls)
+			("backward_calls", p.backward_calls)
+			("forward_flops", p.forward_flops)
+			("backward_flops", p.backward_flops)
+			("bytes", p.bytes)
+			("allocations", p.allocations);
+	}
+	return arr;
+}
+
 String Net::ToString() const {
 	String s;
 	for(int i = 0; i < layers.GetCount(); i++)
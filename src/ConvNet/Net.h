@@ -1,19 +1,52 @@
 #ifndef _ConvNet_Net_h_
 #define _ConvNet_Net_h_
 
+#include <memory>
 #include "LayerBase.h"
+#include "GGUF.h"
 
 namespace ConvNet
 {
 
+// Per-layer totals of the profiler, see Net::SetProfiling. The FLOP and byte counts are
+// estimated from the layer shapes (LayerBase::GetCost) and multiplied by the batch size.
+// The allocations are the buffer allocations (GetBufferAllocations) made in the layer.
+struct LayerProfile : Moveable<LayerProfile> {
+	int64 forward_ns = 0, backward_ns = 0;
+	int64 forward_calls = 0, backward_calls = 0;
+	int64 forward_flops = 0, backward_flops = 0;
+	int64 bytes = 0;
+	int64 allocations = 0;
+	
+	int64 GetTotalNs() const {return forward_ns + backward_ns;}
+};
+
 class Net {
 	
 private:
 	Vector<LayerBase> layers;
 	
+	// profiler
+	Vector<LayerProfile> profile;
+	bool profiling = false;
+	
+	void BackwardLayers();
+	int64 ProfileBegin(int& allocations) const;
+	void ProfileEnd(int layer, bool backward, int64 begin, int allocations);
+	
 	Vector<ParametersAndGradients> response;
 	SpinLock lock;
 	
+	// contiguous parameter and gradient storage, see FlattenParameters
+	Vector<Real> param_buffer, grad_buffer;
+	Real* param_arena = NULL;
+	Real* grad_arena = NULL;
+	int arena_count = 0;
+	bool flat = false;
+	
+	// the GGUF file which the parameters view, see MapGGUF
+	std::shared_ptr<const GGUFFile> mapped_file;
+	
 protected:
 	friend class Session;
 	Net(const Net& iv) {}
@@ -22,6 +55,8 @@ public:
 	Net() {}
 	
 	void Serialize(Stream& s) {
+		if (s.IsLoading())
+			ReleaseArena();
 		s % layers;
 	}
 	
@@ -29,19 +64,73 @@ public:
 	Vector<LayerBase>& GetLayers() {return layers;}
 	Volume& GetOutput() {return layers.Top().output_activation;}
 	
-	LayerBase& AddLayer() {return layers.Add();}
+	LayerBase& AddLayer() {ReleaseArena(); return layers.Add();}
+	void CopyFrom(Net& src);
 	void CheckLayer();
+	void Plan(bool is_training = true, int batch = 1);
 	Volume& Forward(const Vector<VolumePtr>& inputs, bool is_training = false);
 	Volume& Forward(Volume& input, bool is_training = false);
 	double GetCostLoss(Volume& input, int pos, double y);
 	double GetCostLoss(Volume& input, const Vector<double>& y);
 	double Backward(int pos, double y);
 	double Backward(const Vector<double>& y);
-	double Backward(int cols, const Vector<int>& pos, const Vector<double>& y);
-	int GetPrediction();
+	double Backward(int cols, const Vector<int>& pos, const Vector<double>& y, const Vector<double>* weight=NULL);
+	double Backward(const Vector<int>& pos, const Vector<double>& y);
+	int GetPrediction(int b = 0);
 	Vector<ParametersAndGradients>& GetParametersAndGradients();
+	void ReleaseGradients();
+	
+	// Moves all parameters and their gradients into two contiguous, 64-byte aligned
+	// arenas, which the filter and bias volumes then view. Every volume starts at an
+	// aligned offset and the padding between them stays zero, so whole-net operations
+	// (zeroing, replica sync, gradient reduction) run as single loops over the arena.
+	// Re-initializing a parameter volume with the same size keeps it in the arena, and
+	// AddLayer and loading release the arena. Resizing a flattened volume is an error.
+	void FlattenParameters();
+	void ReleaseArena();
+	bool IsFlat() const {return flat;}
+	Real* GetParameterArena() {return param_arena;}
+	Real* GetGradientArena() {return grad_arena;}
+	int GetArenaCount() const {return arena_count;}
+	void CopyParametersFrom(Net& src);
+	void ZeroParameterGradients();
+	
+	// The profiler measures every layer of Forward and Backward from the calling thread.
+	// It is off by default, and costs two clock reads per layer step when enabled.
+	Net& SetProfiling(bool b = true) {profiling = b; return *this;}
+	bool IsProfiling() const {return profiling;}
+	void ResetProfile() {profile.Clear();}
+	const Vector<LayerProfile>& GetProfile() const {return profile;}
+	String GetProfileText() const;
+	String GetProfileJSON() const;
+	
+	// The filters and biases of the fully connected and convolutive layers as the GGUF
+	// tensors "layers.<i>.weight" and "layers.<i>.bias" of the layer i (see GGUF.h).
+	void VisitTensors(GGUFTensorVisitor& v);
+	
+	// Maps the tensors of the file into the layers where the shapes fit, in place when they
+	// have the type of Real. The layers without a tensor keep their parameters. Returns false
+	// if a tensor doesn't fit its layer. The net keeps the file open while it views it.
+	bool MapGGUF(std::shared_ptr<const GGUFFile> file);
+	bool SaveGGUF(const String& path);
+	bool IsMapped() const {return (bool)mapped_file;}
+	
+	// Post-training quantization of the filters of the fully connected and convolutive
+	// layers into GGUF_Q8_0 or GGUF_Q4_0 blocks (see Quantize.h). Forward uses them when not
+	// training. Training reads and updates the filters themselves: a trainer update, MapGGUF
+	// and loading drop the blocks, so Quantize again after them. Dequantize drops the blocks.
+	void Quantize(int type = GGUF_Q8_0);
+	void Dequantize();
+	bool IsQuantized() const;
+	
+	// The rows of the quantized filters are split between the threads of the layers which
+	// are in the net (see QuantizedGemm). The training passes don't use them.
+	Net& SetThreadCount(int i);
+	
+	// The bytes of filters which an inference forward pass reads, quantized or not
+	int64 GetFilterBytes() const;
 	
-	void Clear() {layers.Clear();}
+	void Clear() {ReleaseArena(); layers.Clear(); profile.Clear(); mapped_file.reset();}
 	void Enter() {lock.Enter();}
 	void Leave() {lock.Leave();}
 	
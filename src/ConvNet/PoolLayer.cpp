@@ -19,10 +19,14 @@ void LayerBase::InitPool(int input_width, int input_height, int input_depth) {
 
 Volume& LayerBase::ForwardPool(Volume& input, bool is_training) {
 	input_activation = &input;
+	int batch = input.GetBatch();
 	
-	output_activation.Init(output_width, output_height, output_depth, 0.0);
+	output_activation.SetSize(output_width, output_height, output_depth, batch);
+	SetBufferCount(switchx, batch * output_width * output_height * output_depth);
+	SetBufferCount(switchy, batch * output_width * output_height * output_depth);
 	
 	int n = 0; // a counter for switches
+	for (int b = 0; b < batch; b++)
 	for (int depth = 0; depth < output_depth; depth++)
 	{
 		// WTF C# version int n = depth * output_width * output_height;
@@ -40,7 +44,7 @@ Volume& LayerBase::ForwardPool(Volume& input, bool is_training) {
 						int oy = y + fy;
 						int ox = x + fx;
 						if (oy >= 0 && oy < input.GetHeight() && ox >= 0 && ox < input.GetWidth()) {
-							double v = input.Get(ox, oy, depth);
+							double v = input.Get(b, ox, oy, depth);
 							// perform max pooling and store pointers to where
 							// the max came from. This will speed up backprop
 							// and can help make nice visualizations in future
@@ -56,7 +60,7 @@ Volume& LayerBase::ForwardPool(Volume& input, bool is_training) {
 				switchx[n] = winx;
 				switchy[n] = winy;
 				n++;
-				output_activation.Set(ax, ay, depth, a);
+				output_activation.Set(b, ax, ay, depth, a);
 			}
 		}
 	}
@@ -69,19 +73,21 @@ void LayerBase::BackwardPool() {
 	// gradient wrt data here
 	Volume& input = *input_activation;
 	input.ZeroGradients(); // zero out gradient wrt data
+	int batch = output_activation.GetBatch();
 	
 	int n = 0;
+	for (int b = 0; b < batch; b++)
 	for (int depth = 0; depth < output_depth; depth++)
 	{
 		// WTF C# version int n = depth * output_width * output_height;
 		
 		for (int ax = 0; ax < output_width; ax++) {
 			for (int ay = 0; ay < output_height; ay++) {
-				double chain_gradient_ = output_activation.GetGradient(ax, ay, depth);
+				double chain_gradient_ = output_activation.GetGradient(b, ax, ay, depth);
 				int x = switchx[n];
 				int y = switchy[n];
 				if (x != -1 && y != -1)
-					input.AddGradient(x, y, depth, chain_gradient_);
+					input.AddGradient(b, x, y, depth, chain_gradient_);
 				n++;
 			}
 		}
@@ -0,0 +1,258 @@
+#include "ConvNet.h"
+
+#if defined(__AVX2__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX2__) && defined(__AVXVNNI__)
+#define QUANT_DPBUSD(acc, u, s) _mm256_dpbusd_avx_epi32(acc, u, s)
+#define QUANT_KERNEL "AVX-VNNI"
+#elif defined(__AVX2__) && defined(__AVX512VNNI__) && defined(__AVX512VL__)
+#define QUANT_DPBUSD(acc, u, s) _mm256_dpbusd_epi32(acc, u, s)
+#define QUANT_KERNEL "AVX512-VNNI"
+#elif defined(__AVX2__)
+#define QUANT_KERNEL "AVX2"
+#else
+#define QUANT_KERNEL "scalar"
+#endif
+
+namespace ConvNet {
+
+// A block of the quantized inputs. The scale is a float, because the inputs are quantized
+// in every call and never stored.
+struct InputBlock : Moveable<InputBlock> {
+	float d;
+	int8 qs[QUANT_BLOCK];
+};
+
+static int GetBlockBytes(int type) {
+	return type == GGUF_Q8_0 ? 34 : 18;
+}
+
+static inline float GetScale(const byte* block) {
+	word h;
+	memcpy(&h, block, 2);
+#ifdef __F16C__
+	return _cvtsh_ss(h);
+#else
+	return DataStore::HalfToFloat(h);
+#endif
+}
+
+static inline void SetScale(byte* block, float d) {
+	word h = DataStore::FloatToHalf(d);
+	memcpy(block, &h, 2);
+}
+
+bool IsQuantizedType(int type) {
+	return type == GGUF_Q8_0 || type == GGUF_Q4_0;
+}
+
+// Quantizes n values (the rest of the block is zero), with step values between them.
+// The rounding is the one of the reference quantization of ggml.
+static void QuantizeBlock(int type, const Real* x, int step, int n, byte* out) {
+	double amax = 0, vmax = 0;
+	for (int i = 0; i < n; i++) {
+		double v = x[(int64)i * step];
+		if (fabs(v) > amax) {
+			amax = fabs(v);
+			vmax = v;
+		}
+	}
+	if (type == GGUF_Q8_0) {
+		float d = (float)(amax / 127);
+		float id = d ? 1.0f / d : 0.0f;
+		SetScale(out, d);
+		int8* qs = (int8*)(out + 2);
+		for (int i = 0; i < QUANT_BLOCK; i++)
+			qs[i] = i < n ? (int8)roundf((float)x[(int64)i * step] * id) : 0;
+	}
+	else {
+		// the value of the largest magnitude is -8 * d, and zero is 8
+		float d = (float)(vmax / -8);
+		float id = d ? 1.0f / d : 0.0f;
+		SetScale(out, d);
+		byte* qs = out + 2;
+		for (int i = 0; i < QUANT_BLOCK / 2; i++) {
+			int lo = i < n ? min(15, (int)((float)x[(int64)i * step] * id + 8.5f)) : 8;
+			int hi = i + 16 < n ? min(15, (int)((float)x[(int64)(i + 16) * step] * id + 8.5f)) : 8;
+			qs[i] = (byte)(lo | (hi << 4));
+		}
+	}
+}
+
+static void QuantizeInput(const Real* x, int step, int n, InputBlock* out) {
+	for (int b = 0; b * QUANT_BLOCK < n; b++) {
+		const Real* xb = x + (int64)b * QUANT_BLOCK * step;
+		int count = min((int)QUANT_BLOCK, n - b * QUANT_BLOCK);
+		double amax = 0;
+		for (int i = 0; i < count; i++)
+			amax = max(amax, (double)fabs(xb[(int64)i * step]));
+		float d = (float)(amax / 127);
+		float id = d ? 1.0f / d : 0.0f;
+		InputBlock& blk = out[b];
+		blk.d = d;
+		for (int i = 0; i < QUANT_BLOCK; i++)
+			blk.qs[i] = i < count ? (int8)roundf((float)xb[(int64)i * step] * id) : 0;
+	}
+}
+
+void DequantizeRow(int type, const byte* blocks, int64 begin, int64 count, Real* out) {
+	ASSERT(IsQuantizedType(type));
+	int bytes = GetBlockBytes(type);
+	for (int64 i = 0; i < count; i++) {
+		int64 pos = begin + i;
+		const byte* blk = blocks + pos / QUANT_BLOCK * bytes;
+		int j = (int)(pos % QUANT_BLOCK);
+		int q;
+		if (type == GGUF_Q8_0)
+			q = ((const int8*)(blk + 2))[j];
+		else
+			q = (j < 16 ? blk[2 + j] & 15 : blk[2 + j - 16] >> 4) - 8;
+		out[i] = (Real)(GetScale(blk) * q);
+	}
+}
+
+void QuantizedMatrix::Quantize(int type, const Real* m, int rows, int cols, int ld) {
+	ASSERT(IsQuantizedType(type) && rows > 0 && cols > 0);
+	this->type = type;
+	this->rows = rows;
+	this->cols = cols;
+	int blocks = GetBlockCount();
+	row_bytes = blocks * GetBlockBytes(type);
+	data.SetCount((int)GetByteCount());
+	for (int i = 0; i < rows; i++) {
+		const Real* src = m + (int64)i * ld;
+		byte* dst = data.Begin() + (int64)i * row_bytes;
+		for (int b = 0; b < blocks; b++)
+			QuantizeBlock(type, src + b * QUANT_BLOCK, 1, min((int)QUANT_BLOCK, cols - b * QUANT_BLOCK),
+				dst + b * GetBlockBytes(type));
+	}
+}
+
+void QuantizedMatrix::Dequantize(Real* m, int ld) const {
+	for (int i = 0; i < rows; i++)
+		DequantizeRow(type, GetRow(i), 0, cols, m + (int64)i * ld);
+}
+
+#ifdef __AVX2__
+
+static inline float HorizontalSum(__m256 v) {
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+	s = _mm_add_ss(s, _mm_movehdup_ps(s));
+	return _mm_cvtss_f32(s);
+}
+
+// The 32 products of signed bytes, summed into 8 ints. Both instructions multiply unsigned
+// by signed bytes, so the weights give their magnitude and their sign to the inputs.
+static inline __m256i DotBytes(__m256i w, __m256i x) {
+	__m256i u = _mm256_sign_epi8(w, w);
+	__m256i s = _mm256_sign_epi8(x, w);
+#ifdef QUANT_DPBUSD
+	return QUANT_DPBUSD(_mm256_setzero_si256(), u, s);
+#else
+	return _mm256_madd_epi16(_mm256_maddubs_epi16(u, s), _mm256_set1_epi16(1));
+#endif
+}
+
+static float DotQ8_0(const byte* w, const InputBlock* x, int blocks) {
+	__m256 acc = _mm256_setzero_ps();
+	for (int b = 0; b < blocks; b++, w += 34) {
+		__m256i wq = _mm256_loadu_si256((const __m256i*)(w + 2));
+		__m256i xq = _mm256_loadu_si256((const __m256i*)x[b].qs);
+		__m256 d = _mm256_set1_ps(GetScale(w) * x[b].d);
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(d, _mm256_cvtepi32_ps(DotBytes(wq, xq))));
+	}
+	return HorizontalSum(acc);
+}
+
+static float DotQ4_0(const byte* w, const InputBlock* x, int blocks) {
+	__m256 acc = _mm256_setzero_ps();
+	const __m256i low = _mm256_set1_epi8(15);
+	const __m256i eight = _mm256_set1_epi8(8);
+	for (int b = 0; b < blocks; b++, w += 18) {
+		// the low nibbles are the values 0-15 and the high nibbles 16-31
+		__m128i packed = _mm_loadu_si128((const __m128i*)(w + 2));
+		__m256i wq = _mm256_inserti128_si256(_mm256_castsi128_si256(packed), _mm_srli_epi16(packed, 4), 1);
+		wq = _mm256_sub_epi8(_mm256_and_si256(wq, low), eight);
+		__m256i xq = _mm256_loadu_si256((const __m256i*)x[b].qs);
+		__m256 d = _mm256_set1_ps(GetScale(w) * x[b].d);
+		acc = _mm256_add_ps(acc, _mm256_mul_ps(d, _mm256_cvtepi32_ps(DotBytes(wq, xq))));
+	}
+	return HorizontalSum(acc);
+}
+
+#else
+
+static float DotQ8_0(const byte* w, const InputBlock* x, int blocks) {
+	float sum = 0;
+	for (int b = 0; b < blocks; b++, w += 34) {
+		const int8* qs = (const int8*)(w + 2);
+		int s = 0;
+		for (int i = 0; i < QUANT_BLOCK; i++)
+			s += qs[i] * x[b].qs[i];
+		sum += GetScale(w) * x[b].d * s;
+	}
+	return sum;
+}
+
+static float DotQ4_0(const byte* w, const InputBlock* x, int blocks) {
+	float sum = 0;
+	for (int b = 0; b < blocks; b++, w += 18) {
+		const byte* qs = w + 2;
+		int s = 0;
+		for (int i = 0; i < QUANT_BLOCK / 2; i++)
+			s += ((qs[i] & 15) - 8) * x[b].qs[i] + ((qs[i] >> 4) - 8) * x[b].qs[i + 16];
+		sum += GetScale(w) * x[b].d * s;
+	}
+	return sum;
+}
+
+#endif
+
+const char* GetQuantizedKernel() {
+	return QUANT_KERNEL;
+}
+
+void QuantizedGemm(int thread_count, const QuantizedMatrix& w, int count,
+	const Real* x, int x_stride, int x_step, const Real* bias,
+	Real* out, int out_stride, int out_step) {
+	ASSERT(!w.IsEmpty());
+	if (count <= 0)
+		return;
+
+	// every input is quantized once, and then shared by the threads
+	static thread_local Vector<InputBlock> input;
+	int blocks = w.GetBlockCount();
+	SetBufferCount(input, count * blocks);
+	for (int t = 0; t < count; t++)
+		QuantizeInput(x + (int64)t * x_stride, x_step, w.GetCols(), input.Begin() + (int64)t * blocks);
+
+	const InputBlock* in = input.Begin();
+	auto dot = w.GetType() == GGUF_Q8_0 ? DotQ8_0 : DotQ4_0;
+	auto rows = [=, &w](int i0, int i1) {
+		// a row of weights is read once for all the inputs
+		for (int i = i0; i < i1; i++) {
+			const byte* row = w.GetRow(i);
+			float b = bias ? (float)bias[i] : 0.0f;
+			Real* o = out + (int64)i * out_step;
+			for (int t = 0; t < count; t++)
+				o[(int64)t * out_stride] = (Real)(dot(row, in + (int64)t * blocks, blocks) + b);
+		}
+	};
+
+	int parts = min(thread_count, w.GetRows() / 32);
+	if (parts <= 1) {
+		rows(0, w.GetRows());
+		return;
+	}
+	CoWork co;
+	for (int p = 0; p < parts; p++) {
+		int i0 = (int)((int64)w.GetRows() * p / parts);
+		int i1 = (int)((int64)w.GetRows() * (p + 1) / parts);
+		co & [=] {rows(i0, i1);};
+	}
+}
+
+}
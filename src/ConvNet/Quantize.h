@@ -0,0 +1,64 @@
+#ifndef _ConvNet_Quantize_h_
+#define _ConvNet_Quantize_h_
+
+namespace ConvNet {
+
+/*
+	Block-quantized weights for inference.
+
+	A QuantizedMatrix stores the rows of a weight matrix (one row per output) in the
+	blocks of the GGUF types Q8_0 and Q4_0, 32 values per block with a half precision scale:
+		Q8_0	34 bytes, x[i] = d * qs[i]
+		Q4_0	18 bytes, x[i] = d * ((qs[i] & 15) - 8) and x[i + 16] = d * ((qs[i] >> 4) - 8)
+	so a row of a tensor of such a file is a row of the matrix. Rows which aren't a multiple
+	of 32 long are padded with zeros. Compared to float weights, Q8_0 reads 3.8x and Q4_0
+	7.1x fewer bytes (7.5x and 14x compared to double).
+
+	QuantizedGemm computes out(t, i) = dot(row i of w, x(t)) + bias[i] for count input
+	vectors, where x(t, k) = x[t * x_stride + k * x_step] and out(t, i) is at
+	out[t * out_stride + i * out_step]. The inputs are quantized into 8-bit blocks with a
+	float scale first, like llama.cpp does, and every block product is an integer dot
+	product: AVX-VNNI (vpdpbusd) or AVX2 (vpmaddubsw) when the build flags enable them,
+	and a scalar loop otherwise. The rows of w are split between the threads of CoWork.
+*/
+
+enum {QUANT_BLOCK = 32};
+
+// Q8_0 and Q4_0 are the types which can be quantized
+bool IsQuantizedType(int type);
+
+// Converts count values of a row of blocks from value begin on
+void DequantizeRow(int type, const byte* blocks, int64 begin, int64 count, Real* out);
+
+class QuantizedMatrix : Moveable<QuantizedMatrix> {
+	int type = GGUF_Q8_0;
+	int rows = 0;
+	int cols = 0;
+	int row_bytes = 0;
+	Vector<byte> data;
+
+public:
+	// Quantizes the rows x cols matrix m, which has ld values between the rows
+	void Quantize(int type, const Real* m, int rows, int cols, int ld);
+	void Dequantize(Real* m, int ld) const;
+	void Clear() {data.Clear(); rows = cols = row_bytes = 0;}
+
+	bool IsEmpty() const {return rows == 0;}
+	int GetType() const {return type;}
+	int GetRows() const {return rows;}
+	int GetCols() const {return cols;}
+	int GetBlockCount() const {return (cols + QUANT_BLOCK - 1) / QUANT_BLOCK;}
+	int64 GetByteCount() const {return (int64)rows * row_bytes;}
+	const byte* GetRow(int i) const {return data.Begin() + (int64)i * row_bytes;}
+};
+
+void QuantizedGemm(int thread_count, const QuantizedMatrix& w, int count,
+	const Real* x, int x_stride, int x_step, const Real* bias,
+	Real* out, int out_stride, int out_step);
+
+// The dot product kernel of the build: "AVX-VNNI", "AVX512-VNNI", "AVX2" or "scalar"
+const char* GetQuantizedKernel();
+
+}
+
+#endif
@@ -13,6 +13,31 @@ RecurrentBase::RecurrentBase() {
 	
 }
 
+void RecurrentBase::Serialize(Stream& s) {
+	// Streams from before the fused cells start with the index of input1, which is -1 or
+	// more. The current format starts with a version number below that instead.
+	int version = -2;
+	s % version;
+	if (s.IsLoading() && version >= -1) {
+		input1.value = version;
+		input3 = cell = Wx = Wh = b = gates = MatId();
+		s % input2 % output % d % ix % recurrent_type;
+		return;
+	}
+	if (version != -2) {
+		s.LoadError();
+		return;
+	}
+	s % input1 % input2
+	  % output
+	  % input3 % cell
+	  % Wx % Wh % b
+	  % gates
+	  % d
+	  % ix
+	  % recurrent_type;
+}
+
 RecurrentBase& RecurrentBase::InitOutput(MatPool& pool) {
 	this->pool = &pool;
 	ASSERT(this->pool);
@@ -37,6 +62,16 @@ RecurrentBase& RecurrentBase::SetInput(MatId input1, MatId input2) {
 	return *this;
 }
 
+RecurrentBase& RecurrentBase::SetCell(MatId x, MatId hidden_prev, MatId cell_prev, MatId Wx, MatId Wh, MatId b) {
+	input1 = x;
+	input2 = hidden_prev;
+	input3 = cell_prev;
+	this->Wx = Wx;
+	this->Wh = Wh;
+	this->b = b;
+	return *this;
+}
+
 MatId RecurrentBase::Forward(MatId input) {
 	input1 = input;
 	input2.value = -1;
@@ -54,6 +89,8 @@ MatId RecurrentBase::Forward(MatId input) {
 		case RECURRENT_COPY:		return ForwardCopy();
 		case RECURRENT_ADDCONST:	return ForwardAddConst();
 		case RECURRENT_MULCONST:	return ForwardMulConst();
+		case RECURRENT_RNNCELL:		return ForwardRNNCell();
+		case RECURRENT_LSTMCELL:	return ForwardLSTMCell();
 	}
 	throw Exc("Never");
 }
@@ -75,6 +112,8 @@ MatId RecurrentBase::Forward(MatId input1, MatId input2) {
 		case RECURRENT_COPY:		return ForwardCopy();
 		case RECURRENT_ADDCONST:	return ForwardAddConst();
 		case RECURRENT_MULCONST:	return ForwardMulConst();
+		case RECURRENT_RNNCELL:		return ForwardRNNCell();
+		case RECURRENT_LSTMCELL:	return ForwardLSTMCell();
 	}
 	throw Exc("Never");
 }
@@ -93,6 +132,8 @@ MatId RecurrentBase::Forward() {
 		case RECURRENT_COPY:		return ForwardCopy();
 		case RECURRENT_ADDCONST:	return ForwardAddConst();
 		case RECURRENT_MULCONST:	return ForwardMulConst();
+		case RECURRENT_RNNCELL:		return ForwardRNNCell();
+		case RECURRENT_LSTMCELL:	return ForwardLSTMCell();
 	}
 	throw Exc("Never");
 }
@@ -111,6 +152,8 @@ void RecurrentBase::Backward() {
 		case RECURRENT_COPY:		BackwardCopy(); return;
 		case RECURRENT_ADDCONST:	BackwardAddConst(); return;
 		case RECURRENT_MULCONST:	BackwardMulConst(); return;
+		case RECURRENT_RNNCELL:		BackwardRNNCell(); return;
+		case RECURRENT_LSTMCELL:	BackwardLSTMCell(); return;
 	}
 	throw Exc("Never");
 }
@@ -129,6 +172,8 @@ String RecurrentBase::GetKey() const {
 		case RECURRENT_COPY:		return "Copy";
 		case RECURRENT_ADDCONST:	return "AddConst";
 		case RECURRENT_MULCONST:	return "MulConst";
+		case RECURRENT_RNNCELL:		return "RNNCell";
+		case RECURRENT_LSTMCELL:	return "LSTMCell";
 	}
 	throw Exc("Never");
 }
@@ -147,6 +192,8 @@ int RecurrentBase::GetArgCount() {
 		case RECURRENT_COPY:		return 2;
 		case RECURRENT_ADDCONST:	return 1;
 		case RECURRENT_MULCONST:	return 1;
+		case RECURRENT_RNNCELL:		return 2;
+		case RECURRENT_LSTMCELL:	return 3;
 	}
 	throw Exc("Never");
 }
@@ -163,15 +210,19 @@ MatId RecurrentBase::ForwardRowPluck() {
 	MatPool& ses = *pool;
 	Mat& input = ses.Get(input1);
 	Mat& output = ses.Get(this->output);
-	int chr = ses.GetInput(this->ix);
+	int batch = ses.GetBatch();
 	
-	// pluck a row of input with index ix and return it as col vector
-	ASSERT(chr >= 0 && chr < input.GetLength());
+	// pluck a row of input with index ix and return it as col vector, or as one column
+	// per sequence of a batch
 	int w = input.GetWidth();
 	
-	output.Init(1, w, 0.0);
-	for (int i = 0, h = w; i < h; i++) {
-		output.Set(0, i, input.Get(i, chr)); // copy over the data
+	output.Init(batch, w, 0.0);
+	for (int c = 0; c < batch; c++) {
+		int chr = ses.GetInput(this->ix, c);
+		ASSERT(chr >= 0 && chr < input.GetHeight());
+		for (int i = 0, h = w; i < h; i++) {
+			output.Set(c, i, input.Get(i, chr)); // copy over the data
+		}
 	}
 	return this->output;
 }
@@ -180,12 +231,15 @@ void RecurrentBase::BackwardRowPluck() {
 	MatPool& ses = *pool;
 	Mat& input = ses.Get(input1);
 	Mat& output = ses.Get(this->output);
-	int chr = ses.GetInput(this->ix);
+	int batch = ses.GetBatch();
 	
 	int w = input.GetWidth();
 	
-	for (int i = 0; i < w; i++) {
-		input.AddGradient(i, chr, output.GetGradient(0, i));
+	for (int c = 0; c < batch; c++) {
+		int chr = ses.GetInput(this->ix, c);
+		for (int i = 0; i < w; i++) {
+			input.AddGradient(i, chr, output.GetGradient(c, i));
+		}
 	}
 }
 
@@ -298,6 +352,45 @@ void RecurrentBase::BackwardRelu() {
 
 
 
+// Gemm packs its operands into panels, which costs more than the product itself when one
+// of the dimensions is a few columns, like a single sequence. The narrow
+// products are plain loops, which read the rows of A in the order they are stored.
+static void MatGemm(bool trans_a, bool trans_b, int m, int n, int k,
+	const Real* a, int lda, const Real* b, int ldb, Real beta, Real* c, int ldc) {
+	if (m >= 16 && n >= 16 && k >= 16) {
+		Gemm<Real>(trans_a, trans_b, m, n, k, 1, a, lda, b, ldb, beta, c, ldc);
+		return;
+	}
+	for (int i = 0; i < m; i++)
+		for (int j = 0; j < n; j++)
+			c[i * ldc + j] = beta == 0 ? 0 : beta * c[i * ldc + j];
+	if (trans_b) {
+		// the rows of A and B are dot products
+		for (int i = 0; i < m; i++) {
+			Real* cr = c + i * ldc;
+			for (int j = 0; j < n; j++) {
+				const Real* br = b + j * ldb;
+				Real sum = 0;
+				for (int p = 0; p < k; p++)
+					sum += (trans_a ? a[p * lda + i] : a[i * lda + p]) * br[p];
+				cr[j] += sum;
+			}
+		}
+		return;
+	}
+	for (int o = 0; o < (trans_a ? k : m); o++) {
+		for (int q = 0; q < (trans_a ? m : k); q++) {
+			int i = trans_a ? q : o;
+			int p = trans_a ? o : q;
+			Real av = a[o * lda + q];
+			Real* cr = c + i * ldc;
+			const Real* br = b + p * ldb;
+			for (int j = 0; j < n; j++)
+				cr[j] += av * br[j];
+		}
+	}
+}
+
 MatId RecurrentBase::ForwardMul() {
 	MatPool& ses = *pool;
 	Mat& input1 = ses.Get(this->input1);
@@ -309,22 +402,10 @@ MatId RecurrentBase::ForwardMul() {
 	
 	int h = input1.GetHeight();
 	int w = input2.GetWidth();
+	int k = input1.GetWidth();
 	output.Init(w, h, 0.0);
-	
-	// loop over rows of input1
-	for (int i = 0; i < h; i++) {
-		
-		// loop over cols of input2
-		for (int j = 0; j < w; j++) {
-			
-			// dot product loop
-			double dot = 0.0;
-			for (int k = 0; k < input1.GetWidth(); k++) {
-				dot += input1.Get(k, i) * input2.Get(j, k);
-			}
-			output.Set(j, i, dot);
-		}
-	}
+	MatGemm(false, false, h, w, k, input1.GetWeights().Begin(), k, input2.GetWeights().Begin(), w,
+		0, output.GetWeights().Begin(), w);
 	return this->output;
 }
 
@@ -334,20 +415,14 @@ void RecurrentBase::BackwardMul() {
 	Mat& input2 = ses.Get(this->input2);
 	Mat& output = ses.Get(this->output);
 	
-	// loop over rows of m1
-	for (int i = 0; i < input1.GetHeight(); i++) {
-		
-		// loop over cols of m2
-		for (int j = 0; j < input2.GetWidth(); j++) {
-			
-			// dot product loop
-			for (int k = 0; k < input1.GetWidth(); k++) {
-				double b = output.GetGradient(j, i);
-				input1.AddGradient(k, i, input2.Get(j, k) * b);
-				input2.AddGradient(j, k, input1.Get(k, i) * b);
-			}
-		}
-	}
+	int h = input1.GetHeight();
+	int w = input2.GetWidth();
+	int k = input1.GetWidth();
+	const Real* dout = output.GetGradients().Begin();
+	MatGemm(false, true, h, k, w, dout, w, input2.GetWeights().Begin(), w,
+		1, input1.GetGradients().Begin(), k);
+	MatGemm(true, false, k, w, h, input1.GetWeights().Begin(), k, dout, w,
+		1, input2.GetGradients().Begin(), w);
 }
 
 
@@ -363,9 +438,18 @@ MatId RecurrentBase::ForwardAdd() {
 	Mat& input2 = ses.Get(this->input2);
 	Mat& output = ses.Get(this->output);
 	
-	ASSERT(input1.GetLength() == input2.GetLength());
-	
 	output.Init(input1.GetWidth(), input1.GetHeight(), 0.0);
+	
+	// a column vector is added to every column of a batch
+	if (input2.GetWidth() == 1 && input1.GetWidth() > 1) {
+		ASSERT(input1.GetHeight() == input2.GetHeight());
+		for (int y = 0; y < input1.GetHeight(); y++)
+			for (int x = 0; x < input1.GetWidth(); x++)
+				output.Set(x, y, input1.Get(x, y) + input2.Get(y));
+		return this->output;
+	}
+	
+	ASSERT(input1.GetLength() == input2.GetLength());
 	for (int i = 0; i < input1.GetLength(); i++) {
 		output.Set(i, input1.Get(i) + input2.Get(i));
 	}
@@ -379,6 +463,19 @@ void RecurrentBase::BackwardAdd() {
 	Mat& input2 = ses.Get(this->input2);
 	Mat& output = ses.Get(this->output);
 	
+	if (input2.GetWidth() == 1 && input1.GetWidth() > 1) {
+		for (int y = 0; y < input1.GetHeight(); y++) {
+			double sum = 0;
+			for (int x = 0; x < input1.GetWidth(); x++) {
+				double d = output.GetGradient(x, y);
+				input1.AddGradient(x, y, d);
+				sum += d;
+			}
+			input2.AddGradient(y, sum);
+		}
+		return;
+	}
+	
 	for (int i = 0; i < input1.GetLength(); i++) {
 		input1.AddGradient(i, output.GetGradient(i));
 		input2.AddGradient(i, output.GetGradient(i));
@@ -551,6 +648,212 @@ void RecurrentBase::BackwardMulConst() {
 
 
 
+/*
+	The fused cells replace the graph of Mul, Add and activation nodes of one step with one
+	node. The gates of all rows are computed with one matrix product per input into a
+	preallocated matrix, and the activations with one element-wise pass. The columns of the
+	input and the hidden state are independent sequences.
+	
+	RNNCell:	h = relu(Wx * x + Wh * h_prev + b)
+	LSTMCell:	[i, f, o, w] = [sig, sig, sig, tanh](Wx * x + Wh * h_prev + b)
+				c = f .* c_prev + i .* w
+				h = o .* tanh(c)
+*/
+
+MatId RecurrentBase::ForwardRNNCell() {
+	MatPool& ses = *pool;
+	Mat& x = ses.Get(input1);
+	Mat& hidden_prev = ses.Get(input2);
+	Mat& Wx = ses.Get(this->Wx);
+	Mat& Wh = ses.Get(this->Wh);
+	Mat& b = ses.Get(this->b);
+	Mat& output = ses.Get(this->output);
+	
+	int batch = x.GetWidth();
+	int xs = x.GetHeight();
+	int hs = Wh.GetHeight();
+	ASSERT(Wx.GetWidth() == xs && Wx.GetHeight() == hs && Wh.GetWidth() == hs);
+	ASSERT(hidden_prev.GetHeight() == hs && hidden_prev.GetWidth() == batch && b.GetLength() == hs);
+	
+	output.Init(batch, hs, 0.0);
+	Real* out = output.GetWeights().Begin();
+	MatGemm(false, false, hs, batch, xs, Wx.GetWeights().Begin(), xs, x.GetWeights().Begin(), batch, 0, out, batch);
+	MatGemm(false, false, hs, batch, hs, Wh.GetWeights().Begin(), hs, hidden_prev.GetWeights().Begin(), batch, 1, out, batch);
+	
+	const Real* bias = b.GetWeights().Begin();
+	for (int r = 0; r < hs; r++) {
+		Real* o = out + r * batch;
+		for (int c = 0; c < batch; c++)
+			o[c] = max((Real)0, o[c] + bias[r]);
+	}
+	
+	return this->output;
+}
+
+void RecurrentBase::BackwardRNNCell() {
+	MatPool& ses = *pool;
+	Mat& x = ses.Get(input1);
+	Mat& hidden_prev = ses.Get(input2);
+	Mat& Wx = ses.Get(this->Wx);
+	Mat& Wh = ses.Get(this->Wh);
+	Mat& b = ses.Get(this->b);
+	Mat& output = ses.Get(this->output);
+	Mat& gates = ses.Get(this->gates);
+	
+	int batch = x.GetWidth();
+	int xs = x.GetHeight();
+	int hs = Wh.GetHeight();
+	
+	// the gradient of the pre-activation
+	gates.Init(batch, hs, 0.0);
+	Real* dpre = gates.GetWeights().Begin();
+	const Real* out = output.GetWeights().Begin();
+	const Real* dout = output.GetGradients().Begin();
+	Real* db = b.GetGradients().Begin();
+	for (int r = 0; r < hs; r++) {
+		double sum = 0;
+		for (int c = 0; c < batch; c++) {
+			int k = r * batch + c;
+			Real d = out[k] > 0 ? dout[k] : 0;
+			dpre[k] = d;
+			sum += d;
+		}
+		db[r] += (Real)sum;
+	}
+	
+	MatGemm(false, true, hs, xs, batch, dpre, batch, x.GetWeights().Begin(), batch, 1, Wx.GetGradients().Begin(), xs);
+	MatGemm(false, true, hs, hs, batch, dpre, batch, hidden_prev.GetWeights().Begin(), batch, 1, Wh.GetGradients().Begin(), hs);
+	MatGemm(true, false, xs, batch, hs, Wx.GetWeights().Begin(), xs, dpre, batch, 1, x.GetGradients().Begin(), batch);
+	MatGemm(true, false, hs, batch, hs, Wh.GetWeights().Begin(), hs, dpre, batch, 1, hidden_prev.GetGradients().Begin(), batch);
+}
+
+// The gates matrix has the rows of the activations i, f, o and w, and the rows of tanh(c).
+MatId RecurrentBase::ForwardLSTMCell() {
+	MatPool& ses = *pool;
+	Mat& x = ses.Get(input1);
+	Mat& hidden_prev = ses.Get(input2);
+	Mat& cell_prev = ses.Get(input3);
+	Mat& Wx = ses.Get(this->Wx);
+	Mat& Wh = ses.Get(this->Wh);
+	Mat& b = ses.Get(this->b);
+	Mat& output = ses.Get(this->output);
+	Mat& cell = ses.Get(this->cell);
+	Mat& gates = ses.Get(this->gates);
+	
+	int batch = x.GetWidth();
+	int xs = x.GetHeight();
+	int hs = Wh.GetWidth();
+	int gs = 4 * hs;
+	ASSERT(Wx.GetWidth() == xs && Wx.GetHeight() == gs && Wh.GetHeight() == gs);
+	ASSERT(hidden_prev.GetHeight() == hs && hidden_prev.GetWidth() == batch && b.GetLength() == gs);
+	ASSERT(cell_prev.GetHeight() == hs && cell_prev.GetWidth() == batch);
+	
+	gates.Init(batch, 5 * hs, 0.0);
+	Real* g = gates.GetWeights().Begin();
+	MatGemm(false, false, gs, batch, xs, Wx.GetWeights().Begin(), xs, x.GetWeights().Begin(), batch, 0, g, batch);
+	MatGemm(false, false, gs, batch, hs, Wh.GetWeights().Begin(), hs, hidden_prev.GetWeights().Begin(), batch, 1, g, batch);
+	
+	output.Init(batch, hs, 0.0);
+	cell.Init(batch, hs, 0.0);
+	Real* out = output.GetWeights().Begin();
+	Real* c = cell.GetWeights().Begin();
+	const Real* cp = cell_prev.GetWeights().Begin();
+	const Real* bias = b.GetWeights().Begin();
+	int n = hs * batch;
+	Real* ig = g;
+	Real* fg = g + n;
+	Real* og = g + 2 * n;
+	Real* wg = g + 3 * n;
+	Real* tc = g + 4 * n;
+	for (int r = 0; r < hs; r++) {
+		for (int j = 0; j < batch; j++) {
+			int k = r * batch + j;
+			Real i = (Real)sig(ig[k] + bias[r]);
+			Real f = (Real)sig(fg[k] + bias[hs + r]);
+			Real o = (Real)sig(og[k] + bias[2 * hs + r]);
+			Real w = (Real)tanh(wg[k] + bias[3 * hs + r]);
+			Real cv = f * cp[k] + i * w;
+			Real t = (Real)tanh(cv);
+			ig[k] = i;
+			fg[k] = f;
+			og[k] = o;
+			wg[k] = w;
+			tc[k] = t;
+			c[k] = cv;
+			out[k] = o * t;
+		}
+	}
+	
+	return this->output;
+}
+
+void RecurrentBase::BackwardLSTMCell() {
+	MatPool& ses = *pool;
+	Mat& x = ses.Get(input1);
+	Mat& hidden_prev = ses.Get(input2);
+	Mat& cell_prev = ses.Get(input3);
+	Mat& Wx = ses.Get(this->Wx);
+	Mat& Wh = ses.Get(this->Wh);
+	Mat& b = ses.Get(this->b);
+	Mat& output = ses.Get(this->output);
+	Mat& cell = ses.Get(this->cell);
+	Mat& gates = ses.Get(this->gates);
+	
+	int batch = x.GetWidth();
+	int xs = x.GetHeight();
+	int hs = Wh.GetWidth();
+	int gs = 4 * hs;
+	int n = hs * batch;
+	
+	// the gradients of the pre-activations are written over the gradients of the gates
+	const Real* g = gates.GetWeights().Begin();
+	Real* dpre = gates.GetGradients().Begin();
+	const Real* dh = output.GetGradients().Begin();
+	const Real* dc = cell.GetGradients().Begin();
+	const Real* cp = cell_prev.GetWeights().Begin();
+	Real* dcp = cell_prev.GetGradients().Begin();
+	Real* db = b.GetGradients().Begin();
+	for (int r = 0; r < hs; r++) {
+		double dbi = 0, dbf = 0, dbo = 0, dbw = 0;
+		for (int j = 0; j < batch; j++) {
+			int k = r * batch + j;
+			Real i = g[k], f = g[n + k], o = g[2 * n + k], w = g[3 * n + k], t = g[4 * n + k];
+			Real dct = dc[k] + dh[k] * o * (1 - t * t);
+			Real di = dct * w * i * (1 - i);
+			Real df = dct * cp[k] * f * (1 - f);
+			Real dout = dh[k] * t * o * (1 - o);
+			Real dw = dct * i * (1 - w * w);
+			dpre[k] = di;
+			dpre[n + k] = df;
+			dpre[2 * n + k] = dout;
+			dpre[3 * n + k] = dw;
+			dcp[k] += dct * f;
+			dbi += di;
+			dbf += df;
+			dbo += dout;
+			dbw += dw;
+		}
+		db[r] += (Real)dbi;
+		db[hs + r] += (Real)dbf;
+		db[2 * hs + r] += (Real)dbo;
+		db[3 * hs + r] += (Real)dbw;
+	}
+	
+	MatGemm(false, true, gs, xs, batch, dpre, batch, x.GetWeights().Begin(), batch, 1, Wx.GetGradients().Begin(), xs);
+	MatGemm(false, true, gs, hs, batch, dpre, batch, hidden_prev.GetWeights().Begin(), batch, 1, Wh.GetGradients().Begin(), hs);
+	MatGemm(true, false, xs, batch, gs, Wx.GetWeights().Begin(), xs, dpre, batch, 1, x.GetGradients().Begin(), batch);
+	MatGemm(true, false, hs, batch, gs, Wh.GetWeights().Begin(), hs, dpre, batch, 1, hidden_prev.GetGradients().Begin(), batch);
+}
+
+
+
+
+
+
+
+
+
+
 
 
 
@@ -715,6 +1018,20 @@ MatId GraphTree::MulConstant(double d, MatId in) {
 	return layers.Add().InitOutput(*pool).SetType(RECURRENT_MULCONST).SetInput(in).SetDouble(d).output;
 }
 
+MatId GraphTree::RNNCell(MatId in, MatId hidden_prev, MatId Wx, MatId Wh, MatId b) {
+	RecurrentBase& l = layers.Add().InitOutput(*pool).SetType(RECURRENT_RNNCELL).SetCell(in, hidden_prev, MatId(), Wx, Wh, b);
+	pool->InitMat(l.gates);
+	return l.output;
+}
+
+// The new cell is the cell of the layer, GetLayer(i).cell.
+MatId GraphTree::LSTMCell(MatId in, MatId hidden_prev, MatId cell_prev, MatId Wx, MatId Wh, MatId b) {
+	RecurrentBase& l = layers.Add().InitOutput(*pool).SetType(RECURRENT_LSTMCELL).SetCell(in, hidden_prev, cell_prev, Wx, Wh, b);
+	pool->InitMat(l.cell);
+	pool->InitMat(l.gates);
+	return l.output;
+}
+
 
 void Softmax(const Mat& m, Mat& out) {
 	out.Init(m.GetWidth(), m.GetHeight(), 0.0); // probability volume
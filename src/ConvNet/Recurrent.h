@@ -15,7 +15,7 @@ namespace ConvNet {
 enum {
 	RECURRENT_NULL, RECURRENT_ROWPLUCK, RECURRENT_TANH, RECURRENT_SIGMOID, RECURRENT_RELU,
 	RECURRENT_MUL, RECURRENT_ADD, RECURRENT_DOT, RECURRENT_ELTMUL, RECURRENT_COPY,
-	RECURRENT_ADDCONST, RECURRENT_MULCONST
+	RECURRENT_ADDCONST, RECURRENT_MULCONST, RECURRENT_RNNCELL, RECURRENT_LSTMCELL
 };
 
 class Graph;
@@ -29,6 +29,9 @@ public:
 	
 	MatId input1, input2;
 	MatId output;
+	MatId input3, cell;		// the previous and the next cell of LSTMCell
+	MatId Wx, Wh, b;		// the stacked parameters of the fused cells
+	MatId gates;			// the activations of the fused cells for the backward pass
 	double d = 0.0;
 	int ix = -1;
 	int recurrent_type = RECURRENT_NULL;
@@ -39,16 +42,11 @@ public:
 	RecurrentBase& SetType(int i) {recurrent_type = i; return *this;}
 	RecurrentBase& SetInput(MatId input);
 	RecurrentBase& SetInput(MatId input1, MatId input2);
+	RecurrentBase& SetCell(MatId x, MatId hidden_prev, MatId cell_prev, MatId Wx, MatId Wh, MatId b);
 	RecurrentBase& InitOutput(MatPool& pool);
 	RecurrentBase& SetPool(MatPool& pool);
 	
-	void Serialize(Stream& s) {
-		s % input1 % input2
-		  % output
-		  % d
-		  % ix
-		  % recurrent_type;
-	}
+	void Serialize(Stream& s);
 	
 	String GetKey() const;
 	int GetArgCount();
@@ -69,6 +67,8 @@ public:
 	MatId ForwardCopy();
 	MatId ForwardAddConst();
 	MatId ForwardMulConst();
+	MatId ForwardRNNCell();
+	MatId ForwardLSTMCell();
 	void BackwardRowPluck();
 	void BackwardTanh();
 	void BackwardSigmoid();
@@ -80,6 +80,8 @@ public:
 	void BackwardCopy();
 	void BackwardAddConst();
 	void BackwardMulConst();
+	void BackwardRNNCell();
+	void BackwardLSTMCell();
 	
 	//Mat& operator() (Mat& a) {return Forward(a);}
 	//Mat& operator() (Mat& a, Mat& b) {return Forward(a,b);}
@@ -165,6 +167,8 @@ public:
 	MatId Copy(MatId src, MatId dst);
 	MatId AddConstant(double d, MatId in);
 	MatId MulConstant(double d, MatId in);
+	MatId RNNCell(MatId in, MatId hidden_prev, MatId Wx, MatId Wh, MatId b);
+	MatId LSTMCell(MatId in, MatId hidden_prev, MatId cell_prev, MatId Wx, MatId Wh, MatId b);
 	
 	RecurrentBase& GetLayer(int i) {return layers[i];}
 	int GetCount() const {return layers.GetCount();}
@@ -229,6 +233,29 @@ struct LSTMModel : Moveable<LSTMModel> {
 	
 };
 
+// Stacked parameters of the fused LSTM cell. The rows of Wx, Wh and b are the input,
+// forget, output and cell write gates one after another, so that all gates are computed
+// with one matrix multiplication per input.
+struct LSTMCellModel : Moveable<LSTMCellModel> {
+	
+	MatId Wx, Wh, b;
+	
+	static int GetCount() {return 3;}
+	MatId GetMat(int i) {
+		ASSERT(i >= 0 && i < 3);
+		switch (i) {
+			case 0: return Wx;
+			case 1: return Wh;
+			case 2: return b;
+			default: return b;
+		}
+	}
+	
+	void Serialize(Stream& s) {
+		s % Wx % Wh % b;
+	}
+};
+
 struct RNNModel : Moveable<RNNModel> {
 	
 	MatId Wxh, Whh, bhh;
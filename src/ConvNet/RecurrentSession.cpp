@@ -14,6 +14,7 @@ RecurrentSession::RecurrentSession() {
 	letter_size = -1;
 	max_graphs = 100;
 	initial_bias = -4;
+	fused = true;
 	use_tokenization = false;  // Default to character-level processing
 	
 	// Solver
@@ -34,6 +35,8 @@ int RecurrentSession::GetMatCount() {
 	int count = 0;
 	if (mode == MODE_RNN)
 		count = rnn_model.GetCount() * RNNModel::GetCount();
+	else if (mode == MODE_LSTM && fused)
+		count = lstm_cell_model.GetCount() * LSTMCellModel::GetCount();
 	else if (mode == MODE_LSTM)
 		count = lstm_model.GetCount() * LSTMModel::GetCount();
 	else if (mode == MODE_HIGHWAY)
@@ -56,6 +59,10 @@ MatId RecurrentSession::GetMat(int i) {
 		rows = rnn_model.GetCount();
 		cols = RNNModel::GetCount();
 	}
+	else if (mode == MODE_LSTM && fused) {
+		rows = lstm_cell_model.GetCount();
+		cols = LSTMCellModel::GetCount();
+	}
 	else if (mode == MODE_LSTM) {
 		rows = lstm_model.GetCount();
 		cols = LSTMModel::GetCount();
@@ -82,6 +89,9 @@ MatId RecurrentSession::GetMat(int i) {
 		if (mode == MODE_RNN) {
 			return rnn_model[row].GetMat(col);
 		}
+		else if (mode == MODE_LSTM && fused) {
+			return lstm_cell_model[row].GetMat(col);
+		}
 		else if (mode == MODE_LSTM) {
 			return lstm_model[row].GetMat(col);
 		}
@@ -201,9 +211,15 @@ void RecurrentSession::InitRNN(int i, int j, GraphTree& g) {
 	MatId input_vector = j == 0 ? input : hidden_nexts[j-1];
 	MatId hidden_prev = hidden_prevs[j];
 	
-	MatId h0 = g.Mul(m.Wxh, input_vector);
-	MatId h1 = g.Mul(m.Whh, hidden_prev);
-	MatId hidden_d = g.Relu(g.Add(g.Add(h0, h1), m.bhh));
+	MatId hidden_d;
+	if (fused) {
+		hidden_d = g.RNNCell(input_vector, hidden_prev, m.Wxh, m.Whh, m.bhh);
+	}
+	else {
+		MatId h0 = g.Mul(m.Wxh, input_vector);
+		MatId h1 = g.Mul(m.Whh, hidden_prev);
+		hidden_d = g.Relu(g.Add(g.Add(h0, h1), m.bhh));
+	}
 	
 	hidden_nexts[j] = hidden_d;
 	
@@ -218,14 +234,29 @@ void RecurrentSession::InitLSTM() {
 	int hidden_size = 0;
 	
 	// loop over depths
-	lstm_model.SetCount(hidden_sizes.GetCount());
+	if (fused) {
+		lstm_model.Clear();
+		lstm_cell_model.SetCount(hidden_sizes.GetCount());
+	}
+	else {
+		lstm_cell_model.Clear();
+		lstm_model.SetCount(hidden_sizes.GetCount());
+	}
 	for (int d = 0; d < hidden_sizes.GetCount(); d++) {
-		// loop over depths
-		LSTMModel& m = lstm_model[d];
-		
 		int prev_size = d == 0 ? letter_size : hidden_sizes[d - 1];
 		hidden_size = hidden_sizes[d];
 		
+		if (fused) {
+			// the input, forget, output and cell write parameters stacked
+			LSTMCellModel& m = lstm_cell_model[d];
+			RandMat(4 * hidden_size, prev_size,		0, 0.08,	m.Wx);
+			RandMat(4 * hidden_size, hidden_size,	0, 0.08,	m.Wh);
+			InitMat(m.b, 1, 4 * hidden_size, 0);
+			continue;
+		}
+		
+		LSTMModel& m = lstm_model[d];
+		
 		// gates parameters
 		RandMat(hidden_size, prev_size,		0, 0.08,	m.Wix);
 		RandMat(hidden_size, hidden_size,	0, 0.08,	m.Wih);
@@ -249,8 +280,6 @@ void RecurrentSession::InitLSTM() {
 }
 
 void RecurrentSession::InitLSTM(int i, int j, GraphTree& g) {
-	LSTMModel& m = lstm_model[j];
-	
 	g.Clear();
 	
 	Vector<MatId>& hidden_prevs = this->hidden_prevs[i];
@@ -267,33 +296,43 @@ void RecurrentSession::InitLSTM(int i, int j, GraphTree& g) {
 	MatId cell_prev = cell_prevs[j];
 	ASSERT(hidden_prev.value != -1 && cell_prev.value != -1);
 	
-	// input gate
-	MatId h0 = g.Mul(m.Wix, input_vector);
-	MatId h1 = g.Mul(m.Wih, hidden_prev);
-	MatId input_gate = g.Sigmoid(g.Add(g.Add(h0, h1), m.bi));
-	
-	// forget gate
-	MatId h2 = g.Mul(m.Wfx, input_vector);
-	MatId h3 = g.Mul(m.Wfh, hidden_prev);
-	MatId forget_gate = g.Sigmoid(g.Add(g.Add(h2, h3), m.bf));
-	
-	// output gate
-	MatId h4 = g.Mul(m.Wox, input_vector);
-	MatId h5 = g.Mul(m.Woh, hidden_prev);
-	MatId output_gate = g.Sigmoid(g.Add(g.Add(h4, h5), m.bo));
-	
-	// write operation on cells
-	MatId h6 = g.Mul(m.Wcx, input_vector);
-	MatId h7 = g.Mul(m.Wch, hidden_prev);
-	MatId cell_write = g.Tanh(g.Add(g.Add(h6, h7), m.bc));
-	
-	// compute new cell activation
-	MatId retain_cell = g.EltMul(forget_gate, cell_prev); // what do we keep from cell
-	MatId write_cell = g.EltMul(input_gate, cell_write); // what do we write to cell
-	MatId cell_d = g.Add(retain_cell, write_cell); // new cell contents
-	
-	// compute hidden state as gated, saturated cell activations
-	MatId hidden_d = g.EltMul(output_gate, g.Tanh(cell_d));
+	MatId hidden_d, cell_d;
+	if (fused) {
+		LSTMCellModel& m = lstm_cell_model[j];
+		hidden_d = g.LSTMCell(input_vector, hidden_prev, cell_prev, m.Wx, m.Wh, m.b);
+		cell_d = g.Top().cell;
+	}
+	else {
+		LSTMModel& m = lstm_model[j];
+		
+		// input gate
+		MatId h0 = g.Mul(m.Wix, input_vector);
+		MatId h1 = g.Mul(m.Wih, hidden_prev);
+		MatId input_gate = g.Sigmoid(g.Add(g.Add(h0, h1), m.bi));
+		
+		// forget gate
+		MatId h2 = g.Mul(m.Wfx, input_vector);
+		MatId h3 = g.Mul(m.Wfh, hidden_prev);
+		MatId forget_gate = g.Sigmoid(g.Add(g.Add(h2, h3), m.bf));
+		
+		// output gate
+		MatId h4 = g.Mul(m.Wox, input_vector);
+		MatId h5 = g.Mul(m.Woh, hidden_prev);
+		MatId output_gate = g.Sigmoid(g.Add(g.Add(h4, h5), m.bo));
+		
+		// write operation on cells
+		MatId h6 = g.Mul(m.Wcx, input_vector);
+		MatId h7 = g.Mul(m.Wch, hidden_prev);
+		MatId cell_write = g.Tanh(g.Add(g.Add(h6, h7), m.bc));
+		
+		// compute new cell activation
+		MatId retain_cell = g.EltMul(forget_gate, cell_prev); // what do we keep from cell
+		MatId write_cell = g.EltMul(input_gate, cell_write); // what do we write to cell
+		cell_d = g.Add(retain_cell, write_cell); // new cell contents
+		
+		// compute hidden state as gated, saturated cell activations
+		hidden_d = g.EltMul(output_gate, g.Tanh(cell_d));
+	}
 	
 	hidden_nexts[j] = hidden_d;
 	cell_nexts[j] = cell_d;
@@ -401,6 +440,7 @@ void RecurrentSession::Learn(const Vector<int>& input_sequence) {
 	double cost = 0.0;
 	
 	ASSERT(input_sequence.GetCount() < graphs.GetCount());
+	SetBatch(1);
 	
 	// Copy input sequence. Fixed index_sequence addresses are used in RowPluck.
 	int n = input_sequence.GetCount();
@@ -446,6 +486,94 @@ void RecurrentSession::Learn(const Vector<int>& input_sequence) {
 	SolverStep();
 }
 
+/*
+	Minibatched training: the sequences are the columns of the matrices of the unrolled
+	graphs, so that every matrix multiplication of a step is one product over the batch.
+	The shorter sequences are padded with END tokens, and the loss of the padded steps is
+	masked out. The gradient is the average of the gradients of the sequences, so the
+	learning rate means the same as with a single sequence.
+	
+	The perplexity is over all predicted tokens of the batch. Sorting the sequences by
+	length before batching them keeps the padding small.
+*/
+void RecurrentSession::Learn(const Vector<Vector<int> >& sequences) {
+	ComputeGradients(sequences);
+	SolverStep();
+}
+
+void RecurrentSession::ComputeGradients(const Vector<Vector<int> >& sequences) {
+	ASSERT_(mode == MODE_RNN || mode == MODE_LSTM, "Batches are supported by LSTM and RNN");
+	int count = sequences.GetCount();
+	ASSERT(count > 0);
+	
+	int steps = 0;
+	for(int i = 0; i < count; i++)
+		steps = max(steps, sequences[i].GetCount());
+	ASSERT(steps < graphs.GetCount());
+	
+	// the START token, the sequences and the padding; RowPluck reads the column of a step
+	SetBatch(count);
+	for(int c = 0; c < count; c++)
+		index_sequence[c] = 0;
+	for(int i = 0; i < steps; i++) {
+		for(int c = 0; c < count; c++) {
+			const Vector<int>& seq = sequences[c];
+			index_sequence[(i + 1) * count + c] = i < seq.GetCount() ? seq[i] : 0;
+		}
+	}
+	
+	ResetPrevs();
+	
+	double log2ppl = 0.0;
+	double cost = 0.0;
+	int tokens = 0;
+	for(int i = 0; i <= steps; i++) {
+		Array<GraphTree>& list = graphs[i];
+		for(int j = 0; j < list.GetCount(); j++) {
+			list[j].Forward();
+		}
+		
+		// the log probabilities of the sequences are the columns
+		Mat& logprobs_mat = Get(list.Top().Top().output);
+		int outputs = logprobs_mat.GetHeight();
+		ASSERT(logprobs_mat.GetWidth() == count);
+		batch_probs.SetCount(outputs);
+		
+		for(int c = 0; c < count; c++) {
+			int n = sequences[c].GetCount();
+			if (i > n)
+				continue; // padding: the gradient stays zero
+			int ix_target = i == n ? 0 : sequences[c][i]; // last step: end with END token
+			
+			double maxval = -DBL_MAX;
+			for(int j = 0; j < outputs; j++)
+				maxval = max(maxval, logprobs_mat.Get(c, j));
+			double sum = 0.0;
+			for(int j = 0; j < outputs; j++) {
+				double d = exp(logprobs_mat.Get(c, j) - maxval);
+				batch_probs[j] = d;
+				sum += d;
+			}
+			for(int j = 0; j < outputs; j++)
+				batch_probs[j] /= sum;
+			
+			double p = batch_probs[ix_target];
+			log2ppl += -log2(p);
+			cost += -log(p);
+			tokens++;
+			
+			// write the averaged gradients into log probabilities
+			for(int j = 0; j < outputs; j++)
+				logprobs_mat.SetGradient(c, j, (batch_probs[j] - (j == ix_target ? 1.0 : 0.0)) / count);
+		}
+	}
+	
+	ppl = pow(2, log2ppl / tokens);
+	this->cost = cost / count;
+	
+	Backward(steps);
+}
+
 void RecurrentSession::Backward(int seq_end_cursor) {
 	for (int i = seq_end_cursor; i >= 0; i--) {
 		Array<GraphTree>& list = graphs[i];
@@ -500,17 +628,20 @@ void RecurrentSession::SolverStep() {
 void RecurrentSession::ResetPrevs() {
 	int hidden_count = hidden_sizes.GetCount();
 	
-	first_hidden.SetCount(hidden_count);
-	for (int d = 0; d < hidden_count; d++) {
-		InitMat(first_hidden[d], 1, hidden_sizes[d], 0);
-	}
-	
-	first_cell.SetCount(hidden_count);
+	// the first states of the graphs are cleared in place, because the graphs refer to them
+	// and they have a column per sequence of the batch
+	ASSERT(first_hidden.GetCount() == hidden_count && first_cell.GetCount() == hidden_count);
 	for (int d = 0; d < hidden_count; d++) {
-		InitMat(first_cell[d], 1, hidden_sizes[d], 0);
+		Get(first_hidden[d]).Init(batch, hidden_sizes[d], 0.0);
+		Get(first_cell[d]).Init(batch, hidden_sizes[d], 0.0);
 	}
 }
 
+void RecurrentSession::SetBatch(int count) {
+	batch = count;
+	index_sequence.SetCount(max_graphs * count, 0);
+}
+
 void RecurrentSession::Predict(Vector<int>& output_sequence, bool samplei, double temperature, bool continue_sentence, int max_predictions) {
 	int begin_write = 0;
 	if (continue_sentence) {
@@ -520,6 +651,7 @@ void RecurrentSession::Predict(Vector<int>& output_sequence, bool samplei, doubl
 		output_sequence.SetCount(0);
 	}
 	
+	SetBatch(1);
 	index_sequence[0] = 0;
 	for(int i = 1; i < index_sequence.GetCount(); i++)
 		index_sequence[i] = -1; // for debugging
@@ -604,6 +736,7 @@ void RecurrentSession::Load(const ValueMap& js) {
 	LOAD(learning_rate);
 	LOAD(clipval);
 	LOAD(use_tokenization);
+	LOAD(fused);
 	/*
 	if (js.Find("model") != -1) {
 		ValueMap model = js.GetValue(js.Find("model"));
@@ -674,6 +807,7 @@ void RecurrentSession::Store(ValueMap& js) {
 	SAVE(learning_rate);
 	SAVE(clipval);
 	SAVE(use_tokenization);
+	SAVE(fused);
 	/*
 	ValueMap model;
 	
@@ -719,12 +853,31 @@ void RecurrentSession::Store(ValueMap& js) {
 }
 
 void RecurrentSession::Serialize(Stream& s) {
-	MatPool::Serialize(s);
+	// Streams from before the fused cells start with the packed count of the matrices of
+	// the pool, and their graphs are unfused. The current format starts with a negative
+	// version number instead.
+	int version = -1;
+	s / version;
+	if (s.IsLoading() && version >= 0) {
+		mats.SetCount(version);
+		for(int i = 0; i < mats.GetCount(); i++)
+			s % mats[i];
+		lstm_cell_model = LSTMCellModel();
+		fused = false;
+	}
+	else if (version != -1) {
+		s.LoadError();
+		return;
+	}
+	else
+		MatPool::Serialize(s);
 	
 	s % graphs
 	  % hw_model
-	  % lstm_model
-	  % rnn_model
+	  % lstm_model;
+	if (version < 0)
+		s % lstm_cell_model;
+	s % rnn_model
 	  % Whd % bd % Wil
 	  % noise_i[0] % noise_i[1]
 	  % step_cache
@@ -747,6 +900,8 @@ void RecurrentSession::Serialize(Stream& s) {
 	  % output_size
 	  % letter_size
 	  % max_graphs;
+	if (version < 0)
+		s % fused;
 	 
 	if (s.IsLoading()) {
 		for(int i = 0; i < graphs.GetCount(); i++) {
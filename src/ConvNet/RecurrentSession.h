@@ -27,6 +27,7 @@ protected:
 	// ModelVector
 	Vector<HighwayModel> hw_model;
 	Vector<LSTMModel> lstm_model;
+	Vector<LSTMCellModel> lstm_cell_model;
 	Vector<RNNModel> rnn_model;
 	std::unique_ptr<TransformerCRTP> transformer_model;  // For transformer model
 	std::unique_ptr<GPTModel> gpt_model;                // For GPT model
@@ -45,6 +46,7 @@ protected:
 	Vector<int> hidden_sizes;
 	MatId input;
 	Mat probs;
+	Vector<double> batch_probs;
 	double ppl, cost;
 	double regc;
 	double learning_rate;
@@ -56,8 +58,7 @@ protected:
 	int output_size;
 	int letter_size;
 	int max_graphs;
-	
-	enum {MODE_RNN, MODE_LSTM, MODE_HIGHWAY, MODE_TRANSFORMER, MODE_GPT};
+	bool fused;
 	
 	void InitRNN();
 	void InitRNN(int i, int j, GraphTree& g);
@@ -70,9 +71,13 @@ protected:
 	void Backward(int seq_end_cursor);
 	void SolverStep();
 	void ResetPrevs();
+	void SetBatch(int count);
+	void ComputeGradients(const Vector<Vector<int> >& sequences);
 	
 	
 public:
+	enum {MODE_RNN, MODE_LSTM, MODE_HIGHWAY, MODE_TRANSFORMER, MODE_GPT};
+	
 	bool use_tokenization;  // Flag to indicate if we're using tokenization instead of character-level
 	typedef RecurrentSession CLASSNAME;
 	RecurrentSession();
@@ -81,6 +86,7 @@ public:
 	void Init();
 	void InitGraphs();
 	void Learn(const Vector<int>& index_sequence);
+	void Learn(const Vector<Vector<int> >& sequences);
 	void Predict(Vector<int>& index_sequence, bool samplei=false, double temperature=1.0, bool continue_sentence=false, int max_predictions=-1);
 	void Load(const ValueMap& js);
 	void Store(ValueMap& js);
@@ -96,6 +102,14 @@ public:
 	void SetInputSize(int i) {input_size = i;}
 	void SetOutputSize(int i) {output_size = i;}
 	void SetLearningRate(double d) {learning_rate = d;}
+	void SetMode(int i) {mode = i;}
+	void SetHiddenSizes(const Vector<int>& v) {hidden_sizes <<= v;}
+	void SetLetterSize(int i) {letter_size = i;}
+	
+	// The LSTM and RNN steps are fused cells by default. The unfused graph of the original
+	// generic nodes is kept for comparison. Set before Init.
+	void SetFused(bool b=true) {fused = b;}
+	bool IsFused() const {return fused;}
 	
 	// Getter for mode
 	int GetMode() const { return mode; }
@@ -12,7 +12,7 @@ void LayerBase::InitRegression(int input_width, int input_height, int input_dept
 
 Volume& LayerBase::ForwardRegression(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation = input;
+	output_activation.SetWeights(input);
 	return input; // identity function
 }
 
@@ -20,10 +20,12 @@ double LayerBase::BackwardRegression(const Vector<double>& y) {
 	// compute and accumulate gradient wrt weights and bias of this layer
 	Volume& input = *input_activation;
 	
-	input.ZeroGradients(); // zero out the gradient of input Vol
+	// every input gradient is written below, so no need to zero them first
 	double loss = 0.0;
 	
-	for (int i = 0; i < output_depth; i++) {
+	// y holds the targets of all samples of the batch, one after another
+	int count = input.GetCount();
+	for (int i = 0; i < count; i++) {
 		double dy = input.Get(i) - y[i];
 		input.SetGradient(i,  dy);
 		loss += 0.5 * dy * dy;
@@ -48,22 +50,25 @@ double LayerBase::BackwardRegression(int pos, double y) {
 }
 
 
-double LayerBase::BackwardRegression(int cols, const Vector<int>& posv, const Vector<double>& yv) {
+// The loss of sample i is multiplied by weight[i], if the weights are given.
+double LayerBase::BackwardRegression(int cols, const Vector<int>& posv, const Vector<double>& yv, const Vector<double>* weight) {
 	// compute and accumulate gradient wrt weights and bias of this layer
 	Volume& input = *input_activation;
 	input.ZeroGradients(); // zero out the gradient of input Vol
 	double loss = 0.0;
 	
 	ASSERT(posv.GetCount() == yv.GetCount());
+	ASSERT(!weight || weight->GetCount() == yv.GetCount());
 	for(int i = 0; i < posv.GetCount(); i++) {
 		int p = posv[i];
 		ASSERT(p >= 0 && p < cols);
 		int pos = i * cols + p;
 		double y = yv[i];
+		double w = weight ? (*weight)[i] : 1.0;
 		
 		double dy = input.Get(pos) - y;
-		input.SetGradient(pos, dy);
-		loss += 0.5 * dy * dy;
+		input.SetGradient(pos, w * dy);
+		loss += 0.5 * w * dy * dy;
 	}
 	
 	return loss;
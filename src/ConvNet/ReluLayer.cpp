@@ -11,13 +11,12 @@ void LayerBase::InitRelu(int input_width, int input_height, int input_depth) {
 
 Volume& LayerBase::ForwardRelu(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation = input;
+	output_activation.SetSize(input.GetWidth(), input.GetHeight(), input.GetDepth(), input.GetBatch());
 	Volume& output = output_activation;
 	
-	for (int i = 0; i < input.GetLength(); i++) {
-		if (output.Get(i) < 0) {
-			output.Set(i, 0); // threshold at 0
-		}
+	for (int i = 0; i < input.GetCount(); i++) {
+		double v = input.Get(i);
+		output.Set(i, v < 0 ? 0 : v); // threshold at 0
 	}
 	
 	return output_activation;
@@ -25,9 +24,7 @@ Volume& LayerBase::ForwardRelu(Volume& input, bool is_training) {
 
 void LayerBase::BackwardRelu() {
 	Volume& input = *input_activation; // we need to set dw of this
-	int length = input.GetLength();
-	
-	input.ZeroGradients(); // zero out gradient wrt data
+	int length = input.GetCount();
 	
 	for (int i = 0; i < length; i++)
 	{
@@ -0,0 +1,185 @@
+#include "ConvNet.h"
+
+namespace ConvNet {
+
+void SumTree::Init(int capacity) {
+	ASSERT(capacity >= 0);
+	this->capacity = capacity;
+	size = 1;
+	while (size < capacity)
+		size <<= 1;
+	sum.SetCount(2 * size);
+	min.SetCount(2 * size);
+	Clear();
+}
+
+void SumTree::Clear() {
+	for(int i = 0; i < sum.GetCount(); i++) {
+		sum[i] = 0;
+		min[i] = DBL_MAX;
+	}
+}
+
+void SumTree::Set(int i, double priority) {
+	ASSERT(i >= 0 && i < capacity && priority >= 0);
+	int n = size + i;
+	sum[n] = priority;
+	min[n] = priority > 0 ? priority : DBL_MAX;
+	for(n >>= 1; n > 0; n >>= 1) {
+		sum[n] = sum[2 * n] + sum[2 * n + 1];
+		min[n] = Upp::min(min[2 * n], min[2 * n + 1]);
+	}
+}
+
+int SumTree::Find(double value) const {
+	ASSERT(GetTotal() > 0);
+	// the rounding of the sums can't lead to an empty slot, because a child without
+	// priority is never entered
+	int n = 1;
+	while (n < size) {
+		int left = 2 * n;
+		if ((value < sum[left] && sum[left] > 0) || sum[left + 1] <= 0)
+			n = left;
+		else {
+			value -= sum[left];
+			n = left + 1;
+		}
+	}
+	return n - size;
+}
+
+void PrioritizedReplay::Update(int i, double td_error) {
+	double p = pow(fabs(td_error) + epsilon, alpha);
+	if (!IsFin(p))
+		p = max_priority;
+	max_priority = max(max_priority, p);
+	tree.Set(i, p);
+}
+
+double PrioritizedReplay::GetWeight(int i) const {
+	double p = tree.Get(i);
+	return p > 0 ? pow(tree.GetMin() / p, beta) : 0.0;
+}
+
+int PrioritizedReplay::Sample(double& weight) const {
+	int i = tree.Find(Randomf() * tree.GetTotal());
+	weight = GetWeight(i);
+	return i;
+}
+
+void PrioritizedReplay::Sample(int n, int* index, double* weight) const {
+	double range = tree.GetTotal() / n;
+	for(int k = 0; k < n; k++) {
+		int i = tree.Find((k + Randomf()) * range);
+		index[k] = i;
+		weight[k] = GetWeight(i);
+	}
+}
+
+ReplayBuffer& ReplayBuffer::SetPrioritized(double alpha, double beta) {
+	priority.Set(alpha, beta);
+	if (!prioritized) {
+		prioritized = true;
+		priority.Init(capacity);
+		for(int i = 0; i < count; i++)
+			priority.Add(i);
+	}
+	return *this;
+}
+
+void ReplayBuffer::Init(int capacity, int length) {
+	ASSERT(capacity >= 0 && length >= 0);
+	this->capacity = capacity;
+	this->length = length;
+	state0.SetCount(0);
+	state0.SetCount(capacity * length, 0);
+	state1.SetCount(0);
+	state1.SetCount(capacity * length, 0);
+	action.SetCount(0);
+	action.SetCount(capacity, -1);
+	reward.SetCount(0);
+	reward.SetCount(capacity, 0);
+	if (prioritized)
+		priority.Init(capacity);
+	Clear();
+}
+
+void ReplayBuffer::Clear() {
+	count = 0;
+	write = 0;
+	if (prioritized)
+		priority.Clear();
+}
+
+int ReplayBuffer::Add(const Vector<double>& s0, int a, double r, const Vector<double>& s1) {
+	ASSERT(capacity > 0 && s0.GetCount() == length && s1.GetCount() == length);
+	int i = write;
+	Real* d0 = state0.Begin() + (int64)i * length;
+	Real* d1 = state1.Begin() + (int64)i * length;
+	for(int j = 0; j < length; j++) {
+		d0[j] = (Real)s0[j];
+		d1[j] = (Real)s1[j];
+	}
+	action[i] = a;
+	reward[i] = r;
+	if (prioritized)
+		priority.Add(i);
+	if (++write == capacity)
+		write = 0;
+	if (count < capacity)
+		count++;
+	return i;
+}
+
+void ReplayBuffer::Sample(int n, int* index, double* weight) const {
+	ASSERT(count > 0);
+	if (prioritized) {
+		priority.Sample(n, index, weight);
+		return;
+	}
+	for(int k = 0; k < n; k++) {
+		index[k] = Random(count);
+		weight[k] = 1.0;
+	}
+}
+
+void ReplayBuffer::Gather(const Vector<Real>& states, int length, const int* index, int n, Volume& out) {
+	out.SetSize(1, 1, length, n);
+	Real* d = out.GetWeights().Begin();
+	for(int k = 0; k < n; k++)
+		memcpy(d + (int64)k * length, states.Begin() + (int64)index[k] * length, length * sizeof(Real));
+}
+
+void ReplayBuffer::Serialize(Stream& s) {
+	byte version = 1;
+	s % version;
+	if (s.IsLoading() && version != 1) {
+		s.LoadError();
+		return;
+	}
+	int real_size = sizeof(Real);
+	s % real_size % capacity % length % count % write;
+	if (s.IsLoading()) {
+		// the arrays of capacity * length values must fit in a Vector
+		if (real_size != (int)sizeof(Real) || capacity < 0 || length < 0 ||
+			(int64)capacity * length > INT_MAX ||
+			count < 0 || count > capacity || write < 0 || (capacity && write >= capacity)) {
+			s.LoadError();
+			return;
+		}
+		int c = count, w = write;
+		Init(capacity, length);
+		count = c;
+		write = w;
+		for(int i = 0; prioritized && i < count; i++)
+			priority.Add(i);
+	}
+	// the slots above count have never been written
+	int64 n = (int64)count * length * sizeof(Real);
+	s.SerializeRaw((byte*)state0.Begin(), n);
+	s.SerializeRaw((byte*)state1.Begin(), n);
+	s.SerializeRaw((byte*)action.Begin(), (int64)count * sizeof(int));
+	s.SerializeRaw((byte*)reward.Begin(), (int64)count * sizeof(double));
+}
+
+}
@@ -0,0 +1,127 @@
+#ifndef _ConvNet_ReplayBuffer_h_
+#define _ConvNet_ReplayBuffer_h_
+
+#include "Utilities.h"
+
+namespace ConvNet {
+
+// Binary tree over the priorities of capacity slots. Every node has the sum and the minimum
+// of its children, so that changing a priority and finding the slot of a cumulative
+// priority are O(log n). Slots without a priority have zero in the sum and are ignored by
+// the minimum.
+class SumTree {
+	Vector<double> sum, min;	// the root is 1 and the leaves are size ... 2 * size - 1
+	int size = 0;
+	int capacity = 0;
+
+public:
+	SumTree() {}
+
+	void Init(int capacity);
+	void Clear();
+	void Set(int i, double priority);
+	double Get(int i) const {ASSERT(i >= 0 && i < capacity); return sum[size + i];}
+	int Find(double value) const; // the slot where the cumulative priority exceeds value
+
+	int GetCapacity() const {return capacity;}
+	double GetTotal() const {return size ? sum[1] : 0.0;}
+	double GetMin() const {return size ? min[1] : 0.0;}
+};
+
+// Proportional prioritized experience replay (Schaul et al. 2016). Slot i is sampled with
+// the probability p_i / sum p, where p_i = (|td_error| + epsilon)^alpha, and the update of
+// the sample should be scaled with the importance sampling weight (p_min / p_i)^beta, which
+// is 1 for the least probable slot. New slots get the largest priority so far, so that
+// they are sampled at least once before their error is known.
+//
+// A batch is sampled stratified: the total priority is split into n equal ranges, and one
+// slot is sampled from each.
+class PrioritizedReplay {
+	SumTree tree;
+	double alpha = 0.6;
+	double beta = 0.4;
+	double epsilon = 0.01;
+	double max_priority = 1.0;
+
+public:
+	PrioritizedReplay() {}
+
+	PrioritizedReplay& Set(double alpha, double beta) {this->alpha = alpha; this->beta = beta; return *this;}
+	PrioritizedReplay& SetBeta(double d) {beta = d; return *this;}
+	PrioritizedReplay& SetEpsilon(double d) {epsilon = d; return *this;}
+
+	void Init(int capacity) {tree.Init(capacity); max_priority = 1.0;}
+	void Clear() {tree.Clear(); max_priority = 1.0;}
+	void Add(int i) {tree.Set(i, max_priority);}
+	void Update(int i, double td_error);
+	int Sample(double& weight) const;
+	void Sample(int n, int* index, double* weight) const;
+
+	const SumTree& GetTree() const {return tree;}
+	int GetCapacity() const {return tree.GetCapacity();}
+	double GetAlpha() const {return alpha;}
+	double GetBeta() const {return beta;}
+	double GetPriority(int i) const {return tree.Get(i);}
+	double GetWeight(int i) const;
+};
+
+// Experience replay memory of (state0, action, reward, state1) transitions. The transitions
+// are stored as structure of arrays: the states are rows of two preallocated matrices, and
+// the actions and rewards are arrays of the same capacity. Add writes the transition to the
+// next slot of the ring, so that the oldest one is overwritten when the buffer is full, and
+// nothing is allocated after Init.
+//
+// The rows of sampled transitions are copied directly into the samples of a batched Volume
+// with GatherState0 and GatherState1. Serialize stores the filled part of the arrays as raw
+// memory. The priorities aren't stored: after loading, every transition has the same one.
+//
+// Sample draws uniformly, or with SetPrioritized, in proportion to the priorities which
+// UpdatePriority sets from the TD errors of the transitions.
+class ReplayBuffer {
+	Vector<Real> state0, state1;	// capacity x length
+	Vector<int> action;
+	Vector<double> reward;
+	PrioritizedReplay priority;
+	bool prioritized = false;
+	int capacity = 0;
+	int length = 0;
+	int count = 0;
+	int write = 0;		// the slot of the next transition
+
+	static void Gather(const Vector<Real>& states, int length, const int* index, int n, Volume& out);
+
+public:
+	ReplayBuffer() {}
+
+	void Init(int capacity, int length);
+	void Clear(); // keeps the memory
+
+	ReplayBuffer& SetPrioritized(double alpha=0.6, double beta=0.4);
+	ReplayBuffer& SetUniform() {prioritized = false; return *this;}
+	PrioritizedReplay& GetPriority() {return priority;}
+
+	int Add(const Vector<double>& s0, int a, double r, const Vector<double>& s1); // returns the slot
+	void Sample(int n, int* index, double* weight) const;
+	void UpdatePriority(int i, double td_error) {ASSERT(prioritized); priority.Update(i, td_error);}
+	void GatherState0(const int* index, int n, Volume& out) const {Gather(state0, length, index, n, out);}
+	void GatherState1(const int* index, int n, Volume& out) const {Gather(state1, length, index, n, out);}
+
+	const Real* GetState0(int i) const {ASSERT(i >= 0 && i < capacity); return state0.Begin() + (int64)i * length;}
+	const Real* GetState1(int i) const {ASSERT(i >= 0 && i < capacity); return state1.Begin() + (int64)i * length;}
+	int GetAction(int i) const {return action[i];}
+	double GetReward(int i) const {return reward[i];}
+
+	int GetCapacity() const {return capacity;}
+	int GetLength() const {return length;}
+	int GetCount() const {return count;}
+	int GetWritePosition() const {return write;}
+	bool IsEmpty() const {return count == 0;}
+	bool IsPrioritized() const {return prioritized;}
+	const PrioritizedReplay& GetPriority() const {return priority;}
+
+	void Serialize(Stream& s);
+};
+
+}
+
+#endif
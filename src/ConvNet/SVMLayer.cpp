@@ -12,7 +12,7 @@ void LayerBase::InitSVM(int input_width, int input_height, int input_depth) {
 
 Volume& LayerBase::ForwardSVM(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation = input; // nothing to do, output raw scores
+	output_activation.SetWeights(input); // nothing to do, output raw scores
 	return input;
 }
 
@@ -45,6 +45,35 @@ double LayerBase::BackwardSVM(int pos, double yd) {
 	return loss;
 }
 
+double LayerBase::BackwardSVM(const Vector<int>& posv) {
+	Volume& input = *input_activation;
+	ASSERT(posv.GetCount() == output_activation.GetBatch());
+	
+	input.ZeroGradients(); // zero out the gradient of input Vol
+	
+	const double margin = 1.0;
+	double loss = 0.0;
+	for (int b = 0; b < posv.GetCount(); b++) {
+		int off = b * output_depth;
+		int pos = off + posv[b];
+		double yscore = input.Get(pos); // score of ground truth
+		for (int i = off; i < off + output_depth; i++) {
+			if (pos == i) {
+				continue;
+			}
+			double ydiff = -1.0 * yscore + input.Get(i) + margin;
+			if (ydiff > 0) {
+				// violating dimension, apply loss
+				input.AddGradient(i, 1);
+				input.AddGradient(pos, -1);
+				loss += ydiff;
+			}
+		}
+	}
+	
+	return loss;
+}
+
 String LayerBase::ToStringSVM() const {
 	return Format("SVM: w:%d, h:%d, d:%d, classes:%d",
 		output_width, output_height, output_depth, class_count);
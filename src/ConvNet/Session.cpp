@@ -19,6 +19,8 @@ Session::Session() {
 	iter_cb_interal = 100;
 	augmentation = 0;
 	augmentation_do_flip = false;
+	thread_count = 1;
+	hogwild = false;
 	
 	SetWindowSize(100);
 }
@@ -47,6 +49,7 @@ Session& Session::SetWindowSize(int size, int min_size) {
 	train_window.Init(size, min_size);
 	accuracy_window.Init(size, min_size);
 	test_window.Init(size, min_size);
+	throughput_window.Init(size, min_size);
 	return *this;
 }
 
@@ -115,6 +118,10 @@ void Session::TrainBegin() {
 	SessionData& d = Data();
 	x.Init(d.data_w, d.data_h, d.data_d, 0.0);
 	
+	InitWorkers(max(1, trainer.GetBatchSize()));
+	for(int i = 0; i < workers.GetCount(); i++)
+		workers[i].sample.Init(x);
+	
 	// reinit windows that keep track of val/train accuracies
 	loss_window.Clear();
 	reward_window.Clear();
@@ -123,98 +130,201 @@ void Session::TrainBegin() {
 	train_window.Clear();
 	accuracy_window.Clear();
 	test_window.Clear();
+	throughput_window.Clear();
+	loader.ResetStats();
 	
 }
 
+static double GetMeanSquaredError(const Volume& v, int b, const double* correct) {
+	int length = v.GetLength();
+	double mse = 0.0;
+	for (int i = 0; i < length; i++) {
+		double diff = correct[i] - v.Get(b * length + i);
+		mse += diff * diff;
+	}
+	return mse / length;
+}
+
+void Session::InitWorkers(int batch_size) {
+	if (thread_count <= 1) {
+		workers.Clear();
+		net.Plan(true, batch_size);
+		return;
+	}
+	
+	// replica sync and the gradient reduction work on the flat parameter arenas
+	net.FlattenParameters();
+	workers.SetCount(thread_count);
+	int shard_size = (batch_size + thread_count - 1) / thread_count;
+	for(int i = 0; i < workers.GetCount(); i++) {
+		TrainWorker& w = workers[i];
+		if (i == 0 && !hogwild)
+			w.net = &net;
+		else {
+			w.replica.CopyFrom(net);
+			w.replica.FlattenParameters();
+			w.net = &w.replica;
+		}
+		
+		// Hogwild workers train whole mini-batches with their own trainers
+		if (hogwild) {
+			w.trainer.CopyFrom(trainer);
+			w.trainer.SetNet(w.replica).SetSharedNet(net);
+			w.net->Plan(true, batch_size);
+		}
+		else
+			w.net->Plan(true, shard_size);
+	}
+}
+
+// Loads count samples of the data, starting from begin, to the mini-batch xb and their
+// targets. The sample volume is the temporary of the caller.
+void Session::LoadBatch(int begin, int count, bool train_regression, Volume& sample, Volume& xb, Vector<double>& target, Vector<int>& labels, Vector<double>& rewards) {
+	DataLoader::LoadBatch(Data(), NULL, begin, count, train_regression,
+	                      augmentation, augmentation_do_flip, augmentation ? Random64() : 0,
+	                      sample, xb, target, labels, rewards);
+}
+
+// Adds the accuracy of every sample of the worker's mini-batch in the last forward pass
+// of the net: the negative mean squared error, or 1 for a correct class and 0 otherwise.
+void Session::GetAccuracy(Net& wnet, const TrainWorker& w, bool train_values, Vector<double>& out) {
+	Volume& v = wnet.GetOutput();
+	for(int b = 0; b < w.x.GetBatch(); b++) {
+		if (train_values)
+			out.Add(-GetMeanSquaredError(v, b, w.target.Begin() + b * v.GetLength()));
+		else
+			out.Add(wnet.GetPrediction(b) == w.labels[b] ? 1.0 : 0.0);
+	}
+}
+
 void Session::TrainIteration() {
 	SessionData& d = Data();
 	
 	const Vector<LayerBase>& layers = net.GetLayers();
 	bool train_regression = d.is_data_result ? false : (layers.Top().IsRegressionLayer() || layers.Top().IsDeconvLayer());
+	bool train_values = train_regression || d.is_data_result;
+	
+	// the net is trained with whole mini-batches of the trainer's batch size
+	int batch_size = max(1, trainer.GetBatchSize());
 	
 	try {
 	
-		for(int i = 0; i < d.GetDataCount() && is_training; i++) {
-			ASSERT(d.data[i]);
+		if (hogwild && workers.GetCount() > 1)
+			TrainHogwild(train_regression, train_values);
+		else {
+			bool prefetch = loader.IsEnabled();
+			if (prefetch)
+				loader.SetAugmentation(augmentation, augmentation_do_flip)
+				      .Begin(d, batch_size, iter, train_regression);
 			
-			x.SetData(d.Get(i));
-			
-			if (augmentation)
-				x.Augment(augmentation, -1, -1, augmentation_do_flip);
-			
-			lock.Enter();
-			
-			// use x to build our estimate of validation error
-			if (test_predict && (step_num % predict_interval) == 0) {
-				TimeStop ts;
-				Volume& v = net.Forward(x);
-				forward_time = ts.Elapsed();
+			for(int i0 = 0; i0 < d.GetDataCount() && is_training; i0 += batch_size) {
+				int batch = min(batch_size, d.GetDataCount() - i0);
+				TimeStop batch_ts;
 				
-				if (train_regression || d.is_data_result) {
-					// Mean squared error
-					const Vector<double>& correct = train_regression ? x.GetWeights() : d.GetResult(i);
-					double mse = 0.0;
-					for (int i = 0; i < v.GetLength(); i++) {
-						double diff = correct[i] - v.Get(i);
-						mse += diff * diff;
-					}
-					mse /= v.GetLength();
-					accuracy_window.Add(-mse);
+				// the prefetched batch is swapped in, and back to the loader after the step
+				LoaderBatch* lb = NULL;
+				if (prefetch) {
+					lb = &loader.Get();
+					ASSERT(lb->count == batch);
+					x_batch.SwapData(lb->x);
+					Swap(x_target, lb->target);
+					Swap(batch_labels, lb->labels);
+					Swap(batch_rewards, lb->rewards);
 				}
+				else
+					LoadBatch(i0, batch, train_regression, x, x_batch, x_target, batch_labels, batch_rewards);
+				
+				lock.Enter();
+				
+				// use the batch to build our estimate of validation error, if one of its
+				// steps is a prediction step
+				int predict_step = (step_num + predict_interval - 1) / predict_interval * predict_interval;
+				bool predict = test_predict && predict_step < step_num + batch;
+				
+				if (workers.GetCount() > 1)
+					TrainParallel(batch, train_values, predict);
 				else {
-					// Is correct prediction or not?
-					int cls = net.GetPrediction();
-					accuracy_window.Add(cls == d.GetLabel(i) ? 1.0 : 0.0);
+					if (predict) {
+						TimeStop ts;
+						Volume& v = net.Forward(x_batch);
+						forward_time = ts.Elapsed();
+						
+						for(int b = 0; b < batch; b++) {
+							if (train_values) {
+								// Mean squared error
+								double mse = GetMeanSquaredError(v, b, x_target.Begin() + b * v.GetLength());
+								accuracy_window.Add(-mse);
+							}
+							else {
+								// Is correct prediction or not?
+								int cls = net.GetPrediction(b);
+								accuracy_window.Add(cls == batch_labels[b] ? 1.0 : 0.0);
+							}
+						}
+					}
+					
+					TimeStop ts;
+					if (train_values)
+						trainer.Train(x_batch, x_target); // value
+					else
+						trainer.Train(x_batch, batch_labels, batch_rewards);
+					backward_time = ts.Elapsed();
 				}
-			}
-			
-			TimeStop ts;
-			if (d.is_data_result)
-				trainer.Train(x, d.GetResult(i));
-			else if (train_regression)
-				trainer.Train(x, x.GetWeights()); // value
-			else
-				trainer.Train(x, d.GetLabel(i), 1.0); // value
-			backward_time = ts.Elapsed();
-			
-			double reward = trainer.GetReward();
-			double loss = trainer.GetLoss();
-			double loss_l1d = trainer.GetL1DecayLoss();
-			double loss_l2d = trainer.GetL2DecayLoss();
-			step_num++;
-			lock.Leave();
-			
-			// keep track of stats such as the average training error and loss
-			// if last layer is softmax, then add prediction value to the average
-			if (test_predict) {
-				if (train_regression || d.is_data_result) {
-					// Mean squared error
+				
+				double reward = trainer.GetReward();
+				double loss = trainer.GetLoss();
+				double loss_l1d = trainer.GetL1DecayLoss();
+				double loss_l2d = trainer.GetL2DecayLoss();
+				int prev_step_num = step_num;
+				step_num += batch;
+				lock.Leave();
+				
+				// keep track of stats such as the average training error and loss
+				// if last layer is softmax, then add prediction value to the average
+				if (test_predict && workers.GetCount() > 1) {
+					for(int j = 0; j < workers.GetCount(); j++) {
+						const Vector<double>& train = workers[j].train;
+						for(int k = 0; k < train.GetCount(); k++)
+							train_window.Add(train[k]);
+					}
+				}
+				else if (test_predict) {
 					Volume& v = net.GetOutput();
-					const Vector<double>& correct = train_regression ? x.GetWeights() : d.GetResult(i);
-					double mse = 0.0;
-					for (int i = 0; i < v.GetLength(); i++) {
-						double diff = correct[i] - v.Get(i);
-						mse += diff * diff;
+					for(int b = 0; b < batch; b++) {
+						if (train_values) {
+							// Mean squared error
+							double mse = GetMeanSquaredError(v, b, x_target.Begin() + b * v.GetLength());
+							train_window.Add(-mse);
+						}
+						else {
+							// Is correct prediction or not?
+							int cls = net.GetPrediction(b);
+							train_window.Add(cls == batch_labels[b] ? 1.0 : 0.0); // add 1 when label is correct
+						}
 					}
-					mse /= v.GetLength();
-					train_window.Add(-mse);
 				}
-				else {
-					// Is correct prediction or not?
-					int cls = net.GetPrediction();
-					train_window.Add(cls == d.GetLabel(i) ? 1.0 : 0.0); // add 1 when label is correct
+				
+				reward_window.Add(reward);
+				loss_window.Add(loss);
+				l1_loss_window.Add(loss_l1d);
+				l2_loss_window.Add(loss_l2d);
+				
+				double seconds = batch_ts.Seconds();
+				if (seconds > 0)
+					throughput_window.Add(batch / seconds);
+				
+				if ((step_num / step_cb_interal) != (prev_step_num / step_cb_interal))
+					WhenStepInterval(step_num);
+				
+				if (lb) {
+					x_batch.SwapData(lb->x);
+					Swap(x_target, lb->target);
+					Swap(batch_labels, lb->labels);
+					Swap(batch_rewards, lb->rewards);
+					loader.Release();
 				}
 			}
-			
-			reward_window.Add(reward);
-			loss_window.Add(loss);
-			l1_loss_window.Add(loss_l1d);
-			l2_loss_window.Add(loss_l2d);
-			
-			
-			if ((step_num % step_cb_interal) == 0)
-				WhenStepInterval(step_num);
-			
+			loader.End();
 		}
 		
 		iter++;
@@ -236,7 +346,206 @@ void Session::TrainIteration() {
 	}
 }
 
+// Hogwild: every worker trains its own part of the data with its own trainer, and updates
+// the parameters of the net without locking. The results depend on the timing of the
+// threads, but there is no barrier between the mini-batches.
+void Session::TrainHogwild(bool train_regression, bool train_values) {
+	TimeStop ts;
+	
+	int count = workers.GetCount();
+	int data_count = Data().GetDataCount();
+	
+	// the workers update the filters, so the quantized blocks go before they start
+	net.Dequantize();
+	for(int i = 0; i < count; i++)
+		workers[i].net->Dequantize();
+	
+	CoWork co;
+	for(int i = 0; i < count; i++) {
+		TrainWorker& w = workers[i];
+		w.begin = data_count * i / count;
+		w.count = data_count * (i + 1) / count - w.begin;
+		co & [this, &w, train_regression, train_values] {TrainHogwildWorker(w, train_regression, train_values);};
+	}
+	co.Finish();
+	
+	// the statistics are collected in worker order after all workers have finished
+	int prev_step_num = step_num;
+	int samples = 0;
+	for(int i = 0; i < count; i++) {
+		TrainWorker& w = workers[i];
+		for(int j = 0; j < w.accuracy.GetCount(); j++)
+			accuracy_window.Add(w.accuracy[j]);
+		for(int j = 0; j < w.train.GetCount(); j++)
+			train_window.Add(w.train[j]);
+		for(int j = 0; j < w.stats.GetCount(); j++) {
+			const BatchStats& st = w.stats[j];
+			reward_window.Add(st.reward);
+			loss_window.Add(st.loss);
+			l1_loss_window.Add(st.l1_loss);
+			l2_loss_window.Add(st.l2_loss);
+			samples += st.samples;
+		}
+	}
+	step_num += samples;
+	trainer.iter_count += samples;
+	backward_time = ts.Elapsed();
+	
+	double seconds = ts.Seconds();
+	if (seconds > 0)
+		throughput_window.Add(samples / seconds);
+	
+	if ((step_num / step_cb_interal) != (prev_step_num / step_cb_interal))
+		WhenStepInterval(step_num);
+}
+
+void Session::TrainHogwildWorker(TrainWorker& w, bool train_regression, bool train_values) {
+	int batch_size = max(1, w.trainer.GetBatchSize());
+	int end = w.begin + w.count;
+	
+	w.accuracy.SetCount(0);
+	w.train.SetCount(0);
+	w.stats.SetCount(0);
+	
+	for(int i0 = w.begin; i0 < end && is_training; i0 += batch_size) {
+		int batch = min(batch_size, end - i0);
+		LoadBatch(i0, batch, train_regression, w.sample, w.x, w.target, w.labels, w.rewards);
+		
+		// the data index decides the prediction steps
+		int predict_step = (i0 + predict_interval - 1) / predict_interval * predict_interval;
+		if (test_predict && predict_step < i0 + batch) {
+			w.net->Forward(w.x);
+			GetAccuracy(*w.net, w, train_values, w.accuracy);
+		}
+		
+		if (train_values)
+			w.trainer.Train(w.x, w.target);
+		else
+			w.trainer.Train(w.x, w.labels, w.rewards);
+		
+		if (test_predict)
+			GetAccuracy(*w.net, w, train_values, w.train);
+		
+		BatchStats& st = w.stats.Add();
+		st.loss = w.trainer.GetLoss();
+		st.reward = w.trainer.GetReward();
+		st.l1_loss = w.trainer.GetL1DecayLoss();
+		st.l2_loss = w.trainer.GetL2DecayLoss();
+		st.samples = batch;
+	}
+}
+
+// Trains the mini-batch in x_batch with all workers and updates the net once with the sum
+// of their gradients.
+void Session::TrainParallel(int batch, bool train_values, bool predict) {
+	TimeStop ts;
+	
+	// split the mini-batch into contiguous parts
+	int count = workers.GetCount();
+	for(int i = 0; i < count; i++) {
+		TrainWorker& w = workers[i];
+		w.begin = batch * i / count;
+		w.count = batch * (i + 1) / count - w.begin;
+	}
+	
+	CoWork co;
+	for(int i = 0; i < count; i++) {
+		TrainWorker& w = workers[i];
+		if (w.count > 0)
+			co & [this, &w, train_values, predict] {TrainShard(w, train_values, predict);};
+	}
+	co.Finish();
+	
+	// reduce the gradients of the replicas into the net, one slice of the arena per thread
+	ASSERT(net.IsFlat());
+	int arena_count = net.GetArenaCount();
+	for(int i = 0; i < count; i++)
+		co & [this, i, count, arena_count] {
+			ReduceGradients(arena_count * i / count, arena_count * (i + 1) / count);
+		};
+	co.Finish();
+	
+	double loss = 0, reward = 0;
+	for(int i = 0; i < count; i++) {
+		TrainWorker& w = workers[i];
+		if (w.count == 0)
+			continue;
+		loss += w.loss;
+		for(int j = 0; j < w.rewards.GetCount(); j++)
+			reward += w.rewards[j];
+		for(int j = 0; j < w.accuracy.GetCount(); j++)
+			accuracy_window.Add(w.accuracy[j]);
+	}
+	
+	trainer.ApplyGradients(batch, loss, reward);
+	backward_time = ts.Elapsed();
+}
+
+void Session::TrainShard(TrainWorker& w, bool train_values, bool predict) {
+	Net& wnet = *w.net;
+	
+	// replicas start from the current weights of the net
+	if (&wnet != &net)
+		wnet.CopyParametersFrom(net);
+	
+	int length = x_batch.GetLength();
+	w.x.SetSize(x_batch.GetWidth(), x_batch.GetHeight(), x_batch.GetDepth(), w.count);
+	const Real* src = x_batch.GetWeights().Begin() + w.begin * length;
+	Real* dst = w.x.GetWeights().Begin();
+	for(int i = 0; i < w.count * length; i++)
+		dst[i] = src[i];
+	
+	w.target.SetCount(0);
+	w.labels.SetCount(0);
+	w.rewards.SetCount(0);
+	if (train_values) {
+		int target_length = x_target.GetCount() / x_batch.GetBatch();
+		for(int i = w.begin * target_length; i < (w.begin + w.count) * target_length; i++)
+			w.target.Add(x_target[i]);
+	}
+	else {
+		for(int i = w.begin; i < w.begin + w.count; i++) {
+			w.labels.Add(batch_labels[i]);
+			w.rewards.Add(batch_rewards[i]);
+		}
+	}
+	
+	w.accuracy.SetCount(0);
+	if (predict) {
+		wnet.Forward(w.x);
+		GetAccuracy(wnet, w, train_values, w.accuracy);
+	}
+	
+	wnet.Forward(w.x, true);
+	if (train_values)
+		w.loss = wnet.Backward(w.target);
+	else
+		w.loss = wnet.Backward(w.labels, w.rewards);
+	
+	w.train.SetCount(0);
+	if (test_predict)
+		GetAccuracy(wnet, w, train_values, w.train);
+}
+
+// Adds the gradients in [begin, end) of the arena from the replicas to the net, always in
+// the same order, and zeroes them in the replicas.
+void Session::ReduceGradients(int begin, int end) {
+	Real* sum = net.GetGradientArena();
+	for(int i = 1; i < workers.GetCount(); i++) {
+		TrainWorker& w = workers[i];
+		if (w.count == 0)
+			continue;
+		ASSERT(w.net->GetArenaCount() == net.GetArenaCount());
+		Real* g = w.net->GetGradientArena();
+		for(int j = begin; j < end; j++) {
+			sum[j] += g[j];
+			g[j] = 0;
+		}
+	}
+}
+
 void Session::TrainEnd() {
+	loader.End();
 	
 	LOG("loss = " << loss_window.GetAverage() << ", " << iter << " cycles through data in " << ts.ToString() << "ms");
 	is_training_stopped = true;
@@ -1,7 +1,7 @@
 #ifndef _ConvNet_Session_h_
 #define _ConvNet_Session_h_
 
-#include "SessionData.h"
+#include "DataLoader.h"
 
 namespace ConvNet {
 
@@ -15,6 +15,9 @@ public:
 	// Statistical variables for values for training results
 	Window accuracy_result_window;
 	
+	// Trained samples per second
+	Window throughput_window;
+	
 protected:
 	friend class MagicNet;
 	friend class MetaSession;
@@ -27,6 +30,45 @@ protected:
 	TrainerBase trainer;
 	Net net;
 	Volume x;
+	
+	// Temp vars of the mini-batch being trained
+	Volume x_batch;
+	Vector<double> x_target;
+	Vector<int> batch_labels;
+	Vector<double> batch_rewards;
+	
+	// Data-parallel training: every worker trains its own part of the mini-batch. The first
+	// worker uses the session's net, and the others use replicas of it, which get the
+	// weights of the net before every mini-batch. Their gradients are summed into the net in
+	// worker order, so that the results are the same for a fixed thread count.
+	// In the Hogwild mode every worker uses a replica and an own trainer, which updates the
+	// parameters of the net directly without locking.
+	struct BatchStats : Moveable<BatchStats> {
+		double loss, reward, l1_loss, l2_loss;
+		int samples;
+	};
+	struct TrainWorker {
+		Net replica;
+		Net* net = NULL;
+		TrainerBase trainer;
+		Thread thread;
+		Volume sample, x;
+		Vector<double> target;
+		Vector<int> labels, index;
+		Vector<double> rewards, weight;
+		Vector<double> accuracy, train;
+		Vector<BatchStats> stats;
+		double loss = 0;
+		int begin = 0, count = 0;
+	};
+	Array<TrainWorker> workers;
+	int thread_count;
+	bool hogwild;
+	
+	// Prefetching: the mini-batches are loaded in the loader's threads during the training
+	DataLoader loader;
+	
+	
 	Vector<double> session_last_input_array;
 	int predict_interval, step_num;
 	int train_iter_limit;
@@ -47,6 +89,14 @@ protected:
 	
 	const Value& ChkNotNull(const String& key, const Value& v);
 	void Train();
+	void InitWorkers(int batch_size);
+	void LoadBatch(int begin, int count, bool train_regression, Volume& sample, Volume& xb, Vector<double>& target, Vector<int>& labels, Vector<double>& rewards);
+	void GetAccuracy(Net& wnet, const TrainWorker& w, bool train_values, Vector<double>& out);
+	void TrainHogwild(bool train_regression, bool train_values);
+	void TrainHogwildWorker(TrainWorker& w, bool train_regression, bool train_values);
+	void TrainParallel(int batch, bool train_values, bool predict);
+	void TrainShard(TrainWorker& w, bool train_values, bool predict);
+	void ReduceGradients(int begin, int end);
 	
 public:
 	typedef Session CLASSNAME;
@@ -102,6 +152,8 @@ public:
 	const Window& GetAccuracyWindow() const {return accuracy_window;}
 	const Window& GetTrainingWindow() const {return train_window;}
 	const Window& GetTestingAccuracyWindow() const {return test_window;}
+	const Window& GetThroughputWindow() const {return throughput_window;}
+	double GetThroughputAverage() const {return throughput_window.GetAverage();}
 	double GetL1DecayLossAverage() const {return l1_loss_window.GetAverage();}
 	double GetL2DecayLossAverage() const {return l2_loss_window.GetAverage();}
 	double GetTrainingAccuracyAverage() const {return accuracy_window.GetAverage();}
@@ -110,6 +162,8 @@ public:
 	int GetBackwardTime() const {return backward_time;}
 	int GetStepCount() const {return step_num;}
 	int GetIteration() const {return iter;}
+	int GetThreadCount() const {return thread_count;}
+	bool IsHogwild() const {return hogwild;}
 	bool IsTraining() const {return !is_training_stopped || is_training;}
 	
 	virtual double GetLossAverage() const {return loss_window.GetAverage();}
@@ -121,8 +175,14 @@ public:
 	void SetMaxTrainIters(int count) {train_iter_limit = count;}
 	void SetPredictInterval(int i) {predict_interval = i;}
 	void SetTestPredict(bool b) {test_predict = b;}
-	void SetAugmentation(int i=0, bool flip=false) {augmentation = 0; augmentation_do_flip = flip;}
+	void SetAugmentation(int i=0, bool flip=false) {augmentation = i; augmentation_do_flip = flip;}
 	Session& SetWindowSize(int size, int min_size=1);
+	Session& SetThreadCount(int i) {thread_count = max(1, i); return *this;}
+	Session& SetHogwild(bool b=true) {hogwild = b; return *this;}
+	Session& SetPrefetch(int depth, int workers=1) {loader.SetDepth(depth).SetWorkerCount(workers); return *this;} // 0 disables
+	Session& SetShuffle(bool b=true) {loader.SetShuffle(b); return *this;} // with prefetching
+	DataLoader& GetLoader() {return loader;}
+	double GetStallSeconds() const {return loader.GetStallSeconds();}
 	
 	Callback WhenSessionLoaded;
 	Callback1<int> WhenStepInterval, WhenIterationInterval;
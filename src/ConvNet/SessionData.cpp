@@ -23,7 +23,17 @@ void SessionData::Serialize(Stream& s) {
 	  % is_data_result;
 }
 
+void SessionData::CloseMapped() {
+	store.Clear();
+	test_store.Clear();
+	result_store.Clear();
+	if (mapping.IsOpen())
+		mapping.Close();
+	mapped = false;
+}
+
 void SessionData::ClearData() {
+	CloseMapped();
 	data.Clear();
 	test_data.Clear();
 	result_data.Clear();
@@ -94,11 +104,58 @@ void SessionData::BeginDataResult(int result_length, int count, int width, int h
 }
 
 double SessionData::GetData(int i, int col) const {
-	return data[i][col];
+	return mapped ? store.Get(i, col) : data[i][col];
 }
 
 double SessionData::GetTestData(int i, int col) const {
-	return test_data[i][col];
+	return mapped ? test_store.Get(i, col) : test_data[i][col];
+}
+
+Vector<double>& SessionData::Get(int i) {
+	if (!mapped)
+		return data[i];
+	store.GetSample(i, row);
+	return row;
+}
+
+Vector<double>& SessionData::GetTest(int i) {
+	if (!mapped)
+		return test_data[i];
+	test_store.GetSample(i, row);
+	return row;
+}
+
+Vector<double>& SessionData::GetResult(int i) {
+	if (!mapped)
+		return result_data[i];
+	result_store.GetSample(i, row);
+	return row;
+}
+
+// Sets v to the size of the samples and copies sample i to it.
+void SessionData::GetSample(int i, Volume& v) const {
+	v.SetSize(data_w, data_h, data_d);
+	Real* w = v.GetWeights().Begin();
+	if (mapped)
+		store.GetSample(i, w);
+	else {
+		const Vector<double>& src = data[i];
+		ASSERT(src.GetCount() == data_len);
+		for(int j = 0; j < data_len; j++)
+			w[j] = (Real)src[j];
+	}
+}
+
+void SessionData::AddResult(int i, Vector<double>& out) const {
+	if (mapped) {
+		int length = result_store.GetLength();
+		int begin = out.GetCount();
+		out.SetCount(begin + length);
+		for(int j = 0; j < length; j++)
+			out[begin + j] = result_store.Get(i, j);
+	}
+	else
+		out.Append(result_data[i]);
 }
 
 void SessionData::EndData() {
@@ -147,11 +204,128 @@ void SessionData::GetUniformClassData(int per_class, Vector<Vector<double> >& vo
 		if (count < per_class) {
 			count++;
 			remaining--;
-			HeaplessCopy(volumes[remaining], data[i]);
+			HeaplessCopy(volumes[remaining], Get(i));
 			labels[remaining] = label;
 		}
 	}
 	
 }
 
+// Mapped files start with this header. The DataStore elements follow it in the order of
+// the header, each at a 64-byte aligned position of the file.
+void SessionData::SerializeMapped(Stream& s) {
+	int version = 1;
+	s.Magic(0x44534e43); // "CNSD"
+	s / version;
+	if (s.IsLoading() && version != 1) {
+		s.LoadError();
+		return;
+	}
+	s % data_w % data_h % data_d % data_len
+	  % is_data_result
+	  % classes
+	  % labels % test_labels
+	  % mins % maxs;
+	store.SerializeHeader(s);
+	test_store.SerializeHeader(s);
+	result_store.SerializeHeader(s);
+}
+
+static int64 AlignMapped(int64 pos) {
+	return (pos + 63) & ~(int64)63;
+}
+
+bool SessionData::SaveMapped(const String& path, int type) {
+	ASSERT(!mapped);
+	
+	// the column ranges of all samples, for quantization
+	Vector<double> lo, hi;
+	lo.SetCount(data_len, DBL_MAX);
+	hi.SetCount(data_len, -DBL_MAX);
+	for(int k = 0; k < 2; k++) {
+		const Vector<Vector<double> >& src = k ? test_data : data;
+		for(int i = 0; i < src.GetCount(); i++)
+			for(int j = 0; j < data_len; j++) {
+				lo[j] = min(lo[j], src[i][j]);
+				hi[j] = max(hi[j], src[i][j]);
+			}
+	}
+	
+	// the stores only get the headers: the samples are quantized and written one at a time,
+	// so the file can be larger than the memory
+	store.Init(type, data.GetCount(), data_len);
+	test_store.Init(type, test_data.GetCount(), data_len);
+	if (type == DATA_U8) {
+		for(int j = 0; j < data_len; j++) {
+			double range = hi[j] > lo[j] ? hi[j] - lo[j] : 1.0;
+			double offset = lo[j] <= hi[j] ? lo[j] : 0.0;
+			store.SetColumn(j, range / 255, offset);
+			test_store.SetColumn(j, range / 255, offset);
+		}
+	}
+	
+	// regression targets are kept in single precision
+	int result_length = result_data.IsEmpty() ? 0 : result_data[0].GetCount();
+	result_store.Init(DATA_F32, result_data.GetCount(), result_length);
+	
+	FileOut out;
+	bool ok = out.Open(path);
+	if (ok) {
+		SerializeMapped(out);
+		const DataStore* stores[3] = {&store, &test_store, &result_store};
+		const Vector<Vector<double> >* src[3] = {&data, &test_data, &result_data};
+		Vector<byte> sample;
+		for(int i = 0; i < 3; i++) {
+			int64 pos = out.GetPos();
+			out.Put(0, (int)(AlignMapped(pos) - pos));
+			sample.SetCount(stores[i]->GetSampleBytes());
+			for(int j = 0; j < src[i]->GetCount(); j++) {
+				stores[i]->Encode((*src[i])[j], sample.Begin());
+				out.Put(sample.Begin(), sample.GetCount());
+			}
+		}
+		out.Close();
+		ok = !out.IsError();
+	}
+	store.Clear();
+	test_store.Clear();
+	result_store.Clear();
+	return ok;
+}
+
+bool SessionData::OpenMapped(const String& path) {
+	ClearData();
+	if (!mapping.Open(path))
+		return false;
+	int64 size = mapping.GetFileSize();
+	const byte* begin = size > 0 ? mapping.Map(0, (size_t)size) : NULL;
+	if (!begin) {
+		mapping.Close();
+		return false;
+	}
+	
+	MemReadStream in(begin, size);
+	SerializeMapped(in);
+	int64 pos = in.GetPos();
+	DataStore* stores[3] = {&store, &test_store, &result_store};
+	bool ok = !in.IsError();
+	for(int i = 0; i < 3 && ok; i++) {
+		pos = AlignMapped(pos);
+		if (pos + stores[i]->GetByteCount() > size)
+			ok = false;
+		else {
+			stores[i]->SetView(begin + pos);
+			pos += stores[i]->GetByteCount();
+		}
+	}
+	if (!is_data_result && (labels.GetCount() != store.GetCount() || test_labels.GetCount() != test_store.GetCount()))
+		ok = false;
+	if (!ok) {
+		CloseMapped();
+		return false;
+	}
+	mapped = true;
+	return true;
+}
+
 }
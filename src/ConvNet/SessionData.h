@@ -2,14 +2,24 @@
 #define _ConvNet_SessionData_h_
 
 #include "Net.h"
+#include "DataStore.h"
 
 namespace ConvNet {
 
+// The samples are kept either in memory as rows of doubles, which BeginData creates and
+// the Set* functions fill, or in a memory mapped file written by SaveMapped. A mapped file
+// keeps the samples in compact DataStore elements and is read in place: OpenMapped only
+// maps the file and reads the labels, so the data can be larger than the memory.
+//
+// With mapped data, Get, GetTest and GetResult decode the sample into a temporary row,
+// which the next call overwrites. GetSample and AddResult don't have that limitation and
+// may be called from several threads. Serialize doesn't store the mapped samples.
 class SessionData {
 	
 protected:
 	friend class Session;
 	friend class Brain;
+	friend class DataLoader;
 	
 	Vector<Vector<double> > data, test_data, result_data;
 	Vector<double> mins, maxs;
@@ -18,6 +28,15 @@ protected:
 	int data_w, data_h, data_d, data_len;
 	bool is_data_result;
 	
+	// mapped data
+	DataStore store, test_store, result_store;
+	FileMapping mapping;
+	Vector<double> row;
+	bool mapped = false;
+	
+	void SerializeMapped(Stream& s);
+	void CloseMapped();
+	
 public:
 	typedef SessionData CLASSNAME;
 	SessionData();
@@ -31,9 +50,11 @@ public:
 	void EndData();
 	void ClearData();
 	
-	Vector<double>& Get(int i) {return data[i];}
-	Vector<double>& GetTest(int i) {return test_data[i];}
-	Vector<double>& GetResult(int i) {return result_data[i];}
+	Vector<double>& Get(int i);
+	Vector<double>& GetTest(int i);
+	Vector<double>& GetResult(int i);
+	void GetSample(int i, Volume& v) const;
+	void AddResult(int i, Vector<double>& out) const;
 	String GetClass(int i) const {return classes[i];}
 	double GetData(int i, int col) const;
 	double GetTestData(int i, int col) const;
@@ -41,8 +62,8 @@ public:
 	double GetMin(int col) const {return mins[col];}
 	int GetLabel(int i) const {return labels[i];}
 	int GetTestLabel(int i) const {return test_labels[i];}
-	int GetDataCount() const {return data.GetCount();}
-	int GetTestCount() const {return test_data.GetCount();}
+	int GetDataCount() const {return mapped ? store.GetCount() : data.GetCount();}
+	int GetTestCount() const {return mapped ? test_store.GetCount() : test_data.GetCount();}
 	int GetDataLength() const {return data_w * data_h * data_d;}
 	int GetDataWidth() const {return data_w;}
 	int GetDataHeight() const {return data_h;}
@@ -50,6 +71,14 @@ public:
 	int GetClassCount() const {return classes.GetCount();}
 	void GetUniformClassData(int per_class, Vector<Vector<double> >& volumes, Vector<int>& labels);
 	
+	// Writes the data to a file, which OpenMapped maps. The samples are stored with the
+	// element type (DATA_U8, DATA_F16, DATA_F32). DATA_U8 quantizes every column to its
+	// range in the data, and the others store the values as they are.
+	bool SaveMapped(const String& path, int type = DATA_F32);
+	bool OpenMapped(const String& path);
+	bool IsMapped() const {return mapped;}
+	const DataStore& GetStore() const {return store;}
+	
 	SessionData& SetData(int i, int col, double value) {data[i].Set(col, value); return *this;}
 	SessionData& SetResult(int i, int col, double value) {result_data[i].Set(col, value); return *this;}
 	SessionData& SetLabel(int i, int label) {labels[i] = label; return *this;}
@@ -11,9 +11,9 @@ void LayerBase::InitSigmoid(int input_width, int input_height, int input_depth)
 
 Volume& LayerBase::ForwardSigmoid(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation.Init(input.GetWidth(), input.GetHeight(), input.GetDepth(), 0.0);
+	output_activation.SetSize(input.GetWidth(), input.GetHeight(), input.GetDepth(), input.GetBatch());
 	
-	int length = input.GetLength();
+	int length = input.GetCount();
 	
 	for (int i = 0; i < length; i++) {
 		output_activation.Set(i, 1.0 / (1.0 + exp(-1.0 * input.Get(i))));
@@ -26,10 +26,8 @@ double LayerBase::BackwardSigmoid() {
 	Volume& input = *input_activation; // we need to set dw of this
 	Volume& output = output_activation;
 	
-	input.ZeroGradients(); // zero out gradient wrt data
-	
 	double loss = 0.0;
-	for (int i = 0; i < input.GetLength(); i++) {
+	for (int i = 0; i < input.GetCount(); i++) {
 		double v2wi = output.Get(i);
 		double dy = v2wi * (1.0 - v2wi) * output.GetGradient(i);
 		input.SetGradient(i, dy);
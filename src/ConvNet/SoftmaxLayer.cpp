@@ -13,32 +13,36 @@ void LayerBase::InitSoftmax(int input_width, int input_height, int input_depth)
 
 Volume& LayerBase::ForwardSoftmax(Volume& input, bool is_training) {
 	input_activation = &input;
+	int batch = input.GetBatch();
 	
-	output_activation.Init(1, 1, output_depth, 0.0);
+	output_activation.SetSize(1, 1, output_depth, batch);
+	SetBufferCount(es, batch * output_depth);
 	
-	// compute max activation
-	double amax = input.Get(0);
-	for (int i = 1; i < output_depth; i++) {
-		if (input.Get(i) > amax) {
-			amax = input.Get(i);
+	for (int b = 0; b < batch; b++) {
+		int off = b * output_depth;
+		
+		// compute max activation
+		double amax = input.Get(off);
+		for (int i = 1; i < output_depth; i++) {
+			if (input.Get(off + i) > amax) {
+				amax = input.Get(off + i);
+			}
+		}
+		
+		// compute exponentials (carefully to not blow up)
+		double esum = 0.0;
+		
+		for (int i = 0; i < output_depth; i++) {
+			double e = exp(input.Get(off + i) - amax);
+			esum += e;
+			es[off + i] = e;
+		}
+		
+		// normalize and output to sum to one
+		for (int i = 0; i < output_depth; i++) {
+			es[off + i] /= esum;
+			output_activation.Set(off + i, es[off + i]);
 		}
-	}
-	
-	// compute exponentials (carefully to not blow up)
-	es.SetCount(output_depth, 0.0);
-	
-	double esum = 0.0;
-	
-	for (int i = 0; i < output_depth; i++) {
-		double e = exp(input.Get(i) - amax);
-		esum += e;
-		es[i] = e;
-	}
-	
-	// normalize and output to sum to one
-	for (int i = 0; i < output_depth; i++) {
-		es[i] /= esum;
-		output_activation.Set(i, es[i]);
 	}
 	
 	return output_activation;
@@ -48,8 +52,8 @@ double LayerBase::BackwardSoftmax(int pos, double y) {
 	
 	// compute and accumulate gradient wrt weights and bias of this layer
 	Volume& input = *input_activation;
-	input.ZeroGradients(); // zero out the gradient of input Vol
 	
+	// every input gradient is written below, so no need to zero them first
 	for (int i = 0; i < output_depth; i++) {
 		double indicator = i == pos ? 1.0 : 0.0;
 		double mul = -1.0 * (indicator - es[i]);
@@ -60,6 +64,24 @@ double LayerBase::BackwardSoftmax(int pos, double y) {
 	return -1.0 * log(es[pos]);
 }
 
+double LayerBase::BackwardSoftmax(const Vector<int>& posv) {
+	Volume& input = *input_activation;
+	ASSERT(posv.GetCount() == output_activation.GetBatch());
+	
+	double loss = 0.0;
+	for (int b = 0; b < posv.GetCount(); b++) {
+		int off = b * output_depth;
+		int pos = posv[b];
+		for (int i = 0; i < output_depth; i++) {
+			double indicator = i == pos ? 1.0 : 0.0;
+			input.SetGradient(off + i, -1.0 * (indicator - es[off + i]));
+		}
+		loss += -1.0 * log(es[off + pos]);
+	}
+	
+	return loss;
+}
+
 String LayerBase::ToStringSoftmax() const {
 	return Format("Softmax: w:%d, h:%d, d:%d classes:%d",
 		output_width, output_height, output_depth, class_count);
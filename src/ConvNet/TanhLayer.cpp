@@ -11,8 +11,8 @@ void LayerBase::InitTanh(int input_width, int input_height, int input_depth) {
 
 Volume& LayerBase::ForwardTanh(Volume& input, bool is_training) {
 	input_activation = &input;
-	output_activation.Init(input.GetWidth(), input.GetHeight(), input.GetDepth(), 0.0);
-	int length = input.GetLength();
+	output_activation.SetSize(input.GetWidth(), input.GetHeight(), input.GetDepth(), input.GetBatch());
+	int length = input.GetCount();
 	
 	for (int i = 0; i < length; i++) {
 		output_activation.Set(i, tanh(input.Get(i)));
@@ -23,9 +23,7 @@ Volume& LayerBase::ForwardTanh(Volume& input, bool is_training) {
 double LayerBase::BackwardTanh() {
 	Volume& input = *input_activation; // we need to set dw of this
 	Volume& output = output_activation;
-	int length = input.GetLength();
-	
-	input.ZeroGradients(); // zero out gradient wrt data
+	int length = input.GetCount();
 	
 	double loss = 0.0;
 	for (int i = 0; i < length; i++)
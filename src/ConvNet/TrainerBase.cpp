@@ -42,6 +42,25 @@ void TrainerBase::Serialize(Stream& s) {
 	  % ro;
 }
 
+// Copies the settings and the state of the trainer, but not the nets.
+void TrainerBase::CopyFrom(TrainerBase& src) {
+	StringStream ss;
+	ss.SetStoring();
+	ss % src;
+	ss.Seek(0);
+	ss.SetLoading();
+	ss % *this;
+}
+
+// Hogwild mode: the forward and backward passes run in the own net, which only needs to
+// have the same layers, and the updates go to the parameters of the shared net. Several
+// trainers may update the same shared net from different threads without locking.
+TrainerBase& TrainerBase::SetSharedNet(Net& shared) {
+	shared_params <<= shared.GetParametersAndGradients();
+	shared_net = &shared;
+	return *this;
+}
+
 void TrainerBase::Train(Volume& x, int pos, double y) {
 	vec.SetCount(1);
 	vec[0] = &x;
@@ -70,12 +89,56 @@ void TrainerBase::Train(const Vector<double>& y, const Vector<VolumePtr>& x) {
 	TrainImplem();
 }
 
-void TrainerBase::Train(Volume& x, int cols, const Vector<int>& pos, const Vector<double>& y) {
+// The optional weight of every sample scales its loss and gradient, e.g. the importance
+// sampling weights of prioritized experience replay.
+void TrainerBase::Train(Volume& x, int cols, const Vector<int>& pos, const Vector<double>& y, const Vector<double>* weight) {
 	vec.SetCount(1);
 	vec[0] = &x;
 	Forward(vec);
 	
-	Backward(cols, pos, y);
+	Backward(cols, pos, y, weight);
+	
+	TrainImplem();
+}
+
+// Trains with a mini-batch: x holds the samples, and pos and y have one entry per sample.
+void TrainerBase::Train(Volume& x, const Vector<int>& pos, const Vector<double>& y) {
+	vec.SetCount(1);
+	vec[0] = &x;
+	Forward(vec);
+	
+	Backward(pos, y);
+	
+	TrainImplem();
+}
+
+// Copies the settings of the update kernels for this update.
+void TrainerBase::InitStep(TrainerStep& step) const {
+	step.learning_rate = learning_rate;
+	step.momentum = momentum;
+	step.ro = ro;
+	step.eps = eps;
+	step.beta1 = Beta1;
+	step.beta2 = Beta2;
+	step.scale = 1.0 / update_samples;
+}
+
+// The L1 and L2 decay of one parameter volume, scaled by its multipliers.
+void TrainerBase::SetStepDecay(TrainerStep& step, const ParametersAndGradients& pag) const {
+	step.l2_decay = l2_decay * IF_NULL_1(pag.l2_decay_mul);
+	step.l1_decay = l1_decay * IF_NULL_1(pag.l1_decay_mul);
+}
+
+// Updates the net with gradients, which have already been accumulated into it by the
+// forward and backward passes of the given number of samples, e.g. by the data-parallel
+// workers of a Session. The loss and the reward are the sums over those samples.
+void TrainerBase::ApplyGradients(int samples, double loss, double reward) {
+	sample_count = samples;
+	cost_loss = loss / samples;
+	cost_reward = reward / samples;
+	
+	l2_decay_loss = 0.0;
+	l1_decay_loss = 0.0;
 	
 	TrainImplem();
 }
@@ -88,31 +151,69 @@ void TrainerBase::Backward(int pos, double y) {
 	l1_decay_loss = 0.0;
 }
 
-void TrainerBase::Backward(int cols, const Vector<int>& pos, const Vector<double>& y) {
+void TrainerBase::Backward(int cols, const Vector<int>& pos, const Vector<double>& y, const Vector<double>* weight) {
 	double sum = 0;
 	for(int i = 0; i < y.GetCount(); i++)
 		sum += y[i];
-	cost_reward = sum;
+	cost_reward = sum / sample_count;
 	
-	cost_loss = net->Backward(cols, pos, y);
+	cost_loss = net->Backward(cols, pos, y, weight) / sample_count;
+	
+	l2_decay_loss = 0.0;
+	l1_decay_loss = 0.0;
+}
+
+void TrainerBase::Backward(const Vector<int>& pos, const Vector<double>& y) {
+	double sum = 0;
+	for(int i = 0; i < y.GetCount(); i++)
+		sum += y[i];
+	cost_reward = sum / sample_count;
+	
+	cost_loss = net->Backward(pos, y) / sample_count;
 	
 	l2_decay_loss = 0.0;
 	l1_decay_loss = 0.0;
 }
 
 void TrainerBase::Backward(const Vector<double>& y) {
-	cost_loss = net->Backward(y);
+	cost_loss = net->Backward(y) / sample_count;
 	
 	l2_decay_loss = 0.0;
 	l1_decay_loss = 0.0;
 }
 
 void TrainerBase::Forward(const Vector<VolumePtr>& x) {
+	sample_count = x[0]->GetBatch();
+	
+	// Hogwild: start from the current shared parameters, which other threads may be updating
+	if (shared_net)
+		net->CopyParametersFrom(*shared_net);
+	
 	net->Forward(x, true); // also set the flag that lets the net know we're just training
 }
 
+// Counts the samples of the last forward pass and tells if the gradients of batch_size
+// samples have been accumulated. The update then averages over update_samples samples,
+// so a Train call with a whole mini-batch and batch_size calls with one sample each give
+// the same update.
+bool TrainerBase::AccumulateSamples() {
+	iter_count += sample_count;
+	pending_samples += sample_count;
+	if (pending_samples < batch_size)
+		return false;
+	update_samples = pending_samples;
+	pending_samples = 0;
+	
+	// the update changes the filters, so the quantized blocks of them would be stale. The
+	// Hogwild trainers share their net, which is dequantized before they start.
+	if (!shared_net && net->IsQuantized())
+		net->Dequantize();
+	return true;
+}
+
 void TrainerBase::Reset() {
 	iter_count = 0;
+	pending_samples = 0;
 	
 	gsum.Clear();
 	xsum.Clear();
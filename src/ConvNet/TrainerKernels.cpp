@@ -0,0 +1,99 @@
+#include "Training.h"
+
+namespace ConvNet {
+
+// The common part of all kernels. update(j, gij) updates the accumulators of parameter j
+// with the decayed and scaled gradient gij and returns the step of the weight.
+template <class Update>
+static inline void FusedUpdate(TrainerStep& s, Real* __restrict w, Real* __restrict g, int n, Update update) {
+	const double l1 = s.l1_decay, l2 = s.l2_decay, scale = s.scale;
+	double l1_loss[TRAINER_LANES], l2_loss[TRAINER_LANES];
+	for (int k = 0; k < TRAINER_LANES; k++)
+		l1_loss[k] = l2_loss[k] = 0;
+
+	int j = 0;
+	for (; j + TRAINER_LANES <= n; j += TRAINER_LANES) {
+		for (int k = 0; k < TRAINER_LANES; k++) {
+			double wj = w[j + k];
+			l2_loss[k] += l2 * wj * wj / 2;
+			l1_loss[k] += l1 * fabs(wj);
+			double gij = (l2 * wj + (wj > 0 ? l1 : -l1) + g[j + k]) * scale;
+			w[j + k] = (Real)(wj + update(j + k, gij));
+			g[j + k] = 0;
+		}
+	}
+	for (; j < n; j++) {
+		double wj = w[j];
+		l2_loss[0] += l2 * wj * wj / 2;
+		l1_loss[0] += l1 * fabs(wj);
+		double gij = (l2 * wj + (wj > 0 ? l1 : -l1) + g[j]) * scale;
+		w[j] = (Real)(wj + update(j, gij));
+		g[j] = 0;
+	}
+
+	for (int k = 0; k < TRAINER_LANES; k++) {
+		s.l1_decay_loss += l1_loss[k];
+		s.l2_decay_loss += l2_loss[k];
+	}
+}
+
+void UpdateSgd(TrainerStep& s, Real* w, Real* g, double* gsum, int n) {
+	const double lr = s.learning_rate, momentum = s.momentum;
+	if (gsum)
+		FusedUpdate(s, w, g, n, [=](int j, double gij) {
+			double dx = momentum * gsum[j] - lr * gij;
+			gsum[j] = dx; // back this up for next iteration of momentum
+			return dx;
+		});
+	else
+		FusedUpdate(s, w, g, n, [=](int j, double gij) {
+			return -lr * gij;
+		});
+}
+
+void UpdateNetsterov(TrainerStep& s, Real* w, Real* g, double* gsum, int n) {
+	const double lr = s.learning_rate, momentum = s.momentum;
+	FusedUpdate(s, w, g, n, [=](int j, double gij) {
+		double dx = gsum[j];
+		gsum[j] = gsum[j] * momentum + lr * gij;
+		return momentum * dx - (1.0 + momentum) * gsum[j];
+	});
+}
+
+void UpdateAdagrad(TrainerStep& s, Real* w, Real* g, double* gsum, int n) {
+	const double lr = s.learning_rate, eps = s.eps;
+	FusedUpdate(s, w, g, n, [=](int j, double gij) {
+		gsum[j] = gsum[j] + gij * gij;
+		return -lr / sqrt(gsum[j] + eps) * gij;
+	});
+}
+
+void UpdateWindowgrad(TrainerStep& s, Real* w, Real* g, double* gsum, int n) {
+	const double lr = s.learning_rate, eps = s.eps, ro = s.ro;
+	FusedUpdate(s, w, g, n, [=](int j, double gij) {
+		gsum[j] = ro * gsum[j] + (1 - ro) * gij * gij;
+		return -lr / sqrt(gsum[j] + eps) * gij;
+	});
+}
+
+void UpdateAdadelta(TrainerStep& s, Real* w, Real* g, double* gsum, double* xsum, int n) {
+	const double eps = s.eps, ro = s.ro;
+	FusedUpdate(s, w, g, n, [=](int j, double gij) {
+		gsum[j] = ro * gsum[j] + (1 - ro) * gij * gij;
+		double dx = -sqrt((xsum[j] + eps) / (gsum[j] + eps)) * gij;
+		xsum[j] = ro * xsum[j] + (1 - ro) * dx * dx; // yes, xsum lags behind gsum by 1.
+		return dx;
+	});
+}
+
+void UpdateAdam(TrainerStep& s, Real* w, Real* g, double* gsum, double* xsum, int n) {
+	const double lr = s.learning_rate, eps = s.eps, beta1 = s.beta1, beta2 = s.beta2;
+	const double corr1 = s.bias_corr1, corr2 = s.bias_corr2;
+	FusedUpdate(s, w, g, n, [=](int j, double gij) {
+		gsum[j] = gsum[j] * beta1 + (1 - beta1) * gij; // update biased first moment estimate
+		xsum[j] = xsum[j] * beta2 + (1 - beta2) * gij * gij; // update biased second moment estimate
+		return -lr * (gsum[j] * corr1) / (sqrt(xsum[j] * corr2) + eps);
+	});
+}
+
+}
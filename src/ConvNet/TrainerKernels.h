@@ -0,0 +1,46 @@
+#ifndef _ConvNet_TrainerKernels_h_
+#define _ConvNet_TrainerKernels_h_
+
+namespace ConvNet {
+
+/*
+	Fused parameter update kernels of the trainers.
+
+	Each kernel makes a single pass over one parameter volume: it adds the L1 and L2 decay
+	to the raw gradient, scales it by 1 / update_samples, updates the accumulators (gsum,
+	xsum) and the weights, accumulates the decay losses and zeroes the gradient. The loops
+	work on raw arrays and have no branches or calls in them, so that the compiler turns
+	them into SIMD code for the target (SSE2, AVX2 or AVX-512, depending on the build flags).
+	The decay losses are summed in TRAINER_LANES partial sums, which lets the reduction be
+	vectorized without -ffast-math.
+
+	Everything that only depends on the iteration, like the bias corrections of Adam, is
+	computed once into TrainerStep by the caller.
+*/
+
+enum {TRAINER_LANES = 8};
+
+struct TrainerStep {
+	double learning_rate = 0;
+	double momentum = 0;
+	double ro = 0;
+	double eps = 0;
+	double beta1 = 0, beta2 = 0;
+	double bias_corr1 = 1, bias_corr2 = 1;	// Adam: 1 - beta^iter
+	double scale = 1;						// 1 / update_samples
+	double l1_decay = 0, l2_decay = 0;		// including the decay multipliers of the volume
+
+	double l1_decay_loss = 0, l2_decay_loss = 0; // accumulated by the kernels
+};
+
+// gsum may be NULL, which gives vanilla sgd without momentum
+void UpdateSgd(TrainerStep& s, Real* w, Real* g, double* gsum, int n);
+void UpdateNetsterov(TrainerStep& s, Real* w, Real* g, double* gsum, int n);
+void UpdateAdagrad(TrainerStep& s, Real* w, Real* g, double* gsum, int n);
+void UpdateWindowgrad(TrainerStep& s, Real* w, Real* g, double* gsum, int n);
+void UpdateAdadelta(TrainerStep& s, Real* w, Real* g, double* gsum, double* xsum, int n);
+void UpdateAdam(TrainerStep& s, Real* w, Real* g, double* gsum, double* xsum, int n);
+
+}
+
+#endif
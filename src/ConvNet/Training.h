@@ -2,6 +2,7 @@
 #define _ConvNet_Training_h_
 
 #include "Net.h"
+#include "TrainerKernels.h"
 
 namespace ConvNet {
 
@@ -18,11 +19,19 @@ protected:
 	Net* net = NULL;
 	Vector<VolumePtr> vec;
 	
+	// Hogwild: the parameters of another net, which are updated without locking with the
+	// gradients of this net. Empty when the own parameters are trained.
+	Vector<ParametersAndGradients> shared_params;
+	Net* shared_net = NULL;
+	
 	int iter_count;
 	Vector<Vector<double> > gsum;
 	Vector<Vector<double> > xsum;
 	int trainer_type = TRAINER_NULL;
 	int batch_size;
+	int sample_count = 1;		// samples in the last forward pass
+	int pending_samples = 0;	// samples with gradients accumulated, but not applied yet
+	int update_samples = 1;		// samples averaged in the current update
 	double cost_loss;
 	double cost_reward;
 	double Beta1;
@@ -65,6 +74,7 @@ public:
 	
 	
 	TrainerBase& SetNet(Net& net) {this->net = &net; return *this;}
+	TrainerBase& SetSharedNet(Net& shared);
 	TrainerBase& SetType(int i) {trainer_type = i; return *this;}
 	TrainerBase& SetBatchSize(int i) {batch_size = i; return *this;}
 	TrainerBase& SetCostLoss(double d) {cost_loss = d; return *this;}
@@ -83,13 +93,21 @@ public:
 	void Train(double y, const Vector<VolumePtr>& x);
 	void Train(Volume& x, const Vector<double>& y);
 	void Train(const Vector<double>& y, const Vector<VolumePtr>& x);
-	void Train(Volume& x, int cols, const Vector<int>& pos, const Vector<double>& y);
+	void Train(Volume& x, int cols, const Vector<int>& pos, const Vector<double>& y, const Vector<double>* weight=NULL);
+	void Train(Volume& x, const Vector<int>& pos, const Vector<double>& y);
 	void Forward(const Vector<VolumePtr>& x);
+	void CopyFrom(TrainerBase& src);
+	void ApplyGradients(int samples, double loss, double reward);
 	
 	void TrainImplem();
+	bool AccumulateSamples();
+	void InitStep(TrainerStep& step) const;
+	void SetStepDecay(TrainerStep& step, const ParametersAndGradients& pag) const;
+	Volume& GetUpdatedVolume(int i, const ParametersAndGradients& pag) {return shared_params.IsEmpty() ? *pag.volume : *shared_params[i].volume;}
 	void Backward(int pos, double y);
+	void Backward(const Vector<int>& pos, const Vector<double>& y);
 	void Backward(const Vector<double>& y);
-	void Backward(int cols, const Vector<int>& pos, const Vector<double>& y);
+	void Backward(int cols, const Vector<int>& pos, const Vector<double>& y, const Vector<double>* weight=NULL);
 	void Reset();
 	
 	void TrainImplemAdadelta();
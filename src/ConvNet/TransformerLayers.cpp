@@ -1,569 +1,549 @@
-#include "TransformerLayers.h"
-#include <algorithm>
-#include <cmath>
+#include "ConvNet.h"
 
 namespace ConvNet {
 
-// MultiHeadAttentionCRTP implementation
-MultiHeadAttentionCRTP::MultiHeadAttentionCRTP(int embed_dim, int num_heads) 
-    : embed_dim(embed_dim), num_heads(num_heads), head_dim(embed_dim / num_heads) {
-    // Validate that embedding dimension is divisible by number of heads
-    if (embed_dim % num_heads != 0) {
-        throw std::runtime_error("Embedding dimension must be divisible by number of heads");
-    }
-    
-    // Initialize weight matrices: [embed_dim x embed_dim]
-    wq.Init(embed_dim, embed_dim, 1);
-    wk.Init(embed_dim, embed_dim, 1);
-    wv.Init(embed_dim, embed_dim, 1);
-    wo.Init(embed_dim, embed_dim, 1);
-    
-    // Initialize bias vectors: [embed_dim]
-    bq.Init(embed_dim, 1, 1);
-    bk.Init(embed_dim, 1, 1);
-    bv.Init(embed_dim, 1, 1);
-    bo.Init(embed_dim, 1, 1);
-    
-    // Initialize with small random values - using existing Volume methods
-    wq.Fill(0.01 * Randomf());  // Simple initialization
-    wk.Fill(0.01 * Randomf());
-    wv.Fill(0.01 * Randomf());
-    wo.Fill(0.01 * Randomf());
-    
-    // Initialize bias to small values
-    bq.Fill(0.0);
-    bk.Fill(0.0);
-    bv.Fill(0.0);
-    bo.Fill(0.0);
-}
-
-Volume& MultiHeadAttentionCRTP::ForwardImpl(Volume& input, bool is_training) {
-    int seq_len = input.GetDepth();  // Assuming input shape is [embed_dim, 1, seq_len]
-    
-    // Resize caches for this forward pass
-    queries.SetCount(num_heads);
-    keys.SetCount(num_heads);
-    values.SetCount(num_heads);
-    attention_scores.SetCount(num_heads);
-    attention_outputs.SetCount(num_heads);
-    
-    // Project input to Q, K, V
-    // Shape transformation: [embed_dim, 1, seq_len] -> [embed_dim, 1, seq_len]
-    // This is simplified - in practice, we'd use matrix multiplication
-    Volume q_proj = input;  // Placeholder - actual matrix multiplication needed
-    Volume k_proj = input;  // Placeholder
-    Volume v_proj = input;  // Placeholder
-    
-    // Reshape to [num_heads, head_dim, seq_len]
-    // This is a conceptual representation - actual implementation would require reshaping operations
-    for (int h = 0; h < num_heads; h++) {
-        // Extract head h from Q, K, V
-        // This would involve slicing the projected matrices
-        // For now, we'll use simplified approach
-        queries[h].Init(head_dim, 1, seq_len);
-        keys[h].Init(head_dim, 1, seq_len);
-        values[h].Init(head_dim, 1, seq_len);
-        
-        // Apply scaled dot-product attention for each head
-        attention_outputs[h] = ScaledDotProductAttention(queries[h], keys[h], values[h]);
-    }
-    
-    // Concatenate heads and apply output projection
-    // Concat shape: [embed_dim, 1, seq_len]
-    // Apply output projection: [embed_dim, embed_dim] * [embed_dim, 1, seq_len]
-    // Add bias and return
-    
-    output_activation = input;  // Placeholder
-    return output_activation;
+// MultiHeadAttentionCRTP is implemented in Attention.cpp
+
+static void InitGaussian(Volume& v, int width, int height, int fan_in) {
+    // every output has the variance of one input
+    RandomGaussian& rand = GetRandomGaussian(fan_in);
+    v.Init(width, height, 1, 0.0);
+    for (int i = 0; i < v.GetLength(); i++)
+        v.Set(i, rand);
 }
 
-void MultiHeadAttentionCRTP::BackwardImpl() {
-    // Implementation for gradient computation
-    // This is a complex operation involving gradients flowing back through
-    // attention mechanism and the projection matrices
+// FeedForwardCRTP implementation
+FeedForwardCRTP::FeedForwardCRTP(int embed_dim, int ff_dim)
+    : embed_dim(embed_dim), ff_dim(ff_dim) {
+    if (embed_dim > 0 && ff_dim > 0)
+        InitWeights();
 }
 
-void MultiHeadAttentionCRTP::InitImpl(int input_width, int input_height, int input_depth) {
-    // Initialize based on input dimensions
-    // For attention, the input_depth would typically be sequence length 
-    // and input_width would be embedding dimension
+void FeedForwardCRTP::InitWeights() {
+    InitGaussian(w1, embed_dim, ff_dim, embed_dim);
+    InitGaussian(w2, ff_dim, embed_dim, ff_dim);
+    b1.Init(ff_dim, 1, 1, 0.0);
+    b2.Init(embed_dim, 1, 1, 0.0);
+    Dequantize();
 }
 
-Vector<ParametersAndGradients>& MultiHeadAttentionCRTP::GetParametersAndGradientsImpl() {
-    static Vector<ParametersAndGradients> params;
-    params.Clear();
-    
-    // Add parameters for Q, K, V, and output projections
-    // Each would have weights and potentially gradients
-    ParametersAndGradients wq_grad;
-    wq_grad.volume = &wq;
-    params.Add() = wq_grad;
-    
-    ParametersAndGradients wk_grad;
-    wk_grad.volume = &wk;
-    params.Add() = wk_grad;
-    
-    ParametersAndGradients wv_grad;
-    wv_grad.volume = &wv;
-    params.Add() = wv_grad;
-    
-    ParametersAndGradients wo_grad;
-    wo_grad.volume = &wo;
-    params.Add() = wo_grad;
-    
-    // Add bias parameters
-    ParametersAndGradients bq_grad;
-    bq_grad.volume = &bq;
-    params.Add() = bq_grad;
-    
-    ParametersAndGradients bk_grad;
-    bk_grad.volume = &bk;
-    params.Add() = bk_grad;
-    
-    ParametersAndGradients bv_grad;
-    bv_grad.volume = &bv;
-    params.Add() = bv_grad;
-    
-    ParametersAndGradients bo_grad;
-    bo_grad.volume = &bo;
-    params.Add() = bo_grad;
-    
-    return params;
+void FeedForwardCRTP::SetShape(int embed_dim, int ff_dim) {
+    this->embed_dim = embed_dim;
+    this->ff_dim = ff_dim;
+    b1.Init(ff_dim, 1, 1, 0.0);
+    b2.Init(embed_dim, 1, 1, 0.0);
+    Dequantize();
 }
 
-void MultiHeadAttentionCRTP::StoreImpl(ValueMap& map) const {
-    map.GetAdd("embed_dim") = embed_dim;
-    map.GetAdd("num_heads") = num_heads;
-    map.GetAdd("head_dim") = head_dim;
-    
-    // Store weight matrices and biases
-    // This would require serialization functions for Volume
+void FeedForwardCRTP::VisitTensors(GGUFTensorVisitor& v, const String& prefix) {
+    v.Tensor(prefix + "ffn_up.weight", w1, embed_dim, ff_dim);
+    v.Tensor(prefix + "ffn_up.bias", b1, ff_dim);
+    v.Tensor(prefix + "ffn_down.weight", w2, ff_dim, embed_dim);
+    v.Tensor(prefix + "ffn_down.bias", b2, embed_dim);
 }
 
-void MultiHeadAttentionCRTP::LoadImpl(const ValueMap& map) {
-    embed_dim = map.GetValue(map.Find("embed_dim"));
-    num_heads = map.GetValue(map.Find("num_heads"));
-    head_dim = map.GetValue(map.Find("head_dim"));
-}
-
-String MultiHeadAttentionCRTP::ToStringImpl() const {
-    return Format("MultiHeadAttention(embed_dim=%d, num_heads=%d)", embed_dim, num_heads);
-}
-
-Volume& MultiHeadAttentionCRTP::ScaledDotProductAttention(Volume& query, Volume& key, Volume& value, 
-                                                        const Volume* mask) {
-    // Compute attention scores: Q * K^T / sqrt(d_k)
-    int d_k = query.GetDepth();  // dimension of keys/queries (depth dimension)
-    double scale = sqrt(d_k);
-    
-    // Initialize scores matrix: [seq_len_q, seq_len_k]
-    int seq_len_q = query.GetWidth();   // Assuming width is sequence length for query
-    int seq_len_k = key.GetWidth();     // Assuming width is sequence length for key
-    scores.Init(seq_len_q, seq_len_k, 1); // Initialize scores volume
-    
-    // Compute Q * K^T (matrix multiplication)
-    // For each position in query and key, compute dot product
-    for (int i = 0; i < seq_len_q; i++) {
-        for (int j = 0; j < seq_len_k; j++) {
-            double dot_product = 0.0;
-            // Compute dot product of query[i] and key[j] vectors (over depth dimension)
-            for (int k_idx = 0; k_idx < d_k; k_idx++) {
-                dot_product += query.Get(i, 0, k_idx) * key.Get(j, 0, k_idx);
-            }
-            scores.Set(i, j, 0, dot_product / scale);  // Apply scaling
-        }
-    }
-    
-    // Apply mask if provided (for causal attention in decoder)
-    if (mask != nullptr) {
-        // Add large negative value to masked positions
-        // This would effectively zero out those positions after softmax
-        for (int i = 0; i < seq_len_q; i++) {
-            for (int j = 0; j < seq_len_k; j++) {
-                if (mask->Get(i, j, 0) != 0) { // Assuming mask indicates positions to mask
-                    scores.Set(i, j, 0, -1e9); // Large negative value to zero out after softmax
-                }
-            }
-        }
-    }
-    
-    // Apply softmax to get attention weights
-    // Softmax over the key dimension (dim=1)
-    attention_weights.Init(seq_len_q, seq_len_k, 1);
-    for (int i = 0; i < seq_len_q; i++) {
-        // Compute row-wise softmax
-        double max_val = -INFINITY;
-        // Find max for numerical stability
-        for (int j = 0; j < seq_len_k; j++) {
-            double val = scores.Get(i, j, 0);
-            if (val > max_val) max_val = val;
-        }
-        
-        // Compute exp and sum
-        double sum = 0.0;
-        for (int j = 0; j < seq_len_k; j++) {
-            double exp_val = exp(scores.Get(i, j, 0) - max_val);
-            sum += exp_val;
-            attention_weights.Set(i, j, 0, exp_val);
+void FeedForwardCRTP::Quantize(int type) {
+    quantized[0].Quantize(type, w1.GetWeights().Begin(), ff_dim, embed_dim, embed_dim);
+    quantized[1].Quantize(type, w2.GetWeights().Begin(), embed_dim, ff_dim, ff_dim);
+}
+
+void FeedForwardCRTP::Dequantize() {
+    quantized[0].Clear();
+    quantized[1].Clear();
+}
+
+Volume& FeedForwardCRTP::ForwardImpl(Volume& input, bool is_training) {
+    ASSERT(input.GetWidth() == embed_dim && input.GetHeight() == 1);
+    input_activation = &input;
+    int seq_len = input.GetDepth();
+    int batch = input.GetBatch();
+    SetBufferCount(hidden, batch * ff_dim * seq_len);
+    output_activation.SetSize(embed_dim, 1, seq_len, batch);
+    const Real* bias1 = b1.GetWeights().Begin();
+    const Real* bias2 = b2.GetWeights().Begin();
+
+    for (int b = 0; b < batch; b++) {
+        const Real* x = input.GetWeights().Begin() + (int64)b * embed_dim * seq_len;
+        Real* h = hidden.Begin() + (int64)b * ff_dim * seq_len;
+        Real* y = output_activation.GetWeights().Begin() + (int64)b * embed_dim * seq_len;
+
+        // inference with the quantized weights, position by position
+        if (!is_training && IsQuantized()) {
+            QuantizedGemm(thread_count, quantized[0], seq_len, x, 1, seq_len, bias1, h, 1, seq_len);
+            for (int64 i = 0; i < (int64)ff_dim * seq_len; i++)
+                h[i] = max(h[i], (Real)0);
+            QuantizedGemm(thread_count, quantized[1], seq_len, h, 1, seq_len, bias2, y, 1, seq_len);
+            continue;
         }
-        
-        // Normalize by sum
-        for (int j = 0; j < seq_len_k; j++) {
-            double val = attention_weights.Get(i, j, 0) / sum;
-            attention_weights.Set(i, j, 0, val);
+
+        // hidden = relu(w1 * x + b1)
+        ParallelGemm<Real>(thread_count, false, false, ff_dim, seq_len, embed_dim,
+            (Real)1, w1.GetWeights().Begin(), embed_dim, x, seq_len,
+            (Real)0, h, seq_len);
+        for (int i = 0; i < ff_dim; i++) {
+            Real* row = h + (int64)i * seq_len;
+            for (int t = 0; t < seq_len; t++)
+                row[t] = max(row[t] + bias1[i], (Real)0);
         }
-    }
-    
-    // Compute output: attention_weights * V
-    int d_v = value.GetDepth();  // value depth dimension
-    int seq_len_v = value.GetWidth();  // value sequence length (should be same as seq_len_k)
-    
-    output.Init(seq_len_q, 1, d_v); // Output: [seq_len_q, d_v]
-    
-    for (int i = 0; i < seq_len_q; i++) {
-        for (int k = 0; k < d_v; k++) {
-            double sum = 0.0;
-            for (int j = 0; j < seq_len_v; j++) {
-                sum += attention_weights.Get(i, j, 0) * value.Get(j, 0, k);
-            }
-            output.Set(i, 0, k, sum);
+
+        // output = w2 * hidden + b2
+        ParallelGemm<Real>(thread_count, false, false, embed_dim, seq_len, ff_dim,
+            (Real)1, w2.GetWeights().Begin(), ff_dim, h, seq_len,
+            (Real)0, y, seq_len);
+        for (int i = 0; i < embed_dim; i++) {
+            Real* row = y + (int64)i * seq_len;
+            for (int t = 0; t < seq_len; t++)
+                row[t] += bias2[i];
         }
     }
-    
-    return output;
+    return output_activation;
 }
 
-// Helper method implementations
-void EncoderLayerCRTP::ApplyLayerNorm(Volume& input, const Volume& gamma, const Volume& beta, int d_model, int seq_len) {
-    double eps = 1e-6; // Small epsilon for numerical stability
-    
-    // Perform layer normalization across the embedding dimension for each sequence position
-    for (int seq_idx = 0; seq_idx < seq_len; seq_idx++) {
-        // Calculate mean for this sequence position
-        double mean = 0.0;
-        for (int dim = 0; dim < d_model; dim++) {
-            int idx = seq_idx * d_model + dim;
-            if (idx < input.GetLength()) {
-                mean += input.Get(idx);
-            }
-        }
-        mean /= d_model;
-        
-        // Calculate variance for this sequence position
-        double var = 0.0;
-        for (int dim = 0; dim < d_model; dim++) {
-            int idx = seq_idx * d_model + dim;
-            if (idx < input.GetLength()) {
-                double diff = input.Get(idx) - mean;
-                var += diff * diff;
-            }
+void FeedForwardCRTP::BackwardImpl() {
+    ASSERT(input_activation);
+    Volume& input = *input_activation;
+    int seq_len = input.GetDepth();
+    int batch = input.GetBatch();
+    SetBufferCount(dhidden, ff_dim * seq_len);
+    Real* dh = dhidden.Begin();
+
+    for (int b = 0; b < batch; b++) {
+        const Real* x = input.GetWeights().Begin() + (int64)b * embed_dim * seq_len;
+        Real* dx = input.GetGradients().Begin() + (int64)b * embed_dim * seq_len;
+        const Real* h = hidden.Begin() + (int64)b * ff_dim * seq_len;
+        const Real* dy = output_activation.GetGradients().Begin() + (int64)b * embed_dim * seq_len;
+
+        for (int i = 0; i < embed_dim; i++) {
+            double sum = 0;
+            for (int t = 0; t < seq_len; t++)
+                sum += dy[(int64)i * seq_len + t];
+            b2.AddGradient(i, sum);
         }
-        var /= d_model;
-        
-        // Normalize, scale, and shift for this sequence position
-        for (int dim = 0; dim < d_model; dim++) {
-            int idx = seq_idx * d_model + dim;
-            if (idx < input.GetLength()) {
-                double normalized = (input.Get(idx) - mean) / sqrt(var + eps);
-                int param_idx = dim % gamma.GetLength(); // Handle parameter indexing
-                if (param_idx < gamma.GetLength() && param_idx < beta.GetLength()) {
-                    double scaled_shifted = normalized * gamma.Get(param_idx) + beta.Get(param_idx);
-                    input.Set(idx, scaled_shifted);
-                }
+        Gemm<Real>(false, true, embed_dim, ff_dim, seq_len,
+            (Real)1, dy, seq_len, h, seq_len,
+            (Real)1, w2.GetGradients().Begin(), ff_dim);
+        Gemm<Real>(true, false, ff_dim, seq_len, embed_dim,
+            (Real)1, w2.GetWeights().Begin(), ff_dim, dy, seq_len,
+            (Real)0, dh, seq_len);
+
+        // the ReLU passes the gradient of the active units
+        for (int i = 0; i < ff_dim; i++) {
+            Real* row = dh + (int64)i * seq_len;
+            const Real* hrow = h + (int64)i * seq_len;
+            double sum = 0;
+            for (int t = 0; t < seq_len; t++) {
+                if (hrow[t] <= 0)
+                    row[t] = 0;
+                sum += row[t];
             }
+            b1.AddGradient(i, sum);
         }
+        Gemm<Real>(false, true, ff_dim, embed_dim, seq_len,
+            (Real)1, dh, seq_len, x, seq_len,
+            (Real)1, w1.GetGradients().Begin(), embed_dim);
+
+        // every input gradient is overwritten
+        Gemm<Real>(true, false, embed_dim, seq_len, ff_dim,
+            (Real)1, w1.GetWeights().Begin(), embed_dim, dh, seq_len,
+            (Real)0, dx, seq_len);
     }
 }
 
-void DecoderLayerCRTP::ApplyLayerNorm(Volume& input, const Volume& gamma, const Volume& beta, int d_model, int seq_len) {
+void FeedForwardCRTP::InitImpl(int input_width, int input_height, int input_depth) {
+    ASSERT(input_width == embed_dim && input_height == 1);
+}
+
+Vector<ParametersAndGradients>& FeedForwardCRTP::GetParametersAndGradientsImpl() {
+    params.SetCount(0);
+    params.Add().volume = &w1;
+    params.Add().volume = &b1;
+    params.Add().volume = &w2;
+    params.Add().volume = &b2;
+    return params;
+}
+
+void FeedForwardCRTP::StoreImpl(ValueMap& map) const {
+    map.GetAdd("embed_dim") = embed_dim;
+    map.GetAdd("ff_dim") = ff_dim;
+    map.GetAdd("w1") = StoreWeights(w1);
+    map.GetAdd("b1") = StoreWeights(b1);
+    map.GetAdd("w2") = StoreWeights(w2);
+    map.GetAdd("b2") = StoreWeights(b2);
+}
+
+void FeedForwardCRTP::LoadImpl(const ValueMap& map) {
+    embed_dim = map.GetValue(map.Find("embed_dim"));
+    ff_dim = map.GetValue(map.Find("ff_dim"));
+    if (embed_dim <= 0 || ff_dim <= 0)
+        return;
+    InitWeights();
+    LoadWeights(map, "w1", w1);
+    LoadWeights(map, "b1", b1);
+    LoadWeights(map, "w2", w2);
+    LoadWeights(map, "b2", b2);
+}
+
+String FeedForwardCRTP::ToStringImpl() const {
+    return Format("FeedForward(embed_dim=%d, ff_dim=%d)", embed_dim, ff_dim);
+}
+
+void FeedForwardCRTP::Serialize(Stream& s) {
+    s % embed_dim % ff_dim;
+    s % w1 % b1 % w2 % b2;
+    if (s.IsLoading())
+        Dequantize();
+}
+
+// Layer normalization over the embedding dimension of every position
+void ApplyLayerNorm(Volume& input, const Volume& gamma, const Volume& beta) {
     double eps = 1e-6; // Small epsilon for numerical stability
-    
-    // Perform layer normalization across the embedding dimension for each sequence position
-    for (int seq_idx = 0; seq_idx < seq_len; seq_idx++) {
-        // Calculate mean for this sequence position
-        double mean = 0.0;
-        for (int dim = 0; dim < d_model; dim++) {
-            int idx = seq_idx * d_model + dim;
-            if (idx < input.GetLength()) {
-                mean += input.Get(idx);
-            }
-        }
-        mean /= d_model;
-        
-        // Calculate variance for this sequence position
-        double var = 0.0;
-        for (int dim = 0; dim < d_model; dim++) {
-            int idx = seq_idx * d_model + dim;
-            if (idx < input.GetLength()) {
-                double diff = input.Get(idx) - mean;
+    int d_model = input.GetWidth();
+    int seq_len = input.GetDepth();
+    ASSERT(gamma.GetLength() == d_model && beta.GetLength() == d_model);
+    const Real* g = gamma.GetWeights().Begin();
+    const Real* bt = beta.GetWeights().Begin();
+
+    for (int b = 0; b < input.GetBatch(); b++) {
+        Real* x = input.GetWeights().Begin() + (int64)b * input.GetLength();
+        for (int seq_idx = 0; seq_idx < seq_len; seq_idx++) {
+            // the values of one position are seq_len apart
+            double mean = 0.0;
+            for (int dim = 0; dim < d_model; dim++)
+                mean += x[dim * seq_len + seq_idx];
+            mean /= d_model;
+
+            double var = 0.0;
+            for (int dim = 0; dim < d_model; dim++) {
+                double diff = x[dim * seq_len + seq_idx] - mean;
                 var += diff * diff;
             }
-        }
-        var /= d_model;
-        
-        // Normalize, scale, and shift for this sequence position
-        for (int dim = 0; dim < d_model; dim++) {
-            int idx = seq_idx * d_model + dim;
-            if (idx < input.GetLength()) {
-                double normalized = (input.Get(idx) - mean) / sqrt(var + eps);
-                int param_idx = dim % gamma.GetLength(); // Handle parameter indexing
-                if (param_idx < gamma.GetLength() && param_idx < beta.GetLength()) {
-                    double scaled_shifted = normalized * gamma.Get(param_idx) + beta.Get(param_idx);
-                    input.Set(idx, scaled_shifted);
-                }
+            var /= d_model;
+
+            double inv = 1.0 / sqrt(var + eps);
+            for (int dim = 0; dim < d_model; dim++) {
+                Real& v = x[dim * seq_len + seq_idx];
+                v = (Real)((v - mean) * inv * g[dim] + bt[dim]);
             }
         }
     }
 }
 
+// out = LayerNorm(a + b)
+static void AddAndNorm(const Volume& a, const Volume& b, const Volume& gamma, const Volume& beta, Volume& out) {
+    ASSERT(a.GetCount() == b.GetCount());
+    out.SetSize(a.GetWidth(), a.GetHeight(), a.GetDepth(), a.GetBatch());
+    const Real* x = a.GetWeights().Begin();
+    const Real* y = b.GetWeights().Begin();
+    Real* o = out.GetWeights().Begin();
+    for (int i = 0; i < a.GetCount(); i++)
+        o[i] = x[i] + y[i];
+    ApplyLayerNorm(out, gamma, beta);
+}
+
+static void InitNorm(Volume& weights, Volume& biases, int embed_dim) {
+    weights.Init(embed_dim, 1, 1, 1.0);
+    biases.Init(embed_dim, 1, 1, 0.0);
+}
+
+static void AddParameters(Vector<ParametersAndGradients>& params, Vector<ParametersAndGradients>& src) {
+    for (int i = 0; i < src.GetCount(); i++)
+        params.Add() = src[i];
+}
+
 // EncoderLayerCRTP implementation
 EncoderLayerCRTP::EncoderLayerCRTP(int embed_dim, int num_heads, int ff_dim, double dropout_rate)
-    : self_attention(embed_dim, num_heads), 
-      feed_forward(ff_dim),  // Note: ff_dim should be different from the one used here
-      dropout1(dropout_rate), dropout2(dropout_rate) {
+    : self_attention(embed_dim, num_heads),
+      feed_forward(embed_dim, ff_dim),
+      dropout_rate(dropout_rate) {
+    if (embed_dim <= 0)
+        return;
+
     // Initialize layer normalization parameters
-    norm1_weights.Init(embed_dim, 1, 1);
-    norm1_biases.Init(embed_dim, 1, 1);
-    norm2_weights.Init(embed_dim, 1, 1);
-    norm2_biases.Init(embed_dim, 1, 1);
-    
-    // Initialize to appropriate values for layer normalization
-    norm1_weights.Fill(1.0);
-    norm1_biases.Fill(0.0);
-    norm2_weights.Fill(1.0);
-    norm2_biases.Fill(0.0);
+    InitNorm(norm1_weights, norm1_biases, embed_dim);
+    InitNorm(norm2_weights, norm2_biases, embed_dim);
 }
 
 Volume& EncoderLayerCRTP::ForwardImpl(Volume& input, bool is_training) {
-    // Step 1: Self-attention
+    // Self-attention, then Add & Norm (Residual connection + Layer normalization)
     Volume& attention_output = self_attention.Forward(input, is_training);
-    
-    // Step 2: Add & Norm (Residual connection + Layer normalization)
-    // Add input to attention output (residual connection)
-    // Then normalize
-    Volume& norm1_output = attention_output;  // Placeholder for layer normalization
-    
-    // Step 3: Feed-forward network
-    Volume& ff_output = feed_forward.Forward(norm1_output, is_training);
-    
-    // Step 4: Add & Norm (Residual connection + Layer normalization)
-    // Add norm1_output to ff_output (residual connection)  
-    // Then normalize
-    output_activation = ff_output;  // Placeholder for final layer normalization
+    AddAndNorm(input, attention_output, norm1_weights, norm1_biases, attention_norm);
+
+    // Feed-forward network, then Add & Norm
+    Volume& ff_output = feed_forward.Forward(attention_norm, is_training);
+    AddAndNorm(attention_norm, ff_output, norm2_weights, norm2_biases, output_activation);
     return output_activation;
 }
 
 void EncoderLayerCRTP::BackwardImpl() {
-    // Backward pass implementation - would flow gradients through the 
-    // layer normalization, feed-forward, residual connections, and attention
+    // the gradients of the layer normalizations and the residual connections are missing
+    Panic("EncoderLayerCRTP: backward pass not implemented");
 }
 
 void EncoderLayerCRTP::InitImpl(int input_width, int input_height, int input_depth) {
     // Initialize the sub-layers based on input dimensions
-    self_attention.InitImpl(input_width, input_height, input_depth);
-    feed_forward.InitImpl(input_width, input_height, input_depth);
+    self_attention.Init(input_width, input_height, input_depth);
+    feed_forward.Init(input_width, input_height, input_depth);
 }
 
 Vector<ParametersAndGradients>& EncoderLayerCRTP::GetParametersAndGradientsImpl() {
-    static Vector<ParametersAndGradients> params;
-    params.Clear();
-    
-    // Get parameters from self-attention layer
-    auto& attention_params = self_attention.GetParametersAndGradients();
-    for (int i = 0; i < attention_params.GetCount(); i++) {
-        params.Add() = attention_params[i];
-    }
-    
-    // Get parameters from feed-forward layer
-    auto& ff_params = feed_forward.GetParametersAndGradients();
-    for (int i = 0; i < ff_params.GetCount(); i++) {
-        params.Add() = ff_params[i];
-    }
-    
+    params.SetCount(0);
+    AddParameters(params, self_attention.GetParametersAndGradients());
+    AddParameters(params, feed_forward.GetParametersAndGradients());
+
     // Add layer normalization parameters
-    ParametersAndGradients norm1_w;
-    norm1_w.volume = &norm1_weights;
-    params.Add() = norm1_w;
-    
-    ParametersAndGradients norm1_b;
-    norm1_b.volume = &norm1_biases;
-    params.Add() = norm1_b;
-    
-    ParametersAndGradients norm2_w;
-    norm2_w.volume = &norm2_weights;
-    params.Add() = norm2_w;
-    
-    ParametersAndGradients norm2_b;
-    norm2_b.volume = &norm2_biases;
-    params.Add() = norm2_b;
-    
+    params.Add().volume = &norm1_weights;
+    params.Add().volume = &norm1_biases;
+    params.Add().volume = &norm2_weights;
+    params.Add().volume = &norm2_biases;
     return params;
 }
 
 void EncoderLayerCRTP::StoreImpl(ValueMap& map) const {
-    // Store encoder layer parameters
-    self_attention.Store(map.GetAdd("self_attention"));
-    feed_forward.Store(map.GetAdd("feed_forward"));
-    // Store normalization parameters
+    ValueMap attention, ff;
+    self_attention.Store(attention);
+    feed_forward.Store(ff);
+    map.GetAdd("self_attention") = attention;
+    map.GetAdd("feed_forward") = ff;
+    map.GetAdd("dropout_rate") = dropout_rate;
+    map.GetAdd("norm1_weights") = StoreWeights(norm1_weights);
+    map.GetAdd("norm1_biases") = StoreWeights(norm1_biases);
+    map.GetAdd("norm2_weights") = StoreWeights(norm2_weights);
+    map.GetAdd("norm2_biases") = StoreWeights(norm2_biases);
 }
 
 void EncoderLayerCRTP::LoadImpl(const ValueMap& map) {
-    // Load encoder layer parameters
     self_attention.Load(map.GetValue(map.Find("self_attention")));
     feed_forward.Load(map.GetValue(map.Find("feed_forward")));
-    // Load normalization parameters
+    dropout_rate = map.GetValue(map.Find("dropout_rate"));
+    int embed_dim = self_attention.GetEmbedDim();
+    if (embed_dim <= 0)
+        return;
+    InitNorm(norm1_weights, norm1_biases, embed_dim);
+    InitNorm(norm2_weights, norm2_biases, embed_dim);
+    LoadWeights(map, "norm1_weights", norm1_weights);
+    LoadWeights(map, "norm1_biases", norm1_biases);
+    LoadWeights(map, "norm2_weights", norm2_weights);
+    LoadWeights(map, "norm2_biases", norm2_biases);
 }
 
 String EncoderLayerCRTP::ToStringImpl() const {
-    return Format("EncoderLayer(embed_dim=%d, num_heads=%d)", 
+    return Format("EncoderLayer(embed_dim=%d, num_heads=%d)",
                   self_attention.GetEmbedDim(), self_attention.GetNumHeads());
 }
 
+void EncoderLayerCRTP::Quantize(int type) {
+    self_attention.Quantize(type);
+    feed_forward.Quantize(type);
+}
+
+void EncoderLayerCRTP::Dequantize() {
+    self_attention.Dequantize();
+    feed_forward.Dequantize();
+}
+
+void EncoderLayerCRTP::Serialize(Stream& s) {
+    self_attention.Serialize(s);
+    feed_forward.Serialize(s);
+    s % norm1_weights % norm1_biases % norm2_weights % norm2_biases;
+    s % dropout_rate;
+}
+
 // DecoderLayerCRTP implementation
 DecoderLayerCRTP::DecoderLayerCRTP(int embed_dim, int num_heads, int ff_dim, double dropout_rate)
-    : self_attention(embed_dim, num_heads), 
+    : self_attention(embed_dim, num_heads),
       cross_attention(embed_dim, num_heads),  // Cross attention with encoder
-      feed_forward(ff_dim),
-      dropout1(dropout_rate), dropout2(dropout_rate), dropout3(dropout_rate) {
+      feed_forward(embed_dim, ff_dim),
+      dropout_rate(dropout_rate) {
+    self_attention.SetCausal();
+    if (embed_dim <= 0)
+        return;
+
     // Initialize layer normalization parameters
-    norm1_weights.Init(embed_dim, 1, 1);
-    norm1_biases.Init(embed_dim, 1, 1);
-    norm2_weights.Init(embed_dim, 1, 1);
-    norm2_biases.Init(embed_dim, 1, 1);
-    norm3_weights.Init(embed_dim, 1, 1);
-    norm3_biases.Init(embed_dim, 1, 1);
-    
-    // Initialize to appropriate values
-    norm1_weights.Fill(1.0);
-    norm1_biases.Fill(0.0);
-    norm2_weights.Fill(1.0);
-    norm2_biases.Fill(0.0);
-    norm3_weights.Fill(1.0);
-    norm3_biases.Fill(0.0);
+    InitNorm(norm1_weights, norm1_biases, embed_dim);
+    InitNorm(norm2_weights, norm2_biases, embed_dim);
+    InitNorm(norm3_weights, norm3_biases, embed_dim);
 }
 
 Volume& DecoderLayerCRTP::ForwardImpl(Volume& input, bool is_training) {
-    // Step 1: Masked self-attention
+    // Masked self-attention, then Add & Norm (Residual + Layer norm)
     Volume& self_attn_output = self_attention.Forward(input, is_training);
-    
-    // Step 2: Add & Norm (Residual + Layer norm)
-    Volume& norm1_output = self_attn_output;  // Placeholder
-    
-    // Step 3: Cross-attention with encoder output (memory)
-    // In a complete implementation, we'd need encoder memory as input
-    Volume& cross_attn_output = cross_attention.Forward(norm1_output, is_training);
-    
-    // Step 4: Add & Norm (Residual + Layer norm)
-    Volume& norm2_output = cross_attn_output;  // Placeholder
-    
-    // Step 5: Feed-forward network
-    Volume& ff_output = feed_forward.Forward(norm2_output, is_training);
-    
-    // Step 6: Add & Norm (Residual + Layer norm)
-    output_activation = ff_output;  // Placeholder
+    AddAndNorm(input, self_attn_output, norm1_weights, norm1_biases, attention_norm);
+
+    // The cross-attention with the encoder output (memory) would be here, with norm2
+
+    // Feed-forward network, then Add & Norm
+    Volume& ff_output = feed_forward.Forward(attention_norm, is_training);
+    AddAndNorm(attention_norm, ff_output, norm3_weights, norm3_biases, output_activation);
+    return output_activation;
+}
+
+Volume& DecoderLayerCRTP::ForwardCached(Volume& input, AttentionCache& cache) {
+    Volume& self_attn_output = self_attention.ForwardCached(input, cache);
+    AddAndNorm(input, self_attn_output, norm1_weights, norm1_biases, attention_norm);
+    Volume& ff_output = feed_forward.Forward(attention_norm, false);
+    AddAndNorm(attention_norm, ff_output, norm3_weights, norm3_biases, output_activation);
     return output_activation;
 }
 
+Volume& DecoderLayerCRTP::ForwardCached(Volume& input, const Vector<AttentionCache*>& caches, const Vector<int>& counts) {
+    // the layer normalization and the feed-forward network are position-wise, so the
+    // positions of all sequences go through them together
+    Volume& self_attn_output = self_attention.ForwardCached(input, caches, counts);
+    AddAndNorm(input, self_attn_output, norm1_weights, norm1_biases, attention_norm);
+    Volume& ff_output = feed_forward.Forward(attention_norm, false);
+    AddAndNorm(attention_norm, ff_output, norm3_weights, norm3_biases, output_activation);
+    return output_activation;
+}
+
+void DecoderLayerCRTP::VisitTensors(GGUFTensorVisitor& v, const String& prefix) {
+    int embed_dim = self_attention.GetEmbedDim();
+    self_attention.VisitTensors(v, prefix);
+    v.Tensor(prefix + "attn_norm.weight", norm1_weights, embed_dim);
+    v.Tensor(prefix + "attn_norm.bias", norm1_biases, embed_dim);
+    feed_forward.VisitTensors(v, prefix);
+    v.Tensor(prefix + "ffn_norm.weight", norm3_weights, embed_dim);
+    v.Tensor(prefix + "ffn_norm.bias", norm3_biases, embed_dim);
+}
+
+DecoderLayerCRTP& DecoderLayerCRTP::SetShape(int embed_dim, int num_heads, int ff_dim) {
+    self_attention.SetShape(embed_dim, num_heads);
+    feed_forward.SetShape(embed_dim, ff_dim);
+    InitNorm(norm1_weights, norm1_biases, embed_dim);
+    InitNorm(norm2_weights, norm2_biases, embed_dim);
+    InitNorm(norm3_weights, norm3_biases, embed_dim);
+    return *this;
+}
+
+// The cross-attention isn't applied, so it stays as it is
+void DecoderLayerCRTP::Quantize(int type) {
+    self_attention.Quantize(type);
+    feed_forward.Quantize(type);
+}
+
+void DecoderLayerCRTP::Dequantize() {
+    self_attention.Dequantize();
+    feed_forward.Dequantize();
+}
+
+DecoderLayerCRTP& DecoderLayerCRTP::SetThreadCount(int i) {
+    self_attention.SetThreadCount(i);
+    cross_attention.SetThreadCount(i);
+    feed_forward.SetThreadCount(i);
+    return *this;
+}
+
 void DecoderLayerCRTP::BackwardImpl() {
-    // Backward pass implementation for decoder layer
+    Panic("DecoderLayerCRTP: backward pass not implemented");
 }
 
 void DecoderLayerCRTP::InitImpl(int input_width, int input_height, int input_depth) {
     // Initialize the sub-layers based on input dimensions
-    self_attention.InitImpl(input_width, input_height, input_depth);
-    cross_attention.InitImpl(input_width, input_height, input_depth);
-    feed_forward.InitImpl(input_width, input_height, input_depth);
+    self_attention.Init(input_width, input_height, input_depth);
+    cross_attention.Init(input_width, input_height, input_depth);
+    feed_forward.Init(input_width, input_height, input_depth);
 }
 
 Vector<ParametersAndGradients>& DecoderLayerCRTP::GetParametersAndGradientsImpl() {
-    static Vector<ParametersAndGradients> params;
-    params.Clear();
-    
-    // Get parameters from self-attention, cross-attention, and feed-forward layers
-    auto& self_attn_params = self_attention.GetParametersAndGradients();
-    for (int i = 0; i < self_attn_params.GetCount(); i++) {
-        params.Add() = self_attn_params[i];
-    }
-    
-    auto& cross_attn_params = cross_attention.GetParametersAndGradients();
-    for (int i = 0; i < cross_attn_params.GetCount(); i++) {
-        params.Add() = cross_attn_params[i];
-    }
-    
-    auto& ff_params = feed_forward.GetParametersAndGradients();
-    for (int i = 0; i < ff_params.GetCount(); i++) {
-        params.Add() = ff_params[i];
-    }
-    
+    params.SetCount(0);
+    AddParameters(params, self_attention.GetParametersAndGradients());
+    AddParameters(params, cross_attention.GetParametersAndGradients());
+    AddParameters(params, feed_forward.GetParametersAndGradients());
+
     // Add layer normalization parameters
-    ParametersAndGradients norm1_w;
-    norm1_w.volume = &norm1_weights;
-    params.Add() = norm1_w;
-    
-    ParametersAndGradients norm1_b;
-    norm1_b.volume = &norm1_biases;
-    params.Add() = norm1_b;
-    
-    ParametersAndGradients norm2_w;
-    norm2_w.volume = &norm2_weights;
-    params.Add() = norm2_w;
-    
-    ParametersAndGradients norm2_b;
-    norm2_b.volume = &norm2_biases;
-    params.Add() = norm2_b;
-    
-    ParametersAndGradients norm3_w;
-    norm3_w.volume = &norm3_weights;
-    params.Add() = norm3_w;
-    
-    ParametersAndGradients norm3_b;
-    norm3_b.volume = &norm3_biases;
-    params.Add() = norm3_b;
-    
+    params.Add().volume = &norm1_weights;
+    params.Add().volume = &norm1_biases;
+    params.Add().volume = &norm2_weights;
+    params.Add().volume = &norm2_biases;
+    params.Add().volume = &norm3_weights;
+    params.Add().volume = &norm3_biases;
     return params;
 }
 
 void DecoderLayerCRTP::StoreImpl(ValueMap& map) const {
-    // Store decoder layer parameters
+    ValueMap self_attn, cross_attn, ff;
+    self_attention.Store(self_attn);
+    cross_attention.Store(cross_attn);
+    feed_forward.Store(ff);
+    map.GetAdd("self_attention") = self_attn;
+    map.GetAdd("cross_attention") = cross_attn;
+    map.GetAdd("feed_forward") = ff;
+    map.GetAdd("dropout_rate") = dropout_rate;
+    map.GetAdd("norm1_weights") = StoreWeights(norm1_weights);
+    map.GetAdd("norm1_biases") = StoreWeights(norm1_biases);
+    map.GetAdd("norm2_weights") = StoreWeights(norm2_weights);
+    map.GetAdd("norm2_biases") = StoreWeights(norm2_biases);
+    map.GetAdd("norm3_weights") = StoreWeights(norm3_weights);
+    map.GetAdd("norm3_biases") = StoreWeights(norm3_biases);
 }
 
 void DecoderLayerCRTP::LoadImpl(const ValueMap& map) {
-    // Load decoder layer parameters
+    self_attention.Load(map.GetValue(map.Find("self_attention")));
+    cross_attention.Load(map.GetValue(map.Find("cross_attention")));
+    feed_forward.Load(map.GetValue(map.Find("feed_forward")));
+    dropout_rate = map.GetValue(map.Find("dropout_rate"));
+    self_attention.SetCausal();
+    int embed_dim = self_attention.GetEmbedDim();
+    if (embed_dim <= 0)
+        return;
+    InitNorm(norm1_weights, norm1_biases, embed_dim);
+    InitNorm(norm2_weights, norm2_biases, embed_dim);
+    InitNorm(norm3_weights, norm3_biases, embed_dim);
+    LoadWeights(map, "norm1_weights", norm1_weights);
+    LoadWeights(map, "norm1_biases", norm1_biases);
+    LoadWeights(map, "norm2_weights", norm2_weights);
+    LoadWeights(map, "norm2_biases", norm2_biases);
+    LoadWeights(map, "norm3_weights", norm3_weights);
+    LoadWeights(map, "norm3_biases", norm3_biases);
 }
 
 String DecoderLayerCRTP::ToStringImpl() const {
-    return Format("DecoderLayer(embed_dim=%d, num_heads=%d)", 
+    return Format("DecoderLayer(embed_dim=%d, num_heads=%d)",
                   self_attention.GetEmbedDim(), self_attention.GetNumHeads());
 }
 
+void DecoderLayerCRTP::Serialize(Stream& s) {
+    self_attention.Serialize(s);
+    cross_attention.Serialize(s);
+    feed_forward.Serialize(s);
+    s % norm1_weights % norm1_biases % norm2_weights % norm2_biases % norm3_weights % norm3_biases;
+    s % dropout_rate;
+}
+
 // PositionalEncodingCRTP implementation
 PositionalEncodingCRTP::PositionalEncodingCRTP(int max_len, int embed_dim)
     : max_len(max_len), embed_dim(embed_dim) {
-    // Initialize the positional encoding volume
-    pe.Init(embed_dim, 1, max_len);
     GeneratePositionalEncodings();
 }
 
 Volume& PositionalEncodingCRTP::ForwardImpl(Volume& input, bool is_training) {
     // Add positional encoding to input
     // Input shape: [embed_dim, 1, seq_len]
-    // PE shape: [embed_dim, 1, max_len] (or [embed_dim, 1, seq_len] if truncated)
+    output_activation = input;
+    AddEncodings(output_activation, 0);
+    return output_activation;
+}
+
+void PositionalEncodingCRTP::AddEncodings(Volume& input, int position) const {
+    AddEncodings(input, 0, input.GetDepth(), position);
+}
+
+void PositionalEncodingCRTP::AddEncodings(Volume& input, int column, int count, int position) const {
+    ASSERT(input.GetWidth() == embed_dim && input.GetHeight() == 1 && position >= 0);
     int seq_len = input.GetDepth();
-    
-    // Add positional encoding values to the input
-    // This would involve element-wise addition
-    output_activation = input;  // Placeholder - actual implementation would add PE
-    
-    // Add the positional encoding values up to the sequence length
-    for (int pos = 0; pos < seq_len && pos < max_len; pos++) {
+    ASSERT(column >= 0 && column + count <= seq_len);
+    const Real* enc = pe.GetWeights().Begin();
+
+    // the positions after max_len don't get an encoding
+    count = max(0, min(count, max_len - position));
+    for (int b = 0; b < input.GetBatch(); b++) {
+        Real* x = input.GetWeights().Begin() + (int64)b * input.GetLength() + column;
         for (int i = 0; i < embed_dim; i++) {
-            double pe_value = pe.Get(i, 0, pos);
-            double input_value = input.Get(i, 0, pos);
-            output_activation.Set(i, 0, pos, input_value + pe_value);
+            const Real* row = enc + (int64)i * max_len + position;
+            Real* xrow = x + (int64)i * seq_len;
+            for (int t = 0; t < count; t++)
+                xrow[t] += row[t];
         }
     }
-    
-    return output_activation;
 }
 
 void PositionalEncodingCRTP::BackwardImpl() {
@@ -591,9 +571,8 @@ void PositionalEncodingCRTP::StoreImpl(ValueMap& map) const {
 void PositionalEncodingCRTP::LoadImpl(const ValueMap& map) {
     max_len = map.GetValue(map.Find("max_len"));
     embed_dim = map.GetValue(map.Find("embed_dim"));
-    
+
     // Regenerate positional encodings
-    pe.Init(embed_dim, 1, max_len);
     GeneratePositionalEncodings();
 }
 
@@ -601,11 +580,20 @@ String PositionalEncodingCRTP::ToStringImpl() const {
     return Format("PositionalEncoding(max_len=%d, embed_dim=%d)", max_len, embed_dim);
 }
 
+void PositionalEncodingCRTP::Serialize(Stream& s) {
+    s % max_len % embed_dim;
+    if (s.IsLoading())
+        GeneratePositionalEncodings();
+}
+
 void PositionalEncodingCRTP::GeneratePositionalEncodings() {
     // Generate positional encodings using sine and cosine functions
     // Formula: PE(pos, 2i) = sin(pos / 10000^(2i/d_model))
     //         PE(pos, 2i+1) = cos(pos / 10000^(2i/d_model))
-    
+    if (max_len <= 0 || embed_dim <= 0)
+        return;
+    pe.Init(embed_dim, 1, max_len, 0.0);
+
     for (int pos = 0; pos < max_len; pos++) {
         for (int i = 0; i < embed_dim; i++) {
             if (i % 2 == 0) {
@@ -622,134 +610,109 @@ void PositionalEncodingCRTP::GeneratePositionalEncodings() {
 }
 
 // TransformerCRTP implementation
-TransformerCRTP::TransformerCRTP(int src_vocab_size, int tgt_vocab_size, int embed_dim, 
+TransformerCRTP::TransformerCRTP(int src_vocab_size, int tgt_vocab_size, int embed_dim,
                                int num_heads, int num_encoder_layers, int num_decoder_layers,
                                int ff_dim, int max_seq_len, double dropout_rate)
-    : src_vocab_size(src_vocab_size), tgt_vocab_size(tgt_vocab_size), 
-      embed_dim(embed_dim), num_heads(num_heads),
-      positional_encoding(max_seq_len, embed_dim) {
-    // Initialize embedding matrices
-    src_embedding.Init(embed_dim, src_vocab_size, 1);  // [embed_dim, vocab_size]
-    tgt_embedding.Init(embed_dim, tgt_vocab_size, 1);  // [embed_dim, vocab_size]
-    output_projection.Init(tgt_vocab_size, embed_dim, 1);  // [vocab_size, embed_dim]
-    
+    : positional_encoding(max_seq_len, embed_dim),
+      src_vocab_size(src_vocab_size), tgt_vocab_size(tgt_vocab_size),
+      embed_dim(embed_dim), num_heads(num_heads) {
+    // Initialize embedding matrices with one row per token
+    InitGaussian(src_embedding, embed_dim, src_vocab_size, embed_dim);
+    InitGaussian(tgt_embedding, embed_dim, tgt_vocab_size, embed_dim);
+    InitGaussian(output_projection, embed_dim, tgt_vocab_size, embed_dim);
+
     // Initialize encoder layers
-    for (int i = 0; i < num_encoder_layers; i++) {
-        encoder_layers.Add(EncoderLayerCRTP(embed_dim, num_heads, ff_dim, dropout_rate));
-    }
-    
+    for (int i = 0; i < num_encoder_layers; i++)
+        encoder_layers.Add(new EncoderLayerCRTP(embed_dim, num_heads, ff_dim, dropout_rate));
+
     // Initialize decoder layers
-    for (int i = 0; i < num_decoder_layers; i++) {
-        decoder_layers.Add(DecoderLayerCRTP(embed_dim, num_heads, ff_dim, dropout_rate));
-    }
-    
+    for (int i = 0; i < num_decoder_layers; i++)
+        decoder_layers.Add(new DecoderLayerCRTP(embed_dim, num_heads, ff_dim, dropout_rate));
+
     // Initialize layer normalization for output
-    final_norm_weights.Init(embed_dim, 1, 1);
-    final_norm_biases.Init(embed_dim, 1, 1);
-    final_norm_weights.Fill(1.0);
-    final_norm_biases.Fill(0.0);
-    
-    // Initialize embeddings with small random values
-    src_embedding.FillRandom();
-    tgt_embedding.FillRandom();
-    output_projection.FillRandom();
+    InitNorm(final_norm_weights, final_norm_biases, embed_dim);
+}
+
+void TransformerCRTP::Embed(const Volume& tokens, const Volume& embedding, Volume& out) {
+    int seq_len = tokens.GetCount();
+    int vocab_size = embedding.GetHeight();
+    out.SetSize(embed_dim, 1, seq_len);
+    const Real* emb = embedding.GetWeights().Begin();
+    Real* x = out.GetWeights().Begin();
+    for (int t = 0; t < seq_len; t++) {
+        int token = (int)tokens.Get(t);
+        ASSERT(token >= 0 && token < vocab_size);
+        const Real* row = emb + (int64)token * embed_dim;
+        for (int i = 0; i < embed_dim; i++)
+            x[(int64)i * seq_len + t] = row[i];
+    }
 }
 
 Volume& TransformerCRTP::Forward(Volume& src, Volume& tgt, bool is_training) {
     // Encode source sequence
     Volume& encoder_output = Encode(src, is_training);
-    
+
     // Decode target sequence using encoder output as memory
-    output_activation = Decode(tgt, encoder_output, is_training);
-    
-    return output_activation;
+    return Decode(tgt, encoder_output, is_training);
 }
 
 Volume& TransformerCRTP::Encode(Volume& src, bool is_training) {
-    // Apply source embedding
-    // This would involve looking up embeddings for each token in src
-    Volume embedded_src = src;  // Placeholder
-    
-    // Apply positional encoding
-    Volume& pos_encoded_src = positional_encoding.Forward(embedded_src, is_training);
-    
+    // Apply source embedding and positional encoding
+    Embed(src, src_embedding, embedded_src);
+    positional_encoding.AddEncodings(embedded_src, 0);
+
     // Pass through encoder layers
-    Volume* current = &pos_encoded_src;
+    Volume* current = &embedded_src;
     for (int i = 0; i < encoder_layers.GetCount(); i++) {
         current = &encoder_layers[i].Forward(*current, is_training);
     }
-    
+
     return *current;
 }
 
 Volume& TransformerCRTP::Decode(Volume& tgt, Volume& memory, bool is_training) {
-    // Apply target embedding
-    Volume embedded_tgt = tgt;  // Placeholder
-    
-    // Apply positional encoding
-    Volume& pos_encoded_tgt = positional_encoding.Forward(embedded_tgt, is_training);
-    
-    // Generate causal mask for target sequence
-    // This ensures each position can only attend to previous positions
-    // Volume subsequent_mask = GenerateSubsequentMask(tgt.GetDepth());
-    
-    // Pass through decoder layers
-    Volume* current = &pos_encoded_tgt;
+    // Apply target embedding and positional encoding
+    Embed(tgt, tgt_embedding, embedded_tgt);
+    positional_encoding.AddEncodings(embedded_tgt, 0);
+
+    // Pass through decoder layers, which mask the future positions
+    Volume* current = &embedded_tgt;
     for (int i = 0; i < decoder_layers.GetCount(); i++) {
         // In a complete implementation, we'd pass the encoder memory to the decoder layer
         current = &decoder_layers[i].Forward(*current, is_training);
     }
-    
+
     // Apply final layer normalization
-    // This would be a simplified layer norm implementation
-    output_activation = *current;  // Placeholder
-    
-    // Apply output projection to vocab size
-    // This would convert from embedding space to vocabulary space
+    decoded = *current;
+    ApplyLayerNorm(decoded, final_norm_weights, final_norm_biases);
+
+    // Apply output projection to vocab size: [tgt_vocab_size x embed_dim] * [embed_dim x seq_len]
+    int seq_len = decoded.GetDepth();
+    output_activation.SetSize(tgt_vocab_size, 1, seq_len);
+    Gemm<Real>(false, false, tgt_vocab_size, seq_len, embed_dim,
+        (Real)1, output_projection.GetWeights().Begin(), embed_dim, decoded.GetWeights().Begin(), seq_len,
+        (Real)0, output_activation.GetWeights().Begin(), seq_len);
     return output_activation;
 }
 
 Vector<ParametersAndGradients> TransformerCRTP::GetParametersAndGradients() {
     Vector<ParametersAndGradients> params;
-    
+
     // Add embedding parameters
-    ParametersAndGradients src_emb;
-    src_emb.volume = &src_embedding;
-    params.Add() = src_emb;
-    
-    ParametersAndGradients tgt_emb;
-    tgt_emb.volume = &tgt_embedding;
-    params.Add() = tgt_emb;
-    
-    ParametersAndGradients out_proj;
-    out_proj.volume = &output_projection;
-    params.Add() = out_proj;
-    
-    // Add encoder layer parameters
-    for (int i = 0; i < encoder_layers.GetCount(); i++) {
-        auto& layer_params = encoder_layers[i].GetParametersAndGradients();
-        for (int j = 0; j < layer_params.GetCount(); j++) {
-            params.Add() = layer_params[j];
-        }
-    }
-    
-    // Add decoder layer parameters
-    for (int i = 0; i < decoder_layers.GetCount(); i++) {
-        auto& layer_params = decoder_layers[i].GetParametersAndGradients();
-        for (int j = 0; j < layer_params.GetCount(); j++) {
-            params.Add() = layer_params[j];
-        }
-    }
-    
+    params.Add().volume = &src_embedding;
+    params.Add().volume = &tgt_embedding;
+    params.Add().volume = &output_projection;
+
+    // Add encoder and decoder layer parameters
+    for (int i = 0; i < encoder_layers.GetCount(); i++)
+        AddParameters(params, encoder_layers[i].GetParametersAndGradients());
+    for (int i = 0; i < decoder_layers.GetCount(); i++)
+        AddParameters(params, decoder_layers[i].GetParametersAndGradients());
+
     // Add final normalization parameters
-    ParametersAndGradients final_norm_w;
-    final_norm_w.volume = &final_norm_weights;
-    params.Add() = final_norm_w;
-    
-    ParametersAndGradients final_norm_b;
-    final_norm_b.volume = &final_norm_biases;
-    params.Add() = final_norm_b;
-    
+    params.Add().volume = &final_norm_weights;
+    params.Add().volume = &final_norm_biases;
+
     return params;
 }
 
@@ -759,10 +722,29 @@ void TransformerCRTP::Store(ValueMap& map) const {
     map.GetAdd("tgt_vocab_size") = tgt_vocab_size;
     map.GetAdd("embed_dim") = embed_dim;
     map.GetAdd("num_heads") = num_heads;
-    
-    // Store embeddings
-    // Store encoder/decoder layers
-    // Store positional encoding
+
+    // Store embeddings, layers and positional encoding
+    map.GetAdd("src_embedding") = StoreWeights(src_embedding);
+    map.GetAdd("tgt_embedding") = StoreWeights(tgt_embedding);
+    map.GetAdd("output_projection") = StoreWeights(output_projection);
+    map.GetAdd("final_norm_weights") = StoreWeights(final_norm_weights);
+    map.GetAdd("final_norm_biases") = StoreWeights(final_norm_biases);
+    ValueArray encoders, decoders;
+    for (int i = 0; i < encoder_layers.GetCount(); i++) {
+        ValueMap layer;
+        encoder_layers[i].Store(layer);
+        encoders.Add(layer);
+    }
+    for (int i = 0; i < decoder_layers.GetCount(); i++) {
+        ValueMap layer;
+        decoder_layers[i].Store(layer);
+        decoders.Add(layer);
+    }
+    map.GetAdd("encoder_layers") = encoders;
+    map.GetAdd("decoder_layers") = decoders;
+    ValueMap pe;
+    positional_encoding.Store(pe);
+    map.GetAdd("positional_encoding") = pe;
 }
 
 void TransformerCRTP::Load(const ValueMap& map) {
@@ -771,8 +753,26 @@ void TransformerCRTP::Load(const ValueMap& map) {
     tgt_vocab_size = map.GetValue(map.Find("tgt_vocab_size"));
     embed_dim = map.GetValue(map.Find("embed_dim"));
     num_heads = map.GetValue(map.Find("num_heads"));
-    
+
     // Load embeddings, layers, etc.
+    src_embedding.Init(embed_dim, src_vocab_size, 1, 0.0);
+    tgt_embedding.Init(embed_dim, tgt_vocab_size, 1, 0.0);
+    output_projection.Init(embed_dim, tgt_vocab_size, 1, 0.0);
+    InitNorm(final_norm_weights, final_norm_biases, embed_dim);
+    LoadWeights(map, "src_embedding", src_embedding);
+    LoadWeights(map, "tgt_embedding", tgt_embedding);
+    LoadWeights(map, "output_projection", output_projection);
+    LoadWeights(map, "final_norm_weights", final_norm_weights);
+    LoadWeights(map, "final_norm_biases", final_norm_biases);
+    Value encoders = map.GetValue(map.Find("encoder_layers"));
+    Value decoders = map.GetValue(map.Find("decoder_layers"));
+    encoder_layers.Clear();
+    decoder_layers.Clear();
+    for (int i = 0; i < encoders.GetCount(); i++)
+        encoder_layers.Add(new EncoderLayerCRTP(ValueMap(encoders[i])));
+    for (int i = 0; i < decoders.GetCount(); i++)
+        decoder_layers.Add(new DecoderLayerCRTP(ValueMap(decoders[i])));
+    positional_encoding.Load(map.GetValue(map.Find("positional_encoding")));
 }
 
 void TransformerCRTP::Serialize(Stream& s) {
@@ -781,56 +781,46 @@ void TransformerCRTP::Serialize(Stream& s) {
     s % tgt_vocab_size;
     s % embed_dim;
     s % num_heads;
-    
-    // Serialize all the layers
-    s % encoder_layers;
-    s % decoder_layers;
-    
+
+    // Serialize all the layers, which load their own sizes
+    int encoder_count = encoder_layers.GetCount();
+    int decoder_count = decoder_layers.GetCount();
+    s % encoder_count % decoder_count;
+    if (s.IsLoading()) {
+        encoder_layers.Clear();
+        decoder_layers.Clear();
+        for (int i = 0; i < encoder_count; i++)
+            encoder_layers.Add(new EncoderLayerCRTP(0, 0, 0));
+        for (int i = 0; i < decoder_count; i++)
+            decoder_layers.Add(new DecoderLayerCRTP(0, 0, 0));
+    }
+    for (int i = 0; i < encoder_layers.GetCount(); i++)
+        encoder_layers[i].Serialize(s);
+    for (int i = 0; i < decoder_layers.GetCount(); i++)
+        decoder_layers[i].Serialize(s);
+
     // Serialize embeddings
     s % src_embedding;
     s % tgt_embedding;
     s % output_projection;
-    
+
     // Serialize layer normalization parameters
     s % final_norm_weights;
     s % final_norm_biases;
-    
+
     // Serialize positional encoding
-    s % positional_encoding;
-}
-
-Volume& TransformerCRTP::GenerateSubsequentMask(int size) {
-    // Generate a mask that prevents attending to future positions
-    // Result would be a matrix of shape [size, size] where positions (i,j)
-    // with j > i are masked (usually with a large negative value)
-    
-    // This would create a causal mask for decoder self-attention
-    static Volume mask;  // In practice, this would be stored or computed as needed
-    mask.Init(size, size, 1);
-    
-    // Fill with 0s (allowed) and -inf (masked)
-    for (int i = 0; i < size; i++) {
-        for (int j = 0; j < size; j++) {
-            if (j > i) {
-                mask.Set(i, j, 0, -1e9);  // Large negative value to mask
-            } else {
-                mask.Set(i, j, 0, 0.0);   // Allow attention
-            }
-        }
-    }
-    
-    return mask;
+    positional_encoding.Serialize(s);
 }
 
 // Helper function to create a transformer
-std::unique_ptr<TransformerCRTP> CreateTransformer(int src_vocab_size, int tgt_vocab_size, 
-                                                  int embed_dim, int num_heads, 
+std::unique_ptr<TransformerCRTP> CreateTransformer(int src_vocab_size, int tgt_vocab_size,
+                                                  int embed_dim, int num_heads,
                                                   int num_encoder_layers, int num_decoder_layers,
-                                                  int ff_dim, int max_seq_len, 
+                                                  int ff_dim, int max_seq_len,
                                                   double dropout_rate) {
-    return std::make_unique<TransformerCRTP>(src_vocab_size, tgt_vocab_size, embed_dim, 
+    return std::make_unique<TransformerCRTP>(src_vocab_size, tgt_vocab_size, embed_dim,
                                             num_heads, num_encoder_layers, num_decoder_layers,
                                             ff_dim, max_seq_len, dropout_rate);
 }
 
-} // namespace ConvNet
\ No newline at end of file
+} // namespace ConvNet
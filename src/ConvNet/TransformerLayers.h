@@ -3,21 +3,34 @@
 
 #include "ConvNet.h"
 #include "CrtpLayers.h"
+#include "Attention.h"
 #include "RuntimeFlexibility.h"  // For layer normalization implementation
 
 namespace ConvNet {
 
 // Multi-Head Attention Layer
+//
+// The input and the output are [embed_dim, 1, seq_len] volumes, with one sequence per
+// sample of the batch. Q, K and V are projected with one GEMM each into position-major
+// (seq_len x embed_dim) matrices, where head h has the columns h * head_dim ... and the
+// attention of the heads is tiled with an online softmax (see Attention.h), so that the
+// seq_len x seq_len scores are never stored. The projections, the context of the heads
+// and the log-sum-exp of the score rows are kept for the backward pass.
+//
+// The implementation is in Attention.cpp.
 class MultiHeadAttentionCRTP : public LayerBaseCRTP<MultiHeadAttentionCRTP> {
 private:
     friend class LayerBaseCRTP<MultiHeadAttentionCRTP>;
 
     // Core data
-    int embed_dim;      // Total embedding dimension
-    int num_heads;      // Number of attention heads
-    int head_dim;       // Dimension per head (embed_dim / num_heads)
+    int embed_dim = 0;      // Total embedding dimension
+    int num_heads = 0;      // Number of attention heads
+    int head_dim = 0;       // Dimension per head (embed_dim / num_heads)
+    int tile_size = 64;     // Queries and keys per attention tile
+    int thread_count = 1;   // Heads are computed in parallel with more threads
+    bool causal = false;    // Positions attend only to themselves and earlier positions
     
-    // Weight matrices for Q, K, V projections
+    // Weight matrices for Q, K, V projections, [embed_dim x embed_dim] with one row per output
     Volume wq;          // Query weight matrix
     Volume wk;          // Key weight matrix
     Volume wv;          // Value weight matrix
@@ -29,19 +42,22 @@ private:
     Volume bv;          // Value bias
     Volume bo;          // Output bias
     
-    // Cached values for forward/backward pass
+    // The quantized wq, wk, wv and wo, see Quantize
+    QuantizedMatrix quantized[4];
+    
+    // Cached values for forward/backward pass, one sequence after another
     Volume output_activation;
-    Volume input_activation;
-    Vector<Volume> queries;     // Queries for each head
-    Vector<Volume> keys;        // Keys for each head
-    Vector<Volume> values;      // Values for each head
-    Vector<Volume> attention_scores;  // Attention weights for each head
-    Vector<Volume> attention_outputs; // Output from each head
-    
-    // Temporary volumes for attention computation
-    Volume scores;              // Attention scores (Q*K^T)
-    Volume attention_weights;   // Softmax output
-    Volume output;              // Final attention output
+    Volume* input_activation = NULL;
+    Vector<Real> queries;       // batch * seq_len x embed_dim
+    Vector<Real> keys;
+    Vector<Real> values;
+    Vector<Real> context;       // Output of the heads before the output projection
+    Vector<Real> lse;           // Log-sum-exp of the score rows, batch * num_heads x seq_len
+    Vector<Real> dqueries, dkeys, dvalues, dcontext;
+    Array<AttentionScratch> scratch;    // One per head (and per sequence of ForwardCached)
+    Vector<AttentionCache*> cached;     // The sequences of ForwardCached
+    Vector<int> cached_counts, cached_first;
+    Vector<ParametersAndGradients> params;
 
     // Internal implementation methods
     Volume& ForwardImpl(Volume& input, bool is_training);
@@ -53,29 +69,136 @@ private:
     void LoadImpl(const ValueMap& map);
     String ToStringImpl() const;
     Volume& GetOutputImpl() { return output_activation; }
+    
+    void InitWeights();
+    AttentionShape GetShape(int seq_len) const;
+    void ForwardHeads(int seq_len, int b);
+    void BackwardHeads(int seq_len, int b);
+    const QuantizedMatrix* GetQuantized(int i, bool is_training) const { return !is_training && IsQuantized() ? &quantized[i] : NULL; }
 
 public:
     MultiHeadAttentionCRTP(int embed_dim, int num_heads);
     MultiHeadAttentionCRTP(ValueMap values) { LoadImpl(values); }
 
+    MultiHeadAttentionCRTP& SetCausal(bool b = true) { causal = b; return *this; }
+    MultiHeadAttentionCRTP& SetTileSize(int i) { tile_size = max(1, i); return *this; }
+    MultiHeadAttentionCRTP& SetThreadCount(int i) { thread_count = max(1, i); return *this; }
+
+    // Incremental decoding: the positions of input follow the ones in the cache, they are
+    // appended to it and attend causally to all of them. There is no backward pass.
+    Volume& ForwardCached(Volume& input, AttentionCache& cache);
+    
+    // The same for several sequences in one step: the first counts[0] positions of input
+    // belong to caches[0], the next counts[1] ones to caches[1] etc. The projections of all
+    // positions are computed together.
+    Volume& ForwardCached(Volume& input, const Vector<AttentionCache*>& caches, const Vector<int>& counts);
+    
+    // The weights as GGUF tensors with the llama.cpp names, prefix + "attn_q.weight" etc.
+    void VisitTensors(GGUFTensorVisitor& v, const String& prefix);
+    
+    // Sets the dimensions with zero biases but without the weight matrices, which
+    // VisitTensors maps afterwards
+    void SetShape(int embed_dim, int num_heads);
+    
+    // Post-training quantization of the projections into GGUF_Q8_0 or GGUF_Q4_0 blocks
+    // (see Quantize.h), which the forward passes use when not training. The weights are
+    // kept for training, so Quantize again after they have changed.
+    void Quantize(int type);
+    void Dequantize();
+    bool IsQuantized() const { return !quantized[0].IsEmpty(); }
+
     // Public interface
     int GetEmbedDim() const { return embed_dim; }
     int GetNumHeads() const { return num_heads; }
     int GetHeadDim() const { return head_dim; }
+    int GetTileSize() const { return tile_size; }
+    bool IsCausal() const { return causal; }
     
-    // Scaled Dot-Product Attention helper
-    Volume& ScaledDotProductAttention(Volume& query, Volume& key, Volume& value, 
-                                     const Volume* mask = nullptr);
+    Volume& GetQueryWeights() { return wq; }
+    Volume& GetKeyWeights() { return wk; }
+    Volume& GetValueWeights() { return wv; }
+    Volume& GetOutputWeights() { return wo; }
+    
+    void Serialize(Stream& s);
 };
 
+// Position-wise Feed-Forward Layer
+//
+// Two fully connected layers with a ReLU between them, applied to every position of an
+// [embed_dim, 1, seq_len] volume with one GEMM per layer.
+class FeedForwardCRTP : public LayerBaseCRTP<FeedForwardCRTP> {
+private:
+    friend class LayerBaseCRTP<FeedForwardCRTP>;
+
+    int embed_dim = 0;
+    int ff_dim = 0;
+    int thread_count = 1;   // The GEMMs of the forward pass are split between the threads
+    Volume w1;          // [embed_dim x ff_dim], one row per hidden unit
+    Volume b1;
+    Volume w2;          // [ff_dim x embed_dim], one row per output
+    Volume b2;
+    QuantizedMatrix quantized[2];   // w1 and w2, see Quantize
+
+    // Cached values
+    Volume output_activation;
+    Volume* input_activation = NULL;
+    Vector<Real> hidden;        // ReLU outputs, batch * ff_dim x seq_len
+    Vector<Real> dhidden;
+    Vector<ParametersAndGradients> params;
+
+    // Internal implementation methods
+    Volume& ForwardImpl(Volume& input, bool is_training);
+    void BackwardImpl();
+    void InitImpl(int input_width, int input_height, int input_depth);
+    Vector<ParametersAndGradients>& GetParametersAndGradientsImpl();
+    String GetKeyImpl() const { return "feed_forward"; }
+    void StoreImpl(ValueMap& map) const;
+    void LoadImpl(const ValueMap& map);
+    String ToStringImpl() const;
+    Volume& GetOutputImpl() { return output_activation; }
+
+    void InitWeights();
+
+public:
+    FeedForwardCRTP(int embed_dim, int ff_dim);
+    FeedForwardCRTP(ValueMap values) { LoadImpl(values); }
+
+    FeedForwardCRTP& SetThreadCount(int i) { thread_count = max(1, i); return *this; }
+    
+    // The weights as the GGUF tensors prefix + "ffn_up.weight" etc., and the dimensions
+    // without the weight matrices (see MultiHeadAttentionCRTP::SetShape)
+    void VisitTensors(GGUFTensorVisitor& v, const String& prefix);
+    void SetShape(int embed_dim, int ff_dim);
+    
+    // Quantization of w1 and w2, see MultiHeadAttentionCRTP::Quantize
+    void Quantize(int type);
+    void Dequantize();
+    bool IsQuantized() const { return !quantized[0].IsEmpty(); }
+
+    int GetEmbedDim() const { return embed_dim; }
+    int GetFFDim() const { return ff_dim; }
+
+    void Serialize(Stream& s);
+};
+
+// Layer normalization of every position of an [embed_dim, 1, seq_len] volume, in place
+void ApplyLayerNorm(Volume& input, const Volume& gamma, const Volume& beta);
+
+// The weights of a volume as a Value array of a layer's ValueMap, and back
+Value StoreWeights(const Volume& v);
+void LoadWeights(const ValueMap& map, const char* key, Volume& v);
+
 // Transformer Encoder Layer
+//
+// Self-attention and a feed-forward network, both followed by a residual connection and
+// layer normalization ("Add & Norm"). The backward pass isn't implemented yet.
 class EncoderLayerCRTP : public LayerBaseCRTP<EncoderLayerCRTP> {
 private:
     friend class LayerBaseCRTP<EncoderLayerCRTP>;
 
     // Core components
     MultiHeadAttentionCRTP self_attention;
-    FullyConnLayerCRTP feed_forward;
+    FeedForwardCRTP feed_forward;
     
     // Layer normalization components
     Volume norm1_weights;  // For self-attention
@@ -83,14 +206,13 @@ private:
     Volume norm2_weights;  // For feed-forward
     Volume norm2_biases;
     
-    // Dropout rates
+    // Dropout rate, for training
     double dropout_rate;
-    DropOutLayerCRTP dropout1;
-    DropOutLayerCRTP dropout2;
     
     // Cached values
     Volume output_activation;
-    Volume input_activation;
+    Volume attention_norm;
+    Vector<ParametersAndGradients> params;
 
     // Internal implementation methods
     Volume& ForwardImpl(Volume& input, bool is_training);
@@ -104,21 +226,32 @@ private:
     Volume& GetOutputImpl() { return output_activation; }
 
 public:
-    EncoderLayerCRTP(int embed_dim, int num_heads, int ff_dim, double dropout_rate = 0.1)
-        : self_attention(embed_dim, num_heads), 
-          feed_forward(ff_dim),  // Assuming this takes neuron_count as parameter
-          dropout1(dropout_rate), dropout2(dropout_rate) {}
-    EncoderLayerCRTP(ValueMap values) : self_attention(0, 0), feed_forward(0), dropout1(0.0), dropout2(0.0) { LoadImpl(values); }
+    EncoderLayerCRTP(int embed_dim, int num_heads, int ff_dim, double dropout_rate = 0.1);
+    EncoderLayerCRTP(ValueMap values) : self_attention(0, 0), feed_forward(0, 0), dropout_rate(0.0) { LoadImpl(values); }
 
     // Public interface
     int GetEmbedDim() const { return self_attention.GetEmbedDim(); }
     int GetNumHeads() const { return self_attention.GetNumHeads(); }
     
-    // Helper for layer normalization
-    void ApplyLayerNorm(Volume& input, const Volume& gamma, const Volume& beta, int d_model, int seq_len);
+    MultiHeadAttentionCRTP& GetSelfAttention() { return self_attention; }
+    FeedForwardCRTP& GetFeedForward() { return feed_forward; }
+    
+    // Quantizes the attention projections and the feed-forward network for inference
+    void Quantize(int type);
+    void Dequantize();
+    
+    void Serialize(Stream& s);
 };
 
 // Transformer Decoder Layer
+//
+// Masked self-attention and a feed-forward network, with "Add & Norm" after both. The
+// cross-attention over the encoder output has its weights, but it isn't applied until the
+// encoder memory is passed to the layer. The backward pass isn't implemented yet.
+//
+// ForwardCached is the incremental step of autoregressive decoding: the positions of the
+// input follow the ones whose keys and values are in the cache, so that one new token costs
+// one step instead of a forward pass over the whole context.
 class DecoderLayerCRTP : public LayerBaseCRTP<DecoderLayerCRTP> {
 private:
     friend class LayerBaseCRTP<DecoderLayerCRTP>;
@@ -126,7 +259,7 @@ private:
     // Core components
     MultiHeadAttentionCRTP self_attention;
     MultiHeadAttentionCRTP cross_attention;  // Attention over encoder outputs
-    FullyConnLayerCRTP feed_forward;
+    FeedForwardCRTP feed_forward;
     
     // Layer normalization components
     Volume norm1_weights;  // For self-attention
@@ -136,15 +269,13 @@ private:
     Volume norm3_weights;  // For feed-forward
     Volume norm3_biases;
     
-    // Dropout rates
+    // Dropout rate, for training
     double dropout_rate;
-    DropOutLayerCRTP dropout1;
-    DropOutLayerCRTP dropout2;
-    DropOutLayerCRTP dropout3;
     
     // Cached values
     Volume output_activation;
-    Volume input_activation;
+    Volume attention_norm;
+    Vector<ParametersAndGradients> params;
 
     // Internal implementation methods
     Volume& ForwardImpl(Volume& input, bool is_training);
@@ -158,19 +289,34 @@ private:
     Volume& GetOutputImpl() { return output_activation; }
 
 public:
-    DecoderLayerCRTP(int embed_dim, int num_heads, int ff_dim, double dropout_rate = 0.1)
-        : self_attention(embed_dim, num_heads), 
-          cross_attention(embed_dim, num_heads),  // Cross attention with encoder
-          feed_forward(ff_dim),  // Assuming this takes neuron_count as parameter
-          dropout1(dropout_rate), dropout2(dropout_rate), dropout3(dropout_rate) {}
-    DecoderLayerCRTP(ValueMap values) : self_attention(0, 0), cross_attention(0, 0), feed_forward(0), dropout1(0.0), dropout2(0.0), dropout3(0.0) { LoadImpl(values); }
+    DecoderLayerCRTP(int embed_dim, int num_heads, int ff_dim, double dropout_rate = 0.1);
+    DecoderLayerCRTP(ValueMap values) : self_attention(0, 0), cross_attention(0, 0), feed_forward(0, 0), dropout_rate(0.0) { LoadImpl(values); }
+
+    // Incremental decoding with the keys and values of the earlier positions, of one or
+    // several sequences (see MultiHeadAttentionCRTP::ForwardCached)
+    Volume& ForwardCached(Volume& input, AttentionCache& cache);
+    Volume& ForwardCached(Volume& input, const Vector<AttentionCache*>& caches, const Vector<int>& counts);
+    
+    DecoderLayerCRTP& SetThreadCount(int i);
+    
+    // The weights as the GGUF tensors of the block prefix, e.g. "blk.0.". The normalization
+    // after the attention is "attn_norm" and the one after the feed-forward network
+    // "ffn_norm". The cross-attention isn't visited, and SetShape leaves it empty.
+    void VisitTensors(GGUFTensorVisitor& v, const String& prefix);
+    DecoderLayerCRTP& SetShape(int embed_dim, int num_heads, int ff_dim);
+    
+    // Quantizes the attention projections and the feed-forward network for inference
+    void Quantize(int type);
+    void Dequantize();
 
     // Public interface
     int GetEmbedDim() const { return self_attention.GetEmbedDim(); }
     int GetNumHeads() const { return self_attention.GetNumHeads(); }
     
-    // Helper for layer normalization
-    void ApplyLayerNorm(Volume& input, const Volume& gamma, const Volume& beta, int d_model, int seq_len);
+    MultiHeadAttentionCRTP& GetSelfAttention() { return self_attention; }
+    FeedForwardCRTP& GetFeedForward() { return feed_forward; }
+    
+    void Serialize(Stream& s);
 };
 
 // Positional Encoding Layer
@@ -179,13 +325,12 @@ private:
     friend class LayerBaseCRTP<PositionalEncodingCRTP>;
 
     // Core data
-    int max_len;        // Maximum sequence length
-    int embed_dim;      // Embedding dimension
-    Volume pe;          // Precomputed positional encodings
+    int max_len = 0;        // Maximum sequence length
+    int embed_dim = 0;      // Embedding dimension
+    Volume pe;              // Precomputed positional encodings, [embed_dim, 1, max_len]
     
     // Cached values
     Volume output_activation;
-    Volume input_activation;
 
     // Internal implementation methods
     Volume& ForwardImpl(Volume& input, bool is_training);
@@ -200,7 +345,7 @@ private:
 
 public:
     PositionalEncodingCRTP(int max_len, int embed_dim);
-    PositionalEncodingCRTP(ValueMap values) : pe(0, 0, 0) { LoadImpl(values); }
+    PositionalEncodingCRTP(ValueMap values) { LoadImpl(values); }
 
     // Public interface
     int GetMaxLen() const { return max_len; }
@@ -208,27 +353,45 @@ public:
     
     // Generate positional encodings using sine/cosine functions
     void GeneratePositionalEncodings();
+    
+    // Adds the encodings of the positions position ... to the sequence in place, or to the
+    // count positions of it from column on
+    void AddEncodings(Volume& input, int position) const;
+    void AddEncodings(Volume& input, int column, int count, int position) const;
+    
+    void Serialize(Stream& s);
 };
 
 // Complete Transformer Model
+//
+// The sequences are [1, 1, seq_len] volumes of token ids, and the output has the logits
+// of the target vocabulary, [tgt_vocab_size, 1, seq_len].
 class TransformerCRTP {
 private:
     // Core components
-    Vector<EncoderLayerCRTP> encoder_layers;
-    Vector<DecoderLayerCRTP> decoder_layers;
+    Array<EncoderLayerCRTP> encoder_layers;
+    Array<DecoderLayerCRTP> decoder_layers;
     PositionalEncodingCRTP positional_encoding;
     
     // Embedding layers
     int src_vocab_size;     // Source vocabulary size
     int tgt_vocab_size;     // Target vocabulary size
     int embed_dim;          // Embedding dimension
-    Volume src_embedding;   // Source embedding matrix
-    Volume tgt_embedding;   // Target embedding matrix
-    Volume output_projection; // Output projection matrix
+    int num_heads;
+    Volume src_embedding;   // Source embedding matrix, one row per token
+    Volume tgt_embedding;   // Target embedding matrix, one row per token
+    Volume output_projection; // Output projection matrix, [tgt_vocab_size x embed_dim]
     
     // Output layer normalization
     Volume final_norm_weights;
     Volume final_norm_biases;
+    
+    // Cached values
+    Volume embedded_src, embedded_tgt;
+    Volume decoded;
+    Volume output_activation;
+    
+    void Embed(const Volume& tokens, const Volume& embedding, Volume& out);
 
 public:
     TransformerCRTP(int src_vocab_size, int tgt_vocab_size, int embed_dim, 
@@ -257,11 +420,6 @@ public:
     int GetNumHeads() const { return num_heads; }
     int GetSrcVocabSize() const { return src_vocab_size; }
     int GetTgtVocabSize() const { return tgt_vocab_size; }
-    
-private:
-    // Helper functions
-    Volume& GenerateSubsequentMask(int size);  // For causal masking in decoder
-    int num_heads;
 };
 
 // Helper function to create a transformer
@@ -273,4 +431,4 @@ std::unique_ptr<TransformerCRTP> CreateTransformer(int src_vocab_size, int tgt_v
 
 } // namespace ConvNet
 
-#endif
\ No newline at end of file
+#endif
@@ -8,6 +8,102 @@
 namespace ConvNet {
 using namespace Upp;
 
+// Element type of the Volume and Mat storage. Single precision halves the memory traffic
+// of every layer and doubles the SIMD width. Build with the CONVNET_DOUBLE flag to get
+// double precision back, e.g. for numerical gradient checks.
+#ifdef flagCONVNET_DOUBLE
+typedef double Real;
+#else
+typedef float Real;
+#endif
+
+class RealBuffer;
+
+// Serializes a vector of Real values with the element size given in real_size. When
+// loading, values stored with the other precision are converted.
+void SerializeReals(Stream& s, Vector<Real>& v, int real_size);
+void SerializeReals(Stream& s, RealBuffer& v, int real_size);
+
+// Counts the heap allocations made by Volume buffers and layer scratch buffers. Once a
+// Net has been planned (Net::Plan), forward and backward steps must not change it.
+int  GetBufferAllocations();
+void CountBufferAllocation();
+
+// Resizes a data buffer and counts the resize if it has to grow the allocation.
+template <class T>
+inline void SetBufferCount(Vector<T>& v, int n) {
+	if (n > v.GetAlloc())
+		CountBufferAllocation();
+	v.SetCount(n);
+}
+
+template <class T>
+inline void SetBufferCount(Vector<T>& v, int n, const T& init) {
+	if (n > v.GetAlloc())
+		CountBufferAllocation();
+	v.SetCount(n, init);
+}
+
+// Storage of the Volume values. The buffer either owns its values or is a view into an
+// external array, e.g. the parameter arena of a Net (Net::FlattenParameters). Resizing a
+// view to its own count keeps it, so copying into a volume of the same size writes through
+// to the arena, and SetCount(n, init) fills the viewed values with init. Any other count
+// detaches the buffer into an owned copy first.
+class RealBuffer : Moveable<RealBuffer> {
+	Vector<Real> data;
+	Real* view = NULL;
+	int view_count = 0;
+	
+public:
+	Real* Begin() {return view ? view : data.Begin();}
+	Real* End() {return Begin() + GetCount();}
+	const Real* Begin() const {return view ? view : data.Begin();}
+	const Real* End() const {return Begin() + GetCount();}
+	Real& operator[](int i) {ASSERT(i >= 0 && i < GetCount()); return Begin()[i];}
+	const Real& operator[](int i) const {ASSERT(i >= 0 && i < GetCount()); return Begin()[i];}
+	int GetCount() const {return view ? view_count : data.GetCount();}
+	int GetAlloc() const {return view ? view_count : data.GetAlloc();}
+	bool IsEmpty() const {return GetCount() == 0;}
+	bool IsView() const {return view;}
+	
+	void SetCount(int n) {if (view && n == view_count) return; Detach(); data.SetCount(n);}
+	void SetCount(int n, Real init) {
+		if (view && n == view_count) {
+			for (int i = 0; i < n; i++)
+				view[i] = init;
+			return;
+		}
+		Detach();
+		data.SetCount(n, init);
+	}
+	void Clear() {view = NULL; view_count = 0; data.Clear();}
+	void SetView(Real* p, int n) {view = p; view_count = n; data.Clear();}
+	void Detach() {
+		if (!view) return;
+		data.SetCount(view_count);
+		memcpy(data.Begin(), view, view_count * sizeof(Real));
+		view = NULL;
+		view_count = 0;
+	}
+	
+	friend void Swap(RealBuffer& a, RealBuffer& b) {
+		Upp::Swap(a.data, b.data);
+		Upp::Swap(a.view, b.view);
+		Upp::Swap(a.view_count, b.view_count);
+	}
+};
+
+inline void SetBufferCount(RealBuffer& v, int n) {
+	if (n > v.GetAlloc())
+		CountBufferAllocation();
+	v.SetCount(n);
+}
+
+inline void SetBufferCount(RealBuffer& v, int n, Real init) {
+	if (n > v.GetAlloc())
+		CountBufferAllocation();
+	v.SetCount(n, init);
+}
 
 
 
@@ -19,9 +115,23 @@ using namespace Upp;
 // it is used to hold data for all filters, all volumes,
 // all weights, and also stores all gradients w.r.t.
 // the data.
+//
+// The gradient buffer is allocated lazily: Init and the constructors only size the
+// weights, and the gradients are allocated (zeroed) by the first call that writes them.
+// Until then every gradient reads as zero. Forward passes never touch the gradients,
+// so inference-only volumes carry no gradient storage at all.
+//
+// A volume can also hold a mini-batch of samples of the same size. The samples are stored
+// one after another, so GetLength() is the length of one sample and GetCount() is
+// GetBatch() * GetLength(). The (x, y, d) accessors address the first sample, and the
+// accessors taking a leading sample index b address the others.
 class Volume : Moveable<Volume> {
-	Vector<double> weight_gradients;
-	Vector<double> weights;
+	RealBuffer weight_gradients;
+	RealBuffer weights;
+	
+	void AllocGradients();
+	void ResetGradients(int count);
+	void CopyGradients(const Volume& src);
 
 protected:
 	
@@ -29,6 +139,7 @@ protected:
 	int height;
 	int depth;
 	int length;
+	int batch = 1;
 	
 public:
 
@@ -44,32 +155,53 @@ public:
 	Volume& Init(int width, int height, int depth); // Volume will be filled with random numbers
 	Volume& Init(int width, int height, int depth, const Vector<double>& weights);
 	Volume& Init(int width, int height, int depth, double default_value);
+	Volume& SetSize(int width, int height, int depth, int batch = 1); // keeps the buffers if the length doesn't change
 	
 	~Volume();
 	
 	Volume& operator=(const Volume& src);
 	Volume& Set(const Volume& src);
+	Volume& SetWeights(const Volume& src); // copies weights only, like SetSize for the gradients
 	Volume& Set(const Vector<double>& src);
 	Volume& Set(int w, int h, int d, const Vector<double>& src);
+	void SetSample(int b, const Volume& src);
+	void SetSample(int b, const Vector<double>& src);
+	
+	const RealBuffer& GetWeights() const {return weights;}
+	const RealBuffer& GetGradients() const {return weight_gradients;} // empty if not allocated
+	RealBuffer& GetWeights() {return weights;}
+	RealBuffer& GetGradients() {if (weight_gradients.IsEmpty()) AllocGradients(); return weight_gradients;}
+	
+	// Moves the values into external arrays of GetCount() elements, e.g. the parameter
+	// arena of a Net. Unallocated gradients are written as zeros.
+	void SetView(Real* w, Real* g);
+	void Detach(); // copies the values back into owned buffers
+	bool IsView() const {return weights.IsView();}
 	
-	const Vector<double>& GetWeights() const {return weights;}
-	const Vector<double>& GetGradients() const {return weight_gradients;}
+	// Views the weights in external memory of width * height * depth values, e.g. a tensor
+	// of a mapped GGUF file. The gradients are owned and allocated lazily.
+	Volume& MapWeights(Real* w, int width, int height, int depth);
 	
 	void Add(int i, double v);
 	void Add(int x, int y, int d, double v);
 	void AddFrom(const Volume& volume);
 	void AddFromScaled(const Volume& volume, double a);
 	void AddGradient(int x, int y, int d, double v);
+	void AddGradient(int b, int x, int y, int d, double v);
 	void AddGradient(int i, double v);
 	void AddGradientFrom(const Volume& volume);
 	double Get(int x, int y, int d) const;
+	double Get(int b, int x, int y, int d) const;
 	double TryGet(int x, int y, int d) const;
 	double GetGradient(int x, int y, int d) const;
+	double GetGradient(int b, int x, int y, int d) const;
 	double TryGetGradient(int x, int y, int d) const;
 	void Set(int x, int y, int d, double v);
+	void Set(int b, int x, int y, int d, double v);
 	void SetConst(double c);
 	void SetConstGradient(double c);
 	void SetGradient(int x, int y, int d, double v);
+	void SetGradient(int b, int x, int y, int d, double v);
 	double Get(int i) const;
 	double TryGet(int i) const;
 	void Set(int i, double v);
@@ -77,29 +209,37 @@ public:
 	double TryGetGradient(int i) const;
 	void SetGradient(int i, double v);
 	void ZeroGradients();
+	void ReleaseGradients();
+	bool HasGradients() const {return !weight_gradients.IsEmpty();}
 	void Serialize(Stream& s);
 	void Augment(int crop, int dx=-1, int dy=-1, bool fliplr=false);
+	void SetAugmentedSample(int b, const Volume& src, int dx, int dy, bool fliplr); // crops the size of this
 	void SetData(Vector<double>& data);
 	void SwapData(Volume& vol);
 	
 	int GetPos(int x, int y, int d) const;
+	int GetPos(int b, int x, int y, int d) const {return b * length + GetPos(x, y, d);}
 	int TryGetPos(int x, int y, int d) const;
 	int GetWidth()  const {return width;}
 	int GetHeight() const {return height;}
 	int GetDepth()  const {return depth;}
 	int GetLength() const {return length;}
-	int GetMaxColumn() const;
+	int GetBatch()  const {return batch;}
+	int GetMaxColumn() const {return GetMaxColumn(0);}
+	int GetMaxColumn(int b) const;
 	int GetSampledColumn() const;
 	int GetCount() const {return weights.GetCount();}
 	int GetGradientCount() const {return weight_gradients.GetCount();}
 	
-	static double Get(const Vector<double>& in, int x, int y, int d, int width, int depth) {
+	template <class T>
+	static double Get(const Vector<T>& in, int x, int y, int d, int width, int depth) {
 		ASSERT(x >= 0 && y >= 0 && d >= 0 && x < width && d < depth);
 		int pos = ((width * y) + x) * depth + d;
 		return in[pos];
 	}
 	
-	static void Set(Vector<double>& in, int x, int y, int d, int width, int depth, double v) {
+	template <class T>
+	static void Set(Vector<T>& in, int x, int y, int d, int width, int depth, double v) {
 		ASSERT(x >= 0 && y >= 0 && d >= 0 && x < width && d < depth);
 		int pos = ((width * y) + x) * depth + d;
 		in[pos] = v;
@@ -290,7 +430,9 @@ inline String FixJsonComma(const String& json) {
 	return json;
 }
 
-inline void HeaplessCopy(Vector<double>& dest, const Vector<double>& src) {
+// Copies between Vector and RealBuffer containers of any element type.
+template <class D, class S>
+inline void HeaplessCopy(D& dest, const S& src) {
 	int count = src.GetCount();
 	dest.SetCount(count);
 	for(int i = 0; i < count; i++)
@@ -327,7 +469,7 @@ struct SimpleVolume {
 		w = width;
 		h = height;
 		d = depth;
-		data.SetCount(w * h * d);
+		SetBufferCount(data, w * h * d);
 	}
 	
 	void Zero() {
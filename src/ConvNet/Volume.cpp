@@ -2,6 +2,16 @@
 
 namespace ConvNet {
 
+static Atomic buffer_allocations;
+
+int GetBufferAllocations() {
+	return buffer_allocations;
+}
+
+void CountBufferAllocation() {
+	AtomicInc(buffer_allocations);
+}
+
 Volume::Volume() {
 	width = 0;
 	height = 0;
@@ -27,8 +37,6 @@ Volume::Volume(const Vector<double>& weights) {
 	length = depth;
 	
 	HeaplessCopy(this->weights, weights);
-	
-	weight_gradients.SetCount(depth, 0.0);
 }
 
 Volume::Volume(int width, int height, int depth, const Vector<double>& weights) {
@@ -41,8 +49,6 @@ Volume::Volume(int width, int height, int depth, const Vector<double>& weights)
 	ASSERT(length == weights.GetCount());
 	
 	HeaplessCopy(this->weights, weights);
-	
-	weight_gradients.SetCount(length, 0.0);
 }
 
 Volume::Volume(int width, int height, int depth, Volume& vol) {
@@ -55,23 +61,86 @@ Volume::Volume(int width, int height, int depth, Volume& vol) {
 	HeaplessCopy(this->weights, vol.weights);
 	
 	ASSERT(this->weights.GetCount() == length);
-	
-	weight_gradients.SetCount(length, 0.0);
 }
 
 Volume::~Volume() {
 	
 }
 
+template <class V>
+static void SerializeRealsT(Stream& s, V& v, int real_size) {
+	int count = v.GetCount();
+	s / count;
+	if (s.IsLoading()) {
+		if (count < 0 || (int64)count * real_size > s.GetLeft()) {
+			s.LoadError();
+			return;
+		}
+		v.SetCount(count);
+		if (real_size == sizeof(Real)) {
+			s.SerializeRaw((byte*)v.Begin(), count * sizeof(Real));
+		}
+		else if (real_size == sizeof(double)) {
+			for(int i = 0; i < count; i++) {double d; s % d; v[i] = (Real)d;}
+		}
+		else if (real_size == sizeof(float)) {
+			for(int i = 0; i < count; i++) {float f; s % f; v[i] = (Real)f;}
+		}
+		else s.LoadError();
+	}
+	else {
+		s.SerializeRaw((byte*)v.Begin(), count * sizeof(Real));
+	}
+}
+
+void SerializeReals(Stream& s, Vector<Real>& v, int real_size) {
+	SerializeRealsT(s, v, real_size);
+}
+
+void SerializeReals(Stream& s, RealBuffer& v, int real_size) {
+	SerializeRealsT(s, v, real_size);
+}
+
 void Volume::Serialize(Stream& s) {
-	s % weight_gradients % weights % width % height % depth % length;
+	// Files written before the Real storage type start with the gradient count of a
+	// Vector<double>. The current format starts with a negative version number instead,
+	// so both can be told apart by the first packed int.
+	int version = -2;
+	if (s.IsStoring()) {
+		byte real_size = sizeof(Real);
+		s / version % real_size;
+		SerializeReals(s, weight_gradients, real_size);
+		SerializeReals(s, weights, real_size);
+	}
+	else {
+		s / version;
+		if (version >= 0) {
+			Vector<double> tmp;
+			tmp.SetCount(version);
+			for(int i = 0; i < version; i++)
+				s % tmp[i];
+			HeaplessCopy(weight_gradients, tmp);
+			s % tmp;
+			HeaplessCopy(weights, tmp);
+		}
+		else {
+			byte real_size = 0;
+			s % real_size;
+			SerializeReals(s, weight_gradients, real_size);
+			SerializeReals(s, weights, real_size);
+		}
+	}
+	s % width % height % depth % length;
+	if (s.IsLoading())
+		batch = length > 0 ? max(1, weights.GetCount() / length) : 1;
 }
 
-int Volume::GetMaxColumn() const {
+int Volume::GetMaxColumn(int b) const {
+	const Real* w = weights.Begin() + b * length;
 	double max = -DBL_MAX;
 	int pos = -1;
-	for(int i = 0; i < weights.GetCount(); i++) {
-		double d = weights[i];
+	for(int i = 0; i < length; i++) {
+		double d = w[i];
 		if (i == 0 || d > max) {
 			max = d;
 			pos = i;
@@ -95,10 +164,11 @@ int Volume::GetSampledColumn() const {
 }
 
 void Volume::SetData(Vector<double>& data) {
-	weights.SetCount(data.GetCount());
+	SetBufferCount(weights, data.GetCount());
 	for(int i = 0; i < weights.GetCount(); i++)
 		weights[i] = data[i];
-	weight_gradients.SetCount(data.GetCount(), 0);
+	ResetGradients(data.GetCount());
+	batch = 1;
 }
 
 Volume& Volume::operator=(const Volume& src) {
@@ -106,8 +176,9 @@ Volume& Volume::operator=(const Volume& src) {
 	height = src.height;
 	depth = src.depth;
 	length = src.length;
+	batch = src.batch;
 	HeaplessCopy(weights, src.weights);
-	HeaplessCopy(weight_gradients, src.weight_gradients);
+	CopyGradients(src);
 	return *this;
 }
 
@@ -116,20 +187,81 @@ Volume& Volume::Set(const Volume& src) {
 	height = src.height;
 	depth = src.depth;
 	length = src.length;
+	batch = src.batch;
 	HeaplessCopy(weights, src.weights);
-	HeaplessCopy(weight_gradients, src.weight_gradients);
+	CopyGradients(src);
+	return *this;
+}
+
+void Volume::CopyGradients(const Volume& src) {
+	// a view keeps its arena slot: unallocated source gradients are copied as zeros
+	if (weight_gradients.IsView() && src.weight_gradients.IsEmpty())
+		ZeroGradients();
+	else
+		HeaplessCopy(weight_gradients, src.weight_gradients);
+}
+
+void Volume::SetView(Real* w, Real* g) {
+	int count = weights.GetCount();
+	memcpy(w, weights.Begin(), count * sizeof(Real));
+	if (weight_gradients.GetCount() == count)
+		memcpy(g, weight_gradients.Begin(), count * sizeof(Real));
+	else
+		memset(g, 0, count * sizeof(Real));
+	weights.SetView(w, count);
+	weight_gradients.SetView(g, count);
+}
+
+void Volume::Detach() {
+	weights.Detach();
+	weight_gradients.Detach();
+}
+
+Volume& Volume::MapWeights(Real* w, int width, int height, int depth) {
+	ASSERT(width > 0 && height > 0 && depth > 0);
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	length = width * height * depth;
+	batch = 1;
+	weights.SetView(w, length);
+	weight_gradients.Clear();
 	return *this;
 }
 
+Volume& Volume::SetWeights(const Volume& src) {
+	SetSize(src.width, src.height, src.depth, src.batch);
+	const Real* s = src.weights.Begin();
+	Real* d = weights.Begin();
+	int count = weights.GetCount();
+	for(int i = 0; i < count; i++)
+		d[i] = s[i];
+	return *this;
+}
+
+void Volume::SetSample(int b, const Volume& src) {
+	ASSERT(b >= 0 && b < batch && src.length == length);
+	const Real* s = src.weights.Begin();
+	Real* d = weights.Begin() + b * length;
+	for(int i = 0; i < length; i++)
+		d[i] = s[i];
+}
+
+void Volume::SetSample(int b, const Vector<double>& src) {
+	ASSERT(b >= 0 && b < batch && src.GetCount() == length);
+	Real* d = weights.Begin() + b * length;
+	for(int i = 0; i < length; i++)
+		d[i] = src[i];
+}
+
 Volume& Volume::Set(const Vector<double>& src) {
 	width = 1;
 	height = 1;
 	depth = src.GetCount();
 	length = depth;
+	batch = 1;
 	HeaplessCopy(weights, src);
-	weight_gradients.SetCount(length);
-	for(int i = 0; i < length; i++)
-		weight_gradients[i] = 0;
+	ResetGradients(length);
 	return *this;
 }
 
@@ -138,11 +270,10 @@ Volume& Volume::Set(int w, int h, int d, const Vector<double>& src) {
 	height = h;
 	depth = d;
 	length = w * h * d;
+	batch = 1;
 	ASSERT(src.GetCount() == length);
 	HeaplessCopy(weights, src);
-	weight_gradients.SetCount(length);
-	for(int i = 0; i < length; i++)
-		weight_gradients[i] = 0;
+	ResetGradients(length);
 	return *this;
 }
 
@@ -157,8 +288,9 @@ Volume& Volume::Init(int width, int height, int depth) {
 	int n = width * height * depth;
 	
 	length = n;
-	weights.SetCount(n, 0.0);
-	weight_gradients.SetCount(n, 0.0);
+	batch = 1;
+	SetBufferCount(weights, n);
+	ResetGradients(n);
 	
 	RandomGaussian& rand = GetRandomGaussian(length);
 
@@ -182,13 +314,12 @@ Volume& Volume::Init(int width, int height, int depth, double default_value) {
 	int prev_length = length;
 	
 	length = n;
-	weights.SetCount(n);
-	weight_gradients.SetCount(n);
+	batch = 1;
+	SetBufferCount(weights, n);
+	ResetGradients(n);
 	
-	for (int i = 0; i < n; i++) {
+	for (int i = 0; i < n; i++)
 		weights[i] = default_value;
-		weight_gradients[i] = 0.0;
-	}
 	
 	return *this;
 }
@@ -205,13 +336,30 @@ Volume& Volume::Init(int width, int height, int depth, const Vector<double>& w)
 	ASSERT(n == w.GetCount());
 	
 	length = n;
-	weights.SetCount(n);
-	weight_gradients.SetCount(n);
+	batch = 1;
+	SetBufferCount(weights, n);
+	ResetGradients(n);
 	
-	for (int i = 0; i < n; i++) {
+	for (int i = 0; i < n; i++)
 		weights[i] = w[i];
-		weight_gradients[i] = 0.0;
-	}
+	
+	return *this;
+}
+
+Volume& Volume::SetSize(int width, int height, int depth, int batch) {
+	ASSERT(width > 0 && height > 0 && depth > 0 && batch > 0);
+	
+	this->width = width;
+	this->height = height;
+	this->depth = depth;
+	this->batch = batch;
+	
+	// weights are left as they are: the caller overwrites all of them
+	length = width * height * depth;
+	int count = length * batch;
+	SetBufferCount(weights, count);
+	if (weight_gradients.GetCount() != count)
+		ResetGradients(count);
 	
 	return *this;
 }
@@ -235,6 +383,14 @@ void Volume::Set(int x, int y, int d, double v) {
 	weights[ix] = v;
 }
 
+double Volume::Get(int b, int x, int y, int d) const {
+	return weights[GetPos(b,x,y,d)];
+}
+
+void Volume::Set(int b, int x, int y, int d, double v) {
+	weights[GetPos(b,x,y,d)] = v;
+}
+
 void Volume::Add(int x, int y, int d, double v) {
 	int ix = GetPos(x,y,d);
 	weights[ix] = weights[ix] + v;
@@ -246,24 +402,64 @@ void Volume::Add(int i, double v) {
 
 double Volume::GetGradient(int x, int y, int d) const {
 	int ix = GetPos(x,y,d);
-	return weight_gradients[ix];
+	return weight_gradients.IsEmpty() ? 0.0 : (double)weight_gradients[ix];
 }
 
 void Volume::SetGradient(int x, int y, int d, double v) {
 	int ix = GetPos(x,y,d);
+	if (weight_gradients.IsEmpty()) AllocGradients();
 	weight_gradients[ix] = v;
 }
 
 void Volume::AddGradient(int x, int y, int d, double v) {
 	int ix = GetPos(x,y,d);
+	if (weight_gradients.IsEmpty()) AllocGradients();
 	weight_gradients[ix] += v;
 }
 
+double Volume::GetGradient(int b, int x, int y, int d) const {
+	return weight_gradients.IsEmpty() ? 0.0 : (double)weight_gradients[GetPos(b,x,y,d)];
+}
+
+void Volume::SetGradient(int b, int x, int y, int d, double v) {
+	if (weight_gradients.IsEmpty()) AllocGradients();
+	weight_gradients[GetPos(b,x,y,d)] = v;
+}
+
+void Volume::AddGradient(int b, int x, int y, int d, double v) {
+	if (weight_gradients.IsEmpty()) AllocGradients();
+	weight_gradients[GetPos(b,x,y,d)] += v;
+}
+
 void Volume::ZeroGradients() {
+	// an unallocated buffer already reads as zero
 	for(int i = 0; i < weight_gradients.GetCount(); i++)
 		weight_gradients[i] = 0.0;
 }
 
+// Drops the gradients of new values. A parameter in the arena of a flat Net keeps its
+// slot and the gradients are zeroed instead; the slot can't be resized, the net must
+// release the arena first (Net::ReleaseArena).
+void Volume::ResetGradients(int count) {
+	if (weight_gradients.IsView() && count == weight_gradients.GetCount()) {
+		ZeroGradients();
+		return;
+	}
+	ASSERT(!weight_gradients.IsView());
+	weight_gradients.SetCount(0);
+}
+
+void Volume::AllocGradients() {
+	SetBufferCount(weight_gradients, length * batch, (Real)0);
+}
+
+void Volume::ReleaseGradients() {
+	if (weight_gradients.IsView())
+		ZeroGradients(); // the arena owns the memory
+	else
+		weight_gradients.Clear();
+}
+
 void Volume::AddFrom(const Volume& volume) {
 	for (int i = 0; i < weights.GetCount(); i++) {
 		weights[i] = weights[i] + volume.Get(i);
@@ -271,6 +467,9 @@ void Volume::AddFrom(const Volume& volume) {
 }
 
 void Volume::AddGradientFrom(const Volume& volume) {
+	if (!volume.HasGradients())
+		return;
+	if (weight_gradients.IsEmpty()) AllocGradients();
 	for (int i = 0; i < weight_gradients.GetCount(); i++) {
 		weight_gradients[i] += volume.GetGradient(i);
 	}
@@ -289,6 +488,7 @@ void Volume::SetConst(double c) {
 }
 
 void Volume::SetConstGradient(double c) {
+	if (weight_gradients.IsEmpty()) AllocGradients();
 	for (int i = 0; i < weight_gradients.GetCount(); i++) {
 		weight_gradients[i] = c;
 	}
@@ -299,18 +499,18 @@ double Volume::Get(int i) const {
 }
 
 double Volume::TryGet(int i) const {
-	const double* d = weights.Begin() + i;
+	const Real* d = weights.Begin() + i;
 	if (i >= 0 && i < weights.GetCount())
 		return *d;
 	return 0;
 }
 
 double Volume::GetGradient(int i) const {
-	return weight_gradients[i];
+	return weight_gradients.IsEmpty() ? 0.0 : (double)weight_gradients[i];
 }
 
 double Volume::TryGetGradient(int i) const {
-	const double* d = weight_gradients.Begin() + i;
+	const Real* d = weight_gradients.Begin() + i;
 	if (i >= 0 && i < weight_gradients.GetCount())
 		return *d;
 	return 0;
@@ -318,7 +518,7 @@ double Volume::TryGetGradient(int i) const {
 
 double Volume::TryGetGradient(int x, int y, int d) const {
 	int i = TryGetPos(x,y,d);
-	const double* wg = weight_gradients.Begin() + i;
+	const Real* wg = weight_gradients.Begin() + i;
 	if (i >= 0 && i < weight_gradients.GetCount())
 		return *wg;
 	return 0;
@@ -326,18 +526,20 @@ double Volume::TryGetGradient(int x, int y, int d) const {
 
 double Volume::TryGet(int x, int y, int d) const {
 	int i = TryGetPos(x,y,d);
-	const double* wg = weights.Begin() + i;
+	const Real* wg = weights.Begin() + i;
 	if (i >= 0 && i < weights.GetCount())
 		return *wg;
 	return 0;
 }
 
 void Volume::SetGradient(int i, double v) {
+	if (weight_gradients.IsEmpty()) AllocGradients();
 	weight_gradients[i] = v;
 }
 
 void Volume::AddGradient(int i, double v) {
 	ASSERT(IsFin(v));
+	if (weight_gradients.IsEmpty()) AllocGradients();
 	weight_gradients[i] += v;
 }
 
@@ -352,34 +554,36 @@ void Volume::Augment(int crop, int dx, int dy, bool fliplr) {
 	if (dx == -1) dx = Random(width - crop);
 	if (dy == -1) dy = Random(height - crop);
 	
-	// randomly sample a crop in the input volume
-	if (crop != width || dx != 0 || dy != 0) {
-		Volume W;
-		W.Init(crop, crop, depth, 0.0);
-		for (int x = 0; x < crop; x++) {
-			for (int y = 0; y < crop; y++) {
-				if (x+dx < 0 || x+dx >= width || y+dy < 0 || y+dy >= height)
-					continue; // oob
-				for (int d = 0; d < depth; d++) {
-					W.Set(x, y, d, Get(x+dx, y+dy, d)); // copy data over
-				}
-			}
-		}
-		SwapData(W);
-	}
+	if (crop == width && dx == 0 && dy == 0 && !fliplr)
+		return;
 	
-	if (fliplr) {
-		// flip volume horziontally
-		Volume vol;
-		vol.Init(width, height, depth, 0.0);
+	Volume W;
+	W.SetSize(crop, crop, depth);
+	W.SetAugmentedSample(0, *this, dx, dy, fliplr);
+	SwapData(W);
+}
+
+// Copies the crop of the size of this volume at (dx, dy) in src to the sample b, and flips it
+// horizontally if fliplr is set. Values outside of src are zero.
+void Volume::SetAugmentedSample(int b, const Volume& src, int dx, int dy, bool fliplr) {
+	ASSERT(b >= 0 && b < batch && src.depth == depth);
+	Real* dst = weights.Begin() + b * length;
+	const Real* s = src.weights.Begin();
+	for (int y = 0; y < height; y++) {
+		int sy = y + dy;
 		for (int x = 0; x < width; x++) {
-			for (int y = 0; y < height; y++) {
-				for (int d = 0; d < depth; d++) {
-					vol.Set(x, y, d, Get(width - x - 1, y, d)); // copy data over
-				}
+			int sx = (fliplr ? width - x - 1 : x) + dx;
+			Real* d = dst + ((width * y) + x) * depth;
+			if (sx < 0 || sx >= src.width || sy < 0 || sy >= src.height) {
+				for (int k = 0; k < depth; k++)
+					d[k] = 0;
+			}
+			else {
+				const Real* p = s + ((src.width * sy) + sx) * depth;
+				for (int k = 0; k < depth; k++)
+					d[k] = p[k];
 			}
 		}
-		SwapData(vol);
 	}
 }
 
@@ -390,7 +594,7 @@ void Volume::SwapData(Volume& vol) {
 	Swap(vol.height, height);
 	Swap(vol.depth, depth);
 	Swap(vol.length, length);
-	
+	Swap(vol.batch, batch);
 }
 
 
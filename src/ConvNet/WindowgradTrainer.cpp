@@ -4,9 +4,7 @@ namespace ConvNet {
 
 void TrainerBase::TrainImplemWindowgrad() {
 	
-	iter_count++;
-	
-	if ((iter_count % batch_size) == 0) {
+	if (AccumulateSamples()) {
 		Vector<ParametersAndGradients>& parametersAndGradients = net->GetParametersAndGradients();
 		
 		// initialize lists for accumulators. Will only be done once on first iteration
@@ -18,41 +16,23 @@ void TrainerBase::TrainImplemWindowgrad() {
 		}
 		
 		// perform an update for all sets of weights
+		TrainerStep step;
+		InitStep(step);
 		for (int i = 0; i < parametersAndGradients.GetCount(); i++) {
-			const ParametersAndGradients& parametersAndGradient = parametersAndGradients[i];
+			ParametersAndGradients& parametersAndGradient = parametersAndGradients[i];
 			
 			// param, gradient, other options in future (custom learning rate etc)
-			Volume& vol = *parametersAndGradient.volume;
-			
-			// learning rate for some parameters.
-			double l2_decay_mul = IF_NULL_1(parametersAndGradient.l2_decay_mul);
-			double l1_decay_mul = IF_NULL_1(parametersAndGradient.l1_decay_mul);
-			double l2_decay = this->l2_decay * l2_decay_mul;
-			double l1_decay = this->l1_decay * l1_decay_mul;
+			Volume& vol = GetUpdatedVolume(i, parametersAndGradient);
+			Volume& grad = *parametersAndGradient.volume;
+			SetStepDecay(step, parametersAndGradient);
 			
+			Real* w = vol.GetWeights().Begin();
+			Real* g = grad.GetGradients().Begin(); // zeroed by the kernel, so that we can begin accumulating anew
 			int plen = vol.GetLength();
-			for (int j = 0; j < plen; j++) {
-				l2_decay_loss += l2_decay * vol.Get(j) * vol.Get(j) / 2; // accumulate weight decay loss
-				l1_decay_loss += l1_decay * fabs(vol.Get(j));
-				double l1_grad = l1_decay * (vol.Get(j) > 0 ? 1 : -1);
-				double l2_grad = l2_decay * vol.Get(j);
-				
-				double gij = (l2_grad + l1_grad + vol.GetGradient(j)) / batch_size; // raw batch gradient
-				
-				Vector<double>& gsumi = gsum[i];
-				
-				// this is adagrad but with a moving window weighted average
-				// so the gradient is not accumulated over the entire history of the run.
-				// it's also referred to as Idea #1 in Zeiler paper on Adadelta. Seems reasonable to me!
-				gsumi[j] = ro * gsumi[j] + (1 - ro) * gij * gij;
-				double dx = -1.0 * learning_rate / sqrt(gsumi[j] + eps) * gij;
-				
-				// eps added for better conditioning
-				vol.Set(j, vol.Get(j) + dx);
-				
-				vol.SetGradient(j, 0.0); // zero out gradient so that we can begin accumulating anew
-			}
+			UpdateWindowgrad(step, w, g, gsum[i].Begin(), plen);
 		}
+		l1_decay_loss += step.l1_decay_loss;
+		l2_decay_loss += step.l2_decay_loss;
 	}
 	
 	// in future, TODO: have to completely redo the way loss is done around the network as currently
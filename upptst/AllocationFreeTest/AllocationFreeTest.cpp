@@ -0,0 +1,77 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+    
+    LOG("AllocationFree Test - planned nets don't allocate in forward and backward");
+    
+    Session ses;
+    ses.AddInputLayer(16, 16, 3);
+    ses.AddConvLayer(5, 5, 8, 0.0, 1.0, 1, 2);
+    ses.AddReluLayer();
+    ses.AddLrnLayer(1.0, 3, 0.1, 0.75);
+    ses.AddPoolLayer(2, 2, 2);
+    ses.AddDropoutLayer(0.2);
+    ses.AddFullyConnLayer(4);
+    ses.AddSoftmaxLayer(4);
+    Net& net = ses.GetNetwork();
+    
+    Volume x;
+    x.Init(16, 16, 3);
+    
+    // training steps
+    net.Plan();
+    int before = GetBufferAllocations();
+    for (int step = 0; step < 10; step++) {
+        net.Forward(x, true);
+        net.Backward(step % 4, 0.0);
+    }
+    int allocs = GetBufferAllocations() - before;
+    LOG("  Allocations in 10 training steps: " << allocs);
+    ASSERT(allocs == 0);
+    
+    // mini-batch training steps
+    Volume batch;
+    batch.SetSize(16, 16, 3, 4);
+    for (int i = 0; i < batch.GetCount(); i++)
+        batch.Set(i, Randomf());
+    Vector<int> labels;
+    Vector<double> rewards;
+    labels << 0 << 1 << 2 << 3;
+    rewards.SetCount(4, 0.0);
+    net.Plan(true, 4);
+    before = GetBufferAllocations();
+    for (int step = 0; step < 10; step++) {
+        net.Forward(batch, true);
+        net.Backward(labels, rewards);
+    }
+    allocs = GetBufferAllocations() - before;
+    LOG("  Allocations in 10 mini-batch training steps: " << allocs);
+    ASSERT(allocs == 0);
+    
+    // inference steps, on a net planned without gradients
+    Session inf;
+    inf.AddInputLayer(16, 16, 3);
+    inf.AddConvLayer(5, 5, 8, 0.0, 1.0, 1, 2);
+    inf.AddReluLayer();
+    inf.AddPoolLayer(2, 2, 2);
+    inf.AddFullyConnLayer(4);
+    inf.AddSoftmaxLayer(4);
+    Net& inf_net = inf.GetNetwork();
+    inf_net.Plan(false);
+    before = GetBufferAllocations();
+    for (int step = 0; step < 10; step++)
+        inf_net.Forward(x, false);
+    allocs = GetBufferAllocations() - before;
+    LOG("  Allocations in 10 inference steps: " << allocs);
+    ASSERT(allocs == 0);
+    for (int i = 0; i < inf_net.GetLayers().GetCount(); i++)
+        ASSERT(!inf_net.GetLayers()[i].output_activation.HasGradients());
+    
+    LOG("AllocationFree tests completed successfully!");
+}
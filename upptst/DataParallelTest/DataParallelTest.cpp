@@ -0,0 +1,107 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+static void AddClassifier(Session& ses) {
+    ses.AddInputLayer(8, 8, 2);
+    ses.AddConvLayer(3, 3, 6, 0.0, 1.0, 1, 1);
+    ses.AddReluLayer();
+    ses.AddPoolLayer(2, 2, 2);
+    ses.AddFullyConnLayer(3);
+    ses.AddSoftmaxLayer(3);
+}
+
+static void AddRegressor(Session& ses) {
+    ses.AddInputLayer(1, 1, 6);
+    ses.AddFullyConnLayer(10);
+    ses.AddTanhLayer();
+    ses.AddFullyConnLayer(2);
+    ses.AddRegressionLayer();
+}
+
+// Trains the same data and initial weights with 1 thread and with threads threads, twice,
+// and compares the resulting weights.
+static void CheckTraining(void (*add_layers)(Session&), int batch_size, int threads, bool classify) {
+    Vector<int> labels;
+    Vector<double> values;
+    for (int j = 0; j < 50; j++)
+        labels.Add(Random(3));
+    for (int j = 0; j < 50 * 8 * 8 * 2; j++)
+        values.Add(Randomf() * 2 - 1);
+
+    Session ses[3];
+    for (int i = 0; i < 3; i++) {
+        Session& s = ses[i];
+        add_layers(s);
+        if (i > 0)
+            CopyParameters(s.GetNetwork(), ses[0].GetNetwork());
+        s.GetTrainer().SetType(TRAINER_SGD).SetBatchSize(batch_size).SetMomentum(0.9).SetL2Decay(0.001);
+        s.SetThreadCount(i == 0 ? 1 : threads);
+        s.SetTestPredict(true);
+
+        SessionData& d = s.Data();
+        if (classify) {
+            d.BeginData(3, 50, 8, 8, 2);
+            for (int j = 0; j < 50; j++) {
+                d.SetLabel(j, labels[j]);
+                for (int k = 0; k < 8 * 8 * 2; k++)
+                    d.SetData(j, k, values[j * 8 * 8 * 2 + k] + (k % 3 == labels[j] ? 0.5 : 0.0));
+            }
+        }
+        else {
+            d.BeginDataResult(2, 50, 6);
+            for (int j = 0; j < 50; j++) {
+                double sum = 0;
+                for (int k = 0; k < 6; k++) {
+                    d.SetData(j, k, values[j * 6 + k]);
+                    sum += values[j * 6 + k];
+                }
+                d.SetResult(j, 0, sum / 6);
+                d.SetResult(j, 1, -sum / 6);
+            }
+        }
+        SeedRandom(1234); // EndData shuffles the samples
+        d.EndData();
+    }
+
+    for (int i = 0; i < 3; i++) {
+        ses[i].TrainBegin();
+        for (int j = 0; j < 3; j++)
+            ses[i].TrainIteration();
+        ses[i].TrainEnd();
+    }
+
+    Vector<double> single, parallel, again;
+    GetParameters(ses[0].GetNetwork(), single);
+    GetParameters(ses[1].GetNetwork(), parallel);
+    GetParameters(ses[2].GetNetwork(), again);
+    double diff = MaxDiff(single, parallel);
+    double repeat_diff = MaxDiff(parallel, again);
+    LOG("    weight diff to 1 thread " << diff << ", between two runs " << repeat_diff
+        << ", loss " << ses[0].GetLossAverage() << " vs " << ses[1].GetLossAverage()
+        << ", " << ses[1].GetThroughputAverage() << " samples/s");
+    ASSERT(diff < 1e-9);
+    ASSERT(repeat_diff == 0);
+    ASSERT(fabs(ses[0].GetLossAverage() - ses[1].GetLossAverage()) < 1e-9);
+    ASSERT(ses[0].GetStepCount() == ses[1].GetStepCount());
+    ASSERT(ses[1].GetThroughputWindow().GetAverage() >= 0);
+}
+
+CONSOLE_APP_MAIN
+{
+    LOG("DataParallel Test - training with several worker threads against one thread");
+
+    LOG("  Classifier, batch 16, 4 threads");
+    CheckTraining(AddClassifier, 16, 4, true);
+
+    LOG("  Regression, batch 10, 3 threads");
+    CheckTraining(AddRegressor, 10, 3, false);
+
+    LOG("  Regression, batch 2, 4 threads");
+    CheckTraining(AddRegressor, 2, 4, false);
+
+    LOG("DataParallel tests completed successfully!");
+}
@@ -0,0 +1,273 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+#ifdef flagCONVNET_DOUBLE
+static const double tolerance = 1e-9;
+#else
+static const double tolerance = 1e-4;
+#endif
+
+static double MaxLogitDiff(GPTModel& a, GPTModel& b) {
+    double diff = 0;
+    Vector<double> la, lb;
+    for (int trial = 0; trial < 5; trial++) {
+        Vector<int> context;
+        RandomTokens(context, 1 + Random(12), a.GetVocabSize());
+        GetValues(a.GetNextTokenLogits(context), la);
+        GetValues(b.GetNextTokenLogits(context), lb);
+        diff = max(diff, MaxDiff(la, lb));
+    }
+    return diff;
+}
+
+// Leaves "output.weight" out, as in the checkpoints with tied embeddings
+struct TiedWriter : GGUFWriter {
+    virtual void Tensor(const String& name, Volume& v, int ne0, int ne1) {
+        if (name != "output.weight")
+            GGUFWriter::Tensor(name, v, ne0, ne1);
+    }
+};
+
+// Writes the q, k and v projections as one "attn_qkv" tensor, like GPT-2 checkpoints
+struct FusedWriter : GGUFWriter {
+    Array<Volume> fused;
+    Vector<const Volume*> parts;
+
+    virtual void Tensor(const String& name, Volume& v, int ne0, int ne1) {
+        int pos = name.Find("attn_");
+        String part = pos >= 0 ? name.Mid(pos, 7) : String();
+        if (part != "attn_q." && part != "attn_k." && part != "attn_v.") {
+            GGUFWriter::Tensor(name, v, ne0, ne1);
+            return;
+        }
+        parts.Add(&v);
+        if (part != "attn_v.")
+            return;
+        // the parts are q, k and v of the same suffix, every other call
+        int n = parts.GetCount();
+        Volume& f = fused.Add();
+        f.Init(ne0, 3 * ne1, 1, 0.0);
+        int len = ne0 * ne1;
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < len; j++)
+                f.Set(i * len + j, parts[n - 5 + 2 * i]->Get(j));
+        GGUFWriter::Tensor(name.Left(pos) + "attn_qkv." + name.Mid(pos + 7), f, ne0, 3 * ne1);
+        if (name.EndsWith(".bias"))
+            parts.Clear();
+    }
+};
+
+static void CheckGPT() {
+    LOG("  GPT model");
+    std::unique_ptr<GPTModel> model = CreateGPT(50, 16, 2, 2, 32, 64);
+    String path = GetTempFileName("gguf");
+    ASSERT(model->SaveGGUF(path));
+
+    {
+        std::unique_ptr<GPTModel> mapped = LoadGPT(path);
+        ASSERT(mapped);
+        ASSERT(mapped->IsMapped());
+        ASSERT(mapped->GetVocabSize() == 50);
+        ASSERT(mapped->GetEmbedDim() == 16);
+        ASSERT(mapped->GetNumLayers() == 2);
+        ASSERT(mapped->GetMaxSeqLen() == 64);
+        // the weights of the type of Real are not copied
+        ASSERT(mapped->GetTokenEmbeddings().IsView());
+        double diff = MaxLogitDiff(*model, *mapped);
+        LOG("    max logit difference " << diff);
+        ASSERT(diff < tolerance);
+
+        // the mapping is copy-on-write: a model which writes its weights doesn't change
+        // the other models of the file, nor the file
+        std::unique_ptr<GPTModel> other = LoadGPT(path);
+        ASSERT(other);
+        Volume& w = const_cast<Volume&>(mapped->GetTokenEmbeddings());
+        for (int i = 0; i < w.GetCount(); i++)
+            w.Set(i, 0);
+        ASSERT(other->GetTokenEmbeddings().Get(0) == model->GetTokenEmbeddings().Get(0));
+        std::unique_ptr<GPTModel> reopened = LoadGPT(path);
+        ASSERT(reopened);
+        ASSERT(MaxLogitDiff(*model, *reopened) < tolerance);
+    }
+
+    FileDelete(path);
+}
+
+static void CheckTiedOutput() {
+    LOG("  Tied output weights");
+    std::unique_ptr<GPTModel> model = CreateGPT(40, 16, 4, 1, 32, 32);
+    String path = GetTempFileName("gguf");
+    TiedWriter writer;
+    writer.Set("general.architecture", "convnet-gpt")
+          .Set("convnet-gpt.context_length", 32)
+          .Set("convnet-gpt.embedding_length", 16)
+          .Set("convnet-gpt.feed_forward_length", 32)
+          .Set("convnet-gpt.block_count", 1)
+          .Set("convnet-gpt.attention.head_count", 4);
+    model->VisitTensors(writer);
+    ASSERT(writer.Save(path));
+
+    {
+        std::unique_ptr<GPTModel> mapped = LoadGPT(path);
+        ASSERT(mapped);
+        // the model ties its output weights to the embeddings too
+        double diff = MaxLogitDiff(*model, *mapped);
+        LOG("    max logit difference " << diff);
+        ASSERT(diff < tolerance);
+    }
+
+    FileDelete(path);
+}
+
+static void CheckFusedQKV() {
+    LOG("  Fused attn_qkv");
+    std::unique_ptr<GPTModel> model = CreateGPT(30, 8, 2, 2, 16, 32);
+    String path = GetTempFileName("gguf");
+    FusedWriter writer;
+    writer.Set("general.architecture", "convnet-gpt")
+          .Set("convnet-gpt.context_length", 32)
+          .Set("convnet-gpt.embedding_length", 8)
+          .Set("convnet-gpt.feed_forward_length", 16)
+          .Set("convnet-gpt.block_count", 2)
+          .Set("convnet-gpt.attention.head_count", 2);
+    model->VisitTensors(writer);
+    ASSERT(writer.Save(path));
+
+    {
+        GGUFFile file;
+        ASSERT(file.Open(path));
+        ASSERT(file.FindTensor("blk.0.attn_qkv.weight"));
+        ASSERT(!file.FindTensor("blk.0.attn_q.weight"));
+    }
+    {
+        std::unique_ptr<GPTModel> mapped = LoadGPT(path);
+        ASSERT(mapped);
+        double diff = MaxLogitDiff(*model, *mapped);
+        LOG("    max logit difference " << diff);
+        ASSERT(diff < tolerance);
+    }
+
+    FileDelete(path);
+}
+
+// The metadata keeps the doubles exactly, and a tensor of an unknown type is found but not mapped
+static void CheckTypes() {
+    LOG("  Metadata and tensor types");
+    Volume v;
+    v.Init(4, 1, 1, 1.0);
+    String path = GetTempFileName("gguf");
+    GGUFWriter writer;
+    writer.Set("test.epsilon", 0.1).Set("test.count", 7);
+    writer.Tensor("test.weight", v, 4);
+    ASSERT(writer.Save(path));
+
+    // the type follows the name, the dimension count and the one dimension
+    String data = LoadFile(path);
+    int pos = data.Find("test.weight");
+    ASSERT(pos >= 0);
+    StringBuffer b(data);
+    int type = 1000;
+    memcpy(b.Begin() + pos + 11 + 4 + 8, &type, 4);
+    ASSERT(SaveFile(path, b));
+
+    {
+        GGUFFile file;
+        ASSERT(file.Open(path));
+        ASSERT((double)file.Get("test.epsilon") == 0.1);
+        ASSERT(file.GetInt("test.count") == 7);
+        const GGUFTensor* t = file.FindTensor("test.weight");
+        ASSERT(t && t->type == 1000 && !t->data);
+
+        GGUFMapper mapper(file);
+        Volume w;
+        mapper.Tensor("test.weight", w, 4);
+        ASSERT(mapper.GetMissing().IsEmpty());
+        ASSERT(mapper.GetErrors().GetCount() == 1);
+        ASSERT(w.GetCount() == 0);
+    }
+
+    FileDelete(path);
+}
+
+static void MakeNet(Session& ses, int filters) {
+    ses.AddInputLayer(8, 8, 3);
+    ses.AddConvLayer(3, 3, filters, 0.0, 1.0, 1, 1);
+    ses.AddReluLayer();
+    ses.AddConvLayer(1, 1, 4);
+    ses.AddFullyConnLayer(10);
+    ses.AddSoftmaxLayer(10);
+}
+
+static void CheckNet() {
+    LOG("  Net");
+    Session ses;
+    MakeNet(ses, 6);
+    String path = GetTempFileName("gguf");
+    ASSERT(ses.GetNetwork().SaveGGUF(path));
+
+    std::shared_ptr<GGUFFile> file = std::make_shared<GGUFFile>();
+    ASSERT(file->Open(path));
+    ASSERT(file->GetArchitecture() == "convnet");
+
+    Session mapped;
+    MakeNet(mapped, 6);
+    ASSERT(mapped.GetNetwork().MapGGUF(file));
+    ASSERT(mapped.GetNetwork().IsMapped());
+
+    Volume input;
+    double diff = 0;
+    Vector<double> a, b;
+    for (int trial = 0; trial < 5; trial++) {
+        input.Init(8, 8, 3);
+        GetValues(ses.GetNetwork().Forward(input), a);
+        GetValues(mapped.GetNetwork().Forward(input), b);
+        diff = max(diff, MaxDiff(a, b));
+    }
+    LOG("    max output difference " << diff);
+    ASSERT(diff < tolerance);
+
+    // a net of another architecture doesn't fit the tensors
+    Session other;
+    MakeNet(other, 5);
+    ASSERT(!other.GetNetwork().MapGGUF(file));
+
+    mapped.GetNetwork().Clear();
+    file.reset();
+    FileDelete(path);
+}
+
+static void CheckLoadTime() {
+    LOG("  Load time");
+    std::unique_ptr<GPTModel> model = CreateGPT(2000, 128, 4, 4, 512, 128);
+    String path = GetTempFileName("gguf");
+    ASSERT(model->SaveGGUF(path));
+    model.reset();
+
+    TimeStop ts;
+    std::unique_ptr<GPTModel> mapped = LoadGPT(path);
+    ASSERT(mapped);
+    LOG("    mapped " << GetFileLength(path) / 1024 << " KiB in " << ts.Elapsed() << " ms");
+    mapped.reset();
+
+    FileDelete(path);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+    
+    LOG("GGUF Map Test - mapping the weights of models from GGUF files");
+    
+    CheckGPT();
+    CheckTiedOutput();
+    CheckFusedQKV();
+    CheckTypes();
+    CheckNet();
+    CheckLoadTime();
+    
+    LOG("GGUF Map Test passed");
+}
@@ -0,0 +1,203 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+#ifdef flagCONVNET_DOUBLE
+static const double tolerance = 1e-9;
+#else
+static const double tolerance = 1e-4;
+#endif
+
+// The logits of the context without the cache
+static void GetReference(GPTModel& model, const Vector<int>& context, Vector<double>& out) {
+    GetValues(model.GetNextTokenLogits(context), out);
+}
+
+// One decoder step per token gives the logits of the forward pass over the whole context
+static void CheckIncremental(GPTModel& model) {
+    LOG("  Incremental decoding");
+    Vector<int> tokens, context;
+    RandomTokens(tokens, 40, model.GetVocabSize());
+    Vector<double> cached, full;
+    double diff = 0;
+
+    GPTCache cache;
+    for (int i = 0; i < tokens.GetCount(); i++) {
+        GetValues(model.Decode(tokens[i], cache), cached);
+        context.Add(tokens[i]);
+        GetReference(model, context, full);
+        diff = max(diff, MaxDiff(cached, full));
+    }
+    ASSERT(cache.GetCount() == tokens.GetCount());
+    ASSERT(cache.GetLayerCount() == model.GetNumLayers());
+    ASSERT(cache.GetLayer(0).GetCount() == tokens.GetCount());
+
+    // a prompt is decoded in one step
+    GPTCache prompt;
+    GetValues(model.Decode(tokens, prompt), cached);
+    diff = max(diff, MaxDiff(cached, full));
+    LOG("    largest difference " << diff);
+    ASSERT(diff < tolerance);
+}
+
+// Truncate rolls the cache back, and the next tokens continue from there
+static void CheckRollback(GPTModel& model) {
+    LOG("  Rollback");
+    Vector<int> tokens, draft;
+    RandomTokens(tokens, 20, model.GetVocabSize());
+    RandomTokens(draft, 5, model.GetVocabSize());
+
+    GPTCache cache;
+    model.Decode(tokens, cache);
+    int64 memory = cache.GetMemory();
+    model.Decode(draft, cache);
+    ASSERT(cache.GetCount() == 25);
+
+    // the draft tokens are rejected, and a different token follows
+    cache.Truncate(20);
+    ASSERT(cache.GetCount() == 20 && cache.GetMemory() >= memory);
+    for (int i = 0; i < 20; i++)
+        ASSERT(cache.GetTokens()[i] == tokens[i]);
+    int token = (draft[0] + 1) % model.GetVocabSize();
+    Vector<double> cached, full;
+    GetValues(model.Decode(token, cache), cached);
+    tokens.Add(token);
+    GetReference(model, tokens, full);
+    ASSERT(MaxDiff(cached, full) < tolerance);
+
+    cache.Clear();
+    ASSERT(cache.GetCount() == 0 && cache.GetLayer(0).GetCount() == 0);
+}
+
+// The continuations of a shared prompt start from a copy of its cache, and decode only their
+// own tokens
+static void CheckPrefix(GPTModel& model) {
+    LOG("  Shared prefix");
+    Vector<int> prompt, a, b;
+    RandomTokens(prompt, 30, model.GetVocabSize());
+    GPTCache shared;
+    model.Decode(prompt, shared);
+
+    a <<= prompt;
+    b <<= prompt;
+    a.Add(1);
+    a.Add(2);
+    b.Add(3);
+    ASSERT(shared.GetCommonPrefix(a) == 30 && shared.GetCommonPrefix(b) == 30);
+
+    Vector<double> cached, full;
+    GPTCache cache_a = shared;
+    GetValues(model.GetNextTokenLogits(a, cache_a), cached);
+    GetReference(model, a, full);
+    ASSERT(MaxDiff(cached, full) < tolerance);
+    ASSERT(cache_a.GetCount() == 32 && shared.GetCount() == 30);
+
+    GPTCache cache_b = shared;
+    GetValues(model.GetNextTokenLogits(b, cache_b), cached);
+    GetReference(model, b, full);
+    ASSERT(MaxDiff(cached, full) < tolerance);
+
+    // a context which differs inside the cache rolls it back to the common prefix
+    b[10] = (b[10] + 1) % model.GetVocabSize();
+    ASSERT(cache_b.GetCommonPrefix(b) == 10);
+    GetValues(model.GetNextTokenLogits(b, cache_b), cached);
+    GetReference(model, b, full);
+    ASSERT(MaxDiff(cached, full) < tolerance);
+    ASSERT(cache_b.GetCount() == b.GetCount());
+
+    // the logits of the cached context are the same again
+    GetValues(model.GetNextTokenLogits(b, cache_b), cached);
+    ASSERT(MaxDiff(cached, full) < tolerance);
+}
+
+// Generation with the cache against a full forward pass per token
+static void CheckGeneration() {
+    int vocab_size = 256, embed_dim = 64, heads = 4, layers = 2, max_seq_len = 512;
+    LOG("  Generation, " << layers << " layers, embed_dim " << embed_dim);
+    std::unique_ptr<GPTSession> session = CreateGPTSession(vocab_size, embed_dim, heads, layers,
+        4 * embed_dim, max_seq_len);
+    GPTModel& model = session->GetModel();
+
+    Vector<int> prompt;
+    RandomTokens(prompt, 16, vocab_size);
+    int new_tokens = 200;
+    Vector<int> text = session->GenerateText(prompt, new_tokens);
+    ASSERT(text.GetCount() == prompt.GetCount() + new_tokens);
+    ASSERT(session->GetGeneratedTokens() == new_tokens);
+    ASSERT(session->GetCache().GetCount() == text.GetCount() - 1);
+    double cached_speed = session->GetTokensPerSecond();
+
+    Vector<int> context;
+    context <<= prompt;
+    Vector<double> logits;
+    TimeStop ts;
+    for (int i = 0; i < new_tokens; i++) {
+        GetReference(model, context, logits);
+        context.Add(model.SampleNextToken(logits));
+    }
+    double uncached_speed = new_tokens / max(ts.Seconds(), 1e-6);
+    LOG("    " << cached_speed << " tokens/s with the cache, " << uncached_speed << " tokens/s without");
+    ASSERT(cached_speed > uncached_speed);
+
+    // the session continues from the cache of the last text
+    Vector<int> more = session->GenerateText(text, 10);
+    ASSERT(more.GetCount() == text.GetCount() + 10);
+
+    // the generation stops when the context is full
+    Vector<int> full = session->GenerateText(more, max_seq_len);
+    ASSERT(full.GetCount() == max_seq_len);
+    ASSERT(session->GetCache().GetCount() == max_seq_len - 1);
+
+    // a longer context is cut to its last max_seq_len / 2 tokens, and the next tokens are
+    // decoded into the same cache until the window is full again
+    full.Add(1);
+    Vector<int> window;
+    Vector<double> cut;
+    GPTCache cache;
+    int cuts = 0;
+    for (int i = 0; i < max_seq_len; i++) {
+        int before = cache.GetCount();
+        GetValues(model.GetNextTokenLogits(full, cache), cut);
+        ASSERT(cache.GetCount() <= max_seq_len);
+        if (cache.GetCount() != before + 1) {
+            ASSERT(cache.GetCount() == max_seq_len / 2);
+            cuts++;
+        }
+        if (i % 64 == 0) {
+            window.Clear();
+            window.Append(full, full.GetCount() - cache.GetCount(), cache.GetCount());
+            GetReference(model, window, logits);
+            ASSERT(MaxDiff(cut, logits) < tolerance);
+        }
+        full.Add(model.SampleNextToken(cut));
+    }
+    LOG("    " << cuts << " cuts in " << max_seq_len << " tokens after the full context");
+    ASSERT(cuts == 2);
+
+    // without the cache, the context is cut to its last max_seq_len tokens
+    window.Clear();
+    window.Append(full, full.GetCount() - max_seq_len, max_seq_len);
+    GetReference(model, window, logits);
+    GetReference(model, full, cut);
+    ASSERT(MaxDiff(cut, logits) < tolerance);
+    Vector<int> longer = session->GenerateText(full, 5);
+    ASSERT(longer.GetCount() == full.GetCount() + 1);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("GPT Cache Test - incremental decoding with the keys and values of the earlier tokens");
+
+    GPTModel model(50, 16, 2, 3, 32, 64);
+    CheckIncremental(model);
+    CheckRollback(model);
+    CheckPrefix(model);
+    CheckGeneration();
+
+    LOG("GPTCache tests completed successfully!");
+}
@@ -0,0 +1,250 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+#ifdef flagCONVNET_DOUBLE
+static const double tolerance = 1e-9;
+#else
+static const double tolerance = 1e-4;
+#endif
+
+// The greedy sampling makes the generated text deterministic
+static GenerationParams Greedy(int max_tokens) {
+    GenerationParams p;
+    p.top_k = true;
+    p.k = 1;
+    p.max_tokens = max_tokens;
+    return p;
+}
+
+// The sequences of one batched step give the logits of their own decoder steps
+static void CheckBatchedDecode(GPTModel& model) {
+    LOG("  Batched decoder step");
+    int vocab_size = model.GetVocabSize();
+    Array<GPTCache> batched, single;
+    Vector<Vector<int>> prompts;
+    for (int i = 0; i < 5; i++) {
+        RandomTokens(prompts.Add(), 3 + 7 * i, vocab_size);
+        batched.Add();
+        single.Add();
+    }
+
+    double diff = 0;
+    Vector<GPTCache*> caches;
+    Vector<Vector<int>> tokens;
+    for (int step = 0; step < 4; step++) {
+        // the prompts in one step, and then one or two tokens of every sequence
+        caches.SetCount(0);
+        tokens.SetCount(0);
+        for (int i = 0; i < prompts.GetCount(); i++) {
+            caches.Add(&batched[i]);
+            Vector<int>& t = tokens.Add();
+            if (step == 0)
+                t <<= prompts[i];
+            else
+                RandomTokens(t, 1 + (i + step) % 2, vocab_size);
+        }
+        Volume out = model.Decode(caches, tokens);
+        ASSERT(out.GetWidth() == vocab_size && out.GetDepth() == prompts.GetCount());
+
+        for (int i = 0; i < prompts.GetCount(); i++) {
+            Volume& ref = model.Decode(tokens[i], single[i]);
+            for (int v = 0; v < vocab_size; v++)
+                diff = max(diff, fabs(out.Get(v * prompts.GetCount() + i) - ref.Get(v)));
+            ASSERT(batched[i].GetCount() == single[i].GetCount());
+        }
+    }
+    LOG("    largest difference " << diff);
+    ASSERT(diff < tolerance);
+}
+
+// The scheduler generates the same text as GPTSession::GenerateText, with more prompts than
+// fit in the batch and with prompts decoded in several steps
+static void CheckScheduler(GPTSession& session, int max_batch, int max_step_tokens) {
+    LOG("  Scheduler, batch " << max_batch << ", " << max_step_tokens << " tokens per step");
+    GPTModel& model = session.GetModel();
+    GenerationScheduler scheduler(model);
+    scheduler.SetMaxBatch(max_batch).SetMaxStepTokens(max_step_tokens);
+
+    Vector<Vector<int>> prompts;
+    Vector<int> ids;
+    for (int i = 0; i < 7; i++) {
+        RandomTokens(prompts.Add(), 1 + 5 * i, model.GetVocabSize());
+        ids.Add(scheduler.Submit(prompts[i], Greedy(3 + 4 * i)));
+    }
+    ASSERT(scheduler.GetQueuedCount() == 7);
+
+    // the first step activates a full batch
+    scheduler.Step();
+    ASSERT(scheduler.GetActiveCount() == min(max_batch, 7));
+    ASSERT(scheduler.GetQueuedCount() == 7 - min(max_batch, 7));
+
+    for (int i = ids.GetCount() - 1; i >= 0; i--) {
+        Vector<int> text = scheduler.Wait(ids[i]);
+        Vector<int> ref = session.GenerateText(prompts[i], 3 + 4 * i, 1.0, true, 1);
+        ASSERT(text.GetCount() == ref.GetCount());
+        for (int j = 0; j < ref.GetCount(); j++)
+            ASSERT(text[j] == ref[j]);
+    }
+    ASSERT(scheduler.GetActiveCount() == 0 && scheduler.GetQueuedCount() == 0);
+    LOG("    " << scheduler.GetStepCount() << " steps, average batch " << scheduler.GetAverageBatch());
+}
+
+// A stop token ends a sequence, and a sequence ends when the context of the model is full
+static void CheckStop(GPTModel& model) {
+    LOG("  Stop token and full context");
+    GenerationScheduler scheduler(model);
+    Vector<int> prompt;
+    RandomTokens(prompt, 4, model.GetVocabSize());
+
+    Vector<int> text = scheduler.Generate(prompt, Greedy(10));
+    ASSERT(text.GetCount() == 14);
+    GenerationParams p = Greedy(10);
+    p.stop_token = text[6];
+    Vector<int> stopped = scheduler.Generate(prompt, p);
+    ASSERT(stopped.GetCount() <= 7 && stopped.Top() == text[6]);
+
+    RandomTokens(prompt, model.GetMaxSeqLen() + 10, model.GetVocabSize());
+    Vector<int> full = scheduler.Generate(prompt, Greedy(10));
+    ASSERT(full.GetCount() == model.GetMaxSeqLen());
+    ASSERT(full[0] == prompt[11]);
+
+    ASSERT(scheduler.Generate(prompt, Greedy(0)).GetCount() == model.GetMaxSeqLen() - 1);
+}
+
+// A temperature of zero is greedy decoding, like top-k sampling with k = 1
+static void CheckZeroTemperature(GPTModel& model) {
+    LOG("  Zero temperature");
+    Vector<double> logits;
+    logits << 1.0 << 5.0 << 2.0 << -3.0;
+    ASSERT(model.SampleNextToken(logits, 0.0) == 1);
+    ASSERT(model.SampleNextToken(logits, -1.0) == 1);
+
+    GenerationScheduler scheduler(model);
+    Vector<int> prompt;
+    RandomTokens(prompt, 6, model.GetVocabSize());
+    GenerationParams p;
+    p.temperature = 0;
+    p.max_tokens = 10;
+    Vector<int> text = scheduler.Generate(prompt, p);
+    Vector<int> ref = scheduler.Generate(prompt, Greedy(10));
+    ASSERT(text.GetCount() == ref.GetCount());
+    for (int i = 0; i < ref.GetCount(); i++)
+        ASSERT(text[i] == ref[i]);
+}
+
+// Many threads submit their prompts to the scheduler thread
+static void CheckThreads(GPTSession& session) {
+    LOG("  Worker thread");
+    GPTModel& model = session.GetModel();
+    int count = 16;
+    Vector<Vector<int>> prompts, texts;
+    for (int i = 0; i < count; i++)
+        RandomTokens(prompts.Add(), 5 + i, model.GetVocabSize());
+    texts.SetCount(count);
+
+    GenerationScheduler scheduler(model);
+    scheduler.SetMaxBatch(8);
+    scheduler.Start();
+    CoWork co;
+    for (int i = 0; i < count; i++)
+        co & [&, i] {texts[i] = scheduler.Generate(prompts[i], Greedy(12));};
+    co.Finish();
+    scheduler.Stop();
+
+    for (int i = 0; i < count; i++) {
+        Vector<int> ref = session.GenerateText(prompts[i], 12, 1.0, true, 1);
+        ASSERT(texts[i].GetCount() == ref.GetCount());
+        for (int j = 0; j < ref.GetCount(); j++)
+            ASSERT(texts[i][j] == ref[j]);
+    }
+}
+
+// Steps taken by the caller while the worker thread runs must not leave the worker asleep
+static void CheckStepWhileRunning(GPTModel& model) {
+    LOG("  Step while the worker runs");
+    GenerationScheduler scheduler(model);
+    scheduler.SetMaxBatch(4);
+    scheduler.Start();
+    for (int round = 0; round < 20; round++) {
+        Vector<int> ids;
+        for (int i = 0; i < 8; i++) {
+            Vector<int> prompt;
+            RandomTokens(prompt, 3 + i, model.GetVocabSize());
+            ids.Add(scheduler.Submit(prompt, Greedy(6)));
+        }
+        scheduler.Step();
+        scheduler.Step();
+        for (int i = 0; i < ids.GetCount(); i++)
+            ASSERT(scheduler.Wait(ids[i]).GetCount() == 3 + i + 6);
+    }
+    scheduler.Stop();
+}
+
+// The throughput of the batched steps against one sequence at a time
+static void CheckThroughput() {
+    int vocab_size = 256, embed_dim = 128, heads = 4, layers = 2, max_seq_len = 256;
+    int count = 32, new_tokens = 32;
+    LOG("  Throughput, " << count << " prompts, embed_dim " << embed_dim);
+    std::unique_ptr<GPTSession> session = CreateGPTSession(vocab_size, embed_dim, heads, layers,
+        4 * embed_dim, max_seq_len);
+    GPTModel& model = session->GetModel();
+
+    Vector<Vector<int>> prompts;
+    for (int i = 0; i < count; i++)
+        RandomTokens(prompts.Add(), 16, vocab_size);
+
+    TimeStop ts;
+    for (int i = 0; i < count; i++)
+        session->GenerateText(prompts[i], new_tokens);
+    double sequential = count * new_tokens / max(ts.Seconds(), 1e-6);
+
+    GenerationScheduler scheduler(model);
+    scheduler.SetMaxBatch(count);
+    GenerationParams p;
+    p.max_tokens = new_tokens;
+    Vector<int> ids;
+    ts.Reset();
+    for (int i = 0; i < count; i++)
+        ids.Add(scheduler.Submit(prompts[i], p));
+    for (int i = 0; i < count; i++)
+        scheduler.Wait(ids[i]);
+    double batched = count * new_tokens / max(ts.Seconds(), 1e-6);
+
+    int threads = CPU_Cores();
+    scheduler.SetThreadCount(threads);
+    ids.SetCount(0);
+    ts.Reset();
+    for (int i = 0; i < count; i++)
+        ids.Add(scheduler.Submit(prompts[i], p));
+    for (int i = 0; i < count; i++)
+        scheduler.Wait(ids[i]);
+    double parallel = count * new_tokens / max(ts.Seconds(), 1e-6);
+    scheduler.SetThreadCount(1);
+
+    LOG("    " << sequential << " tokens/s one at a time, " << batched << " tokens/s batched, "
+        << parallel << " tokens/s batched with " << threads << " threads");
+    ASSERT(batched > sequential);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("Generation Scheduler Test - continuous batching of GPT decoder steps");
+
+    std::unique_ptr<GPTSession> session = CreateGPTSession(50, 16, 2, 2, 32, 64);
+    CheckBatchedDecode(session->GetModel());
+    CheckScheduler(*session, 3, 256);
+    CheckScheduler(*session, 4, 6);
+    CheckScheduler(*session, 16, 1);
+    CheckStop(session->GetModel());
+    CheckZeroTemperature(session->GetModel());
+    CheckThreads(*session);
+    CheckThroughput();
+
+    LOG("GenerationScheduler tests completed successfully!");
+}
@@ -0,0 +1,96 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("Hogwild Test - lock-free training with several threads");
+
+    {
+        LOG("  Session, 4 threads");
+        Session ses;
+        ses.AddInputLayer(1, 1, 2);
+        ses.AddFullyConnLayer(8);
+        ses.AddReluLayer();
+        ses.AddFullyConnLayer(2);
+        ses.AddSoftmaxLayer(2);
+        ses.GetTrainer().SetType(TRAINER_SGD).SetBatchSize(8).SetLearningRate(0.05).SetMomentum(0.9);
+        ses.SetThreadCount(4).SetHogwild();
+        ses.SetTestPredict(true);
+
+        SessionData& d = ses.Data();
+        d.BeginData(2, 400, 2);
+        Vector<double> state;
+        state.SetCount(2);
+        for (int i = 0; i < 400; i++) {
+            state[0] = Randomf();
+            state[1] = Randomf();
+            d.SetData(i, 0, state[0]).SetData(i, 1, state[1]).SetLabel(i, GetBestAction(state));
+        }
+        d.EndData();
+
+        Vector<double> before, after;
+        GetParameters(ses.GetNetwork(), before);
+        ses.TrainBegin();
+        for (int i = 0; i < 30; i++)
+            ses.TrainIteration();
+        ses.TrainEnd();
+        GetParameters(ses.GetNetwork(), after);
+
+        LOG("    steps " << ses.GetStepCount() << ", loss " << ses.GetLossAverage()
+            << ", training accuracy " << ses.GetTrainingWindow().GetAverage()
+            << ", " << ses.GetThroughputAverage() << " samples/s");
+        ASSERT(ses.GetStepCount() == 30 * 400);
+        ASSERT(ses.GetTrainer().GetIteration() == 30 * 400);
+        ASSERT(MaxDiff(before, after) > 0);
+        ASSERT(ses.GetTrainingWindow().GetAverage() > 0.8);
+    }
+
+    {
+        LOG("  Brain, 3 learner threads");
+        Brain brain;
+        brain.Init(2, 2);
+        brain.SetStartTrainingTreshold(200);
+        brain.SetThreadCount(3).SetHogwild();
+        brain.gamma = 0.0;
+
+        Vector<double> before, after;
+        GetParameters(brain.GetNetwork(), before);
+        Vector<double> state;
+        state.SetCount(2);
+        for (int i = 0; i < 20000; i++) {
+            state[0] = Randomf();
+            state[1] = Randomf();
+            int action = brain.Forward(state);
+            brain.Backward(action == GetBestAction(state) ? 1.0 : 0.0);
+        }
+
+        // the learners count their samples in the brain's trainer
+        while (brain.GetTrainer().GetIteration() < 64 * 3000)
+            Sleep(10);
+        brain.StopLearners();
+        GetParameters(brain.GetNetwork(), after);
+
+        // greedy policy
+        int correct = 0;
+        for (int i = 0; i < 200; i++) {
+            state[0] = Randomf();
+            state[1] = Randomf();
+            Vector<double> input;
+            brain.GetNetInput(state, input);
+            correct += brain.GetPolicy(input).action == GetBestAction(state);
+        }
+        LOG("    loss " << brain.GetAverageLoss() << " over " << brain.GetAverageLossWindowSize()
+            << " mini-batches, greedy accuracy " << correct / 200.0);
+        ASSERT(brain.GetAverageLossWindowSize() > 0);
+        ASSERT(MaxDiff(before, after) > 0);
+        ASSERT(correct > 150);
+    }
+
+    LOG("Hogwild tests completed successfully!");
+}
@@ -0,0 +1,59 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+static bool AnyActivationGradients(const Net& net) {
+    const Vector<LayerBase>& layers = net.GetLayers();
+    for (int i = 0; i < layers.GetCount(); i++)
+        if (layers[i].output_activation.HasGradients())
+            return true;
+    return false;
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+    
+    LOG("InferenceMode Test - gradient buffers are allocated only by backward");
+    
+    Session ses;
+    ses.AddInputLayer(8, 8, 2);
+    ses.AddConvLayer(3, 3, 4);
+    ses.AddReluLayer();
+    ses.AddFullyConnLayer(3);
+    ses.AddSoftmaxLayer(3);
+    Net& net = ses.GetNetwork();
+    
+    Volume x;
+    x.Init(8, 8, 2);
+    ASSERT(!x.HasGradients());
+    ASSERT(x.GetGradient(0) == 0.0);
+    
+    // inference: no gradient storage anywhere in the activations
+    Vector<double> out;
+    HeaplessCopy(out, net.Forward(x, false).GetWeights());
+    ASSERT(!AnyActivationGradients(net));
+    ASSERT(!x.HasGradients());
+    LOG("  Forward allocated no gradients");
+    
+    // the first backward allocates the buffers it writes
+    net.Forward(x, true);
+    net.Backward(1, 0.0);
+    ASSERT(AnyActivationGradients(net));
+    ASSERT(net.GetLayers()[1].filters[0].HasGradients());
+    LOG("  Backward allocated gradients");
+    
+    // releasing them returns to inference mode with identical output
+    net.ReleaseGradients();
+    ASSERT(!AnyActivationGradients(net));
+    ASSERT(!net.GetLayers()[1].filters[0].HasGradients());
+    Volume& o = net.Forward(x, false);
+    for (int i = 0; i < out.GetCount(); i++)
+        ASSERT(o.Get(i) == out[i]);
+    ASSERT(!AnyActivationGradients(net));
+    LOG("  ReleaseGradients restored inference mode");
+    
+    LOG("InferenceMode tests completed successfully!");
+}
@@ -0,0 +1,98 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("LayerProfile Test - per-layer forward and backward profiler");
+
+    const int batch = 4;
+    Session ses;
+    ses.AddInputLayer(16, 16, 3);
+    ses.AddConvLayer(3, 3, 8, 0.0, 1.0, 1, 1);
+    ses.AddReluLayer();
+    ses.AddPoolLayer(2, 2, 2);
+    ses.AddFullyConnLayer(10);
+    ses.AddSoftmaxLayer(10);
+    Net& net = ses.GetNetwork();
+    net.Plan(true, batch);
+
+    Volume x;
+    x.SetSize(16, 16, 3, batch);
+    for (int i = 0; i < x.GetCount(); i++)
+        x.Set(i, Randomf() * 2 - 1);
+    Vector<int> labels;
+    Vector<double> rewards;
+    for (int i = 0; i < batch; i++) {
+        labels.Add(Random(10));
+        rewards.Add(1.0);
+    }
+
+    // the profiler is off by default
+    net.Forward(x, true);
+    net.Backward(labels, rewards);
+    ASSERT(!net.IsProfiling());
+    ASSERT(net.GetProfile().IsEmpty());
+
+    const int steps = 5;
+    net.SetProfiling();
+    for (int i = 0; i < steps; i++) {
+        net.Forward(x, true);
+        net.Backward(labels, rewards);
+    }
+
+    const Vector<LayerProfile>& profile = net.GetProfile();
+    const Vector<LayerBase>& layers = net.GetLayers();
+    ASSERT(profile.GetCount() == layers.GetCount());
+    int64 total = 0;
+    for (int i = 0; i < profile.GetCount(); i++) {
+        const LayerProfile& p = profile[i];
+        LOG("  " << i << " " << layers[i].GetKey() << ": forward " << p.forward_ns << " ns, backward "
+            << p.backward_ns << " ns, " << p.forward_flops + p.backward_flops << " flops, "
+            << p.bytes << " bytes, " << p.allocations << " allocations");
+        ASSERT(p.forward_calls == steps);
+        ASSERT(p.backward_calls == steps);
+        ASSERT(p.allocations == 0);
+        total += p.GetTotalNs();
+    }
+    ASSERT(total > 0);
+
+    // conv: 2 flops per multiply-add, per output value and filter weight, for every sample
+    const LayerBase& conv = layers[1];
+    int64 conv_flops = 2LL * 16 * 16 * 8 * 3 * 3 * 3 * batch;
+    ASSERT(profile[1].forward_flops == steps * conv_flops);
+    ASSERT(profile[1].backward_flops == 2 * steps * conv_flops);
+    ASSERT(conv.GetKey() == "conv");
+
+    // fully connected: 4 * 8 * 8 inputs to 10 neurons
+    ASSERT(profile[4].forward_flops == steps * 2LL * 8 * 8 * 8 * 10 * batch);
+
+    String text = net.GetProfileText();
+    String json = net.GetProfileJSON();
+    LOG(text);
+    LOG(json);
+    ASSERT(json.StartsWith("["));
+    ASSERT(json.Find("\"type\":\"conv\"") >= 0);
+
+    // GetCostLoss profiles the backward pass of the loss layer too
+    net.ResetProfile();
+    Volume x1;
+    x1.SetSize(16, 16, 3);
+    for (int i = 0; i < x1.GetCount(); i++)
+        x1.Set(i, x.Get(i));
+    net.GetCostLoss(x1, labels[0], 1.0);
+    ASSERT(net.GetProfile().Top().forward_calls == 1);
+    ASSERT(net.GetProfile().Top().backward_calls == 1);
+
+    net.ResetProfile();
+    ASSERT(net.GetProfile().IsEmpty());
+    net.SetProfiling(false);
+    net.Forward(x, true);
+    ASSERT(net.GetProfile().IsEmpty());
+
+    LOG("LayerProfile tests completed successfully!");
+}
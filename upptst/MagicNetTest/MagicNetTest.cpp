@@ -0,0 +1,182 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+// Gives the test the folds and the candidates of the MagicNet
+struct TestMagicNet : MagicNet {
+    // hyperparameter ranges for the small data of the test
+    TestMagicNet() {
+        batch_size_min = 2;
+        batch_size_max = 10;
+        l2_decay_max = -2;
+        learning_rate_min = -2;
+    }
+
+    // candidates without dropout, so that their training doesn't use random numbers
+    void AddCandidates(int count) {
+        ClearSessions();
+        for (int i = 0; i < count; i++) {
+            Session& s = session.Add();
+            s.AddInputLayer(1, 1, 4);
+            s.AddFullyConnLayer(6 + i);
+            s.AddReluLayer();
+            s.AddFullyConnLayer(3);
+            s.AddSoftmaxLayer(3);
+            s.GetTrainer().SetType(i % 2 ? TRAINER_ADAGRAD : TRAINER_SGD).SetBatchSize(4 + i)
+                .SetLearningRate(0.01 * (i + 1)).SetMomentum(0.9);
+            s.accuracy_result_window.Init(num_folds, 1);
+        }
+    }
+
+    void CopyFrom(TestMagicNet& src) {
+        train_folds <<= src.train_folds;
+        test_folds <<= src.test_folds;
+        for (int i = 0; i < session.GetCount(); i++) {
+            Vector<ParametersAndGradients>& d = session[i].GetNetwork().GetParametersAndGradients();
+            Vector<ParametersAndGradients>& s = src.session[i].GetNetwork().GetParametersAndGradients();
+            for (int j = 0; j < d.GetCount(); j++)
+                *d[j].volume = *s[j].volume;
+        }
+    }
+};
+
+static void FillData(SessionData& d, int count) {
+    d.BeginData(3, count, 4);
+    for (int i = 0; i < count; i++) {
+        int label = Random(3);
+        d.SetLabel(i, label);
+        for (int k = 0; k < 4; k++)
+            d.SetData(i, k, (k == label ? 1.0 : 0.0) + Randomf() * 0.6 - 0.3);
+    }
+    d.EndData();
+}
+
+// Trains the same candidates with 1 and 4 threads
+static void CheckThreads() {
+    TestMagicNet m[2];
+    for (int i = 0; i < 2; i++) {
+        SeedRandom(1234);
+        FillData(m[i].GetSessionData(0), 100);
+        m[i].SetFoldsCount(2);
+        m[i].SetEpochCount(3);
+        m[i].SetThreadCount(i ? 4 : 1);
+        m[i].SampleFolds();
+        m[i].AddCandidates(6);
+        if (i > 0)
+            m[i].CopyFrom(m[0]);
+    }
+
+    // the nets are reset with random weights after the fold, so only its results are compared
+    for (int i = 0; i < 2; i++) {
+        while (m[i].GetFold() == 0)
+            m[i].Step();
+        ASSERT(m[i].GetIterationsTotal() == 3 * 70);
+    }
+    double diff = 0, best = 0;
+    for (int k = 0; k < 6; k++) {
+        double a = m[0].GetSession(k).accuracy_result_window.GetAverage();
+        double b = m[1].GetSession(k).accuracy_result_window.GetAverage();
+        diff = max(diff, fabs(a - b));
+        best = max(best, a);
+    }
+    LOG("    best validation accuracy " << best << ", diff between 1 and 4 threads " << diff);
+    ASSERT(diff == 0);
+    ASSERT(best > 0.5);
+}
+
+// 9 candidates, rungs after 1 and 3 epochs of 9: 9 -> 3 -> 1 candidates
+static void CheckHalving() {
+    SeedRandom(1234);
+    TestMagicNet m;
+    FillData(m.GetSessionData(0), 100);
+    m.SetFoldsCount(2);
+    m.SetEpochCount(9);
+    m.SetCandidateCount(9);
+    m.SetThreadCount(3);
+    m.SetHalving(3, 1);
+    m.SampleFolds();
+    m.SampleCandidates();
+
+    int fold_size = 70;
+    while (m.GetIterationsTotal() < fold_size)
+        m.Step();
+    ASSERT(m.GetSessionCount() == 3 && m.GetDroppedCandidateCount() == 6);
+    while (m.GetIterationsTotal() < 3 * fold_size)
+        m.Step();
+    ASSERT(m.GetSessionCount() == 1 && m.GetDroppedCandidateCount() == 8);
+
+    while (m.GetEvaluatedCandidateCount() == 0)
+        m.Step();
+    ASSERT(m.GetIterationsTotal() == 2 * 9 * fold_size);
+    ASSERT(m.GetEvaluatedCandidateCount() == 1);
+    ASSERT(m.GetSessionCount() == 9); // the next candidates
+    double acc = m.GetEvaluatedCandidate(0).accuracy_result_window.GetAverage();
+    LOG("    the best candidate: validation accuracy " << acc);
+    ASSERT(acc > 0.5);
+}
+
+// The batched prediction against averaging the forward passes of one sample at a time
+static void CheckPredict() {
+    SeedRandom(1234);
+    TestMagicNet m;
+    FillData(m.GetSessionData(0), 100);
+    m.SetFoldsCount(1);
+    m.SetEpochCount(1);
+    m.SampleFolds();
+    m.AddCandidates(5);
+    while (m.GetEvaluatedCandidateCount() == 0)
+        m.Step();
+    ASSERT(m.GetEvaluatedCandidateCount() == 5);
+    m.SetThreadCount(3);
+    m.SetPredictBatchSize(16);
+
+    SessionData& d = m.GetSessionData(0);
+    int count = 50;
+    Volume in;
+    in.SetSize(1, 1, 4, count);
+    for (int b = 0; b < count; b++)
+        for (int k = 0; k < 4; k++)
+            in.Set(b, 0, 0, k, d.GetData(b, k));
+
+    Volume out;
+    Vector<int> labels;
+    m.PredictSoft(in, out);
+    m.PredictSoftLabels(in, labels);
+    ASSERT(out.GetBatch() == count && out.GetLength() == 3);
+
+    double diff = 0;
+    Volume x;
+    for (int b = 0; b < count; b++) {
+        x.SetSize(1, 1, 4);
+        for (int k = 0; k < 4; k++)
+            x.Set(k, d.GetData(b, k));
+        int label = m.PredictSoftLabel(x);
+        ASSERT(label == labels[b]);
+        for (int c = 0; c < 3; c++) {
+            double sum = 0;
+            for (int j = 0; j < 5; j++)
+                sum += m.GetEvaluatedCandidate(j).GetNetwork().Forward(x).Get(c);
+            diff = max(diff, fabs(out.Get(b, 0, 0, c) - sum / 5));
+        }
+    }
+    LOG("    max diff to one sample at a time " << diff);
+    ASSERT(diff < 1e-12);
+}
+
+CONSOLE_APP_MAIN
+{
+    LOG("MagicNet Test - parallel candidates, successive halving and batched prediction");
+
+    LOG("  Candidates with 1 and 4 threads");
+    CheckThreads();
+
+    LOG("  Successive halving");
+    CheckHalving();
+
+    LOG("  Batched ensemble prediction");
+    CheckPredict();
+
+    LOG("MagicNet tests completed successfully!");
+}
@@ -0,0 +1,134 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+static void FillData(SessionData& d, int count, int test_count) {
+    d.BeginData(3, count, 4, 4, 3, test_count);
+    for (int i = 0; i < count; i++) {
+        int label = i % 3;
+        d.SetLabel(i, label);
+        for (int k = 0; k < 4 * 4 * 3; k++)
+            d.SetData(i, k, (k % 3 == label ? 1.0 : 0.0) + Randomf() * 0.5 - 0.25);
+    }
+    for (int i = 0; i < test_count; i++) {
+        d.SetTestLabel(i, (i + 1) % 3);
+        for (int k = 0; k < 4 * 4 * 3; k++)
+            d.SetTestData(i, k, Randomf());
+    }
+    d.EndData();
+}
+
+// Saves the data with the element type and compares the mapped samples to the original ones.
+static void CheckRoundTrip(SessionData& d, int type, double tolerance) {
+    String path = GetTempFileName("mapped");
+    ASSERT(d.SaveMapped(path, type));
+
+    SessionData m;
+    ASSERT(m.OpenMapped(path));
+    ASSERT(m.IsMapped());
+    ASSERT(m.GetStore().GetType() == type);
+    ASSERT(m.GetDataCount() == d.GetDataCount() && m.GetTestCount() == d.GetTestCount());
+    ASSERT(m.GetDataLength() == d.GetDataLength() && m.GetClassCount() == d.GetClassCount());
+
+    double diff = 0;
+    Volume v;
+    for (int i = 0; i < d.GetDataCount(); i++) {
+        ASSERT(m.GetLabel(i) == d.GetLabel(i));
+        m.GetSample(i, v);
+        ASSERT(v.GetLength() == d.GetDataLength());
+        for (int k = 0; k < d.GetDataLength(); k++) {
+            diff = max(diff, fabs(m.GetData(i, k) - d.GetData(i, k)));
+            diff = max(diff, fabs(v.Get(k) - d.GetData(i, k)));
+        }
+    }
+    for (int i = 0; i < d.GetTestCount(); i++) {
+        ASSERT(m.GetTestLabel(i) == d.GetTestLabel(i));
+        for (int k = 0; k < d.GetDataLength(); k++)
+            diff = max(diff, fabs(m.GetTestData(i, k) - d.GetTestData(i, k)));
+    }
+    LOG("    type " << type << ": file " << GetFileLength(path) << " bytes, max diff " << diff);
+    ASSERT(diff <= tolerance);
+
+    m.ClearData();
+    ASSERT(!m.IsMapped());
+    FileDelete(path);
+}
+
+static void CheckHalf() {
+    float values[] = {0.0f, 1.0f, -2.5f, 65504.0f, 0.1f, 6.1035156e-05f, 5.9604645e-08f, 1e-9f};
+    for (float f : values) {
+        float h = DataStore::HalfToFloat(DataStore::FloatToHalf(f));
+        ASSERT(fabs(h - f) <= fabs(f) / 1024 + 6e-8);
+    }
+    ASSERT(DataStore::FloatToHalf(1e6f) == 0x7c00);
+    ASSERT(DataStore::FloatToHalf(-1.0f) == 0xbc00);
+    // 1 + 2^-11 is halfway between two halves and rounds to the even one
+    ASSERT(DataStore::FloatToHalf(1.0f + 1.0f / 2048) == 0x3c00);
+    for (int i = 0; i < 0x7c00; i++)
+        ASSERT(DataStore::FloatToHalf(DataStore::HalfToFloat((word)i)) == i);
+}
+
+// Trains the same network from the data in memory and from the mapped float data.
+static void CheckTraining() {
+    String path = GetTempFileName("mapped");
+    {
+        SessionData d;
+        SeedRandom(1234);
+        FillData(d, 60, 10);
+        ASSERT(d.SaveMapped(path, DATA_F32));
+    }
+
+    Session ses[2];
+    for (int i = 0; i < 2; i++) {
+        Session& s = ses[i];
+        s.AddInputLayer(4, 4, 3);
+        s.AddFullyConnLayer(8);
+        s.AddReluLayer();
+        s.AddFullyConnLayer(3);
+        s.AddSoftmaxLayer(3);
+        if (i > 0)
+            CopyParameters(s.GetNetwork(), ses[0].GetNetwork());
+        s.GetTrainer().SetType(TRAINER_SGD).SetBatchSize(8).SetMomentum(0.9);
+        if (i == 0) {
+            SeedRandom(1234);
+            FillData(s.Data(), 60, 10);
+        }
+        else
+            ASSERT(s.Data().OpenMapped(path));
+    }
+    for (int i = 0; i < 2; i++) {
+        ses[i].TrainBegin();
+        for (int j = 0; j < 4; j++)
+            ses[i].TrainIteration();
+        ses[i].TrainEnd();
+    }
+    LOG("    loss in memory " << ses[0].GetLossAverage() << ", mapped " << ses[1].GetLossAverage());
+    ASSERT(fabs(ses[0].GetLossAverage() - ses[1].GetLossAverage()) < 1e-4);
+    ses[1].Data().ClearData();
+    FileDelete(path);
+}
+
+CONSOLE_APP_MAIN
+{
+    LOG("MappedData Test - SessionData in a memory mapped file");
+
+    SeedRandom(1234);
+    SessionData d;
+    FillData(d, 60, 10);
+
+    LOG("  Round trips");
+    CheckRoundTrip(d, DATA_F32, 1e-6);
+    CheckRoundTrip(d, DATA_F16, 1e-3);
+    CheckRoundTrip(d, DATA_U8, 0.01);
+
+    LOG("  Half precision conversion");
+    CheckHalf();
+
+    LOG("  Training from mapped data");
+    CheckTraining();
+
+    LOG("MappedData tests completed successfully!");
+}
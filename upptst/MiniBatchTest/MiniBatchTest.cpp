@@ -0,0 +1,191 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+static void ZeroParameterGradients(Net& net) {
+    Vector<ParametersAndGradients>& pag = net.GetParametersAndGradients();
+    for (int i = 0; i < pag.GetCount(); i++)
+        pag[i].volume->ZeroGradients();
+}
+
+static void GetParameterGradients(Net& net, Vector<double>& out) {
+    out.SetCount(0);
+    Vector<ParametersAndGradients>& pag = net.GetParametersAndGradients();
+    for (int i = 0; i < pag.GetCount(); i++)
+        for (int j = 0; j < pag[i].volume->GetLength(); j++)
+            out.Add(pag[i].volume->GetGradient(j));
+}
+
+// Runs the batch through the net at once and sample by sample, and compares the outputs,
+// the input gradients and the summed parameter gradients.
+static void CheckBatch(Net& net, Volume& batch, const Vector<int>& labels, const Vector<double>& targets) {
+    int n = batch.GetBatch();
+    int length = batch.GetLength();
+    bool classify = !labels.IsEmpty();
+    int target_length = classify ? 0 : targets.GetCount() / n;
+
+    Vector<double> batch_out, batch_in_grad, batch_param_grad;
+    ZeroParameterGradients(net);
+    Volume& out = net.Forward(batch, true);
+    ASSERT(out.GetBatch() == n);
+    HeaplessCopy(batch_out, out.GetWeights());
+    Vector<double> rewards;
+    rewards.SetCount(n, 0.0);
+    double batch_loss = classify ? net.Backward(labels, rewards) : net.Backward(targets);
+    HeaplessCopy(batch_in_grad, net.GetLayers()[1].output_activation.GetGradients());
+    GetParameterGradients(net, batch_param_grad);
+
+    Vector<double> single_out, single_in_grad, single_param_grad;
+    ZeroParameterGradients(net);
+    double single_loss = 0;
+    Volume x;
+    Vector<double> y;
+    for (int b = 0; b < n; b++) {
+        x.SetSize(batch.GetWidth(), batch.GetHeight(), batch.GetDepth());
+        for (int i = 0; i < length; i++)
+            x.Set(i, batch.Get(b * length + i));
+        Volume& o = net.Forward(x, true);
+        for (int i = 0; i < o.GetCount(); i++)
+            single_out.Add(o.Get(i));
+        if (classify)
+            single_loss += net.Backward(labels[b], 0.0);
+        else {
+            y.SetCount(target_length);
+            for (int i = 0; i < target_length; i++)
+                y[i] = targets[b * target_length + i];
+            single_loss += net.Backward(y);
+        }
+        Volume& g = net.GetLayers()[1].output_activation;
+        for (int i = 0; i < g.GetCount(); i++)
+            single_in_grad.Add(g.GetGradient(i));
+    }
+    GetParameterGradients(net, single_param_grad);
+
+    double out_diff = MaxDiff(batch_out, single_out);
+    double in_diff = MaxDiff(batch_in_grad, single_in_grad);
+    double param_diff = MaxDiff(batch_param_grad, single_param_grad);
+    LOG("    output diff " << out_diff << ", input gradient diff " << in_diff
+        << ", parameter gradient diff " << param_diff << ", loss " << batch_loss << " vs " << single_loss);
+    ASSERT(out_diff < 1e-9);
+    ASSERT(in_diff < 1e-9);
+    ASSERT(param_diff < 1e-9);
+    ASSERT(fabs(batch_loss - single_loss) < 1e-9);
+}
+
+static void RandomBatch(Volume& batch, int w, int h, int d, int n) {
+    batch.SetSize(w, h, d, n);
+    for (int i = 0; i < batch.GetCount(); i++)
+        batch.Set(i, Randomf() * 2 - 1);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("MiniBatch Test - batched forward and backward against one sample at a time");
+
+    int n = 5;
+    Vector<int> labels;
+    Vector<double> targets;
+    Volume batch;
+
+    for (int algo = 0; algo < 2; algo++) {
+        LOG("  Softmax net, " << (algo == CONV_GEMM ? "GEMM" : "reference") << " convolution");
+        Session ses;
+        ses.AddInputLayer(8, 8, 3);
+        ses.AddConvLayer(3, 3, 6, 0.0, 1.0, 1, 1).SetConvAlgorithm(algo);
+        ses.AddReluLayer();
+        ses.AddLrnLayer(1.0, 3, 0.1, 0.75);
+        ses.AddPoolLayer(2, 2, 2);
+        ses.AddMaxoutLayer(2);
+        ses.AddFullyConnLayer(4);
+        ses.AddSoftmaxLayer(4);
+        RandomBatch(batch, 8, 8, 3, n);
+        labels.SetCount(n);
+        for (int i = 0; i < n; i++)
+            labels[i] = Random(4);
+        targets.Clear();
+        CheckBatch(ses.GetNetwork(), batch, labels, targets);
+    }
+
+    {
+        LOG("  SVM net");
+        Session ses;
+        ses.AddInputLayer(1, 1, 10);
+        ses.AddFullyConnLayer(12);
+        ses.AddTanhLayer();
+        ses.AddMaxoutLayer(2);
+        ses.AddFullyConnLayer(3);
+        ses.AddSVMLayer(3);
+        RandomBatch(batch, 1, 1, 10, n);
+        labels.SetCount(n);
+        for (int i = 0; i < n; i++)
+            labels[i] = Random(3);
+        CheckBatch(ses.GetNetwork(), batch, labels, targets);
+    }
+
+    {
+        LOG("  Regression net with unpool and deconv");
+        Session ses;
+        ses.AddInputLayer(4, 4, 2);
+        ses.AddUnpoolLayer(2, 2, 2);
+        ses.AddConvLayer(3, 3, 4, 0.0, 1.0, 1, 1);
+        ses.AddSigmoidLayer();
+        ses.AddDeconvLayer(3, 3, 2, 0.0, 1.0, 2, 1);
+        ses.AddRegressionLayer();
+        Net& net = ses.GetNetwork();
+        RandomBatch(batch, 4, 4, 2, n);
+        labels.Clear();
+        targets.SetCount(n * net.GetLayers().Top().output_depth);
+        for (int i = 0; i < targets.GetCount(); i++)
+            targets[i] = Randomf();
+        CheckBatch(net, batch, labels, targets);
+    }
+
+    {
+        LOG("  Trainer: one batch of 4 against 4 single samples");
+        Session a, b;
+        for (int i = 0; i < 2; i++) {
+            Session& ses = i ? b : a;
+            ses.AddInputLayer(6, 6, 2);
+            ses.AddConvLayer(3, 3, 4, 0.0, 1.0, 1, 1);
+            ses.AddReluLayer();
+            ses.AddFullyConnLayer(3);
+            ses.AddSoftmaxLayer(3);
+        }
+        CopyParameters(b.GetNetwork(), a.GetNetwork());
+
+        TrainerBase ta, tb;
+        ta.SetNet(a.GetNetwork()).SetType(TRAINER_SGD).SetBatchSize(4).SetMomentum(0.0).SetL2Decay(0.001);
+        tb.SetNet(b.GetNetwork()).SetType(TRAINER_SGD).SetBatchSize(4).SetMomentum(0.0).SetL2Decay(0.001);
+
+        RandomBatch(batch, 6, 6, 2, 4);
+        labels.SetCount(4);
+        Vector<double> rewards;
+        rewards.SetCount(4, 1.0);
+        for (int i = 0; i < 4; i++)
+            labels[i] = Random(3);
+
+        Volume x;
+        for (int s = 0; s < 4; s++) {
+            x.SetSize(6, 6, 2);
+            for (int i = 0; i < x.GetLength(); i++)
+                x.Set(i, batch.Get(s * x.GetLength() + i));
+            ta.Train(x, labels[s], 1.0);
+        }
+        tb.Train(batch, labels, rewards);
+
+        Vector<double> pa, pb;
+        GetParameters(a.GetNetwork(), pa);
+        GetParameters(b.GetNetwork(), pb);
+        double diff = MaxDiff(pa, pb);
+        LOG("    parameter diff after the update " << diff);
+        ASSERT(diff < 1e-9);
+        ASSERT(ta.GetIteration() == tb.GetIteration());
+    }
+
+    LOG("MiniBatch tests completed successfully!");
+}
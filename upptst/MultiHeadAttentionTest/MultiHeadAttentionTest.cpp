@@ -0,0 +1,236 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+#ifdef flagCONVNET_DOUBLE
+static const double tolerance = 1e-9;
+static const double grad_tolerance = 1e-5;
+#else
+static const double tolerance = 1e-4;
+static const double grad_tolerance = 1e-3;
+#endif
+
+static void RandomFill(Vector<Real>& v, int n) {
+    v.SetCount(n);
+    for (int i = 0; i < n; i++)
+        v[i] = (Real)(Randomf() * 2 - 1);
+}
+
+// The attention with the full score matrix, and its gradients for the output gradient dout
+static void ReferenceAttention(const AttentionShape& shape, const Vector<Real>& q,
+    const Vector<Real>& k, const Vector<Real>& v, const Vector<Real>& dout,
+    Vector<double>& out, Vector<double>& dq, Vector<double>& dk, Vector<double>& dv) {
+    int n = shape.q_count, m = shape.k_count, dim = shape.dim;
+    Vector<double> p, dp;
+    p.SetCount(n * m, 0);
+    dp.SetCount(n * m, 0);
+    out.SetCount(0);
+    out.SetCount(n * dim, 0);
+    dq.SetCount(0);
+    dq.SetCount(n * dim, 0);
+    dk.SetCount(0);
+    dk.SetCount(m * dim, 0);
+    dv.SetCount(0);
+    dv.SetCount(m * dim, 0);
+
+    for (int i = 0; i < n; i++) {
+        int allowed = shape.causal ? min(m, shape.q_offset + i + 1) : m;
+        double mx = -DBL_MAX, sum = 0;
+        for (int j = 0; j < allowed; j++) {
+            double s = 0;
+            for (int d = 0; d < dim; d++)
+                s += q[i * dim + d] * k[j * dim + d];
+            p[i * m + j] = s * shape.scale;
+            mx = max(mx, p[i * m + j]);
+        }
+        for (int j = 0; j < allowed; j++)
+            sum += p[i * m + j] = exp(p[i * m + j] - mx);
+        for (int j = 0; j < allowed; j++) {
+            p[i * m + j] /= sum;
+            for (int d = 0; d < dim; d++)
+                out[i * dim + d] += p[i * m + j] * v[j * dim + d];
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        double delta = 0;
+        for (int j = 0; j < m; j++) {
+            double s = 0;
+            for (int d = 0; d < dim; d++) {
+                s += dout[i * dim + d] * v[j * dim + d];
+                dv[j * dim + d] += p[i * m + j] * dout[i * dim + d];
+            }
+            dp[i * m + j] = s;
+            delta += s * p[i * m + j];
+        }
+        for (int j = 0; j < m; j++) {
+            double ds = p[i * m + j] * (dp[i * m + j] - delta) * shape.scale;
+            for (int d = 0; d < dim; d++) {
+                dq[i * dim + d] += ds * k[j * dim + d];
+                dk[j * dim + d] += ds * q[i * dim + d];
+            }
+        }
+    }
+}
+
+// The tiled kernels give the same output and gradients as the full score matrix
+static void CheckKernel(int q_count, int k_count, int dim, int tile, bool causal) {
+    LOG("  Kernel, " << q_count << " queries, " << k_count << " keys, dim " << dim
+        << ", tile " << tile << (causal ? ", causal" : ""));
+    AttentionShape shape;
+    shape.q_count = q_count;
+    shape.k_count = k_count;
+    shape.q_offset = k_count - q_count;
+    shape.dim = dim;
+    shape.tile_q = tile;
+    shape.tile_k = tile + 3; // the tiles of queries and keys don't have to be the same
+    shape.causal = causal;
+    shape.scale = 1.0 / sqrt((double)dim);
+
+    Vector<Real> q, k, v, dout, out, lse, dq, dk, dv;
+    RandomFill(q, q_count * dim);
+    RandomFill(k, k_count * dim);
+    RandomFill(v, k_count * dim);
+    RandomFill(dout, q_count * dim);
+    out.SetCount(q_count * dim);
+    lse.SetCount(q_count);
+    dq.SetCount(q_count * dim);
+    dk.SetCount(k_count * dim);
+    dv.SetCount(k_count * dim);
+
+    AttentionScratch scratch;
+    AttentionForward(shape, q.Begin(), dim, k.Begin(), v.Begin(), dim, out.Begin(), dim, lse.Begin(), scratch);
+    AttentionBackward(shape, q.Begin(), dim, k.Begin(), v.Begin(), dim, out.Begin(), dout.Begin(), dim,
+        lse.Begin(), dq.Begin(), dk.Begin(), dv.Begin(), scratch);
+
+    Vector<double> rout, rdq, rdk, rdv;
+    ReferenceAttention(shape, q, k, v, dout, rout, rdq, rdk, rdv);
+    double diff = max(max(MaxDiff(out, rout), MaxDiff(dq, rdq)), max(MaxDiff(dk, rdk), MaxDiff(dv, rdv)));
+    LOG("    largest difference " << diff);
+    ASSERT(diff < tolerance * 10);
+
+    // the scratch holds one tile of scores
+    ASSERT(scratch.s.GetCount() == shape.tile_q * shape.tile_k);
+}
+
+static double GetLoss(MultiHeadAttentionCRTP& mha, Volume& x, const Vector<double>& g) {
+    Volume& y = mha.Forward(x, true);
+    double loss = 0;
+    for (int i = 0; i < y.GetCount(); i++)
+        loss += y.Get(i) * g[i];
+    return loss;
+}
+
+// The gradients of the layer against finite differences of the loss sum(y * g)
+static void CheckLayerGradients(bool causal) {
+    LOG("  Layer gradients" << (causal ? ", causal" : ""));
+    int embed_dim = 8, heads = 2, seq_len = 11;
+    MultiHeadAttentionCRTP mha(embed_dim, heads);
+    mha.SetCausal(causal).SetTileSize(4);
+    ASSERT(mha.GetHeadDim() == 4);
+
+    Volume x(embed_dim, 1, seq_len, 0.0);
+    x.SetSize(embed_dim, 1, seq_len, 2);
+    for (int i = 0; i < x.GetCount(); i++)
+        x.Set(i, Randomf() * 2 - 1);
+    Vector<double> g;
+    for (int i = 0; i < x.GetCount(); i++)
+        g.Add(Randomf() * 2 - 1);
+
+    Vector<ParametersAndGradients>& params = mha.GetParametersAndGradients();
+    ASSERT(params.GetCount() == 8);
+    for (int i = 0; i < params.GetCount(); i++)
+        params[i].volume->ZeroGradients();
+    Volume& y = mha.Forward(x, true);
+    for (int i = 0; i < y.GetCount(); i++)
+        y.SetGradient(i, g[i]);
+    mha.Backward();
+
+    double eps = 1e-4;
+#ifndef flagCONVNET_DOUBLE
+    eps = 1e-2;
+#endif
+    double worst = 0;
+    auto check = [&](Volume& vol, int i, double analytic) {
+        double orig = vol.Get(i);
+        vol.Set(i, orig + eps);
+        double lp = GetLoss(mha, x, g);
+        vol.Set(i, orig - eps);
+        double lm = GetLoss(mha, x, g);
+        vol.Set(i, orig);
+        double numeric = (lp - lm) / (2 * eps);
+        double d = fabs(numeric - analytic) / max(1.0, fabs(numeric));
+        worst = max(worst, d);
+    };
+
+    Vector<double> dx;
+    for (int i = 0; i < x.GetCount(); i++)
+        dx.Add(x.GetGradient(i));
+    for (int i = 0; i < x.GetCount(); i += 3)
+        check(x, i, dx[i]);
+    for (int p = 0; p < params.GetCount(); p++) {
+        Volume& vol = *params[p].volume;
+        Vector<double> dw;
+        for (int i = 0; i < vol.GetCount(); i++)
+            dw.Add(vol.GetGradient(i));
+        for (int i = 0; i < vol.GetCount(); i += 5)
+            check(vol, i, dw[i]);
+    }
+    LOG("    largest relative difference " << worst);
+    ASSERT(worst < grad_tolerance);
+}
+
+// A long sequence never has the full score matrix: the memory is linear in the length
+static void CheckLongSequence() {
+    int embed_dim = 64, heads = 4, seq_len = 2048;
+    LOG("  Long sequence, " << seq_len << " positions, " << heads << " heads");
+    MultiHeadAttentionCRTP mha(embed_dim, heads);
+    mha.SetCausal();
+
+    Volume x(embed_dim, 1, seq_len, 0.0);
+    for (int i = 0; i < x.GetCount(); i++)
+        x.Set(i, Randomf() * 2 - 1);
+
+    TimeStop ts;
+    Volume& y = mha.Forward(x, true);
+    double forward = ts.Seconds();
+    Vector<double> single;
+    for (int i = 0; i < y.GetCount(); i++) {
+        ASSERT(IsFin(y.Get(i)));
+        single.Add(y.Get(i));
+        y.SetGradient(i, Randomf() - 0.5);
+    }
+    ts.Reset();
+    mha.Backward();
+    double backward = ts.Seconds();
+    LOG("    forward " << forward << " s, backward " << backward << " s, "
+        << (double)seq_len * seq_len * heads * sizeof(Real) / (1024 * 1024)
+        << " MB of scores not stored");
+
+    // the heads in parallel give the same output
+    mha.SetThreadCount(4);
+    Volume& y4 = mha.Forward(x, true);
+    for (int i = 0; i < y4.GetCount(); i++)
+        ASSERT(y4.Get(i) == single[i]);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("Multi-Head Attention Test - tiled attention with an online softmax");
+
+    CheckKernel(1, 1, 4, 4, false);
+    CheckKernel(37, 37, 8, 8, false);
+    CheckKernel(37, 37, 8, 8, true);
+    CheckKernel(100, 100, 16, 64, true);
+    CheckKernel(5, 29, 8, 4, true); // the queries after a prefix of 24 keys
+    CheckLayerGradients(false);
+    CheckLayerGradients(true);
+    CheckLongSequence();
+
+    LOG("Multi-head attention tests completed successfully!");
+}
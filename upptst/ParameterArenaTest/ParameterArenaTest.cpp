@@ -0,0 +1,149 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+static void AddLayers(Session& ses) {
+    ses.AddInputLayer(6, 6, 2);
+    ses.AddConvLayer(3, 3, 5, 0.0, 1.0, 1, 1);
+    ses.AddReluLayer();
+    ses.AddPoolLayer(2, 2, 2);
+    ses.AddFullyConnLayer(7);
+    ses.AddTanhLayer();
+    ses.AddFullyConnLayer(3);
+    ses.AddSoftmaxLayer(3);
+}
+
+// Every parameter volume must view the arena at an aligned offset, in order, and the
+// padding between the volumes must be zero.
+static void CheckLayout(Net& net) {
+    Real* w = net.GetParameterArena();
+    Real* g = net.GetGradientArena();
+    ASSERT(((uintptr_t)w & 63) == 0 && ((uintptr_t)g & 63) == 0);
+    Vector<ParametersAndGradients>& pag = net.GetParametersAndGradients();
+    int offset = 0;
+    for (int i = 0; i < pag.GetCount(); i++) {
+        Volume& v = *pag[i].volume;
+        ASSERT(v.IsView());
+        ASSERT(v.GetWeights().Begin() == w + offset);
+        ASSERT(v.GetGradients().Begin() == g + offset);
+        ASSERT(((uintptr_t)v.GetWeights().Begin() & 63) == 0);
+        int end = offset + v.GetCount();
+        offset = (end * sizeof(Real) + 63) / 64 * 64 / sizeof(Real);
+        for (int j = end; j < offset; j++)
+            ASSERT(w[j] == 0 && g[j] == 0);
+    }
+    ASSERT(offset == net.GetArenaCount());
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("ParameterArena Test - flat parameter and gradient arenas");
+
+    Session a, b;
+    AddLayers(a);
+    AddLayers(b);
+    Net& na = a.GetNetwork();
+    Net& nb = b.GetNetwork();
+    CopyParameters(nb, na);
+
+    Vector<double> pa, pb;
+    GetParameters(nb, pb);
+    nb.FlattenParameters();
+    ASSERT(nb.IsFlat());
+    GetParameters(nb, pa);
+    ASSERT(MaxDiff(pa, pb) == 0);
+    LOG("  " << nb.GetParametersAndGradients().GetCount() << " parameter volumes in an arena of " << nb.GetArenaCount() << " values");
+    CheckLayout(nb);
+
+    {
+        LOG("  Training a flat and a regular net with the same data");
+        TrainerBase ta, tb;
+        ta.SetNet(na).SetType(TRAINER_ADAM).SetBatchSize(4).SetL2Decay(0.001);
+        tb.SetNet(nb).SetType(TRAINER_ADAM).SetBatchSize(4).SetL2Decay(0.001);
+        Volume batch;
+        Vector<int> labels;
+        Vector<double> rewards;
+        rewards.SetCount(4, 1.0);
+        labels.SetCount(4);
+        for (int step = 0; step < 20; step++) {
+            batch.SetSize(6, 6, 2, 4);
+            for (int i = 0; i < batch.GetCount(); i++)
+                batch.Set(i, Randomf() * 2 - 1);
+            for (int i = 0; i < 4; i++)
+                labels[i] = Random(3);
+            ta.Train(batch, labels, rewards);
+            tb.Train(batch, labels, rewards);
+        }
+        GetParameters(na, pa);
+        GetParameters(nb, pb);
+        double diff = MaxDiff(pa, pb);
+        LOG("    parameter diff after 20 updates " << diff);
+        ASSERT(diff < 1e-9);
+        CheckLayout(nb);
+    }
+
+    {
+        LOG("  Arena copy, zeroing and serialization");
+        Session c;
+        AddLayers(c);
+        Net& nc = c.GetNetwork();
+        nc.FlattenParameters();
+        nc.CopyParametersFrom(nb);
+        GetParameters(nc, pa);
+        ASSERT(MaxDiff(pa, pb) == 0);
+
+        Vector<ParametersAndGradients>& pag = nc.GetParametersAndGradients();
+        for (int i = 0; i < pag.GetCount(); i++)
+            pag[i].volume->SetGradient(0, 1.0);
+        nc.ZeroParameterGradients();
+        for (int i = 0; i < pag.GetCount(); i++)
+            ASSERT(pag[i].volume->GetGradient(0) == 0);
+
+        // re-initializing a volume of the same size keeps its arena slot
+        Volume& v = *pag[0].volume;
+        const Real* w = v.GetWeights().Begin();
+        v.SetGradient(0, 1.0);
+        v.Init(v.GetWidth(), v.GetHeight(), v.GetDepth(), 0.5);
+        ASSERT(v.IsView() && v.GetWeights().Begin() == w && v.GetGradients().IsView());
+        ASSERT(v.Get(0) == 0.5 && v.GetGradient(0) == 0);
+        CheckLayout(nc);
+
+        Net nd;
+        nd.CopyFrom(nb);
+        ASSERT(!nd.IsFlat());
+        GetParameters(nd, pa);
+        ASSERT(MaxDiff(pa, pb) == 0);
+    }
+
+    {
+        LOG("  Releasing the arena keeps the values");
+        nb.ReleaseArena();
+        ASSERT(!nb.IsFlat());
+        Vector<ParametersAndGradients>& pag = nb.GetParametersAndGradients();
+        for (int i = 0; i < pag.GetCount(); i++)
+            ASSERT(!pag[i].volume->IsView());
+        GetParameters(nb, pa);
+        ASSERT(MaxDiff(pa, pb) == 0);
+    }
+
+    {
+        LOG("  Initializing a view of the same count");
+        Vector<Real> arena;
+        arena.SetCount(8, 1);
+        RealBuffer b;
+        b.SetView(arena.Begin(), 8);
+        b.SetCount(8, 0);
+        ASSERT(b.IsView() && b.Begin() == arena.Begin());
+        for (int i = 0; i < arena.GetCount(); i++)
+            ASSERT(arena[i] == 0);
+        b.SetCount(4, 2);
+        ASSERT(!b.IsView() && b.GetCount() == 4 && b[0] == 0 && arena[0] == 0);
+    }
+
+    LOG("ParameterArena tests completed successfully!");
+}
@@ -0,0 +1,167 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+static void FillData(SessionData& d, int count) {
+    d.BeginData(3, count, 6, 6, 2);
+    for (int i = 0; i < count; i++) {
+        int label = i % 3;
+        d.SetLabel(i, label);
+        for (int k = 0; k < 6 * 6 * 2; k++)
+            d.SetData(i, k, (k % 3 == label ? 1.0 : 0.0) + Randomf() * 0.5 - 0.25);
+    }
+    d.EndData();
+}
+
+// The crop and flip of the loader against Volume::Augment
+static void CheckAugment() {
+    Volume src;
+    src.Init(6, 5, 2);
+    Volume dst;
+    dst.SetSize(4, 4, 2, 3);
+    for (int flip = 0; flip < 2; flip++) {
+        for (int dx = 0; dx <= 3; dx++) { // 3 is partly outside of src
+            Volume ref = src;
+            ref.Augment(4, dx, 1, flip);
+            dst.SetAugmentedSample(2, src, dx, 1, flip);
+            for (int x = 0; x < 4; x++)
+                for (int y = 0; y < 4; y++)
+                    for (int z = 0; z < 2; z++)
+                        ASSERT(dst.Get(2, x, y, z) == ref.Get(x, y, z));
+        }
+    }
+}
+
+// Collects the samples and labels of an epoch in the order of the batches
+static void ReadEpoch(DataLoader& l, const SessionData& d, int epoch, Vector<double>& values, Vector<int>& labels) {
+    values.SetCount(0);
+    labels.SetCount(0);
+    l.Begin(d, 7, epoch, false);
+    for (int i = 0; i < l.GetBatchCount(); i++) {
+        LoaderBatch& b = l.Get();
+        ASSERT(b.index == i && b.x.GetBatch() == b.count);
+        for (int j = 0; j < b.x.GetCount(); j++)
+            values.Add(b.x.Get(j));
+        labels.Append(b.labels);
+        if (i % 3 == 0)
+            Sleep(1); // lets the workers get ahead
+        l.Release();
+    }
+    l.End();
+}
+
+// The batches don't depend on the worker count or the queue depth, and the order changes
+// between epochs.
+static void CheckLoader(const SessionData& d) {
+    DataLoader a, b;
+    a.SetDepth(1).SetWorkerCount(1).SetShuffle().SetAugmentation(4, true).SetSeed(5);
+    b.SetDepth(4).SetWorkerCount(3).SetShuffle().SetAugmentation(4, true).SetSeed(5);
+
+    Vector<double> va, vb, va2;
+    Vector<int> la, lb, la2;
+    ReadEpoch(a, d, 0, va, la);
+    ReadEpoch(b, d, 0, vb, lb);
+    ASSERT(la.GetCount() == d.GetDataCount());
+    ASSERT(va.GetCount() == d.GetDataCount() * 4 * 4 * 2);
+    ASSERT(MaxDiff(va, vb) == 0);
+    for (int i = 0; i < la.GetCount(); i++)
+        ASSERT(la[i] == lb[i]);
+
+    ReadEpoch(a, d, 1, va2, la2);
+    ASSERT(MaxDiff(va, va2) > 0);
+    int sum = 0, sum2 = 0;
+    for (int i = 0; i < la.GetCount(); i++) {
+        sum += la[i];
+        sum2 += la2[i];
+    }
+    ASSERT(sum == sum2); // the same samples in another order
+
+    // the ring of batches is reused in the later epochs
+    int before = GetBufferAllocations();
+    ReadEpoch(b, d, 2, vb, lb);
+    int allocs = GetBufferAllocations() - before;
+    LOG("    stalls " << b.GetStallCount() << " (" << b.GetStallSeconds() << " s), loaded " << b.GetLoadedCount()
+        << " batches in " << b.GetLoadSeconds() << " s, allocations in the third epoch " << allocs);
+    ASSERT(allocs == 0);
+    ASSERT(b.GetLoadedCount() == 2 * b.GetBatchCount());
+}
+
+// Stops in the middle of an epoch
+static void CheckEnd(const SessionData& d) {
+    DataLoader l;
+    l.SetDepth(2).SetWorkerCount(2);
+    for (int i = 0; i < 3; i++) {
+        l.Begin(d, 5, i, false);
+        l.Get();
+        l.Release();
+        l.Get();
+        l.End();
+        ASSERT(!l.IsRunning());
+    }
+}
+
+// Trains the same data and initial weights with and without prefetching
+static void CheckTraining(int threads) {
+    Session ses[2];
+    for (int i = 0; i < 2; i++) {
+        Session& s = ses[i];
+        s.AddInputLayer(6, 6, 2);
+        s.AddConvLayer(3, 3, 4, 0.0, 1.0, 1, 1);
+        s.AddReluLayer();
+        s.AddFullyConnLayer(3);
+        s.AddSoftmaxLayer(3);
+        if (i > 0)
+            CopyParameters(s.GetNetwork(), ses[0].GetNetwork());
+        s.GetTrainer().SetType(TRAINER_ADAM).SetBatchSize(7);
+        s.SetThreadCount(threads);
+        s.SetTestPredict(true);
+        if (i == 1)
+            s.SetPrefetch(3, 2);
+        SeedRandom(1234);
+        FillData(s.Data(), 40);
+    }
+    for (int i = 0; i < 2; i++) {
+        ses[i].TrainBegin();
+        for (int j = 0; j < 3; j++)
+            ses[i].TrainIteration();
+        ses[i].TrainEnd();
+    }
+
+    Vector<double> sync, prefetch;
+    GetParameters(ses[0].GetNetwork(), sync);
+    GetParameters(ses[1].GetNetwork(), prefetch);
+    double diff = MaxDiff(sync, prefetch);
+    LOG("    weight diff " << diff << ", stall " << ses[1].GetStallSeconds() << " s");
+    ASSERT(diff == 0);
+    ASSERT(ses[0].GetStepCount() == ses[1].GetStepCount());
+    ASSERT(!ses[1].GetLoader().IsRunning());
+}
+
+CONSOLE_APP_MAIN
+{
+    LOG("PrefetchLoader Test - loading the mini-batches in worker threads");
+
+    SeedRandom(1234);
+    SessionData d;
+    FillData(d, 40);
+
+    LOG("  Crop and flip");
+    CheckAugment();
+
+    LOG("  Batches with 1 and 3 workers");
+    CheckLoader(d);
+
+    LOG("  Ending in the middle of an epoch");
+    CheckEnd(d);
+
+    LOG("  Training with and without prefetching");
+    CheckTraining(1);
+
+    LOG("  Data-parallel training with and without prefetching");
+    CheckTraining(3);
+
+    LOG("PrefetchLoader tests completed successfully!");
+}
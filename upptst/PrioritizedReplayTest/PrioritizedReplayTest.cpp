@@ -0,0 +1,272 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+static void CheckSumTree() {
+    LOG("  Sum tree");
+    SumTree tree;
+    tree.Init(5);
+    ASSERT(tree.GetTotal() == 0);
+
+    double p[5] = {1, 0, 3, 0.5, 2};
+    for (int i = 0; i < 5; i++)
+        tree.Set(i, p[i]);
+    ASSERT(fabs(tree.GetTotal() - 6.5) < 1e-12);
+    ASSERT(tree.GetMin() == 0.5); // the empty slot 1 isn't the minimum
+
+    // the cumulative priorities are [0,1) -> 0, [1,4) -> 2, [4,4.5) -> 3, [4.5,6.5) -> 4
+    ASSERT(tree.Find(0.0) == 0);
+    ASSERT(tree.Find(0.999) == 0);
+    ASSERT(tree.Find(1.0) == 2);
+    ASSERT(tree.Find(3.99) == 2);
+    ASSERT(tree.Find(4.2) == 3);
+    ASSERT(tree.Find(6.49) == 4);
+    ASSERT(tree.Find(100.0) == 4); // rounding beyond the total stays in a slot with priority
+
+    // random updates against the sums of the leaves
+    tree.Init(1000);
+    Vector<double> leaf;
+    leaf.SetCount(1000, 0);
+    for (int k = 0; k < 5000; k++) {
+        int i = Random(1000);
+        leaf[i] = Randomf() * 10;
+        tree.Set(i, leaf[i]);
+    }
+    double total = 0, mn = DBL_MAX;
+    for (int i = 0; i < 1000; i++) {
+        total += leaf[i];
+        if (leaf[i] > 0)
+            mn = min(mn, leaf[i]);
+        ASSERT(tree.Get(i) == leaf[i]);
+    }
+    ASSERT(fabs(tree.GetTotal() - total) < 1e-6);
+    ASSERT(tree.GetMin() == mn);
+    for (int k = 0; k < 100; k++) {
+        double u = Randomf() * total;
+        int i = tree.Find(u);
+        double below = 0;
+        for (int j = 0; j < i; j++)
+            below += leaf[j];
+        ASSERT(leaf[i] > 0 && below <= u + 1e-6 && u < below + leaf[i] + 1e-6);
+    }
+}
+
+static void CheckSampling() {
+    LOG("  Proportional sampling");
+    PrioritizedReplay pr;
+    pr.Set(1.0, 0.5).SetEpsilon(0);
+    pr.Init(4);
+    for (int i = 0; i < 4; i++)
+        pr.Add(i);
+    ASSERT(pr.GetPriority(0) == 1.0); // the largest priority so far
+
+    // with alpha 1 the priorities are the absolute errors
+    pr.Update(0, 1.0);
+    pr.Update(1, -2.0);
+    pr.Update(2, 3.0);
+    pr.Update(3, 4.0);
+    ASSERT(pr.GetPriority(1) == 2.0);
+
+    int hits[4] = {0, 0, 0, 0};
+    int n = 100000;
+    for (int k = 0; k < n; k++) {
+        double w;
+        hits[pr.Sample(w)]++;
+    }
+    for (int i = 0; i < 4; i++) {
+        double expected = (i + 1) / 10.0;
+        LOG("    slot " << i << ": " << (double)hits[i] / n << ", expected " << expected);
+        ASSERT(fabs((double)hits[i] / n - expected) < 0.01);
+    }
+
+    // the least probable slot has the weight 1
+    ASSERT(pr.GetWeight(0) == 1.0);
+    ASSERT(fabs(pr.GetWeight(3) - pow(0.25, 0.5)) < 1e-12);
+
+    // a stratified batch has one sample of every quarter of the total priority
+    int index[4];
+    double weight[4];
+    pr.Sample(4, index, weight);
+    ASSERT(index[0] == 1 || index[0] == 2); // [0, 2.5)
+    ASSERT(index[3] == 3);                  // [7.5, 10)
+    for (int k = 0; k < 4; k++)
+        ASSERT(weight[k] == pr.GetWeight(index[k]));
+
+    // new slots get the largest priority
+    pr.Init(8);
+    pr.Update(0, 4.0);
+    pr.Add(1);
+    ASSERT(pr.GetPriority(1) == 4.0);
+}
+
+static void CheckReplayBuffer() {
+    LOG("  Prioritized replay buffer");
+    ReplayBuffer rb;
+    rb.Init(16, 2);
+    Vector<double> s;
+    s.SetCount(2, 0);
+    for (int i = 0; i < 8; i++)
+        rb.Add(s, 0, 0, s);
+
+    // the experiences so far get the same priority
+    rb.SetPrioritized(1.0, 1.0);
+    for (int i = 0; i < 8; i++)
+        ASSERT(rb.GetPriority().GetPriority(i) == 1.0);
+    for (int i = 0; i < 8; i++)
+        rb.UpdatePriority(i, i == 5 ? 10.0 : 0.0);
+
+    Vector<int> index;
+    Vector<double> weight;
+    index.SetCount(64);
+    weight.SetCount(64);
+    rb.Sample(64, index.Begin(), weight.Begin());
+    int fives = 0;
+    for (int k = 0; k < 64; k++) {
+        ASSERT(index[k] >= 0 && index[k] < 8);
+        fives += index[k] == 5;
+    }
+    LOG("    " << fives << " of 64 samples of the transition with the largest error");
+    ASSERT(fives > 48);
+
+    // the uniform buffer has the weight 1
+    rb.SetUniform();
+    rb.Sample(64, index.Begin(), weight.Begin());
+    for (int k = 0; k < 64; k++)
+        ASSERT(weight[k] == 1.0 && index[k] < 8);
+}
+
+static void CheckWeightedRegression() {
+    LOG("  Weighted regression");
+    Session ses;
+    ses.AddInputLayer(1, 1, 3);
+    ses.AddFullyConnLayer(2);
+    ses.AddRegressionLayer();
+    Net& net = ses.GetNetwork();
+
+    Volume x(1, 1, 3, 0.0);
+    x.SetSize(1, 1, 3, 2);
+    for (int i = 0; i < x.GetCount(); i++)
+        x.Set(i, Randomf());
+    Vector<int> pos;
+    pos << 0 << 1;
+    Vector<double> y;
+    y << 1.0 << -1.0;
+
+    net.Forward(x, true);
+    double loss = net.Backward(2, pos, y);
+    Volume& out = net.GetOutput();
+    double l0 = 0.5 * pow(out.Get(0) - y[0], 2);
+    double l1 = 0.5 * pow(out.Get(3) - y[1], 2);
+    ASSERT(fabs(loss - (l0 + l1)) < 1e-5);
+
+    Vector<double> w;
+    w << 0.25 << 2.0;
+    net.Forward(x, true);
+    double weighted = net.Backward(2, pos, y, &w);
+    ASSERT(fabs(weighted - (0.25 * l0 + 2.0 * l1)) < 1e-5);
+}
+
+static void CheckBrain(int threads) {
+    LOG("  Brain, " << threads << " thread(s)");
+    Brain brain;
+    brain.Init(2, 2);
+    brain.SetPrioritizedReplay();
+    brain.SetStartTrainingTreshold(200);
+    if (threads > 1)
+        brain.SetThreadCount(threads).SetHogwild();
+    brain.gamma = 0.0;
+    ASSERT(brain.IsPrioritizedReplay());
+
+    Vector<double> state;
+    state.SetCount(2);
+    for (int i = 0; i < 5000; i++) {
+        state[0] = Randomf();
+        state[1] = Randomf();
+        int action = brain.Forward(state);
+        brain.Backward(action == GetBestAction(state) ? 1.0 : 0.0);
+    }
+    if (threads > 1) {
+        while (brain.GetTrainer().GetIteration() < 64 * 1000)
+            Sleep(10);
+        brain.StopLearners();
+    }
+
+    // the priorities have been updated from the errors
+    const PrioritizedReplay& pr = brain.GetExperience().GetPriority();
+    double lo = DBL_MAX, hi = 0;
+    for (int i = 0; i < brain.GetExperienceCount(); i++) {
+        lo = min(lo, pr.GetPriority(i));
+        hi = max(hi, pr.GetPriority(i));
+    }
+    ASSERT(lo > 0 && hi > lo);
+
+    int correct = 0;
+    for (int i = 0; i < 200; i++) {
+        state[0] = Randomf();
+        state[1] = Randomf();
+        Vector<double> input;
+        brain.GetNetInput(state, input);
+        correct += brain.GetPolicy(input).action == GetBestAction(state);
+    }
+    LOG("    loss " << brain.GetAverageLoss() << ", priorities " << lo << " ... " << hi
+        << ", greedy accuracy " << correct / 200.0);
+    ASSERT(correct > 150);
+}
+
+static void CheckDQNAgent() {
+    LOG("  DQNAgent");
+    DQNAgent agent;
+    agent.Init(1, 2, 2);
+    agent.Reset();
+    agent.SetGamma(0.0);
+    agent.SetPrioritizedReplay();
+    ASSERT(agent.IsPrioritizedReplay());
+
+    Vector<double> state;
+    state.SetCount(2);
+    for (int i = 0; i < 10000; i++) {
+        state[0] = Randomf();
+        state[1] = Randomf();
+        int action = agent.Act(state);
+        agent.Learn(action == GetBestAction(state) ? 1.0 : 0.0);
+    }
+    ASSERT(agent.GetExperienceCount() > 0);
+    ASSERT(agent.GetPriority().GetTree().GetTotal() > 0);
+
+    agent.SetEpsilon(0);
+    int correct = 0;
+    for (int i = 0; i < 200; i++) {
+        state[0] = Randomf();
+        state[1] = Randomf();
+        correct += agent.Act(state) == GetBestAction(state);
+    }
+    LOG("    greedy accuracy " << correct / 200.0);
+    ASSERT(correct > 150);
+
+    // the TD errors above the clamp of the Huber loss keep their size for the priorities
+    Mat s0;
+    s0.Init(1, 2, state);
+    double small = agent.LearnFromTuple(s0, 0, 10.0, s0, 0);
+    double large = agent.LearnFromTuple(s0, 0, 100.0, s0, 0);
+    ASSERT(fabs(small) > 5 && fabs(large) > 50);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("Prioritized Replay Test");
+
+    CheckSumTree();
+    CheckSampling();
+    CheckReplayBuffer();
+    CheckWeightedRegression();
+    CheckBrain(1);
+    CheckBrain(3);
+    CheckDQNAgent();
+
+    LOG("Prioritized replay tests completed successfully!");
+}
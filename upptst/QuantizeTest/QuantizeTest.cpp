@@ -0,0 +1,396 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+static const char* GetTypeName(int type) {
+    return type == GGUF_Q8_0 ? "Q8_0" : "Q4_0";
+}
+
+static void RandomValues(Vector<Real>& v, int n) {
+    RandomGaussian& rand = GetRandomGaussian(1);
+    v.SetCount(n);
+    for (int i = 0; i < n; i++)
+        v[i] = (Real)rand;
+}
+
+static double MaxAbs(const Vector<double>& a) {
+    double d = 0;
+    for (int i = 0; i < a.GetCount(); i++)
+        d = max(d, fabs(a[i]));
+    return d;
+}
+
+// The blocks are the ones of GGUF files: known blocks convert to known values, and a
+// quantized matrix converts like a tensor of the same type
+static void CheckBlocks() {
+    LOG("  GGUF blocks");
+    Vector<Real> out;
+    out.SetCount(32);
+
+    // Q8_0: d = 0.5, qs[i] = i - 16
+    byte q8[34];
+    q8[0] = 0x00; q8[1] = 0x38;
+    for (int i = 0; i < 32; i++)
+        q8[2 + i] = (byte)(int8)(i - 16);
+    GGUFTensor t;
+    t.type = GGUF_Q8_0;
+    t.dims = 1;
+    t.ne[0] = 32;
+    t.data = q8;
+    ASSERT(GGUFFile::CanConvert(t.type));
+    GGUFFile::Convert(t, 0, 32, out.Begin());
+    for (int i = 0; i < 32; i++)
+        ASSERT(out[i] == (Real)(0.5 * (i - 16)));
+
+    // Q4_0: d = 1, the low nibble of qs[0] is the value 0 and its high nibble the value 16
+    byte q4[18];
+    q4[0] = 0x00; q4[1] = 0x3c;
+    for (int i = 0; i < 16; i++)
+        q4[2 + i] = 0x88;
+    q4[2] = 0x9f;
+    t.type = GGUF_Q4_0;
+    t.data = q4;
+    GGUFFile::Convert(t, 0, 32, out.Begin());
+    for (int i = 0; i < 32; i++)
+        ASSERT(out[i] == (i == 0 ? 7 : i == 16 ? 1 : 0));
+
+    for (int type = 0; type < 2; type++) {
+        int qtype = type ? GGUF_Q4_0 : GGUF_Q8_0;
+        int rows = 5, cols = 96;
+        Vector<Real> m, dq, conv;
+        RandomValues(m, rows * cols);
+        QuantizedMatrix q;
+        q.Quantize(qtype, m.Begin(), rows, cols, cols);
+        ASSERT(q.GetByteCount() == rows * cols / 32 * GetGGUFTypeSize(qtype));
+        dq.SetCount(rows * cols);
+        q.Dequantize(dq.Begin(), cols);
+
+        GGUFTensor qt;
+        qt.type = qtype;
+        qt.dims = 2;
+        qt.ne[0] = cols;
+        qt.ne[1] = rows;
+        qt.data = q.GetRow(0);
+        ASSERT(qt.GetByteCount() == q.GetByteCount());
+        conv.SetCount(rows * cols);
+        GGUFFile::Convert(qt, 0, rows * cols, conv.Begin());
+
+        // the error of a value is at most one step of its block
+        double err = 0;
+        for (int i = 0; i < rows * cols; i++) {
+            ASSERT(conv[i] == dq[i]);
+            err = max(err, (double)fabs(m[i] - dq[i]));
+        }
+        double amax = 0;
+        for (int i = 0; i < rows * cols; i++)
+            amax = max(amax, (double)fabs(m[i]));
+        LOG("    " << GetTypeName(qtype) << " max error " << err << " of " << amax);
+        ASSERT(err <= amax / (type ? 8 : 127) * 1.01);
+    }
+}
+
+// QuantizedGemm against the dequantized weights, with the inputs as rows or as columns
+static void CheckGemm() {
+    LOG("  QuantizedGemm (" << GetQuantizedKernel() << ")");
+    for (int trial = 0; trial < 40; trial++) {
+        int qtype = trial % 2 ? GGUF_Q4_0 : GGUF_Q8_0;
+        int rows = 1 + Random(trial < 30 ? 40 : 300);
+        int cols = 1 + Random(200);
+        int count = 1 + Random(9);
+        bool transposed = Random(2);
+
+        Vector<Real> m, dq, x, bias;
+        RandomValues(m, rows * cols);
+        RandomValues(x, count * cols);
+        RandomValues(bias, rows);
+        QuantizedMatrix q;
+        q.Quantize(qtype, m.Begin(), rows, cols, cols);
+        ASSERT(q.GetRows() == rows && q.GetCols() == cols);
+        dq.SetCount(rows * cols);
+        q.Dequantize(dq.Begin(), cols);
+
+        int x_stride = transposed ? 1 : cols, x_step = transposed ? count : 1;
+        int out_stride = transposed ? 1 : rows, out_step = transposed ? count : 1;
+        Vector<Real> out, threaded;
+        out.SetCount(count * rows);
+        threaded.SetCount(count * rows);
+        QuantizedGemm(1, q, count, x.Begin(), x_stride, x_step, bias.Begin(), out.Begin(), out_stride, out_step);
+        QuantizedGemm(4, q, count, x.Begin(), x_stride, x_step, bias.Begin(), threaded.Begin(), out_stride, out_step);
+
+        // the inputs are rounded to 1/127 of their block maximum
+        double xmax = 0;
+        for (int i = 0; i < x.GetCount(); i++)
+            xmax = max(xmax, (double)fabs(x[i]));
+        for (int t = 0; t < count; t++) {
+            for (int i = 0; i < rows; i++) {
+                double ref = bias[i], wsum = 0;
+                for (int k = 0; k < cols; k++) {
+                    ref += dq[i * cols + k] * x[t * x_stride + k * x_step];
+                    wsum += fabs(dq[i * cols + k]);
+                }
+                double o = out[t * out_stride + i * out_step];
+                ASSERT(fabs(o - ref) <= wsum * xmax / 127 + 1e-3);
+                ASSERT(o == threaded[t * out_stride + i * out_step]);
+            }
+        }
+    }
+}
+
+// Noisy copies of one random image per class
+static void FillImages(SessionData& d, int classes, int count, int test_count, int w, int h, int depth, double noise) {
+    int length = w * h * depth;
+    Vector<Vector<double>> templates;
+    for (int c = 0; c < classes; c++) {
+        Vector<double>& t = templates.Add();
+        t.SetCount(length);
+        for (int i = 0; i < length; i++)
+            t[i] = Randomf() * 2 - 1;
+    }
+    RandomGaussian& rand = GetRandomGaussian(1);
+    d.BeginData(classes, count, w, h, depth, test_count);
+    for (int i = 0; i < count + test_count; i++) {
+        int c = i % classes;
+        for (int j = 0; j < length; j++) {
+            double v = templates[c][j] + noise * rand;
+            if (i < count)
+                d.SetData(i, j, v);
+            else
+                d.SetTestData(i - count, j, v);
+        }
+        if (i < count)
+            d.SetLabel(i, c);
+        else
+            d.SetTestLabel(i - count, c);
+    }
+    d.EndData();
+}
+
+static double GetTestAccuracy(Net& net, const SessionData& d, Vector<double>* outputs = NULL) {
+    Volume x;
+    x.Init(d.GetDataWidth(), d.GetDataHeight(), d.GetDataDepth(), 0.0);
+    int correct = 0;
+    if (outputs)
+        outputs->SetCount(0);
+    for (int i = 0; i < d.GetTestCount(); i++) {
+        for (int j = 0; j < d.GetDataLength(); j++)
+            x.Set(j, d.GetTestData(i, j));
+        Volume& out = net.Forward(x, false);
+        if (outputs)
+            for (int j = 0; j < out.GetCount(); j++)
+                outputs->Add(out.Get(j));
+        if (net.GetPrediction() == d.GetTestLabel(i))
+            correct++;
+    }
+    return (double)correct / max(1, d.GetTestCount());
+}
+
+static void MakeNet(Session& ses, int w, int h, int depth, int classes) {
+    ses.AddInputLayer(w, h, depth);
+    ses.AddConvLayer(5, 5, 8, 0.0, 1.0, 1, 2);
+    ses.AddReluLayer();
+    ses.AddPoolLayer(2, 2, 2);
+    if (depth > 1) {
+        ses.AddConvLayer(5, 5, 16, 0.0, 1.0, 1, 2);
+        ses.AddReluLayer();
+        ses.AddPoolLayer(2, 2, 2);
+    }
+    ses.AddFullyConnLayer(classes);
+    ses.AddSoftmaxLayer(classes);
+    ses.GetTrainer().SetType(TRAINER_ADAM).SetBatchSize(16).SetLearningRate(0.001);
+}
+
+// Trains the net, and compares the test accuracy with the float filters and with the
+// quantized ones
+static void CheckAccuracy(const String& name, Session& ses, int iterations) {
+    ses.TrainBegin();
+    for (int i = 0; i < iterations; i++)
+        ses.TrainIteration();
+    ses.TrainEnd();
+
+    Net& net = ses.GetNetwork();
+    const SessionData& d = ses.Data();
+    Vector<double> ref, out;
+    double acc = GetTestAccuracy(net, d, &ref);
+    int64 bytes = net.GetFilterBytes();
+    LOG("    " << name << ": " << d.GetTestCount() << " test samples, accuracy " << acc
+        << ", filters " << bytes << " bytes");
+
+    for (int type = 0; type < 2; type++) {
+        int qtype = type ? GGUF_Q4_0 : GGUF_Q8_0;
+        net.Quantize(qtype);
+        ASSERT(net.IsQuantized());
+        double qacc = GetTestAccuracy(net, d, &out);
+        int64 qbytes = net.GetFilterBytes();
+        double ratio = (double)bytes / qbytes;
+        LOG("      " << GetTypeName(qtype) << ": accuracy " << qacc << " (delta " << qacc - acc
+            << "), max output difference " << MaxDiff(ref, out) << ", filters " << qbytes
+            << " bytes (" << ratio << "x less)");
+        ASSERT(ratio > (type ? 5 : 3));
+        if (type == 0)
+            ASSERT(fabs(qacc - acc) <= 0.02);
+        else
+            ASSERT(fabs(qacc - acc) <= 0.1);
+    }
+
+    // the float filters are intact
+    net.Dequantize();
+    ASSERT(!net.IsQuantized());
+    ASSERT(GetTestAccuracy(net, d, &out) == acc);
+    ASSERT(MaxDiff(ref, out) == 0);
+}
+
+static void CheckSynthetic() {
+    {
+        Session ses;
+        MakeNet(ses, 28, 28, 1, 10);
+        FillImages(ses.Data(), 10, 500, 500, 28, 28, 1, 6.0);
+        CheckAccuracy("MNIST-sized synthetic data", ses, 3);
+    }
+    {
+        Session ses;
+        MakeNet(ses, 32, 32, 3, 10);
+        FillImages(ses.Data(), 10, 500, 500, 32, 32, 3, 6.0);
+        CheckAccuracy("CIFAR-sized synthetic data", ses, 3);
+    }
+}
+
+// The threads of the quantized filters give the same outputs, and mapping or training the
+// filters drops the quantized blocks of them
+static void CheckNetState() {
+    LOG("  Threads, MapGGUF and training of a quantized net");
+    Session ses;
+    ses.AddInputLayer(8, 8, 3);
+    ses.AddConvLayer(3, 3, 64, 0.0, 1.0, 1, 1);
+    ses.AddReluLayer();
+    ses.AddFullyConnLayer(128);
+    ses.AddFullyConnLayer(10);
+    ses.AddSoftmaxLayer(10);
+    ses.GetTrainer().SetType(TRAINER_SGD).SetBatchSize(1);
+    Net& net = ses.GetNetwork();
+
+    Volume x;
+    x.Init(8, 8, 3);
+    Vector<double> ref, out;
+    net.Quantize(GGUF_Q8_0);
+    GetValues(net.Forward(x), ref);
+    net.SetThreadCount(4);
+    ASSERT(net.GetLayers()[1].GetThreadCount() == 4);
+    GetValues(net.Forward(x), out);
+    ASSERT(MaxDiff(ref, out) == 0);
+    net.SetThreadCount(1);
+
+    String path = GetTempFileName("gguf");
+    ASSERT(net.SaveGGUF(path));
+    {
+        std::shared_ptr<GGUFFile> file = std::make_shared<GGUFFile>();
+        ASSERT(file->Open(path));
+        ASSERT(net.MapGGUF(file));
+        ASSERT(!net.IsQuantized());
+        net.Clear();
+    }
+    FileDelete(path);
+
+    Session trained;
+    trained.AddInputLayer(8, 8, 3);
+    trained.AddFullyConnLayer(10);
+    trained.AddSoftmaxLayer(10);
+    trained.GetTrainer().SetType(TRAINER_SGD).SetBatchSize(1);
+    trained.GetNetwork().Quantize(GGUF_Q8_0);
+    ASSERT(trained.GetNetwork().IsQuantized());
+    trained.GetTrainer().Train(x, 3, 1.0);
+    ASSERT(!trained.GetNetwork().IsQuantized());
+}
+
+// Datasets which SessionData::SaveMapped has written, e.g. MNIST and CIFAR-10
+static void CheckDataset(const String& path) {
+    Session ses;
+    if (!ses.Data().OpenMapped(path)) {
+        LOG("    can't open " << path);
+        return;
+    }
+    const SessionData& d = ses.Data();
+    MakeNet(ses, d.GetDataWidth(), d.GetDataHeight(), d.GetDataDepth(), d.GetClassCount());
+    CheckAccuracy(GetFileName(path), ses, 1);
+    ses.Data().ClearData();
+}
+
+// The projections of the decoder layers
+static void CheckGPT() {
+    LOG("  GPT model");
+    std::unique_ptr<GPTModel> model = CreateGPT(64, 64, 4, 2, 128, 64);
+    Vector<int> context;
+    for (int i = 0; i < 20; i++)
+        context.Add(Random(64));
+    Vector<double> ref, out, cached;
+    GetValues(model->GetNextTokenLogits(context), ref);
+
+    for (int type = 0; type < 2; type++) {
+        int qtype = type ? GGUF_Q4_0 : GGUF_Q8_0;
+        model->Quantize(qtype);
+        GetValues(model->GetNextTokenLogits(context), out);
+        double rel = MaxDiff(ref, out) / MaxAbs(ref);
+        LOG("    " << GetTypeName(qtype) << ": relative logit difference " << rel);
+        if (type == 0)
+            ASSERT(rel < 0.05);
+
+        // incremental decoding computes the same projections
+        GPTCache cache;
+        for (int i = 0; i < context.GetCount(); i++)
+            GetValues(model->Decode(context[i], cache), cached);
+        ASSERT(MaxDiff(cached, out) < 1e-3 * MaxAbs(out));
+    }
+
+    model->Dequantize();
+    GetValues(model->GetNextTokenLogits(context), out);
+    ASSERT(MaxDiff(ref, out) == 0);
+}
+
+static void CheckSpeed() {
+    LOG("  Matrix-vector product of 1024 x 1024");
+    int n = 1024, reps = 100;
+    Vector<Real> m, x, y;
+    RandomValues(m, n * n);
+    RandomValues(x, n);
+    y.SetCount(n);
+
+    TimeStop ts;
+    for (int r = 0; r < reps; r++)
+        Gemm<Real>(false, false, n, 1, n, (Real)1, m.Begin(), n, x.Begin(), 1, (Real)0, y.Begin(), 1);
+    LOG("    Gemm: " << (double)ts.Elapsed() / reps << " ms, " << n * n * sizeof(Real) << " bytes of weights");
+
+    for (int type = 0; type < 2; type++) {
+        int qtype = type ? GGUF_Q4_0 : GGUF_Q8_0;
+        QuantizedMatrix q;
+        q.Quantize(qtype, m.Begin(), n, n, n);
+        ts.Reset();
+        for (int r = 0; r < reps; r++)
+            QuantizedGemm(1, q, 1, x.Begin(), n, 1, NULL, y.Begin(), n, 1);
+        LOG("    " << GetTypeName(qtype) << ": " << (double)ts.Elapsed() / reps << " ms, "
+            << q.GetByteCount() << " bytes of weights");
+    }
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+    
+    LOG("Quantize Test - block-quantized weights for inference");
+    
+    CheckBlocks();
+    CheckGemm();
+    
+    LOG("  Accuracy of quantized nets");
+    CheckSynthetic();
+    CheckNetState();
+    const Vector<String>& args = CommandLine();
+    for (int i = 0; i < args.GetCount(); i++)
+        CheckDataset(args[i]);
+    
+    CheckGPT();
+    CheckSpeed();
+    
+    LOG("Quantize Test passed");
+}
@@ -0,0 +1,179 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+// Exposes the gradients of a batch without the solver step
+struct GradientSession : RecurrentSession {
+    void Gradients(const Vector<Vector<int> >& sequences, Vector<double>& out) {
+        ComputeGradients(sequences);
+        out.SetCount(0);
+        for (int k = 0; k < GetMatCount(); k++) {
+            Mat& m = Get(GetMat(k));
+            for (int i = 0; i < m.GetLength(); i++) {
+                out.Add(m.GetGradient(i));
+                m.SetGradient(i, 0);
+            }
+        }
+    }
+};
+
+static void InitSession(RecurrentSession& ses, int mode, bool fused, int hidden_size) {
+    Vector<int> hidden_sizes;
+    hidden_sizes << hidden_size << hidden_size;
+    ses.SetMode(mode);
+    ses.SetFused(fused);
+    ses.SetHiddenSizes(hidden_sizes);
+    ses.SetLetterSize(5);
+    ses.SetInputSize(27);
+    ses.SetOutputSize(27);
+    ses.Init();
+}
+
+static void RandomSequence(Vector<int>& seq) {
+    seq.SetCount(1 + Random(12));
+    for (int i = 0; i < seq.GetCount(); i++)
+        seq[i] = 1 + Random(26);
+}
+
+#ifdef flagCONVNET_DOUBLE
+static const double tolerance = 1e-9;
+static const double train_tolerance = 1e-9;
+#else
+static const double tolerance = 1e-5;
+static const double train_tolerance = 1e-4; // the rounding grows over the solver steps
+#endif
+
+// The gradient of a padded batch is the average of the gradients of its sequences
+static void CheckGradients(int mode, bool fused, int count, int hidden_size) {
+    LOG("  Gradients, " << (mode == RecurrentSession::MODE_LSTM ? "LSTM" : "RNN")
+        << (fused ? " fused" : " graph") << ", batch " << count << ", hidden " << hidden_size);
+    GradientSession ses;
+    InitSession(ses, mode, fused, hidden_size);
+
+    Vector<Vector<int> > batch;
+    for (int i = 0; i < count; i++)
+        RandomSequence(batch.Add());
+
+    Vector<double> batched, single, sum;
+    ses.Gradients(batch, batched);
+    for (int i = 0; i < count; i++) {
+        Vector<Vector<int> > one;
+        one.Add() <<= batch[i];
+        ses.Gradients(one, single);
+        if (sum.IsEmpty())
+            sum.SetCount(single.GetCount(), 0);
+        for (int j = 0; j < single.GetCount(); j++)
+            sum[j] += single[j];
+    }
+
+    double diff = 0, mag = 0;
+    for (int j = 0; j < sum.GetCount(); j++) {
+        diff = max(diff, fabs(batched[j] - sum[j] / count));
+        mag = max(mag, fabs(batched[j]));
+    }
+    LOG("    largest gradient " << mag << ", difference " << diff);
+    ASSERT(mag > 0);
+    ASSERT(diff < tolerance);
+}
+
+// A batch of one matches the single sequence Learn
+static void CheckSingle() {
+    LOG("  Batch of one");
+    Vector<int> seq;
+    RandomSequence(seq);
+    seq.SetCount(max(seq.GetCount(), 3), 1);
+    Vector<Vector<int> > one;
+    one.Add() <<= seq;
+
+    RecurrentSession a, b;
+    SeedRandom(5);
+    InitSession(a, RecurrentSession::MODE_LSTM, true, 10);
+    SeedRandom(5);
+    InitSession(b, RecurrentSession::MODE_LSTM, true, 10);
+    for (int i = 0; i < 5; i++) {
+        a.Learn(seq);
+        b.Learn(one);
+    }
+    for (int k = 0; k < a.GetMatCount(); k++) {
+        const Mat& ma = a.Get(a.GetMat(k));
+        const Mat& mb = b.Get(b.GetMat(k));
+        for (int i = 0; i < ma.GetLength(); i++)
+            ASSERT(fabs(ma.Get(i) - mb.Get(i)) < train_tolerance);
+    }
+
+    // the single sequence predicts after the batches
+    Vector<int> out;
+    b.Predict(out, false, 1.0, false, 10);
+}
+
+static void CheckThroughput() {
+    LOG("  Throughput");
+    Vector<Vector<int> > corpus;
+    for (int i = 0; i < 256; i++)
+        RandomSequence(corpus.Add());
+
+    // sequences of similar length in the same batch
+    Vector<Vector<int> > sorted;
+    sorted <<= corpus;
+    Sort(sorted, [](const Vector<int>& a, const Vector<int>& b) {return a.GetCount() < b.GetCount();});
+
+    for (int bs = 1; bs <= 64; bs *= 4) {
+        RecurrentSession ses;
+        InitSession(ses, RecurrentSession::MODE_LSTM, true, 64);
+        TimeStop ts;
+        for (int epoch = 0; epoch < 2; epoch++) {
+            for (int i = 0; i < sorted.GetCount(); i += bs) {
+                if (bs == 1) {
+                    ses.Learn(sorted[i]);
+                    continue;
+                }
+                Vector<Vector<int> > batch;
+                for (int j = i; j < min(i + bs, sorted.GetCount()); j++)
+                    batch.Add() <<= sorted[j];
+                ses.Learn(batch);
+            }
+        }
+        LOG("    batch " << bs << ": " << (int)(2 * sorted.GetCount() / ts.Seconds()) << " sequences/s");
+    }
+}
+
+static void CheckLearning() {
+    LOG("  Learning");
+    const char* words[] = {"hello", "world", "recurrent", "network", "cell", "batch", "matrix", "column"};
+    Vector<Vector<int> > batch;
+    for (int i = 0; i < 8; i++) {
+        Vector<int>& s = batch.Add();
+        for (const char* c = words[i]; *c; c++)
+            s.Add(*c - 'a' + 1);
+    }
+    RecurrentSession ses;
+    InitSession(ses, RecurrentSession::MODE_LSTM, true, 32);
+    double first = 0;
+    for (int i = 0; i < 600; i++) {
+        ses.Learn(batch);
+        if (i == 0)
+            first = ses.GetPerplexity();
+    }
+    LOG("    perplexity " << first << " -> " << ses.GetPerplexity());
+    ASSERT(ses.GetPerplexity() < 2.0 && ses.GetPerplexity() < first);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("Recurrent Batch Test - minibatched sequence training");
+
+    CheckGradients(RecurrentSession::MODE_LSTM, true, 5, 10);
+    CheckGradients(RecurrentSession::MODE_LSTM, false, 5, 10);
+    CheckGradients(RecurrentSession::MODE_RNN, true, 5, 10);
+    CheckGradients(RecurrentSession::MODE_RNN, false, 5, 10);
+    CheckGradients(RecurrentSession::MODE_LSTM, true, 20, 24); // products through Gemm
+    CheckSingle();
+    CheckLearning();
+    CheckThroughput();
+
+    LOG("Recurrent batch tests completed successfully!");
+}
@@ -0,0 +1,293 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+struct Pool : MatPool {
+    MatId Rand(int width, int height) {
+        MatId id;
+        InitMat(id, width, height, 0);
+        Mat& m = Get(id);
+        for (int i = 0; i < m.GetLength(); i++)
+            m.Set(i, Randomf() * 2 - 1);
+        return id;
+    }
+
+    // The rows begin ... begin + count of the matrix
+    MatId Rows(MatId src, int begin, int count) {
+        Mat& s = Get(src);
+        MatId id;
+        InitMat(id, s.GetWidth(), count, 0);
+        Mat& m = Get(id);
+        for (int i = 0; i < m.GetLength(); i++)
+            m.Set(i, s.Get(begin * s.GetWidth() + i));
+        return id;
+    }
+
+    double RowsGradientDiff(MatId stacked, int begin, MatId part) {
+        Mat& s = Get(stacked);
+        Mat& m = Get(part);
+        double d = 0;
+        for (int i = 0; i < m.GetLength(); i++)
+            d = max(d, fabs(s.GetGradient(begin * s.GetWidth() + i) - m.GetGradient(i)));
+        return d;
+    }
+
+    double GradientDiff(MatId a, MatId b) {
+        Mat& ma = Get(a);
+        Mat& mb = Get(b);
+        ASSERT(ma.GetLength() == mb.GetLength());
+        double d = 0;
+        for (int i = 0; i < ma.GetLength(); i++)
+            d = max(d, fabs(ma.GetGradient(i) - mb.GetGradient(i)));
+        return d;
+    }
+
+    double Diff(MatId a, MatId b) {
+        Mat& ma = Get(a);
+        Mat& mb = Get(b);
+        ASSERT(ma.GetLength() == mb.GetLength());
+        double d = 0;
+        for (int i = 0; i < ma.GetLength(); i++)
+            d = max(d, fabs(ma.Get(i) - mb.Get(i)));
+        return d;
+    }
+
+    // Sets the gradient of the loss sum(m .* r) with random r, the same for both mats
+    void SetRandomGradient(MatId a, MatId b) {
+        Mat& ma = Get(a);
+        Mat& mb = Get(b);
+        for (int i = 0; i < ma.GetLength(); i++) {
+            double r = Randomf() * 2 - 1;
+            ma.SetGradient(i, r);
+            mb.SetGradient(i, r);
+        }
+    }
+};
+
+#ifdef flagCONVNET_DOUBLE
+static const double tolerance = 1e-9;
+#else
+static const double tolerance = 1e-4;
+#endif
+
+// The fused cell against the graph of generic nodes of RecurrentSession
+static void CheckLSTMCell() {
+    LOG("  LSTM cell");
+    int xs = 5, hs = 3;
+    Pool pool;
+    MatId Wx = pool.Rand(xs, 4 * hs);
+    MatId Wh = pool.Rand(hs, 4 * hs);
+    MatId b = pool.Rand(1, 4 * hs);
+    MatId x = pool.Rand(1, xs), h = pool.Rand(1, hs), c = pool.Rand(1, hs);
+    MatId x2 = pool.Rows(x, 0, xs), h2 = pool.Rows(h, 0, hs), c2 = pool.Rows(c, 0, hs);
+
+    GraphTree fused;
+    fused.SetPool(pool);
+    MatId hidden_f = fused.LSTMCell(x, h, c, Wx, Wh, b);
+    MatId cell_f = fused.Top().cell;
+
+    GraphTree g;
+    g.SetPool(pool);
+    MatId gate[4];
+    MatId Wxs[4], Whs[4], bs[4];
+    for (int k = 0; k < 4; k++) {
+        Wxs[k] = pool.Rows(Wx, k * hs, hs);
+        Whs[k] = pool.Rows(Wh, k * hs, hs);
+        bs[k] = pool.Rows(b, k * hs, hs);
+        MatId pre = g.Add(g.Add(g.Mul(Wxs[k], x2), g.Mul(Whs[k], h2)), bs[k]);
+        gate[k] = k < 3 ? g.Sigmoid(pre) : g.Tanh(pre);
+    }
+    MatId cell_g = g.Add(g.EltMul(gate[1], c2), g.EltMul(gate[0], gate[3]));
+    MatId hidden_g = g.EltMul(gate[2], g.Tanh(cell_g));
+
+    fused.Forward();
+    g.Forward();
+    ASSERT(pool.Diff(hidden_f, hidden_g) < tolerance);
+    ASSERT(pool.Diff(cell_f, cell_g) < tolerance);
+
+    pool.SetRandomGradient(hidden_f, hidden_g);
+    pool.SetRandomGradient(cell_f, cell_g);
+    fused.Backward();
+    g.Backward();
+    ASSERT(pool.GradientDiff(x, x2) < tolerance);
+    ASSERT(pool.GradientDiff(h, h2) < tolerance);
+    ASSERT(pool.GradientDiff(c, c2) < tolerance);
+    for (int k = 0; k < 4; k++) {
+        ASSERT(pool.RowsGradientDiff(Wx, k * hs, Wxs[k]) < tolerance);
+        ASSERT(pool.RowsGradientDiff(Wh, k * hs, Whs[k]) < tolerance);
+        ASSERT(pool.RowsGradientDiff(b, k * hs, bs[k]) < tolerance);
+    }
+}
+
+static void CheckRNNCell() {
+    LOG("  RNN cell");
+    int xs = 4, hs = 6;
+    Pool pool;
+    MatId Wx = pool.Rand(xs, hs);
+    MatId Wh = pool.Rand(hs, hs);
+    MatId b = pool.Rand(1, hs);
+    MatId x = pool.Rand(1, xs), h = pool.Rand(1, hs);
+    MatId x2 = pool.Rows(x, 0, xs), h2 = pool.Rows(h, 0, hs);
+
+    GraphTree fused;
+    fused.SetPool(pool);
+    MatId hidden_f = fused.RNNCell(x, h, Wx, Wh, b);
+
+    GraphTree g;
+    g.SetPool(pool);
+    MatId hidden_g = g.Relu(g.Add(g.Add(g.Mul(Wx, x2), g.Mul(Wh, h2)), b));
+
+    fused.Forward();
+    g.Forward();
+    ASSERT(pool.Diff(hidden_f, hidden_g) < tolerance);
+
+    // the parameters are shared, so the gradients of both graphs are accumulated in them
+    pool.SetRandomGradient(hidden_f, hidden_g);
+    fused.Backward();
+    Vector<double> fused_grad;
+    for (int i = 0; i < pool.Get(Wx).GetLength(); i++)
+        fused_grad.Add(pool.Get(Wx).GetGradient(i));
+    g.Backward();
+    for (int i = 0; i < pool.Get(Wx).GetLength(); i++)
+        ASSERT(fabs(pool.Get(Wx).GetGradient(i) - 2 * fused_grad[i]) < tolerance);
+    ASSERT(pool.GradientDiff(x, x2) < tolerance);
+    ASSERT(pool.GradientDiff(h, h2) < tolerance);
+}
+
+// The columns of a batch are independent sequences
+static void CheckBatchColumns() {
+    LOG("  Batch columns");
+    int xs = 5, hs = 4, batch = 3;
+    Pool pool;
+    MatId Wx = pool.Rand(xs, 4 * hs);
+    MatId Wh = pool.Rand(hs, 4 * hs);
+    MatId b = pool.Rand(1, 4 * hs);
+    MatId x = pool.Rand(batch, xs), h = pool.Rand(batch, hs), c = pool.Rand(batch, hs);
+
+    GraphTree g;
+    g.SetPool(pool);
+    MatId out = g.LSTMCell(x, h, c, Wx, Wh, b);
+    g.Forward();
+
+    for (int col = 0; col < batch; col++) {
+        MatId xc, hc, cc;
+        pool.InitMat(xc, 1, xs, 0);
+        pool.InitMat(hc, 1, hs, 0);
+        pool.InitMat(cc, 1, hs, 0);
+        for (int i = 0; i < xs; i++)
+            pool.Get(xc).Set(i, pool.Get(x).Get(col, i));
+        for (int i = 0; i < hs; i++) {
+            pool.Get(hc).Set(i, pool.Get(h).Get(col, i));
+            pool.Get(cc).Set(i, pool.Get(c).Get(col, i));
+        }
+        GraphTree single;
+        single.SetPool(pool);
+        MatId o = single.LSTMCell(xc, hc, cc, Wx, Wh, b);
+        single.Forward();
+        for (int i = 0; i < hs; i++)
+            ASSERT(fabs(pool.Get(o).Get(i) - pool.Get(out).Get(col, i)) < tolerance);
+    }
+}
+
+static void MakeSentences(Vector<Vector<int> >& sents) {
+    const char* words[] = {"hello", "world", "recurrent", "network", "cell"};
+    for (int i = 0; i < 5; i++) {
+        Vector<int>& s = sents.Add();
+        for (const char* c = words[i]; *c; c++)
+            s.Add(*c - 'a' + 1);
+    }
+}
+
+static double Train(int mode, bool fused, double learning_rate, double& ppl) {
+    SeedRandom(1);
+    RecurrentSession ses;
+    Vector<int> hidden_sizes;
+    hidden_sizes << 20 << 20;
+    ses.SetMode(mode);
+    ses.SetFused(fused);
+    ses.SetHiddenSizes(hidden_sizes);
+    ses.SetLetterSize(5);
+    ses.SetInputSize(27);
+    ses.SetOutputSize(27);
+    ses.SetLearningRate(learning_rate);
+    ses.Init();
+    ASSERT(ses.IsFused() == fused);
+
+    Vector<Vector<int> > sents;
+    MakeSentences(sents);
+    TimeStop ts;
+    double sum = 0;
+    for (int i = 0; i < 1000; i++) {
+        ses.Learn(sents[i % sents.GetCount()]);
+        if (i >= 900)
+            sum += ses.GetPerplexity();
+    }
+    ppl = sum / 100;
+    return ts.Seconds();
+}
+
+static void CheckSession(int mode, const char* name, double learning_rate) {
+    double ppl_fused, ppl_graph;
+    double fused = Train(mode, true, learning_rate, ppl_fused);
+    double graph = Train(mode, false, learning_rate, ppl_graph);
+    LOG("  " << name << ": fused " << fused << " s, perplexity " << ppl_fused
+        << ", graph " << graph << " s, perplexity " << ppl_graph);
+    ASSERT(ppl_fused < 3.0);
+    ASSERT(ppl_graph < 3.0);
+}
+
+// The fused cells round-trip, and a layer of the stream format before them still loads
+static void CheckSerialize() {
+    LOG("  Serialize");
+    RecurrentSession ses;
+    Vector<int> hidden_sizes;
+    hidden_sizes << 8;
+    ses.SetMode(RecurrentSession::MODE_LSTM);
+    ses.SetHiddenSizes(hidden_sizes);
+    ses.SetLetterSize(5);
+    ses.SetInputSize(27);
+    ses.SetOutputSize(27);
+    ses.Init();
+    StringStream out;
+    ses.Serialize(out);
+    RecurrentSession in;
+    in.SetFused(false);
+    StringStream s(out.GetResult());
+    in.Serialize(s);
+    ASSERT(!s.IsError());
+    ASSERT(in.IsFused() && in.GetMatCount() == ses.GetMatCount());
+
+    StringStream old;
+    MatId input1, input2, output;
+    input1.value = 3;
+    input2.value = 4;
+    output.value = 5;
+    double d = 0.5;
+    int ix = 2, type = RECURRENT_ADD;
+    old % input1 % input2 % output % d % ix % type;
+    RecurrentBase layer;
+    StringStream ls(old.GetResult());
+    layer.Serialize(ls);
+    ASSERT(!ls.IsError());
+    ASSERT(layer.input1.value == 3 && layer.input2.value == 4 && layer.output.value == 5);
+    ASSERT(layer.d == 0.5 && layer.ix == 2 && layer.recurrent_type == RECURRENT_ADD);
+    ASSERT(layer.Wx.value == -1 && layer.gates.value == -1);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("Recurrent Cell Test - fused LSTM and RNN cells");
+
+    CheckLSTMCell();
+    CheckRNNCell();
+    CheckBatchColumns();
+    CheckSerialize();
+    CheckSession(RecurrentSession::MODE_LSTM, "LSTM", 0.01);
+    CheckSession(RecurrentSession::MODE_RNN, "RNN", 0.001);
+
+    LOG("Recurrent cell tests completed successfully!");
+}
@@ -0,0 +1,234 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+// The transition t has the states t and t + 1 in every value, the action t and the reward t / 2
+static void AddTransition(ReplayBuffer& rb, int t) {
+    Vector<double> s0, s1;
+    s0.SetCount(rb.GetLength(), t);
+    s1.SetCount(rb.GetLength(), t + 1);
+    rb.Add(s0, t, t * 0.5, s1);
+}
+
+static void CheckTransition(const ReplayBuffer& rb, int i, int t) {
+    ASSERT(rb.GetAction(i) == t);
+    ASSERT(rb.GetReward(i) == t * 0.5);
+    for (int j = 0; j < rb.GetLength(); j++) {
+        ASSERT(rb.GetState0(i)[j] == t);
+        ASSERT(rb.GetState1(i)[j] == t + 1);
+    }
+}
+
+static void CheckRing() {
+    LOG("  Ring");
+    ReplayBuffer rb;
+    rb.Init(4, 3);
+    ASSERT(rb.IsEmpty());
+    const Real* begin = rb.GetState0(0);
+
+    for (int t = 0; t < 6; t++)
+        AddTransition(rb, t);
+
+    // the oldest transitions 0 and 1 have been overwritten
+    ASSERT(rb.GetCount() == 4);
+    ASSERT(rb.GetWritePosition() == 2);
+    CheckTransition(rb, 0, 4);
+    CheckTransition(rb, 1, 5);
+    CheckTransition(rb, 2, 2);
+    CheckTransition(rb, 3, 3);
+    ASSERT(rb.GetState0(0) == begin);
+
+    rb.Clear();
+    ASSERT(rb.IsEmpty() && rb.GetCapacity() == 4);
+    AddTransition(rb, 7);
+    CheckTransition(rb, 0, 7);
+    ASSERT(rb.GetState0(0) == begin);
+}
+
+static void CheckGather() {
+    LOG("  Gather");
+    ReplayBuffer rb;
+    rb.Init(8, 5);
+    for (int t = 0; t < 8; t++)
+        AddTransition(rb, t);
+
+    int index[3] = {6, 0, 3};
+    Volume x;
+    rb.GatherState0(index, 3, x);
+    ASSERT(x.GetLength() == 5 && x.GetBatch() == 3);
+    for (int k = 0; k < 3; k++)
+        for (int j = 0; j < 5; j++)
+            ASSERT(x.Get(k * 5 + j) == index[k]);
+
+    // the batch of the same size is gathered without allocating
+    int before = GetBufferAllocations();
+    rb.GatherState1(index, 3, x);
+    ASSERT(GetBufferAllocations() == before);
+    for (int k = 0; k < 3; k++)
+        for (int j = 0; j < 5; j++)
+            ASSERT(x.Get(k * 5 + j) == index[k] + 1);
+}
+
+static void CheckSerialize() {
+    LOG("  Serialize");
+    ReplayBuffer rb;
+    rb.Init(16, 7);
+    for (int t = 0; t < 20; t++)
+        AddTransition(rb, t);
+
+    StringStream out;
+    rb.Serialize(out);
+    String data = out.GetResult();
+
+    // the header and the raw arrays, without a per-transition overhead
+    int64 raw = 16 * (2 * 7 * sizeof(Real) + sizeof(int) + sizeof(double));
+    LOG("    " << data.GetCount() << " bytes, " << raw << " in the arrays");
+    ASSERT(data.GetCount() >= raw && data.GetCount() < raw + 32);
+
+    ReplayBuffer in;
+    StringStream s(data);
+    in.Serialize(s);
+    ASSERT(!s.IsError());
+    ASSERT(in.GetCapacity() == 16 && in.GetLength() == 7 && in.GetCount() == 16);
+    ASSERT(in.GetWritePosition() == rb.GetWritePosition());
+    for (int i = 0; i < 16; i++)
+        CheckTransition(in, i, i < 4 ? 16 + i : i);
+
+    // a partially filled buffer only stores the filled slots
+    ReplayBuffer part;
+    part.Init(16, 7);
+    AddTransition(part, 1);
+    StringStream pout;
+    part.Serialize(pout);
+    ASSERT(pout.GetResult().GetCount() < data.GetCount() / 8);
+
+    // an unknown version and sizes which don't fit in memory are load errors
+    String bad = data;
+    bad.Set(0, 2);
+    StringStream bs(bad);
+    ReplayBuffer b;
+    b.Serialize(bs);
+    ASSERT(bs.IsError());
+
+    StringStream hout;
+    byte version = 1;
+    int real_size = sizeof(Real), capacity = 1 << 20, length = 1 << 12, count = 0, write = 0;
+    hout % version % real_size % capacity % length % count % write;
+    StringStream hs(hout.GetResult());
+    b.Serialize(hs);
+    ASSERT(hs.IsError());
+}
+
+static void CheckSameExperience(const ReplayBuffer& a, const ReplayBuffer& b) {
+    ASSERT(a.GetCount() == b.GetCount() && a.GetLength() == b.GetLength());
+    for (int i = 0; i < a.GetCount(); i++) {
+        ASSERT(a.GetAction(i) == b.GetAction(i) && a.GetReward(i) == b.GetReward(i));
+        for (int j = 0; j < a.GetLength(); j++)
+            ASSERT(a.GetState0(i)[j] == b.GetState0(i)[j] && a.GetState1(i)[j] == b.GetState1(i)[j]);
+    }
+}
+
+// A Brain stream has the ReplayBuffer, and the streams from before it, with a Vector of
+// transitions in its place, load into the ring
+static void CheckBrainStream(Brain& brain) {
+    LOG("  Brain streams");
+    const ReplayBuffer& rb = brain.GetExperience();
+    StringStream out;
+    brain.Serialize(out);
+    String stored = out.GetResult();
+    {
+        Brain loaded;
+        StringStream in(stored);
+        loaded.Serialize(in);
+        ASSERT(!in.IsError());
+        CheckSameExperience(rb, loaded.GetExperience());
+    }
+
+    // SerializeWithoutExperience writes the same fields, without the experience in between
+    StringStream wout;
+    brain.SerializeWithoutExperience(wout);
+    String without = wout.GetResult();
+    int head = 0;
+    while (head < without.GetCount() && without[head] == stored[head])
+        head++;
+    StringStream legacy;
+    legacy.Put(without.Left(head));
+    int n = rb.GetCount();
+    legacy / n;
+    for (int i = 0; i < n; i++) {
+        Vector<double> s0, s1;
+        for (int j = 0; j < rb.GetLength(); j++) {
+            s0.Add(rb.GetState0(i)[j]);
+            s1.Add(rb.GetState1(i)[j]);
+        }
+        int action = rb.GetAction(i);
+        double reward = rb.GetReward(i);
+        legacy % s0 % action % reward % s1;
+    }
+    legacy.Put(without.Mid(head));
+
+    Brain old;
+    StringStream in(legacy.GetResult());
+    old.Serialize(in);
+    ASSERT(!in.IsError());
+    ASSERT(old.GetExperienceCount() == n);
+    CheckSameExperience(rb, old.GetExperience());
+}
+
+static void CheckBrain() {
+    LOG("  Brain");
+    Brain brain;
+    brain.Init(2, 2);
+    brain.experience_size = 500;
+    brain.SetStartTrainingTreshold(200);
+    brain.gamma = 0.0;
+
+    Vector<double> state;
+    state.SetCount(2);
+    for (int i = 0; i < 5000; i++) {
+        state[0] = Randomf();
+        state[1] = Randomf();
+        int action = brain.Forward(state);
+        brain.Backward(action == GetBestAction(state) ? 1.0 : 0.0);
+    }
+
+    // the memory is allocated once, and the newest transitions replace the oldest ones
+    const ReplayBuffer& rb = brain.GetExperience();
+    ASSERT(rb.GetCapacity() == 500 && brain.GetExperienceCount() == 500);
+    for (int i = 0; i < rb.GetCount(); i++) {
+        const Real* s0 = rb.GetState0(i);
+        ASSERT(rb.GetAction(i) == 0 || rb.GetAction(i) == 1);
+        // the reward is of the best action of the current state, which is the first one
+        ASSERT(rb.GetReward(i) == (rb.GetAction(i) == (s0[0] > s0[1] ? 0 : 1) ? 1.0 : 0.0));
+    }
+
+    int correct = 0;
+    for (int i = 0; i < 200; i++) {
+        state[0] = Randomf();
+        state[1] = Randomf();
+        Vector<double> input;
+        brain.GetNetInput(state, input);
+        correct += brain.GetPolicy(input).action == GetBestAction(state);
+    }
+    LOG("    loss " << brain.GetAverageLoss() << ", greedy accuracy " << correct / 200.0);
+    ASSERT(correct > 150);
+
+    CheckBrainStream(brain);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("Replay Buffer Test");
+
+    CheckRing();
+    CheckGather();
+    CheckSerialize();
+    CheckBrain();
+
+    LOG("Replay buffer tests completed successfully!");
+}
@@ -0,0 +1,112 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+#include <TestSupport/TestSupport.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+static void Step(Brain& brain, Vector<double>& state) {
+    state[0] = Randomf();
+    state[1] = Randomf();
+    int action = brain.Forward(state);
+    brain.Backward(action == GetBestAction(state) ? 1.0 : 0.0);
+}
+
+static int GetGreedyCorrect(Brain& brain) {
+    Vector<double> state, input;
+    state.SetCount(2);
+    int correct = 0;
+    for (int i = 0; i < 200; i++) {
+        state[0] = Randomf();
+        state[1] = Randomf();
+        brain.GetNetInput(state, input);
+        correct += brain.GetPolicy(input).action == GetBestAction(state);
+    }
+    return correct;
+}
+
+// The target network is the net at the first mini-batch, until it is refreshed
+static void CheckFrozen() {
+    LOG("  Frozen target network");
+    Brain brain;
+    brain.Init(2, 2);
+    brain.SetStartTrainingTreshold(200);
+    brain.SetTargetNetwork(1000000);
+    ASSERT(brain.GetTargetUpdateInterval() == 1000000);
+
+    Vector<double> state, before, after, target;
+    state.SetCount(2);
+    while (brain.GetExperienceCount() < 200)
+        Step(brain, state);
+    GetParameters(brain.GetNetwork(), before);
+    ASSERT(brain.GetTrainer().GetIteration() == 0);
+
+    for (int i = 0; i < 500; i++)
+        Step(brain, state);
+    GetParameters(brain.GetNetwork(), after);
+    GetParameters(brain.GetTargetNetwork(), target);
+    ASSERT(MaxDiff(before, after) > 0);
+    ASSERT(MaxDiff(before, target) == 0);
+}
+
+// The target network is refreshed every mini-batch, so it is the net before the last update
+static void CheckRefresh() {
+    LOG("  Refreshed target network");
+    Brain brain;
+    brain.Init(2, 2);
+    brain.SetStartTrainingTreshold(200);
+    brain.SetTargetNetwork(1);
+
+    Vector<double> state, a, b;
+    state.SetCount(2);
+    for (int i = 0; i < 300; i++)
+        Step(brain, state);
+    GetParameters(brain.GetNetwork(), a);
+    GetParameters(brain.GetTargetNetwork(), b);
+    ASSERT(MaxDiff(a, b) > 0);
+
+    // the target network follows the net
+    Vector<double> prev;
+    prev <<= a;
+    Step(brain, state);
+    GetParameters(brain.GetTargetNetwork(), b);
+    ASSERT(MaxDiff(prev, b) == 0);
+}
+
+static void CheckLearning(int interval, bool prioritized) {
+    LOG("  Learning, target update interval " << interval << (prioritized ? ", prioritized" : ""));
+    Brain brain;
+    brain.Init(2, 2);
+    brain.SetStartTrainingTreshold(200);
+    brain.SetTargetNetwork(interval);
+    if (prioritized)
+        brain.SetPrioritizedReplay();
+    brain.gamma = 0.5;
+
+    Vector<double> state;
+    state.SetCount(2);
+    TimeStop ts;
+    for (int i = 0; i < 5000; i++)
+        Step(brain, state);
+    double seconds = ts.Seconds();
+
+    int correct = GetGreedyCorrect(brain);
+    LOG("    " << 5000 / max(seconds, 1e-6) << " steps/s, loss " << brain.GetAverageLoss()
+        << ", greedy accuracy " << correct / 200.0);
+    ASSERT(correct > 150);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("Target Network Test - batched Q-learning with a frozen target network");
+
+    CheckFrozen();
+    CheckRefresh();
+    CheckLearning(0, false);
+    CheckLearning(50, false);
+    CheckLearning(50, true);
+
+    LOG("TargetNetwork tests completed successfully!");
+}
@@ -0,0 +1,54 @@
+#ifndef _TestSupport_TestSupport_h_
+#define _TestSupport_TestSupport_h_
+
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+
+namespace ConvNet {
+
+inline void GetParameters(Net& net, Vector<double>& out) {
+    out.SetCount(0);
+    Vector<ParametersAndGradients>& pag = net.GetParametersAndGradients();
+    for (int i = 0; i < pag.GetCount(); i++)
+        for (int j = 0; j < pag[i].volume->GetLength(); j++)
+            out.Add(pag[i].volume->Get(j));
+}
+
+inline void CopyParameters(Net& dst, Net& src) {
+    Vector<ParametersAndGradients>& d = dst.GetParametersAndGradients();
+    Vector<ParametersAndGradients>& s = src.GetParametersAndGradients();
+    ASSERT(d.GetCount() == s.GetCount());
+    for (int i = 0; i < d.GetCount(); i++)
+        *d[i].volume = *s[i].volume;
+}
+
+inline void GetValues(const Volume& v, Vector<double>& out) {
+    out.SetCount(v.GetCount());
+    for (int i = 0; i < v.GetCount(); i++)
+        out[i] = v.Get(i);
+}
+
+// The largest absolute difference of two vectors of the same length
+template <class T>
+double MaxDiff(const Vector<T>& a, const Vector<double>& b) {
+    ASSERT(a.GetCount() == b.GetCount());
+    double d = 0;
+    for (int i = 0; i < a.GetCount(); i++)
+        d = max(d, fabs(a[i] - b[i]));
+    return d;
+}
+
+inline void RandomTokens(Vector<int>& tokens, int n, int vocab_size) {
+    tokens.SetCount(n);
+    for (int i = 0; i < n; i++)
+        tokens[i] = Random(vocab_size);
+}
+
+// The best action of the two-input agent tests is the index of the larger input
+inline int GetBestAction(const Vector<double>& state) {
+    return state[0] > state[1] ? 0 : 1;
+}
+
+}
+
+#endif
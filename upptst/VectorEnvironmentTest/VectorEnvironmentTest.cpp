@@ -0,0 +1,295 @@
+#include <Core/Core.h>
+#include <ConvNet/ConvNet.h>
+
+using namespace Upp;
+using namespace ConvNet;
+
+// One step episodes: the state is two random values, and the reward is 1 for the index of
+// the larger one
+struct BanditEnvironment : Environment {
+    double a = 0, b = 0;
+
+    virtual int GetStateCount() const {return 2;}
+    virtual int GetActionCount() const {return 2;}
+    virtual void Reset() {a = Randomf(); b = Randomf();}
+    virtual void GetState(Vector<double>& state) {state.SetCount(2); state[0] = a; state[1] = b;}
+    virtual double Step(int action, bool& done) {
+        done = true;
+        return action == (a > b ? 0 : 1) ? 1.0 : 0.0;
+    }
+};
+
+static void InitAgent(DQNAgent& agent, int states, int actions) {
+    agent.Init(1, states, actions);
+    agent.Reset();
+}
+
+static void CheckEvaluate() {
+    LOG("  Batched evaluation");
+    DQNAgent agent;
+    InitAgent(agent, 8, 5);
+
+    int count = 7;
+    Vector<double> states, values, single, row;
+    for (int i = 0; i < count * 8; i++)
+        states.Add(Randomf() * 2 - 1);
+    agent.Evaluate(states, count, values);
+    ASSERT(values.GetCount() == count * 5);
+
+    // every row matches the evaluation of the graph
+    for (int i = 0; i < count; i++) {
+        row.SetCount(0);
+        for (int j = 0; j < 8; j++)
+            row.Add(states[i * 8 + j]);
+        agent.Evaluate(row, single);
+        for (int j = 0; j < 5; j++)
+            ASSERT(fabs(single[j] - values[i * 5 + j]) < 1e-5);
+    }
+
+    // the greedy actions are the argmax of the rows
+    agent.SetEpsilon(0);
+    Vector<int> actions;
+    agent.Act(states, count, actions);
+    for (int i = 0; i < count; i++)
+        for (int j = 0; j < 5; j++)
+            ASSERT(values[i * 5 + j] <= values[i * 5 + actions[i]]);
+}
+
+static void CheckTransitions() {
+    LOG("  Transitions");
+    DQNAgent agent;
+    InitAgent(agent, 8, 5);
+
+    VectorEnvironment venv;
+    for (int i = 0; i < 16; i++)
+        venv.Create<PuckWorldEnvironment>();
+    venv.SetThreadCount(4);
+    ASSERT(venv.GetCount() == 16 && venv.GetStateCount() == 8);
+    venv.Reset();
+
+    for (int k = 0; k < 10; k++) {
+        Vector<double> before;
+        before <<= venv.GetStates();
+        venv.Step(agent, false);
+
+        // the transitions are from the states before the step to the states after it,
+        // because the puck world doesn't end
+        int expi = agent.GetExperienceWritePointer() - 16;
+        ASSERT(expi == k * 16);
+        for (int i = 0; i < 16; i++) {
+            const DQExperience& e = agent.GetExperience(expi + i);
+            ASSERT(e.action0 == venv.GetActions()[i]);
+            ASSERT(e.reward0 == venv.GetRewards()[i]);
+            for (int j = 0; j < 8; j++) {
+                ASSERT(fabs(e.state0.Get(j) - before[i * 8 + j]) < 1e-6);
+                ASSERT(fabs(e.state1.Get(j) - venv.GetStates()[i * 8 + j]) < 1e-6);
+            }
+        }
+    }
+    ASSERT(venv.GetStepCount() == 160);
+    ASSERT(agent.GetExperienceCount() == 160);
+}
+
+static void CheckLearning(int threads, bool prioritized) {
+    LOG("  Learning, " << threads << " thread(s)" << (prioritized ? ", prioritized" : ""));
+    DQNAgent agent;
+    InitAgent(agent, 2, 2);
+    agent.SetGamma(0.0);
+    if (prioritized)
+        agent.SetPrioritizedReplay();
+
+    VectorEnvironment venv;
+    for (int i = 0; i < 8; i++)
+        venv.Create<BanditEnvironment>();
+    venv.SetThreadCount(threads).SetLearningSteps(20);
+    for (int k = 0; k < 1000; k++)
+        venv.Step(agent);
+    ASSERT(venv.GetStepCount() == 8000);
+
+    // every episode was reset, so the states are new
+    agent.SetEpsilon(0);
+    Vector<double> state;
+    state.SetCount(2);
+    int correct = 0;
+    for (int i = 0; i < 200; i++) {
+        state[0] = Randomf();
+        state[1] = Randomf();
+        correct += agent.Act(state) == (state[0] > state[1] ? 0 : 1);
+    }
+    LOG("    average reward " << venv.GetAverageReward() << ", greedy accuracy " << correct / 200.0);
+    ASSERT(correct > 150);
+}
+
+static void CheckGridWorld() {
+    LOG("  Grid world");
+    GridWorldEnvironment env;
+    env.Init(5, 5);
+    env.SetStopState(4, 4);
+    env.SetReward(4, 4, 1.0);
+    env.SetDisabled(1, 0);
+    env.Reset();
+    ASSERT(env.GetStateCount() == 25);
+
+    Vector<double> state;
+    env.GetState(state);
+    ASSERT(state.GetCount() == 25 && state[0] == 1.0);
+
+    // the wall and the edge keep the cell
+    bool done = true;
+    ASSERT(fabs(env.Step(ACT_RIGHT, done) + 0.01) < 1e-9 && !done);
+    ASSERT(env.GetX() == 0 && env.GetY() == 0);
+    env.Step(ACT_LEFT, done);
+    ASSERT(env.GetX() == 0 && env.GetY() == 0);
+    env.Step(ACT_UP, done);
+    ASSERT(env.GetX() == 0 && env.GetY() == 1);
+    env.GetState(state);
+    ASSERT(state[5] == 1.0);
+
+    // the step from the stop cell ends the episode with the reward of the cell
+    for (int i = 0; i < 3; i++)
+        env.Step(ACT_UP, done);
+    for (int i = 0; i < 4; i++)
+        env.Step(ACT_RIGHT, done);
+    ASSERT(env.GetX() == 4 && env.GetY() == 4 && !done);
+    double r = env.Step(ACT_LEFT, done);
+    ASSERT(done && fabs(r - 0.99) < 1e-9);
+    ASSERT(env.GetX() == 0 && env.GetY() == 0);
+}
+
+// The tabular agents learn through the Agent base in 16 copies of a 5x5 grid world
+static void TrainGridWorld(Agent& agent, VectorEnvironment& venv) {
+    for (int i = 0; i < 16; i++) {
+        GridWorldEnvironment& env = venv.Create<GridWorldEnvironment>();
+        env.Init(5, 5);
+        env.SetStopState(4, 4);
+        env.SetReward(4, 4, 1.0);
+        env.SetDisabled(1, 0);
+        env.SetDisabled(2, 2);
+    }
+    ((GridWorldEnvironment&)venv[0]).InitAgent(agent);
+    ASSERT(agent.GetNumStates() == 25);
+    for (int k = 0; k < 1000; k++)
+        venv.Step(agent);
+    ASSERT(venv.GetStepCount() == 16000);
+}
+
+// The shortest episode from the corner to the opposite corner is 8 moves and the step from
+// the stop cell.
+static void CheckEpisode(Agent& agent, VectorEnvironment& venv) {
+    GridWorldEnvironment& env = (GridWorldEnvironment&)venv[0];
+    Vector<double> state;
+    Vector<int> action;
+    env.Reset();
+    int length = -1;
+    for (int i = 0; i < 50 && length < 0; i++) {
+        env.GetState(state);
+        agent.Act(state, 1, action);
+        bool done = false;
+        env.Step(action[0], done);
+        if (done)
+            length = i + 1;
+    }
+    LOG("    average reward " << venv.GetAverageReward() << ", greedy episode " << length);
+    ASSERT(length >= 9 && length <= 12);
+}
+
+static void CheckTabular() {
+    LOG("  Grid world, DPAgent");
+    DPAgent dp;
+    dp.SetGamma(0.9);
+    VectorEnvironment dp_env;
+    TrainGridWorld(dp, dp_env);
+    CheckEpisode(dp, dp_env);
+
+    LOG("  Grid world, TDAgent");
+    TDAgent td;
+    td.LoadInitJSON("{\"alpha\": 0.1, \"gamma\": 0.9}");
+    VectorEnvironment td_env;
+    TrainGridWorld(td, td_env);
+    td.SetEpsilon(0);
+    CheckEpisode(td, td_env);
+}
+
+static void CheckWaterWorld() {
+    LOG("  Water world");
+    WaterWorldEnvironment world;
+    Vector<double> state;
+    world.GetState(state);
+    ASSERT(state.GetCount() == 152);
+
+    DQNAgent agent;
+    InitAgent(agent, world.GetStateCount(), world.GetActionCount());
+    VectorEnvironment venv;
+    for (int i = 0; i < 8; i++)
+        venv.Create<WaterWorldEnvironment>();
+    venv.SetThreadCount(4).SetLearningSteps(1);
+    int eaten = 0;
+    for (int k = 0; k < 500; k++) {
+        venv.Step(agent);
+        for (int i = 0; i < 8; i++) {
+            double r = venv.GetRewards()[i];
+            ASSERT(r == (int)r);
+            eaten += r != 0;
+        }
+    }
+
+    // the eyes see the normalized proximity, and the agents stay in the walls
+    const Vector<double>& states = venv.GetStates();
+    for (int i = 0; i < 8; i++) {
+        for (int j = 0; j < WaterWorldEnvironment::EYE_COUNT * 3; j++) {
+            double p = states[i * 152 + j / 3 * 5 + j % 3];
+            ASSERT(p >= 0 && p <= 1);
+        }
+        WaterWorldEnvironment& env = (WaterWorldEnvironment&)venv[i];
+        ASSERT(env.GetAgentX() >= 1 && env.GetAgentX() <= WaterWorldEnvironment::WIDTH - 1);
+        ASSERT(env.GetAgentY() >= 1 && env.GetAgentY() <= WaterWorldEnvironment::HEIGHT - 1);
+        ASSERT(env.GetItemCount() <= WaterWorldEnvironment::ITEM_COUNT);
+    }
+    LOG("    " << eaten << " items eaten, average reward " << venv.GetAverageReward());
+    ASSERT(eaten > 0);
+}
+
+// Environment steps per second of the puck world without the GUI
+static double Benchmark(int count, int threads, int learning_steps) {
+    DQNAgent agent;
+    InitAgent(agent, 8, 5);
+    VectorEnvironment venv;
+    for (int i = 0; i < count; i++)
+        venv.Create<PuckWorldEnvironment>();
+    venv.SetThreadCount(threads).SetLearningSteps(learning_steps);
+    while (venv.GetStepCount() < 20000)
+        venv.Step(agent);
+    double sps = venv.GetStepsPerSecond();
+    LOG("    " << count << " environment(s), " << threads << " thread(s), " << learning_steps
+        << " replay steps: " << (int)sps << " steps/s, average reward " << venv.GetAverageReward());
+    return sps;
+}
+
+static void CheckBenchmark() {
+    LOG("  Headless puck world");
+    double single = Benchmark(1, 1, 10);
+    double vec = Benchmark(16, 1, 10);
+    Benchmark(16, 4, 10);
+    Benchmark(64, 4, 0);
+    // with the same replay steps per vector step, the learning is shared by the environments
+    ASSERT(vec > single);
+}
+
+CONSOLE_APP_MAIN
+{
+    SeedRandom();
+
+    LOG("Vector Environment Test");
+
+    CheckEvaluate();
+    CheckTransitions();
+    CheckLearning(1, false);
+    CheckLearning(4, false);
+    CheckLearning(4, true);
+    CheckGridWorld();
+    CheckTabular();
+    CheckWaterWorld();
+    CheckBenchmark();
+
+    LOG("Vector environment tests completed successfully!");
+}